@@ -0,0 +1,17 @@
+#include "./common.h"
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+/**
+ * 自动调节连接数（-m auto）
+ * 每个采样间隔统计总吞吐量，并读取各连接的 TCP_INFO（RTT、接收窗口）：
+ * 新增一个连接后吞吐量提升不足 AUTOTUNE_MIN_GAIN 或 RTT 明显升高时撤销该连接，
+ * 稳定阶段吞吐量明显下降（例如被服务器限速）时撤下一个连接。
+ * 每次决策写入 <输出文件>.autotune.log
+ * 调用前初始线程需已启动；函数在所有下载线程退出后返回
+ * @param downloader 已启用动态调度和自动连接数的下载器
+ */
+void autotune_run(MultiThreadDownloader* downloader);
+
+#endif
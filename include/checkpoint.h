@@ -0,0 +1,39 @@
+#include "./common.h"
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+/**
+ * 当前下载选项是否建立持久化检查点
+ * 需要线程模式直接写入输出文件、设置了检查点条件，且不做 Metalink 分块校验
+ * @return 是返回1，否则返回0
+ */
+int checkpoint_enabled();
+
+/**
+ * 读取上次中断时留下的状态文件
+ * 文件大小、ETag 和 Last-Modified 都与本次探测结果一致时，载入已落盘的区间；
+ * ETag 和 Last-Modified 都没有时无法确认文件未变化，不载入
+ * @param downloader 下载器（使用 file_size 和 probe_response，成功时填写 resume_ranges、resumed_bytes）
+ * @param state_path 状态文件路径
+ * @return 载入的区间数，状态文件不存在、格式错误、缺少校验标识或与服务器上的文件不一致时返回0
+ */
+int checkpoint_load(MultiThreadDownloader* downloader, const char* state_path);
+
+/**
+ * 建立检查点：先记下各段已交给内核的位置，fdatasync 输出文件后再原子地替换状态文件，
+ * 状态文件中记录的区间一定已经落盘
+ * @param downloader 下载器
+ * @param fd 输出文件（.chd-partial）的描述符
+ * @return 成功返回0，失败返回-1
+ */
+int checkpoint_save(MultiThreadDownloader* downloader, int fd);
+
+/**
+ * 检查点线程：新落盘的数据达到 checkpoint_bytes 或距上次检查点超过 checkpoint_interval 秒时建立检查点，
+ * 两次检查点之间用 sync_file_range 在后台提前回写，直到下载器停止
+ * @param arg 下载器
+ */
+void* checkpoint_worker(void* arg);
+
+#endif
@@ -24,6 +24,8 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 
 #define READ_BUFFER_SIZE 8192
 #define REQUEST_BUFFER 8192
@@ -31,6 +33,82 @@
 
 #define MAX_THREADS 16 // 最大线程数限制
 #define MIN_SEGMENT_SIZE (1024 * 1024) // 最小段大小：1MB
+#define MAX_SEGMENTS_PER_THREAD 32 // 动态调度时每个线程最多拆分出的段数
+#define SEGMENT_ALIGN (64 * 1024) // 初始分段的边界对齐（reflink 要求偏移按文件系统块对齐）
+#define MERGE_MAX_THREADS 8 // 并行合并临时文件的最大线程数
+#define MERGE_COPY_BUFFER_SIZE (1024 * 1024) // 不能在内核中复制时用户态合并的缓冲区大小
+#define ENDGAME_MIN_REMAINING (64 * 1024) // 收尾阶段值得重复下载的最小剩余字节数
+#define ENDGAME_REMAINING_PERCENT 5 // 剩余数据不超过文件大小的该百分比时进入收尾阶段
+#define AUTOTUNE_INITIAL_CONNECTIONS 2 // 自动连接数模式的初始连接数
+#define HEDGE_SPEED_RATIO_SUGGESTED 0.25 // 建议的对冲速度阈值：段速度低于活动段速度中位数的该比例（默认不对冲）
+#define HEDGE_STALL_MS_SUGGESTED 5000 // 建议的对冲停滞阈值：段无进展超过该时间（毫秒）（默认不对冲）
+#define HEDGE_MAX_ACTIVE 2 // 同时进行的对冲请求数上限（占用 -t 指定的连接数）
+#define HEDGE_CHECK_INTERVAL_MS 200 // 采样各段速度、检查慢段的间隔
+#define HEDGE_WARMUP_MS 2000 // 段开始下载后经过该时间才按速度比较（连接建立和慢启动）
+#define HEDGE_EWMA_ALPHA 0.3 // 段速度指数加权平均的平滑系数
+
+#define MAX_MIRRORS 8 // 同一文件最多使用的下载地址数（主 URL + 镜像）
+#define MIRROR_COOLDOWN_MS 1000 // 地址失败后暂停分配请求的时间（毫秒），连续失败时加倍
+#define MIRROR_COOLDOWN_MAX_MS 30000 // 地址暂停分配请求的最长时间（毫秒）
+#define METALINK_HASH_LENGTH 129 // 十六进制哈希值的最大长度（sha-512 为 128 个字符）+1
+#define METALINK_DEFAULT_PRIORITY 999999 // Metalink 地址未指定 priority 时的优先级（数值越小越优先）
+
+#define MAX_EVENT_CONNECTIONS 256 // epoll 引擎最大连接数
+#define MAX_EVENT_LOOPS 8 // epoll 引擎最大事件循环线程数
+
+#define POOL_MAX_IDLE_CONNECTIONS 32 // 连接池最大空闲连接数
+#define POOL_IDLE_TIMEOUT 15 // 空闲连接超时时间（秒）
+
+#define CONNECT_TIMEOUT_DEFAULT 10 // 默认 TCP 连接超时（秒）
+#define SOCKET_IO_TIMEOUT 30 // 阻塞收发的超时（秒），分段引擎关闭低速检测时也用作无数据超时
+#define LOW_SPEED_LIMIT_DEFAULT 1024 // 低速检测：连接在时间窗口内的平均速度低于该值（字节/秒）时中止
+#define LOW_SPEED_TIME_DEFAULT 5 // 低速检测的时间窗口（秒），也是分段引擎收发无数据的超时
+#define LOW_SPEED_CHECK_INTERVAL_MS 250 // 低速看门狗的检查间隔
+#define RETRY_MAX_ATTEMPTS 5 // 每个段最多尝试的次数
+#define RETRY_BASE_DELAY_MS 250 // 第二次重试前的等待时间，之后每次翻倍（第一次重试立即进行）
+#define RETRY_MAX_DELAY_MS 8000 // 重试等待时间的上限
+#define HAPPY_EYEBALLS_DELAY_MS 250 // 上一个地址未连上时启动下一个地址的间隔（RFC 8305 推荐值）
+
+#define DNS_CACHE_TTL 300 // DNS 缓存有效期（秒），getaddrinfo 不返回记录的 TTL
+#define DNS_MAX_ADDRESSES 16 // 每个域名最多缓存的地址数
+#define STRIPE_DEMOTE_TIME 30 // 地址连接失败或明显偏慢后暂停分配新连接的时间（秒）
+#define STRIPE_SLOW_RATIO 0.25 // 吞吐量低于最快地址的该比例时视为偏慢
+#define STRIPE_MIN_SAMPLE_BYTES (256 * 1024) // 计入吞吐量测量的最小传输字节数
+
+#define RATE_LIMIT_SLICE_MS 10 // 限速时每次接收最多取走该时长的令牌，接收调用按此粒度均匀分布
+#define RATE_LIMIT_BURST_MS 50 // 令牌桶容量（空闲后允许的突发量）对应的时长
+#define RATE_LIMIT_MIN_SLICE 1024 // 每次接收至少取走的令牌数（字节），避免极低速率时接收调用过于频繁
+#define RATE_LIMIT_MAX_HOSTS 16 // 单独限速的主机数上限
+#define RATE_LIMIT_POLL_MS 1000 // 检查限速控制文件是否修改的间隔
+
+#define REDIRECT_MAX_HOPS 10 // 多线程下载初始化时最多跟随的重定向次数
+#define REDIRECT_CACHE_MAX_ENTRIES 128 // 永久重定向缓存的最大条目数
+#define REDIRECT_CACHE_TTL (7 * 24 * 3600) // 永久重定向缓存的有效期（秒）
+
+#define SPLICE_PIPE_SIZE (1024 * 1024) // splice 零拷贝管道容量
+#define MMAP_WINDOW_DEFAULT (16 * 1024 * 1024) // mmap 后端每个连接映射的输出文件窗口大小
+
+#define H2_STREAM_WINDOW (4 * 1024 * 1024) // HTTP/2 每个流的接收窗口（字节）
+#define H2_CONNECTION_WINDOW (32 * 1024 * 1024) // HTTP/2 连接的接收窗口（所有流合计）
+#define H2_DEFAULT_MAX_STREAMS 100 // 服务器未声明并发流上限时同时打开的流数上限
+#define HPACK_TABLE_SIZE 4096 // HPACK 动态表大小（SETTINGS_HEADER_TABLE_SIZE 默认值）
+
+#define PIPELINE_DEFAULT_DEPTH 8 // 批量下载时同一连接上已发出但未收到响应的请求数上限
+#define PIPELINE_MAX_DEPTH 64 // 流水线深度的上限
+
+#define WRITER_BLOCK_SIZE (256 * 1024) // 写入队列缓冲块大小，接收的数据填满一块后交给写入线程
+#define WRITER_RING_SLOTS 32 // 每个连接的写入环形队列的槽位数
+#define WRITER_MAX_IOV 64 // 写入线程合并为一次 pwritev 的最大块数
+#define WRITE_BUFFER_DEFAULT (64 * 1024 * 1024) // 写入队列的默认内存预算（所有连接共享）
+#define DIRECT_IO_ALIGN 4096 // 直接 I/O 的缓冲区地址、文件偏移和长度的对齐要求
+#define WRITE_CHUNK_DEFAULT (1024 * 1024) // 合并写入策略下下载线程攒够该大小再写文件
+#define CHECKPOINT_BYTES_DEFAULT (64 * 1024 * 1024) // 新写入的数据达到该大小时建立检查点
+#define CHECKPOINT_INTERVAL_DEFAULT 5 // 距上次检查点超过该时间（秒）且有新数据时建立检查点
+#define CHECKPOINT_POLL_MS 200 // 检查是否需要建立检查点的间隔
+#define RESUME_MAX_RANGES 4096 // 断点状态文件中最多记录的已完成区间数
+
+#define PARTIAL_FILE_SUFFIX ".chd-partial" // 直接写入模式下未完成输出文件的后缀
+#define STATE_FILE_SUFFIX ".chd-state" // 断点状态文件的后缀（记录 .chd-partial 中已落盘的区间）
 
 typedef enum {
   DOWNLOAD_SUCCESS = 0,
@@ -43,6 +121,7 @@ typedef enum {
   DOWNLOAD_ERROR_FILE_WRITE = -7,
   DOWNLOAD_ERROR_NETWORK = -8,
   DOWNLOAD_ERROR_MEMORY = -9,
+  DOWNLOAD_ERROR_VERIFY = -10,
 } DownloadResult;
 
 typedef enum {
@@ -76,6 +155,109 @@ typedef struct {
   char default_download_filename[PATH_MAX];   // 默认下载文件名
 } Config;
 
+// 段下载引擎
+typedef enum {
+  DOWNLOAD_ENGINE_THREADS = 0,  // 每个段一个阻塞线程
+  DOWNLOAD_ENGINE_EPOLL = 1,    // 少量事件循环线程驱动非阻塞连接
+  DOWNLOAD_ENGINE_HTTP2 = 2     // 所有段作为一个 HTTP/2 连接上的并发流（服务器不支持时使用 epoll 引擎）
+} DownloadEngine;
+
+// 段数据的接收/写入方式
+typedef enum {
+  IO_BACKEND_STDIO = 0,       // recv + fwrite
+  IO_BACKEND_URING = 1,       // io_uring 链接的 recv -> 定位写
+  IO_BACKEND_SPLICE = 2,      // splice 零拷贝 socket -> 管道 -> 文件
+  IO_BACKEND_MMAP = 3         // recv 直接写入映射的输出文件窗口（需要预分配的输出文件）
+} IoBackend;
+
+// 多线程下载的输出方式
+typedef enum {
+  OUTPUT_MODE_DIRECT = 0,     // 预分配输出文件，各段按偏移直接写入，无需合并
+  OUTPUT_MODE_TEMP_FILES = 1  // 每段写 .partN 临时文件，完成后合并
+} OutputMode;
+
+// 段数据写入文件的策略
+typedef enum {
+  WRITE_POLICY_COALESCE = 0,  // 攒成大块再写，只在检查点 fdatasync
+  WRITE_POLICY_STRICT = 1     // 每次接收后立即写入文件（fflush）
+} WritePolicy;
+
+// Metalink 中文件的一个下载地址
+typedef struct {
+  char url[2048];             // HTTP/HTTPS 地址
+  int priority;               // 优先级，数值越小越优先
+} MetalinkUrl;
+
+// Metalink (RFC 5854) 描述的文件（只使用第一个 <file>）
+typedef struct {
+  char file_name[256];        // 文件名（已去掉目录部分）
+  long long file_size;        // 文件大小，-1表示未指定
+  char hash_type[16];         // 整个文件的哈希算法（如 sha-256），空表示没有
+  char hash[METALINK_HASH_LENGTH]; // 整个文件的哈希值（十六进制）
+  MetalinkUrl urls[MAX_MIRRORS]; // 按优先级排序的下载地址
+  int url_count;              // 地址数量
+  long long piece_length;     // 分块大小
+  char piece_hash_type[16];   // 分块哈希算法，空表示没有分块哈希
+  char (*piece_hashes)[METALINK_HASH_LENGTH]; // 各分块的哈希值
+  int piece_count;            // 分块数量
+} MetalinkInfo;
+
+// 分块校验状态
+typedef enum {
+  PIECE_PENDING = 0,          // 尚未下载完整或尚未校验
+  PIECE_VERIFYING,            // 正在计算哈希
+  PIECE_VERIFIED,             // 校验通过
+  PIECE_CORRUPT,              // 校验失败，等待单独重新下载
+  PIECE_REFETCHING            // 正在单独重新下载
+} PieceState;
+
+// 运行时下载选项（命令行设置，进程内共享）
+typedef struct {
+  DownloadEngine engine;      // 段下载引擎
+  int event_loops;            // epoll 引擎的事件循环线程数
+  IoBackend io_backend;       // HTTP 响应体的 I/O 方式（uring 仅用于线程模式的段）
+  OutputMode output_mode;     // 多线程下载的输出方式
+  int auto_connections;       // 是否根据实测吞吐量自动增减连接数（-m auto）
+  int connect_timeout;        // TCP 连接超时（秒），所有地址在此时间内都未连上则失败
+  int low_speed_limit;        // 低速检测的速度阈值（字节/秒），0表示关闭低速检测
+  int low_speed_time;         // 低速检测的时间窗口（秒）
+  double hedge_speed_ratio;   // 对冲请求的速度阈值（相对中位数的比例），0表示不按速度对冲
+  int hedge_stall_ms;         // 对冲请求的无进展阈值（毫秒），0表示不按停滞对冲
+  const char* mirrors[MAX_MIRRORS - 1]; // 同一文件的其他下载地址（--mirror）
+  int mirror_count;           // 镜像数量
+  MetalinkInfo* metalink;     // -d 指定 .meta4 文件时解析出的文件描述，否则为NULL
+  long long write_buffer;     // 写入队列的内存预算（字节），0表示网络线程直接写文件
+  WritePolicy write_policy;   // 写入策略
+  long long write_chunk;      // 合并写入策略下下载线程每次写文件的数据量（不使用写入线程时）
+  long long checkpoint_bytes; // 新落盘数据达到该字节数时建立检查点，0表示不按数据量
+  int checkpoint_interval;    // 距上次检查点超过该秒数时建立检查点，0表示不按时间
+  int direct_io;              // 是否以 O_DIRECT 写输出文件，不占用页缓存（需要写入线程）
+  long long mmap_window;      // mmap 后端每个连接同时映射的最大字节数（决定映射占用的内存上限）
+} DownloadOptions;
+
+// io_uring 实例（直接使用系统调用，不依赖 liburing）
+typedef struct {
+  int ring_fd;                        // io_uring 文件描述符
+  unsigned int features;              // 内核支持的特性 (IORING_FEAT_*)
+  unsigned int sq_entries;            // 提交队列大小
+  unsigned int* sq_head;              // 提交队列头（内核更新）
+  unsigned int* sq_tail;              // 提交队列尾（用户更新）
+  unsigned int* sq_mask;              // 提交队列掩码
+  unsigned int* sq_array;             // 提交队列索引数组
+  struct io_uring_sqe* sqes;          // 提交队列项数组
+  unsigned int sqe_tail;              // 本地已填写的提交项位置
+  unsigned int sqe_head;              // 本地已发布到提交队列的位置
+  unsigned int* cq_head;              // 完成队列头（用户更新）
+  unsigned int* cq_tail;              // 完成队列尾（内核更新）
+  unsigned int* cq_mask;              // 完成队列掩码
+  struct io_uring_cqe* cqes;          // 完成队列项数组
+  void* sq_ring_ptr;                  // 提交队列映射
+  size_t sq_ring_size;                // 提交队列映射大小
+  void* cq_ring_ptr;                  // 完成队列映射（单映射时与提交队列相同）
+  size_t cq_ring_size;                // 完成队列映射大小
+  size_t sqes_size;                   // 提交项数组映射大小
+} IoUring;
+
 typedef struct {
   char scheme[8];   //协议
   char host[512];   //主机
@@ -109,6 +291,8 @@ typedef struct {
   char transfer_encoding[128];          // Transfer-Encoding头部
   char content_range[128];             // Content-Range 头的值
   char accept_ranges[64];              // Accept-Ranges 头的值
+  char etag[256];                      // ETag 头的值
+  char last_modified[128];             // Last-Modified 头的值
 } HttpResponseInfo;
 
 // http请求响应信息buffer
@@ -119,6 +303,46 @@ typedef struct {
   int sockfd;                         // Socket文件描述符
 } HttpReadBuffer;
 
+// 令牌桶（字段均为原子变量，各线程无锁地补充和取走令牌）
+typedef struct {
+  _Atomic long long rate;     // 速率（字节/秒），0表示不限速
+  _Atomic long long tokens;   // 可用令牌（字节），为负表示已被预支
+  _Atomic long long refill_ns; // 上次补充令牌的时间（单调时钟纳秒）
+} RateBucket;
+
+// 一次下载使用的限速器：全局、所在主机和本次下载三个令牌桶同时生效
+typedef struct {
+  RateBucket* host;           // 主机的令牌桶，NULL表示该主机没有单独限速
+  RateBucket* download;       // 本次下载的令牌桶，NULL表示不按下载限速
+} RateLimiter;
+
+// 批量下载列表中的一个文件
+typedef struct {
+  char* url;                  // 下载地址
+  char* output_filename;      // 输出文件名（不包含路径）
+  int status;                 // 0未完成，1已完成，-1失败
+} BatchEntry;
+
+// HPACK 动态表中的一个头部字段
+typedef struct {
+  char* name;                 // 字段名（与值共用一块内存）
+  size_t name_length;         // 字段名长度
+  char* value;                // 字段值
+  size_t value_length;        // 字段值长度
+} HpackEntry;
+
+// HPACK 解码器的动态表（环形队列，first 为最新的条目）
+typedef struct {
+  HpackEntry entries[HPACK_TABLE_SIZE / 32]; // 每个条目至少占 32 字节
+  int first;                  // 最新条目的位置
+  int count;                  // 条目数
+  size_t size;                // 当前大小（每个条目按 名称长度 + 值长度 + 32 计算）
+  size_t max_size;            // 当前上限（对端可通过动态表大小更新调小）
+} HpackTable;
+
+// 解码出一个头部字段时的回调
+typedef void (*HpackHeaderCallback)(void* context, const char* name, size_t name_length, const char* value, size_t value_length);
+
 // 下载进度条
 typedef struct {
   FILE* output_file;              // 输出文件指针
@@ -127,6 +351,7 @@ typedef struct {
   time_t start_time;              // 下载开始时间
   time_t last_update_time;        // 上次更新时间
   double download_speed;          // 下载速度（B/秒）
+  RateLimiter* rate_limiter;      // 本次下载的限速器，NULL表示只受全局限速
 } DownloadProgress;
 
 // 线程状态枚举
@@ -140,27 +365,171 @@ typedef enum {
 } ThreadState;
 
 typedef struct {
-  struct ssl_ctx_st* ctx;     // SSL 上下文
+  struct ssl_ctx_st* ctx;     // SSL 上下文（进程内共享，不随连接释放）
   struct ssl_st* ssl;         // SSL 连接对象
   int sockfd;                 // socket 文件描述符
+  char session_key[528];      // 会话缓存键（host:port）
+  int session_reused;         // 本次握手是否为会话恢复
+  double handshake_ms;        // TLS 握手耗时（毫秒）
+  double handshake_started_ms; // 握手开始时间（单调时钟，毫秒）
+  int http2;                  // 握手时通过 ALPN 协商使用 HTTP/2
 } HttpsConnection;
 
+// TLS 握手统计信息
+typedef struct {
+  long long full_handshakes;      // 完整握手次数
+  long long resumed_handshakes;   // 会话恢复握手次数
+  double full_handshake_ms;       // 完整握手累计耗时（毫秒）
+  double resumed_handshake_ms;    // 会话恢复握手累计耗时（毫秒）
+} TlsHandshakeStats;
+
+// 连接池中的连接（按 scheme + host + port 复用）
+typedef struct PooledConnection {
+  ProtocolType protocol_type;         // 协议类型
+  char host[512];                     // 主机
+  int port;                           // 端口
+  int sockfd;                         // socket 文件描述符（HTTP）
+  HttpsConnection* https_connection;  // HTTPS 连接（HTTPS）
+  time_t last_used;                   // 最后一次归还到池中的时间
+  int reused;                         // 是否从池中复用
+  int request_count;                  // 已在此连接上发送的请求数
+  struct sockaddr_storage peer_address; // 对端地址（用于按地址统计吞吐量）
+  int has_peer_address;               // peer_address 是否有效
+  struct PooledConnection* next;      // 空闲链表指针
+} PooledConnection;
+
+// 连接池统计信息
+typedef struct {
+  long long hits;             // 复用空闲连接次数
+  long long misses;           // 新建连接次数
+  long long evictions;        // 因超时或失效被淘汰的连接数
+  long long stale_retries;    // 复用连接失效后重新建连的次数
+  int idle_connections;       // 当前空闲连接数
+} ConnectionPoolStats;
+
+// 域名解析得到的全部地址（端口未设置）
+typedef struct {
+  int count;
+  struct sockaddr_storage addresses[DNS_MAX_ADDRESSES];
+  socklen_t lengths[DNS_MAX_ADDRESSES];
+  int preferred;              // 第一个地址是否为按分流权重选出的地址
+} DnsAddressList;
+
+// 单个地址的分流统计（按各地址实测吞吐量加权分配连接）
+typedef struct {
+  struct sockaddr_storage address;
+  long long bytes;                    // 从该地址下载的字节数
+  double rate;                        // 单个连接的平均吞吐量（字节/毫秒，指数加权），0表示尚未测量
+  int connections;                    // 成功建立的连接数
+  int failures;                       // 连接或传输失败次数
+  double demoted_until_ms;            // 在此之前不为新连接选择该地址
+  double current_weight;              // 平滑加权轮询的当前值
+} DnsAddressStats;
+
+// DNS 缓存条目（进程内共享，按域名查找）
+typedef struct DnsCacheEntry {
+  char host[512];
+  DnsAddressList addresses;
+  int status;                         // getaddrinfo 返回值，0表示成功
+  int pending;                        // 是否正在解析（其他线程等待结果，不重复解析）
+  double expires_ms;                  // 过期时间（单调时钟毫秒）
+  DnsAddressStats address_stats[DNS_MAX_ADDRESSES]; // 与 addresses 一一对应
+  struct DnsCacheEntry* next;
+} DnsCacheEntry;
+
+// DNS 缓存统计信息
+typedef struct {
+  long long hits;             // 命中缓存（包括等待正在进行的解析）的次数
+  long long misses;           // 需要重新解析的次数
+  long long resolutions;      // 实际调用 getaddrinfo 的次数
+  double resolve_ms;          // getaddrinfo 累计耗时（毫秒）
+} DnsCacheStats;
+
 // 文件段信息
 typedef struct {
   long long start_byte;       // 段开始字节位置
   long long end_byte;         // 段结束字节位置
   long long downloaded_bytes; // 已下载字节数
+  _Atomic long long written_bytes; // 已交给内核写入文件的字节数（不含缓冲区和写入队列中的数据）
   ThreadState state;          // 线程状态
-  int thread_id;              // 线程ID
+  int thread_id;              // 负责该段的线程ID，-1表示已被放弃
+  int duplicate_of;           // 收尾阶段重复下载的原段序号，-1表示普通段
+  int duplicate_index;        // 正在重复下载本段的段序号，-1表示没有
+  int hedge;                  // 是否为对冲请求（为慢段的剩余部分发出的第二个请求）
+  double rate_ewma;           // 下载速度的指数加权平均（字节/毫秒，由对冲监视器采样）
+  long long sampled_bytes;    // 上次采样时的已下载字节数
+  double sample_ms;           // 上次采样的时间，0表示尚未采样
+  double first_sample_ms;     // 第一次采样的时间
+  double last_progress_ms;    // 最近一次有进展的时间
   char error_message[256];    // 错误信息
 } FileSegment;
 
+// 写入队列中的一块数据
+typedef struct {
+  char* data;                 // 缓冲块（WRITER_BLOCK_SIZE 字节）
+  size_t length;              // 有效数据长度
+  long long offset;           // 写入文件的偏移
+  int fd;                     // 目标文件描述符
+  double commit_ms;           // 放入队列的时间（用于统计排队延迟）
+  _Atomic long long* written; // 写入成功后更新的进度，NULL表示不需要
+  long long written_value;    // 写入成功后 *written 的值
+} WriteBlock;
+
+// 单个连接的写入环形队列（单生产者单消费者，head/tail 无锁推进）
+typedef struct WriteRing {
+  WriteBlock blocks[WRITER_RING_SLOTS];
+  _Atomic unsigned int head;  // 生产者（网络线程）下一个放入的位置
+  _Atomic unsigned int tail;  // 消费者（写入线程）下一个写出的位置
+  _Atomic int error;          // 写入失败时的 errno，0表示没有错误
+  char* reserved;             // 生产者已取得但尚未放入队列的缓冲块
+  struct AsyncWriter* writer; // 所属写入线程
+} WriteRing;
+
+// 写入线程统计
+typedef struct {
+  long long queued_bytes;     // 当前在队列中等待写入的字节数
+  long long peak_queued_bytes; // 队列中等待写入的最大字节数
+  long long budget_bytes;     // 内存预算
+  long long written_bytes;    // 已写入的字节数
+  long long write_calls;      // pwritev 调用次数
+  long long blocks;           // 已写入的缓冲块数
+  double write_ms;            // pwritev 总耗时
+  double max_write_ms;        // 单次 pwritev 的最长耗时
+  double queue_wait_ms;       // 缓冲块从放入队列到写完的总时间
+  long long backpressure_waits; // 网络线程因队列已满而等待的次数
+  double backpressure_ms;     // 网络线程因队列已满而等待的总时间
+  long long direct_bytes;     // 以直接 I/O 写入（绕过页缓存）的字节数
+} WriterStats;
+
+// 写入线程：轮询各连接的环形队列，把同一文件上连续的块合并为一次 pwritev
+typedef struct AsyncWriter {
+  WriteRing* rings;           // 每个连接一个环形队列
+  int ring_count;             // 环形队列数量
+  pthread_t thread;           // 写入线程
+  pthread_mutex_t mutex;      // 保护空闲块链表、等待计数和统计
+  pthread_cond_t work_cond;   // 写入线程空闲时等待新数据
+  pthread_cond_t space_cond;  // 网络线程等待空闲块或队列排空
+  _Atomic int idle;           // 写入线程是否正在等待新数据
+  int stopping;               // 是否在排空后退出
+  char** free_blocks;         // 空闲缓冲块
+  int free_count;             // 空闲缓冲块数量
+  int allocated_blocks;       // 已分配的缓冲块数量
+  int max_blocks;             // 内存预算允许的缓冲块数量
+  int direct_fd;              // 以 O_DIRECT 打开的输出文件，-1表示不使用直接 I/O（只由写入线程改变）
+  int waiters;                // 等待空闲块或排空的网络线程数
+  _Atomic long long queued_bytes; // 当前在队列中等待写入的字节数
+  _Atomic long long peak_queued_bytes; // 队列中等待写入的最大字节数
+  WriterStats stats;          // 统计（持有 mutex 时读写）
+} AsyncWriter;
+
 // 单个下载线程的参数
 typedef struct {
   int thread_id;              // 线程ID
   char* url;                  // 下载URL
-  char* temp_filename;        // 临时文件名
+  char* temp_filename;        // 临时文件名（直接写入模式下为 .chd-partial 输出文件）
   FileSegment* segment;       // 分配的文件段
+  int direct_output;          // 是否直接写入预分配的输出文件
+  long long output_offset;    // 段数据在写入文件中的起始偏移（临时文件为0）
   pthread_t pthread_id;       // pthread ID
 
   // 统计信息
@@ -169,19 +538,49 @@ typedef struct {
 
   // 状态控制
   volatile int should_stop;   // 停止标志
+  volatile int retiring;      // 被自动调节器撤下：完成当前段后退出，不再领取新段
   pthread_mutex_t* progress_mutex; // 进度互斥锁
+  struct MultiThreadDownloader* downloader; // 所属下载器（动态调度时领取新段）
+  volatile int active_sockfd; // 当前使用的连接的 socket，-1表示没有（用于读取 TCP_INFO）
+  int mirror_index;           // 当前段使用的下载地址（MultiThreadDownloader.mirrors 的下标）
+  double connection_start_ms; // 当前连接开始传输的时间（用于按地址统计吞吐量）
+  double watchdog_start_ms;   // 低速检测当前窗口的开始时间，0表示没有被检测的连接
+  long long watchdog_bytes;   // 低速检测窗口开始时段已下载的字节数
+  volatile long long watchdog_aborted; // 连接因速度过低被看门狗中止时为使用的速度阈值，否则为0
+  RateLimiter rate_limiter;   // 当前段的限速器
+  long long connection_start_bytes; // 当前连接开始传输时段已下载的字节数
+  volatile int finished;      // 线程是否已经退出
+  WriteRing* write_ring;      // 该线程槽位的写入队列，NULL表示直接写文件
 } ThreadDownloadParams;
 
-// 多线程下载管理器
+// 同一文件的一个下载地址（主 URL 或镜像）
 typedef struct {
+  char* url;                  // 下载URL（已跟随重定向的最终地址）
+  URLInfo url_info;           // url 的解析结果，所有段共享
+  char etag[256];             // HEAD 响应的 ETag（用于和其他镜像比对）
+  char last_modified[128];    // HEAD 响应的 Last-Modified
+  long long bytes;            // 从该地址下载的字节数
+  double rate;                // 单个连接的平均吞吐量（字节/毫秒，指数加权），0表示尚未测量
+  int failures;               // 失败次数
+  int consecutive_failures;   // 连续失败次数，成功一次后清零
+  double cooldown_until_ms;   // 暂停分配请求直到该时刻（单调时钟毫秒）
+  int dropped;                // 是否已停用（元数据与主 URL 不一致）
+  double current_weight;      // 平滑加权轮询的当前值
+} MirrorInfo;
+
+// 多线程下载管理器
+typedef struct MultiThreadDownloader {
   char* url;                  // 下载URL
   char* output_filename;      // 输出文件名
   char* download_dir;         // 下载目录
 
-  int thread_count;           // 线程数量
+  int thread_count;           // 线程数量（自动连接数模式下为已使用的线程槽位数）
+  int thread_capacity;        // 线程参数数组容量
   long long file_size;        // 文件总大小
 
   FileSegment* segments;      // 文件段数组
+  int segment_count;          // 已使用的段数（动态调度时会增长）
+  int segment_capacity;       // 段数组容量
   ThreadDownloadParams* threads; // 线程参数数组
 
   // 同步对象
@@ -197,6 +596,49 @@ typedef struct {
   volatile int should_stop;   // 全局停止标志
   int completed_threads;      // 已完成线程数
   int error_count;            // 错误计数
+  DownloadResult error_code;  // multithread_download 失败时的原因
+  int progress_lines;         // 进度区域已输出的行数，0表示尚未显示
+
+  // 输出文件
+  int direct_output;          // 是否直接写入预分配的输出文件（否则使用临时文件合并）
+  char* partial_path;         // 直接写入时的 .chd-partial 文件路径，完成后重命名为输出文件
+
+  // 动态分段调度（工作窃取 + 收尾阶段重复下载）
+  int dynamic_segments;       // 是否启用动态调度
+  int steal_count;            // 拆分其他段的次数
+  int endgame_count;          // 收尾阶段重复下载的次数
+  int auto_connections;       // 是否由自动调节器增减连接数
+  int peak_connections;       // 自动调节期间同时使用的最大连接数
+  int hedging;                // 是否为慢段发出对冲请求
+  int hedge_count;            // 发出的对冲请求数
+  int hedge_won_count;        // 先于原请求完成的对冲请求数
+
+  // 多镜像下载（mirrors[0] 为主 URL）
+  MirrorInfo mirrors[MAX_MIRRORS];
+  int mirror_count;           // 地址数量，1表示只有主 URL
+
+  // Metalink 分块校验
+  PieceState* piece_states;   // 各分块的校验状态，NULL表示不做分块校验
+  int verified_pieces;        // 校验通过的分块数
+  int corrupt_pieces;         // 校验失败后单独重新下载的次数
+
+  RateBucket rate_bucket;     // 本次下载的令牌桶，所有段共享
+
+  AsyncWriter* writer;        // 写入线程，NULL表示网络线程直接写文件
+  WriterStats writer_stats;   // 写入线程退出时的统计
+
+  // 持久化检查点：定期 fdatasync 输出文件并记录已落盘的区间，中断后再次下载时从检查点继续
+  char* state_path;           // .chd-state 文件路径，NULL表示不建立检查点
+  long long (*resume_ranges)[2]; // 从状态文件恢复的已完成区间 [起点, 终点)，按起点排序
+  int resume_range_count;     // 已完成区间数
+  long long resumed_bytes;    // 已完成区间的总字节数（计入下载进度）
+  int checkpoint_count;       // 建立检查点的次数
+  double checkpoint_sync_ms;  // 检查点 fdatasync 的总耗时
+
+  // 启动探测（GET Range: bytes=0-），响应体留给第一段继续读取
+  struct PooledConnection* probe_connection; // 尚未被第一段接手的探测连接，NULL表示没有
+  HttpResponseInfo probe_response; // 探测请求的响应头
+  HttpReadBuffer probe_buffer;     // 读取响应头时多读到的响应体数据
 
 } MultiThreadDownloader;
 
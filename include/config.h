@@ -7,4 +7,17 @@ int load_config(Config* config);
 
 int init_config(Config* config);
 
+/**
+ * 获取运行时下载选项
+ * @return 进程内共享的下载选项
+ */
+DownloadOptions* get_download_options();
+
+/**
+ * 获取分段引擎（epoll、HTTP/2、io_uring）收发无数据的超时：开启低速检测时为检测窗口，否则为 SOCKET_IO_TIMEOUT。
+ * 这些路径超时后会重试；socket 本身的收发超时固定为 SOCKET_IO_TIMEOUT
+ * @return 超时毫秒数
+ */
+int get_io_idle_timeout_ms();
+
 #endif
\ No newline at end of file
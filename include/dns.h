@@ -0,0 +1,65 @@
+#include "./common.h"
+
+#ifndef DNS_H
+#define DNS_H
+
+/**
+ * 通过进程内共享的缓存解析域名，返回全部地址（IPv4 和 IPv6）
+ * 缓存 DNS_CACHE_TTL 秒；同一域名正在解析时等待其结果而不重复解析
+ * 地址列表的第一个是按各地址实测吞吐量加权轮询选出的地址（分流各个连接）
+ * @param hostname 域名或IP地址
+ * @param addresses 输出的地址列表
+ * @return 成功返回0，失败返回-1
+ */
+int dns_resolve(const char* hostname, DnsAddressList* addresses);
+
+/**
+ * 在后台线程中预先解析域名并放入缓存，不等待结果
+ * 之后的 dns_resolve 会直接命中缓存或等待这次解析完成
+ * @param hostname 域名或IP地址
+ */
+void dns_prefetch(const char* hostname);
+
+/**
+ * 报告连接某个地址的结果，失败的地址在 STRIPE_DEMOTE_TIME 秒内不再分配新连接
+ * @param hostname 域名或IP地址
+ * @param address 连接的地址
+ * @param success 是否连接成功
+ */
+void dns_report_connect(const char* hostname, const struct sockaddr* address, int success);
+
+/**
+ * 报告一次传输的结果，用于按地址统计字节数和吞吐量（决定分流权重）
+ * 传输失败或吞吐量明显低于最快地址时降级该地址
+ * @param hostname 域名或IP地址
+ * @param address 连接的地址
+ * @param bytes 本次传输的字节数
+ * @param elapsed_ms 本次传输耗时（毫秒）
+ * @param failed 传输是否失败
+ */
+void dns_report_transfer(const char* hostname, const struct sockaddr* address, long long bytes, double elapsed_ms, int failed);
+
+/**
+ * 检查地址当前是否被降级（降级地址的空闲连接不应再复用）
+ * @param hostname 域名或IP地址
+ * @param address 连接的地址
+ * @return 被降级返回1，否则返回0
+ */
+int dns_address_demoted(const char* hostname, const struct sockaddr* address);
+
+/**
+ * 获取域名各个地址的分流统计
+ * @param hostname 域名或IP地址
+ * @param stats 输出数组
+ * @param max_count 数组容量
+ * @return 地址数量
+ */
+int dns_get_address_stats(const char* hostname, DnsAddressStats* stats, int max_count);
+
+/**
+ * 获取 DNS 缓存统计信息
+ * @param stats 输出的统计信息
+ */
+void dns_get_stats(DnsCacheStats* stats);
+
+#endif
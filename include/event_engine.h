@@ -0,0 +1,15 @@
+#include "./common.h"
+
+#ifndef EVENT_ENGINE_H
+#define EVENT_ENGINE_H
+
+/**
+ * 使用 epoll 事件循环下载所有文件段
+ * 每个段是一个非阻塞的 HTTP/HTTPS 状态机，段按序号分配给 event_loops 个事件循环线程，
+ * 数据写入与线程模式相同的 .partN 临时文件
+ * @param downloader 已完成 initialize_multithread_download 的下载器
+ * @return 失败的段数，0表示全部成功，-1表示引擎无法启动
+ */
+int event_engine_download(MultiThreadDownloader* downloader);
+
+#endif
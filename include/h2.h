@@ -0,0 +1,17 @@
+#include "./common.h"
+
+#ifndef H2_H
+#define H2_H
+
+/**
+ * HTTP/2 引擎：在一个 TLS 连接上通过 ALPN 协商 h2，所有分段作为并发的流请求
+ * 同时打开的流数不超过服务器的 SETTINGS_MAX_CONCURRENT_STREAMS，其余分段排队；
+ * 每个流的接收窗口为 H2_STREAM_WINDOW，连接的接收窗口为 H2_CONNECTION_WINDOW，
+ * 数据写入文件后通过 WINDOW_UPDATE 归还窗口；连接断开时重新连接并从各段已下载的位置继续
+ * 服务器不支持 h2（或 URL 不是 HTTPS）时改用 epoll 引擎
+ * @param downloader 已初始化的下载器（静态分段）
+ * @return 失败的段数，无法开始下载返回-1
+ */
+int h2_engine_download(MultiThreadDownloader* downloader);
+
+#endif
@@ -0,0 +1,41 @@
+#include "./common.h"
+
+#ifndef HPACK_H
+#define HPACK_H
+
+/**
+ * 初始化 HPACK 解码器的动态表（大小上限为 HPACK_TABLE_SIZE）
+ * @param table 动态表
+ */
+void hpack_table_init(HpackTable* table);
+
+/**
+ * 释放动态表中的所有条目
+ * @param table 动态表
+ */
+void hpack_table_free(HpackTable* table);
+
+/**
+ * 解码一个完整的头部块（HEADERS 及其 CONTINUATION 帧的内容），每个字段调用一次回调
+ * 同一连接上的所有头部块必须按收到的顺序解码，即使不关心其内容，否则动态表会不一致
+ * @param table 连接的动态表
+ * @param data 头部块
+ * @param length 头部块长度
+ * @param callback 字段回调
+ * @param context 传给回调的参数
+ * @return 成功返回0，头部块格式错误返回-1（应作为连接错误处理）
+ */
+int hpack_decode_block(HpackTable* table, const unsigned char* data, size_t length, HpackHeaderCallback callback, void* context);
+
+/**
+ * 编码一个头部字段（不加入对端的动态表，不使用 Huffman 编码）
+ * 字段名和值与静态表完全匹配时编码为索引，只有名称匹配时引用静态表中的名称
+ * @param output 输出缓冲区
+ * @param output_size 输出缓冲区大小
+ * @param name 字段名（小写）
+ * @param value 字段值
+ * @return 成功返回编码后的长度，缓冲区不足返回-1
+ */
+int hpack_encode_header(unsigned char* output, size_t output_size, const char* name, const char* value);
+
+#endif
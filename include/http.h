@@ -43,6 +43,15 @@ int process_header_field(const char* name, const char* value, HttpResponseInfo*
  */
 int parse_http_response_headers(int sockfd, HttpResponseInfo* response_info, HttpReadBuffer* remaining_buffer);
 
+/**
+ * 解析已完整读入内存的HTTP响应头部（用于非阻塞连接）
+ * @param header_block 响应头数据（到空行为止）
+ * @param length 数据长度
+ * @param response_info 用于存储解析结果的结构体
+ * @return 成功返回0，失败返回-1
+ */
+int parse_http_response_block(const char* header_block, size_t length, HttpResponseInfo* response_info);
+
 
 /**
  * 构建HTTP GET请求
@@ -32,6 +32,19 @@ void cleanup_openssl();
  */
 SSL_CTX* create_ssl_context();
 
+/**
+ * 获取进程内共享的 SSL 上下文（首次调用时创建）
+ * 所有 HTTPS 连接共用同一个上下文，并按 host:port 缓存会话以便恢复握手
+ * @return 成功返回 SSL_CTX 指针，失败返回 NULL
+ */
+SSL_CTX* get_shared_ssl_context();
+
+/**
+ * 获取 TLS 握手统计信息（完整握手与会话恢复的次数和耗时）
+ * @param stats 输出的统计信息
+ */
+void get_tls_handshake_stats(TlsHandshakeStats* stats);
+
 /**
  * 创建 HTTPS 连接
  * @param hostname 服务器主机名
@@ -40,6 +53,30 @@ SSL_CTX* create_ssl_context();
  */
 HttpsConnection* create_https_connection(const char* hostname, int port);
 
+/**
+ * 在已建立的 TCP 连接上创建 SSL 对象（设置 SNI 并尝试恢复缓存的会话），不执行握手
+ * @param sockfd 已连接的 socket 文件描述符（失败时不会关闭）
+ * @param hostname 服务器主机名
+ * @param port 端口号
+ * @return 成功返回 HttpsConnection 指针，失败返回 NULL
+ */
+HttpsConnection* https_connection_attach(int sockfd, const char* hostname, int port);
+
+/**
+ * 握手前通过 ALPN 同时提供 h2 和 http/1.1，握手完成后 https_connection->http2 表示服务器是否选择了 h2
+ * 未调用时不发送 ALPN，服务器只会使用 HTTP/1.1
+ * @param https_connection 尚未握手的 HTTPS 连接
+ * @return 成功返回0，失败返回-1
+ */
+int https_connection_offer_h2(HttpsConnection* https_connection);
+
+/**
+ * 推进一次 SSL 握手，可用于非阻塞 socket
+ * @param https_connection HTTPS 连接指针
+ * @return 握手完成返回0，需要等待可读/可写时返回 SSL_ERROR_WANT_READ/SSL_ERROR_WANT_WRITE，失败返回-1
+ */
+int ssl_handshake_step(HttpsConnection* https_connection);
+
 /**
  * 关闭 HTTPS 连接
  * @param https_connection HTTPS 连接指针
@@ -0,0 +1,47 @@
+#include "./common.h"
+
+#ifndef METALINK_H
+#define METALINK_H
+
+/**
+ * 判断下载参数是否为本地的 Metalink 文件（扩展名 .meta4，且不是 URL）
+ * @param argument -d 后面的参数
+ * @return 是返回1，否则返回0
+ */
+int metalink_is_file(const char* argument);
+
+/**
+ * 解析 Metalink (RFC 5854) 文件，读取第一个 <file> 的文件名、大小、哈希、分块哈希和下载地址
+ * 只保留 HTTP/HTTPS 地址，按 priority 排序后最多保留 MAX_MIRRORS 个
+ * @param path Metalink 文件路径
+ * @param info 输出的文件描述，使用完后调用 metalink_free 释放
+ * @return 成功返回0，失败返回-1
+ */
+int metalink_parse_file(const char* path, MetalinkInfo* info);
+
+/**
+ * 释放 metalink_parse_file 分配的内存
+ * @param info 文件描述
+ */
+void metalink_free(MetalinkInfo* info);
+
+/**
+ * 检查是否支持某种哈希算法（需要 OpenSSL）
+ * @param hash_type Metalink 中的算法名，如 sha-256
+ * @return 支持返回1，否则返回0
+ */
+int metalink_hash_supported(const char* hash_type);
+
+/**
+ * 计算文件中一段数据的哈希值
+ * @param fd 文件描述符（使用 pread，不改变文件位置）
+ * @param offset 起始偏移
+ * @param length 数据长度
+ * @param hash_type Metalink 中的算法名
+ * @param hex 输出的十六进制哈希值（小写）
+ * @param hex_size 输出缓冲区大小（建议 METALINK_HASH_LENGTH）
+ * @return 成功返回0，失败返回-1
+ */
+int metalink_hash_range(int fd, long long offset, long long length, const char* hash_type, char* hex, size_t hex_size);
+
+#endif
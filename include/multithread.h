@@ -22,6 +22,16 @@ MultiThreadDownloader* create_multithread_downloader(const char* url, const char
  */
 int check_range_support(const char* url, long long* file_size);
 
+/**
+ * 用一个 GET Range: bytes=0- 请求探测文件大小和 Range 支持，
+ * 206 响应的连接和已读到的数据保存在下载器中，由第一段直接继续读取响应体
+ * 探测失败或响应不能判断时退回 check_range_support
+ * @param downloader 下载器指针
+ * @param file_size 输出文件大小
+ * @return 支持返回1，不支持返回0，错误返回-1
+ */
+int probe_range_stream(MultiThreadDownloader* downloader, long long* file_size);
+
 /**
  * 开始多线程下载
  * @param downloader 下载器指针
@@ -71,6 +81,14 @@ int test_range_request(const char* url);
  */
 int calculate_file_segments(long long file_size, int thread_count, FileSegment* segments);
 
+/**
+ * 打开段的输出文件并定位到段内已下载数据之后
+ * 直接写入模式打开共享的预分配输出文件，否则打开（或追加）段临时文件
+ * @param thread_params 线程参数
+ * @return 成功返回文件指针，失败返回NULL
+ */
+FILE* open_segment_output(ThreadDownloadParams* thread_params);
+
 /**
  * 初始化多线程下载
  * @param downloader 下载器指针
@@ -85,6 +103,13 @@ int initialize_multithread_download(MultiThreadDownloader* downloader);
  */
 int download_segment(ThreadDownloadParams* thread_params);
 
+/**
+ * 带重试的段下载函数（每次尝试都从连接池借用连接）
+ * @param thread_params 线程参数
+ * @return 成功返回0，失败返回-1
+ */
+int download_segment_with_retry(ThreadDownloadParams* thread_params);
+
 /**
  * HTTP 段下载
  * @param url_info URL信息
@@ -129,6 +154,13 @@ void* thread_download_worker(void* arg);
  */
 void* progress_display_worker(void* arg);
 
+/**
+ * 低速看门狗工作线程：中止在 low_speed_time 秒内平均速度低于 low_speed_limit 的连接
+ * @param arg 下载器指针
+ * @return NULL
+ */
+void* stall_watchdog_worker(void* arg);
+
 /**
  * 单线程下载回退函数
  * @param downloader 下载器指针
@@ -143,6 +175,38 @@ int download_file_fallback_single_thread(MultiThreadDownloader* downloader);
  */
 int merge_temp_files(MultiThreadDownloader* downloader);
 
+/**
+ * 生成输出文件的完整路径
+ * @param downloader 下载器指针
+ * @param buffer 输出缓冲区
+ * @param buffer_size 缓冲区大小
+ */
+void build_output_path(const MultiThreadDownloader* downloader, char* buffer, size_t buffer_size);
+
+/**
+ * 统计所有分段已下载的字节数（重复下载的部分只计一次）
+ * @param downloader 下载器指针
+ * @return 已下载字节数
+ */
+long long multithread_downloaded_bytes(MultiThreadDownloader* downloader);
+
+/**
+ * 新增一个下载线程（仅动态调度模式），新线程从调度器领取分段
+ * @param downloader 下载器指针
+ * @return 成功返回线程序号，已达上限或创建失败返回-1
+ */
+int add_download_worker(MultiThreadDownloader* downloader);
+
+/**
+ * 对冲请求监视器（动态调度且连接数固定时使用）
+ * 每 HEDGE_CHECK_INTERVAL_MS 采样各段的下载速度，段速度低于活动段中位数的 hedge_speed_ratio
+ * 或 hedge_stall_ms 内没有进展时，用额外的连接为该段的剩余部分发出第二个请求。
+ * 对冲请求的写入位置超过原请求时原请求在该位置结束，先完成的一方结束另一方
+ * 调用前下载线程需已启动；函数在所有下载线程退出后返回
+ * @param downloader 下载器指针
+ */
+void hedge_run(MultiThreadDownloader* downloader);
+
 /**
  * 清理临时文件
  * @param downloader 下载器指针
@@ -3,12 +3,32 @@
 #define NET_H
 
 /**
- * 建立TCP连接
- * @param ip_str IP地址字符串
+ * 建立到主机的TCP连接（Happy Eyeballs，RFC 8305）
+ * 解析出的 IPv6 和 IPv4 地址交替尝试，上一个地址 HAPPY_EYEBALLS_DELAY_MS 内未连上就同时连接下一个，
+ * 最先连上的获胜，其余关闭；第一个尝试的地址由 DNS 缓存按各地址吞吐量分流选出，
+ * 连接失败的地址会被降级（只是被其他地址抢先的不降级）
+ * 所有地址在 connect_timeout 秒内都未连上时失败
+ * @param hostname 域名或IP地址
+ * @param port 端口号
+ * @return 成功返回阻塞模式的socket文件描述符（收发超时为 SOCKET_IO_TIMEOUT），失败返回-1
+ */
+int connect_to_host(const char* hostname, int port);
+
+/**
+ * 发起非阻塞TCP连接（连接可能尚未完成）
+ * @param ip_str IPv4 或 IPv6 地址字符串
  * @param port 端口号
  * @return 成功返回socket文件描述符，失败返回-1
  */
-int create_tcp_connection(const char* ip_str, int port);
+int create_tcp_connection_nonblocking(const char* ip_str, int port);
+
+/**
+ * 设置或清除 socket 的非阻塞模式
+ * @param sockfd socket文件描述符
+ * @param enabled 1为非阻塞，0为阻塞
+ * @return 成功返回0，失败返回-1
+ */
+int set_socket_nonblocking(int sockfd, int enabled);
 
 /**
  * 发送完整数据的封装函数
@@ -19,6 +39,33 @@ int create_tcp_connection(const char* ip_str, int port);
  */
 int send_full_data(int sockfd, const char* buffer, size_t length);
 
+/**
+ * 创建用于 splice 零拷贝的管道，并尽量扩大管道容量
+ * @param pipe_fds 输出的管道描述符（[0]读端，[1]写端）
+ * @return 成功返回0，失败返回-1
+ */
+int create_splice_pipe(int pipe_fds[2]);
+
+/**
+ * 关闭 splice 管道
+ * @param pipe_fds 管道描述符
+ */
+void close_splice_pipe(int pipe_fds[2]);
+
+/**
+ * 通过 splice 把 socket 中的数据经管道直接写入文件的指定偏移，数据不经过用户态
+ * socket 需为阻塞模式，接收超时沿用 SO_RCVTIMEO
+ * @param sockfd socket文件描述符
+ * @param pipe_fds create_splice_pipe 创建的管道（调用前需为空）
+ * @param file_fd 输出文件描述符（不能是 O_APPEND 模式）
+ * @param offset 写入的文件偏移
+ * @param length 本次最多搬运的字节数
+ * 文件不支持 splice 写入时，已进入管道的数据经用户态写入文件，不会丢失
+ * @return 写入文件的字节数，0表示连接关闭，-1表示失败（errno 为失败原因，管道中可能残留数据；
+ *         只有第一步 socket 到管道失败、没有数据离开 socket 时 errno 才为 EINVAL）
+ */
+ssize_t splice_socket_to_file(int sockfd, int pipe_fds[2], int file_fd, long long offset, size_t length);
+
 
 
 #endif
\ No newline at end of file
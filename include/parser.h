@@ -3,9 +3,10 @@
 #define PARSER_H
 
 /**
- * 域名解析函数
+ * 域名解析函数（结果来自共享 DNS 缓存）
+ * 返回按各地址吞吐量分流选出的下一个地址（IPv4 或 IPv6）
  * @param hostname 输入的域名字符串
- * @param ip_str 输出的IP地址字符串缓冲区
+ * @param ip_str 输出的IP地址字符串缓冲区（建议 INET6_ADDRSTRLEN）
  * @param ip_str_len IP地址字符串缓冲区长度
  * @return 成功返回0，失败返回-1
  */
@@ -0,0 +1,19 @@
+#include "./common.h"
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/**
+ * 批量下载列表中的文件，同一主机的文件在一个 keep-alive 连接上以 HTTP/1.1 流水线方式请求：
+ * 连续发出多个 GET，再按顺序读取各个响应写入各自的文件
+ * 服务器在响应边界正常关闭连接（keep-alive 请求数上限）时重新连接并继续流水线；
+ * 连接在响应中途断开、没有返回任何响应、响应无法确定长度（分块编码或无 Content-Length）时，
+ * 该主机剩余的文件改为每个文件一个连接单独下载，重定向的文件同样单独下载
+ * @param list_file URL 列表文件（每行一个 URL，可在空白后跟输出文件名，# 开头的行为注释）
+ * @param download_dir 下载目录，NULL表示当前目录
+ * @param depth 流水线深度（1 到 PIPELINE_MAX_DEPTH，1表示只复用连接不流水线）
+ * @return 下载失败的文件数，无法读取列表返回-1
+ */
+int pipeline_download_batch(const char* list_file, const char* download_dir, int depth);
+
+#endif
@@ -0,0 +1,95 @@
+#include "./common.h"
+
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * 从连接池获取一个到 url_info 指定主机的连接
+ * 优先复用空闲的 keep-alive 连接，没有可用连接时新建
+ * @param url_info URL信息（使用 protocol_type、host、port 作为键）
+ * @return 成功返回连接指针，失败返回NULL
+ */
+PooledConnection* connection_pool_acquire(const URLInfo* url_info);
+
+/**
+ * 只从空闲链表中获取可复用的连接，不新建连接
+ * @param url_info URL信息
+ * @return 有可用空闲连接时返回连接指针，否则返回NULL
+ */
+PooledConnection* connection_pool_acquire_idle(const URLInfo* url_info);
+
+/**
+ * 把调用者自行建立的连接包装为连接池连接（计入新建次数）
+ * @param url_info URL信息
+ * @param sockfd 已连接的 socket（HTTP）
+ * @param https_connection 已握手的 HTTPS 连接（HTTPS，HTTP 时为NULL）
+ * @return 成功返回连接指针，失败返回NULL（不关闭传入的连接）
+ */
+PooledConnection* pooled_connection_create(const URLInfo* url_info, int sockfd, HttpsConnection* https_connection);
+
+/**
+ * 归还连接
+ * @param connection 连接指针
+ * @param reusable 响应已完整读取且服务器允许保持连接时为1，否则为0（直接关闭）
+ * 放回池中的连接会恢复为阻塞模式
+ */
+void connection_pool_release(PooledConnection* connection, int reusable);
+
+/**
+ * 通过连接池发送请求并解析响应头
+ * 若复用的连接已被服务器关闭，会自动新建连接重发一次
+ * @param url_info URL信息
+ * @param request 请求数据
+ * @param request_len 请求长度
+ * @param connection 输出的连接指针（成功时由调用者负责归还）
+ * @param response_info 响应信息结构体
+ * @param remaining_buffer 剩余数据缓冲区
+ * @return 成功返回0，失败返回-1
+ */
+int pooled_connection_request(const URLInfo* url_info, const char* request, size_t request_len,
+  PooledConnection** connection, HttpResponseInfo* response_info, HttpReadBuffer* remaining_buffer);
+
+/**
+ * 在连接上发送数据
+ * @param connection 连接指针
+ * @param buffer 发送缓冲区
+ * @param length 数据长度
+ * @return 成功返回0，失败返回-1
+ */
+int pooled_connection_send(PooledConnection* connection, const char* buffer, size_t length);
+
+/**
+ * 在连接上接收数据
+ * @param connection 连接指针
+ * @param buffer 接收缓冲区
+ * @param length 缓冲区大小
+ * @return 实际接收的字节数，0表示连接关闭，-1表示错误
+ */
+ssize_t pooled_connection_recv(PooledConnection* connection, void* buffer, size_t length);
+
+/**
+ * 读取并丢弃响应体，使连接可以被复用
+ * @param connection 连接指针
+ * @param remaining_buffer 解析响应头后的剩余数据
+ * @param length 响应体长度
+ * @return 成功返回0，失败返回-1
+ */
+int pooled_connection_drain(PooledConnection* connection, HttpReadBuffer* remaining_buffer, long long length);
+
+/**
+ * 淘汰超过 POOL_IDLE_TIMEOUT 的空闲连接
+ */
+void connection_pool_evict_idle();
+
+/**
+ * 获取连接池统计信息
+ * @param stats 输出的统计信息
+ */
+void connection_pool_get_stats(ConnectionPoolStats* stats);
+
+/**
+ * 关闭所有空闲连接
+ */
+void connection_pool_cleanup();
+
+#endif
@@ -0,0 +1,91 @@
+#include "./common.h"
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/**
+ * 解析速率，支持 K/M/G 后缀（1024 进制），如 500K、1.5M
+ * @param text 速率文本
+ * @return 字节/秒，0表示不限速，格式错误返回-1
+ */
+long long ratelimit_parse_rate(const char* text);
+
+/**
+ * 设置全局限速（进程内所有下载共享）
+ * @param rate 字节/秒，0表示不限速
+ */
+void ratelimit_set_global(long long rate);
+
+/**
+ * 设置单个主机的限速（连接该主机的所有下载共享）
+ * @param host 主机名
+ * @param rate 字节/秒，0表示不限速
+ * @return 成功返回0，主机数超过 RATE_LIMIT_MAX_HOSTS 返回-1
+ */
+int ratelimit_set_host(const char* host, long long rate);
+
+/**
+ * 设置每个下载的限速（同一下载的所有段共享）
+ * @param rate 字节/秒，0表示不限速
+ */
+void ratelimit_set_download(long long rate);
+
+/**
+ * 设置限速控制文件。下载过程中每 RATE_LIMIT_POLL_MS 检查一次文件，修改后重新读取，
+ * 每行一条设置: "global <速率>"、"download <速率>" 或 "host <主机名> <速率>"
+ * @param path 文件路径
+ * @return 成功返回0，文件无法读取或格式错误返回-1
+ */
+int ratelimit_set_control_file(const char* path);
+
+/**
+ * 是否配置了任何限速（包括控制文件，之后可能开启限速）
+ * 限速时接收数据需要逐次取令牌，零拷贝和 io_uring 后端改用普通收发
+ * @return 是返回1，否则返回0
+ */
+int ratelimit_enabled();
+
+/**
+ * 低速检测使用的速度阈值。限速时每个连接只能分到令牌桶速率的一部分，
+ * 阈值不超过每个连接应得速率的一半，被限速的连接不会被当作停滞而反复重连
+ * @param limiter 连接使用的限速器，NULL表示只受全局限速
+ * @param connections 共享限速的连接数
+ * @return 字节/秒，0表示不做低速检测
+ */
+long long ratelimit_low_speed_limit(RateLimiter* limiter, int connections);
+
+/**
+ * 初始化一次下载的限速器
+ * @param limiter 限速器
+ * @param host 下载所在的主机名
+ * @param download 本次下载的令牌桶（调用者分配，所有段共享，首次使用前清零）
+ */
+void ratelimit_init(RateLimiter* limiter, const char* host, RateBucket* download);
+
+/**
+ * 接收数据前取走令牌：最多取 RATE_LIMIT_SLICE_MS 对应的数据量，令牌不足时短暂等待，
+ * 使接收调用均匀分布，TCP 流量控制保持平稳
+ * @param limiter 限速器，NULL表示只受全局限速
+ * @param wanted 想要接收的字节数
+ * @return 本次允许接收的字节数（不超过 wanted）
+ */
+size_t ratelimit_acquire(RateLimiter* limiter, size_t wanted);
+
+/**
+ * ratelimit_acquire 的非阻塞版本，供事件循环使用：令牌不足时不等待
+ * @param limiter 限速器，NULL表示只受全局限速
+ * @param wanted 想要接收的字节数
+ * @param wait_ms 返回0时写入需要等待的毫秒数
+ * @return 本次允许接收的字节数，令牌不足时返回0
+ */
+size_t ratelimit_try_acquire(RateLimiter* limiter, size_t wanted, int* wait_ms);
+
+/**
+ * 接收后归还没有用掉的令牌
+ * @param limiter 限速器
+ * @param granted ratelimit_acquire 返回的字节数
+ * @param received 实际接收的字节数（出错时为负数）
+ */
+void ratelimit_refund(RateLimiter* limiter, size_t granted, ssize_t received);
+
+#endif
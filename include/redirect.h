@@ -0,0 +1,40 @@
+#include "./common.h"
+
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+/**
+ * 把 Location 头解析为绝对 URL（支持绝对 URL、//host/path、/path 和相对路径）
+ * @param base_url 发出请求的 URL
+ * @param location Location 头的值
+ * @param output 输出的绝对 URL
+ * @param output_size 输出缓冲区大小
+ * @return 成功返回0，失败返回-1
+ */
+int resolve_redirect_location(const char* base_url, const char* location, char* output, size_t output_size);
+
+/**
+ * 查找缓存的永久重定向（301/308）
+ * 缓存文件位于 $XDG_CACHE_HOME/chttpdownloader/redirects（默认 ~/.cache），
+ * 最多 REDIRECT_CACHE_MAX_ENTRIES 条，每条保留 REDIRECT_CACHE_TTL 秒
+ * @param url 原始 URL
+ * @param target 输出的重定向目标
+ * @param target_size 输出缓冲区大小
+ * @return 命中返回0，否则返回-1
+ */
+int redirect_cache_lookup(const char* url, char* target, size_t target_size);
+
+/**
+ * 记录一次永久重定向，超出容量时丢弃最旧的条目
+ * @param url 原始 URL
+ * @param target 重定向目标
+ */
+void redirect_cache_store(const char* url, const char* target);
+
+/**
+ * 删除一条缓存的重定向（目标已失效时调用）
+ * @param url 原始 URL
+ */
+void redirect_cache_remove(const char* url);
+
+#endif
@@ -13,5 +13,14 @@
  */
 void download_test();
 
+/**
+ * 下载性能基准测试：用各个可用的 I/O 后端多线程下载同一 URL，
+ * 比较耗时、吞吐量和进程 CPU 时间（用户态/内核态）
+ * @param url 下载URL（需支持 Range）
+ * @param thread_count 线程数
+ * @return 成功返回0
+ */
+int download_benchmark(const char* url, int thread_count);
+
 
 #endif
\ No newline at end of file
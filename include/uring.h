@@ -0,0 +1,82 @@
+#include "./common.h"
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+/**
+ * 检查内核是否支持 io_uring（结果会被缓存）
+ * @return 支持返回1，不支持返回0
+ */
+int uring_available();
+
+/**
+ * 创建 io_uring 实例并映射提交/完成队列
+ * @param ring io_uring 实例
+ * @param entries 提交队列大小
+ * @return 成功返回0，失败返回 -errno
+ */
+int uring_init(IoUring* ring, unsigned int entries);
+
+/**
+ * 销毁 io_uring 实例
+ * @param ring io_uring 实例
+ */
+void uring_destroy(IoUring* ring);
+
+/**
+ * 注册固定缓冲区，供 IORING_OP_READ_FIXED/WRITE_FIXED 使用
+ * @param ring io_uring 实例
+ * @param iovecs 缓冲区数组
+ * @param count 缓冲区数量
+ * @return 成功返回0，失败返回 -errno
+ */
+int uring_register_buffers(IoUring* ring, const struct iovec* iovecs, unsigned int count);
+
+/**
+ * 获取一个空闲的提交队列项
+ * @param ring io_uring 实例
+ * @return 成功返回已清零的提交项，队列已满返回NULL
+ */
+struct io_uring_sqe* uring_get_sqe(IoUring* ring);
+
+/**
+ * 提交已填写的提交项并等待完成
+ * @param ring io_uring 实例
+ * @param wait_nr 至少等待的完成数，0表示只提交
+ * @param timeout_ms 等待超时（毫秒），小于0表示一直等待；需要内核支持 IORING_FEAT_EXT_ARG
+ * @return 成功返回提交的数量，超时返回 -ETIME，失败返回 -errno
+ */
+int uring_submit_and_wait(IoUring* ring, unsigned int wait_nr, int timeout_ms);
+
+/**
+ * 取出一个完成项（不阻塞）
+ * @param ring io_uring 实例
+ * @param cqe 输出的完成项指针
+ * @return 有完成项返回1，没有返回0
+ */
+int uring_peek_cqe(IoUring* ring, struct io_uring_cqe** cqe);
+
+/**
+ * 标记完成项已处理
+ * @param ring io_uring 实例
+ */
+void uring_cqe_seen(IoUring* ring);
+
+/**
+ * 填写 socket 接收请求
+ */
+void uring_prep_recv(struct io_uring_sqe* sqe, int sockfd, void* buffer, size_t length, int flags);
+
+/**
+ * 填写使用固定缓冲区的定位写请求
+ */
+void uring_prep_write_fixed(struct io_uring_sqe* sqe, int fd, const void* buffer, size_t length, long long offset, int buffer_index);
+
+/**
+ * 填写取消请求（按 user_data 匹配）
+ */
+void uring_prep_cancel(struct io_uring_sqe* sqe, unsigned long long user_data);
+
+#endif
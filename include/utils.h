@@ -17,4 +17,18 @@ const char* format_file_size(long long bytes);
  */
 char* format_time(int seconds);
 
+/**
+ * 获取单调时钟时间，用于计算耗时
+ * @return 毫秒数
+ */
+double get_monotonic_ms();
+
+/**
+ * 计算第 retry 次重试前的等待时间：第一次重试立即进行，之后从 RETRY_BASE_DELAY_MS 开始指数增长，
+ * 不超过 RETRY_MAX_DELAY_MS，并在 [一半, 全部] 之间随机抖动，避免各连接同时重试
+ * @param retry 重试序号（从1开始）
+ * @return 等待毫秒数
+ */
+int retry_backoff_ms(int retry);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "./common.h"
+
+#ifndef WRITER_H
+#define WRITER_H
+
+/**
+ * 创建写入线程及每个连接的环形队列
+ * 网络线程把接收的数据放入各自的队列，写入线程合并连续的块后按偏移写入文件
+ * @param ring_count 环形队列数量（每个下载线程槽位一个）
+ * @param budget 缓冲块占用内存的上限（字节），不足两块时按两块计算
+ * @return 成功返回写入线程，失败返回NULL
+ */
+AsyncWriter* async_writer_create(int ring_count, long long budget);
+
+/**
+ * 写完队列中的所有数据后停止写入线程并释放资源
+ * @param writer 写入线程，NULL时不做任何操作
+ * @param stats 输出停止前的统计，可为NULL
+ */
+void async_writer_destroy(AsyncWriter* writer, WriterStats* stats);
+
+/**
+ * 以 O_DIRECT 打开输出文件，此后偏移和长度按 DIRECT_IO_ALIGN 对齐的块绕过页缓存写入
+ * 必须在放入第一个块之前调用；所有块都必须写入同一个文件
+ * @param writer 写入线程
+ * @param path 输出文件路径
+ * @return 成功返回0，文件系统不支持直接 I/O 时返回-1（继续经页缓存写入）
+ */
+int async_writer_enable_direct_io(AsyncWriter* writer, const char* path);
+
+/**
+ * 获取第 index 个连接的环形队列
+ * @param writer 写入线程
+ * @param index 队列下标
+ * @return 环形队列
+ */
+WriteRing* async_writer_ring(AsyncWriter* writer, int index);
+
+/**
+ * 获取统计信息
+ * @param writer 写入线程
+ * @param stats 输出的统计信息
+ */
+void async_writer_get_stats(AsyncWriter* writer, WriterStats* stats);
+
+/**
+ * 取得一个空闲缓冲块用于接收数据（只能由该队列的生产者线程调用）
+ * 队列已满或内存预算用完时等待写入线程写出数据（背压）
+ * 上次取得的块尚未放入队列时返回同一块
+ * @param ring 环形队列
+ * @param capacity 输出缓冲块大小
+ * @return 缓冲块
+ */
+char* write_ring_reserve(WriteRing* ring, size_t* capacity);
+
+/**
+ * 把 write_ring_reserve 取得的缓冲块放入队列，由写入线程写到 fd 的 offset 处
+ * @param ring 环形队列
+ * @param fd 目标文件描述符（队列排空前不能关闭）
+ * @param offset 写入偏移
+ * @param length 数据长度，0表示归还缓冲块而不写入
+ * @param written 写入成功后更新的进度（如段的 written_bytes），NULL表示不需要
+ * @param written_value 写入成功后 *written 的值
+ */
+void write_ring_commit(WriteRing* ring, int fd, long long offset, size_t length,
+  _Atomic long long* written, long long written_value);
+
+/**
+ * 等待队列中的数据全部写入文件
+ * @param ring 环形队列
+ * @return 成功返回0，有块写入失败返回-1（errno 为失败原因，错误状态随之清除）
+ */
+int write_ring_drain(WriteRing* ring);
+
+#endif
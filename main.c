@@ -33,6 +33,9 @@ int main(int argc, char* argv[]) {
 	const char* RED = "\033[31m";
 	const char* GREEN = "\033[32m";
 
+	// 复用的 keep-alive 连接可能已被服务器关闭，写入时不应触发 SIGPIPE 终止进程
+	signal(SIGPIPE, SIG_IGN);
+
 	if (argc > 1) {
 		return cli_choice(argc, argv);
 	}
@@ -88,6 +91,33 @@ int main(int argc, char* argv[]) {
 				printf("  --download, -d <URL> [输出文件名] [下载目录] [--multithread|-m] [-线程数] 下载文件\n");
 				printf("  --test, -t           运行测试\n");
 				printf("  --multithread, -m    启用多线程下载（与 --download 配合使用）\n");
+				printf("  -m auto              从 %d 个连接开始，按实测吞吐量自动增减连接数（日志写入 <输出文件>.autotune.log）\n", AUTOTUNE_INITIAL_CONNECTIONS);
+				printf("  --epoll              使用 epoll 事件驱动引擎下载分段（最多 %d 个连接）\n", MAX_EVENT_CONNECTIONS);
+				printf("  --event-loops <N>    epoll 引擎的事件循环线程数（默认 1，最多 %d）\n", MAX_EVENT_LOOPS);
+				printf("  --http2              HTTPS 下载通过 ALPN 协商 HTTP/2，所有分段作为一个连接上的并发流（最多 %d 个）\n", MAX_EVENT_CONNECTIONS);
+				printf("  --io-backend <B>     HTTP 响应体的 I/O 方式: stdio（默认）、uring、splice（零拷贝）或 mmap（直接接收到映射的输出文件）\n");
+				printf("  --mmap-window <S>    mmap 后端每个连接同时映射的输出文件大小，限制占用的内存（默认 %dM）\n", MMAP_WINDOW_DEFAULT / (1024 * 1024));
+				printf("  --connect-timeout <S> TCP 连接超时秒数（默认 %d），多个地址时 IPv6/IPv4 交替并发尝试\n", CONNECT_TIMEOUT_DEFAULT);
+				printf("  --low-speed-limit <B> 连接在检测窗口内的平均速度低于该值（字节/秒）时中止并重试（默认 %d，0 关闭）\n", LOW_SPEED_LIMIT_DEFAULT);
+				printf("  --low-speed-time <S> 低速检测的时间窗口秒数，也是分段下载收发无数据的超时（默认 %d）\n", LOW_SPEED_TIME_DEFAULT);
+				printf("  --temp-files         多线程下载时每段写临时文件再合并（默认预分配输出文件直接写入）\n");
+				printf("  --write-buffer <S>   多线程下载由写入线程合并写文件，S 为写入队列的内存上限（可带 K/M/G 后缀，默认 %dM，0 由下载线程直接写）\n", WRITE_BUFFER_DEFAULT / (1024 * 1024));
+				printf("  --write-policy <P>   写入策略: coalesce（默认，攒成大块写入，只在检查点同步）或 strict（每次接收后立即写入文件）\n");
+				printf("  --direct-io          写入线程以 O_DIRECT 写预分配的输出文件，不占用页缓存（文件系统不支持时自动改用页缓存）\n");
+				printf("  --write-chunk <S>    coalesce 策略下不使用写入线程时每次写入的大小（默认 %dM）\n", WRITE_CHUNK_DEFAULT / (1024 * 1024));
+				printf("  --checkpoint-size <S> 新写入的数据达到该大小时 fdatasync 并保存断点状态 <输出文件>.chd-state（默认 %dM，0 不按大小）\n", CHECKPOINT_BYTES_DEFAULT / (1024 * 1024));
+				printf("  --checkpoint-interval <S> 距上次检查点超过该秒数时建立检查点（默认 %d，0 不按时间；两者都为 0 时不保存断点状态）\n", CHECKPOINT_INTERVAL_DEFAULT);
+				printf("  --mirror <URL>       同一文件的镜像地址（可重复，最多 %d 个），按各镜像实测吞吐量分配分段\n", MAX_MIRRORS - 1);
+				printf("  --hedge-ratio <F>    段速度低于其他段中位数的该比例时为剩余部分发出对冲请求（默认关闭，建议 %.2f）\n", HEDGE_SPEED_RATIO_SUGGESTED);
+				printf("  --hedge-stall <MS>   段无进展超过该毫秒数时发出对冲请求（默认关闭，建议 %d；-m auto 时不对冲）\n", HEDGE_STALL_MS_SUGGESTED);
+				printf("  --limit-rate <R>     所有下载共享的总速率上限（字节/秒，可带 K/M/G 后缀，0 不限）\n");
+				printf("  --limit-host <H>=<R> 对某个主机的总速率上限（可重复，最多 %d 个主机）\n", RATE_LIMIT_MAX_HOSTS);
+				printf("  --limit-download <R> 每个下载（所有分段合计）的速率上限\n");
+				printf("  --limit-file <文件>  从文件读取限速设置（每行 global <R>、download <R> 或 host <H> <R>），下载中修改文件即时生效\n");
+				printf("  -d <文件.meta4>      从 Metalink 文件读取下载地址、文件大小和分块哈希，每个分块下载完立即校验\n");
+				printf("  --bench <URL> [N]    用各个 I/O 后端下载同一 URL，比较吞吐量和 CPU 时间\n");
+				printf("  --batch <列表> [目录] 下载列表中的所有 URL（每行一个，可跟文件名），同一主机的文件在一个连接上流水线请求\n");
+				printf("  --pipeline <N>       --batch 时同一连接上未收到响应的请求数上限（默认 %d，最多 %d）\n", PIPELINE_DEFAULT_DEPTH, PIPELINE_MAX_DEPTH);
 				printf("\n示例:\n");
 				printf("  %s -d http://example.com/file.zip\n", argv[0]);
 				printf("  %s -d http://example.com/file.zip myfile.zip\n", argv[0]);
@@ -103,6 +133,7 @@ int main(int argc, char* argv[]) {
 				printf("  %d: 文件写入错误\n", DOWNLOAD_ERROR_FILE_WRITE);
 				printf("  %d: 网络错误\n", DOWNLOAD_ERROR_NETWORK);
 				printf("  %d: 内存分配错误\n", DOWNLOAD_ERROR_MEMORY);
+				printf("  %d: Metalink 校验失败\n", DOWNLOAD_ERROR_VERIFY);
 				break;
 			}
 			default:
@@ -0,0 +1,266 @@
+#include "../include/common.h"
+#include "../include/autotune.h"
+#include "../include/multithread.h"
+#include "../include/utils.h"
+#include <netinet/tcp.h>
+
+#define AUTOTUNE_INTERVAL_MS 1000       // 采样间隔
+#define AUTOTUNE_POLL_MS 100            // 等待采样期间检查线程退出的间隔
+#define AUTOTUNE_MIN_GAIN 0.10          // 新增一个连接至少带来的吞吐增益比例
+#define AUTOTUNE_HOLD_INTERVALS 5       // 撤销连接后保持连接数不变的采样次数
+#define AUTOTUNE_DROP_RATIO 0.70        // 稳定阶段吞吐低于同连接数下最好成绩的比例
+#define AUTOTUNE_DROP_INTERVALS 2       // 连续多少次吞吐下降后撤下一个连接
+#define AUTOTUNE_RTT_INFLATION 2.0      // RTT 超过观测最小值的倍数时认为链路出现排队
+
+typedef enum {
+  AUTOTUNE_WARMUP,    // 连接数刚变化，新连接还在建连/慢启动，本次采样不参与决策
+  AUTOTUNE_PROBING,   // 比较新增连接前后的吞吐量
+  AUTOTUNE_STEADY     // 保持连接数，监测吞吐下降并择机继续探测
+} AutotunePhase;
+
+// 各连接 TCP_INFO 的平均值
+typedef struct {
+  double rtt_ms;              // 平均 RTT（毫秒）
+  double rcv_space_kb;        // 平均接收窗口（KB），近似每个连接的带宽时延积
+  int samples;                // 成功读取的连接数
+} TcpInfoSample;
+
+// 读取各活动连接的 TCP_INFO；下载方向上发送拥塞窗口没有意义，使用接收端的 RTT 和接收窗口
+static void sample_tcp_info(MultiThreadDownloader* downloader, TcpInfoSample* sample) {
+  memset(sample, 0, sizeof(TcpInfoSample));
+
+  // 持有进度锁时 active_sockfd 不会被关闭
+  pthread_mutex_lock(&downloader->progress_mutex);
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    int sockfd = thread->active_sockfd;
+    if (sockfd < 0 || thread->finished) {
+      continue;
+    }
+
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0) {
+      continue;
+    }
+
+    unsigned int rtt_us = info.tcpi_rcv_rtt > 0 ? info.tcpi_rcv_rtt : info.tcpi_rtt;
+    sample->rtt_ms += rtt_us / 1000.0;
+    sample->rcv_space_kb += info.tcpi_rcv_space / 1024.0;
+    sample->samples++;
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+
+  if (sample->samples > 0) {
+    sample->rtt_ms /= sample->samples;
+    sample->rcv_space_kb /= sample->samples;
+  }
+}
+
+// 回收已退出的线程，使槽位可以复用
+static void reap_finished_workers(MultiThreadDownloader* downloader) {
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    if (thread->finished && thread->pthread_id != 0) {
+      pthread_join(thread->pthread_id, NULL);
+      thread->pthread_id = 0;
+    }
+  }
+}
+
+// 正在下载且未被撤下的连接数
+static int count_active_workers(MultiThreadDownloader* downloader) {
+  int active = 0;
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    if (thread->pthread_id != 0 && !thread->finished && !thread->retiring) {
+      active++;
+    }
+  }
+  return active;
+}
+
+// 撤下一个连接：优先撤下最近新增的。线程完成当前段后退出，不再领取新段；
+// 不能直接放弃当前段，其他线程可能已经因为没有可拆分的数据而退出，留下的段会无人接手
+static int retire_worker(MultiThreadDownloader* downloader, int* added, int* added_count) {
+  while (*added_count > 0) {
+    ThreadDownloadParams* thread = &downloader->threads[added[--(*added_count)]];
+    if (thread->pthread_id != 0 && !thread->finished && !thread->retiring) {
+      thread->retiring = 1;
+      return 0;
+    }
+  }
+
+  // 至少保留一个连接
+  if (count_active_workers(downloader) <= 1) {
+    return -1;
+  }
+  for (int i = downloader->thread_count - 1; i >= 0; i--) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    if (thread->pthread_id != 0 && !thread->finished && !thread->retiring) {
+      thread->retiring = 1;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void autotune_run(MultiThreadDownloader* downloader) {
+  char log_path[4096 + 32];
+  build_output_path(downloader, log_path, sizeof(log_path) - 32);
+  strcat(log_path, ".autotune.log");
+
+  FILE* log_file = fopen(log_path, "w");
+  if (log_file) {
+    fprintf(log_file, "# 自动连接数决策日志 (采样间隔 %d ms, 最小增益 %.0f%%)\n",
+      AUTOTUNE_INTERVAL_MS, AUTOTUNE_MIN_GAIN * 100);
+    fprintf(log_file, "# 时间(s)  连接数  吞吐(MB/s)  RTT(ms)  接收窗口(KB)  决策  原因\n");
+  }
+
+  int* added = malloc(sizeof(int) * downloader->thread_capacity * 2);
+  int added_count = 0;
+  AutotunePhase phase = AUTOTUNE_WARMUP;
+  AutotunePhase after_warmup = AUTOTUNE_STEADY;
+  double baseline = 0.0;      // 新增连接前的吞吐量
+  double best = 0.0;          // 当前连接数下的最好吞吐量
+  double min_rtt = 0.0;       // 观测到的最小 RTT
+  int hold = 0;
+  int drop_intervals = 0;
+
+  double start_ms = get_monotonic_ms();
+  double last_ms = start_ms;
+  long long last_bytes = multithread_downloaded_bytes(downloader);
+  downloader->peak_connections = count_active_workers(downloader);
+
+  while (!downloader->should_stop) {
+    // 等待一个采样间隔，期间所有线程退出则提前结束
+    int active = 0;
+    for (int waited = 0; waited < AUTOTUNE_INTERVAL_MS; waited += AUTOTUNE_POLL_MS) {
+      usleep(AUTOTUNE_POLL_MS * 1000);
+      reap_finished_workers(downloader);
+      active = count_active_workers(downloader);
+      if (active == 0 || downloader->should_stop) {
+        break;
+      }
+    }
+    if (active == 0 || downloader->should_stop) {
+      break;
+    }
+
+    double now_ms = get_monotonic_ms();
+    long long bytes = multithread_downloaded_bytes(downloader);
+    double goodput = (bytes - last_bytes) * 1000.0 / (now_ms - last_ms);
+    last_ms = now_ms;
+    last_bytes = bytes;
+
+    TcpInfoSample tcp;
+    sample_tcp_info(downloader, &tcp);
+    if (tcp.samples > 0 && tcp.rtt_ms > 0 && (min_rtt == 0 || tcp.rtt_ms < min_rtt)) {
+      min_rtt = tcp.rtt_ms;
+    }
+    int rtt_inflated = min_rtt > 0 && tcp.rtt_ms > min_rtt * AUTOTUNE_RTT_INFLATION;
+
+    // 剩余数据足够再拆出一段时才值得新增连接
+    long long remaining = downloader->file_size - bytes;
+    int can_grow = active < downloader->thread_capacity &&
+      remaining >= (long long)(active + 1) * 2 * MIN_SEGMENT_SIZE;
+
+    const char* decision = "保持";
+    char reason[128] = "";
+
+    switch (phase) {
+    case AUTOTUNE_WARMUP:
+      snprintf(reason, sizeof(reason), "连接数变化后预热");
+      phase = after_warmup;
+      break;
+
+    case AUTOTUNE_PROBING: {
+      double gain = baseline > 0 ? (goodput - baseline) / baseline : 1.0;
+      if (gain >= AUTOTUNE_MIN_GAIN && !rtt_inflated) {
+        baseline = goodput;
+        best = goodput;
+        if (can_grow) {
+          int index = add_download_worker(downloader);
+          if (index >= 0) {
+            added[added_count++] = index;
+            decision = "增加";
+            snprintf(reason, sizeof(reason), "增益 %.0f%%，继续探测", gain * 100);
+            phase = AUTOTUNE_WARMUP;
+            after_warmup = AUTOTUNE_PROBING;
+            break;
+          }
+        }
+        snprintf(reason, sizeof(reason), "增益 %.0f%%，已无可拆分的数据", gain * 100);
+        phase = AUTOTUNE_STEADY;
+      }
+      else {
+        if (retire_worker(downloader, added, &added_count) == 0) {
+          decision = "撤销";
+        }
+        if (rtt_inflated) {
+          snprintf(reason, sizeof(reason), "RTT %.1f ms 超过最小值 %.1f ms 的 %.0f 倍",
+            tcp.rtt_ms, min_rtt, AUTOTUNE_RTT_INFLATION);
+        }
+        else {
+          snprintf(reason, sizeof(reason), "增益 %.0f%% 低于 %.0f%%", gain * 100, AUTOTUNE_MIN_GAIN * 100);
+        }
+        best = 0.0;
+        hold = AUTOTUNE_HOLD_INTERVALS;
+        phase = AUTOTUNE_WARMUP;
+        after_warmup = AUTOTUNE_STEADY;
+      }
+      break;
+    }
+
+    case AUTOTUNE_STEADY:
+      if (goodput > best) {
+        best = goodput;
+      }
+      drop_intervals = active > 1 && goodput < best * AUTOTUNE_DROP_RATIO ? drop_intervals + 1 : 0;
+
+      if (drop_intervals >= AUTOTUNE_DROP_INTERVALS) {
+        if (retire_worker(downloader, added, &added_count) == 0) {
+          decision = "减少";
+        }
+        snprintf(reason, sizeof(reason), "吞吐降至最好成绩的 %.0f%%（可能被限速）", goodput * 100 / best);
+        best = 0.0;
+        drop_intervals = 0;
+        hold = AUTOTUNE_HOLD_INTERVALS;
+        phase = AUTOTUNE_WARMUP;
+        after_warmup = AUTOTUNE_STEADY;
+      }
+      else if (hold > 0) {
+        hold--;
+      }
+      else if (can_grow && !rtt_inflated) {
+        int index = add_download_worker(downloader);
+        if (index >= 0) {
+          added[added_count++] = index;
+          baseline = goodput;
+          decision = "增加";
+          snprintf(reason, sizeof(reason), "探测更多连接的收益");
+          phase = AUTOTUNE_WARMUP;
+          after_warmup = AUTOTUNE_PROBING;
+        }
+      }
+      break;
+    }
+
+    int connections = count_active_workers(downloader);
+    if (connections > downloader->peak_connections) {
+      downloader->peak_connections = connections;
+    }
+
+    if (log_file) {
+      fprintf(log_file, "%9.1f  %6d  %10.2f  %7.1f  %12.0f  %s  %s\n",
+        (now_ms - start_ms) / 1000.0, active, goodput / (1024 * 1024),
+        tcp.rtt_ms, tcp.rcv_space_kb, decision, reason);
+      fflush(log_file);
+    }
+  }
+
+  free(added);
+  if (log_file) {
+    fclose(log_file);
+  }
+}
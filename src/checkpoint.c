@@ -0,0 +1,290 @@
+#include "../include/common.h"
+#include "../include/checkpoint.h"
+#include "../include/config.h"
+#include "../include/utils.h"
+
+// CLI颜色定义
+static const char* YELLOW = "\033[33m";
+static const char* RESET = "\033[0m";
+
+#define STATE_FILE_MAGIC "CHD-STATE 1"
+
+int checkpoint_enabled() {
+  const DownloadOptions* options = get_download_options();
+  return options->engine == DOWNLOAD_ENGINE_THREADS && options->output_mode == OUTPUT_MODE_DIRECT &&
+    (options->checkpoint_bytes > 0 || options->checkpoint_interval > 0) && !options->metalink;
+}
+
+static int compare_ranges(const void* a, const void* b) {
+  long long start_a = ((const long long*)a)[0];
+  long long start_b = ((const long long*)b)[0];
+  return start_a < start_b ? -1 : (start_a > start_b ? 1 : 0);
+}
+
+// 按起点排序并合并重叠或相邻的区间，返回合并后的区间数
+static int merge_ranges(long long (*ranges)[2], int count) {
+  if (count == 0) {
+    return 0;
+  }
+  qsort(ranges, count, sizeof(ranges[0]), compare_ranges);
+
+  int merged = 0;
+  for (int i = 1; i < count; i++) {
+    if (ranges[i][0] <= ranges[merged][1]) {
+      if (ranges[i][1] > ranges[merged][1]) {
+        ranges[merged][1] = ranges[i][1];
+      }
+    }
+    else {
+      merged++;
+      ranges[merged][0] = ranges[i][0];
+      ranges[merged][1] = ranges[i][1];
+    }
+  }
+  return merged + 1;
+}
+
+// 去掉行尾的换行符
+static void trim_line(char* line) {
+  size_t length = strlen(line);
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+    line[--length] = '\0';
+  }
+}
+
+// 复制字段值，超过目标缓冲区时返回-1（截断的 ETag 无法和探测结果比对）
+static int copy_field(char* destination, size_t size, const char* value) {
+  size_t length = strlen(value);
+  if (length >= size) {
+    return -1;
+  }
+  memcpy(destination, value, length + 1);
+  return 0;
+}
+
+int checkpoint_load(MultiThreadDownloader* downloader, const char* state_path) {
+  FILE* file = fopen(state_path, "r");
+  if (!file) {
+    return 0;
+  }
+
+  long long (*ranges)[2] = malloc(sizeof(ranges[0]) * RESUME_MAX_RANGES);
+  if (!ranges) {
+    fclose(file);
+    return 0;
+  }
+
+  // 状态文件逐行记录: 文件大小、ETag、Last-Modified 和已落盘的区间 [起点, 终点)
+  char line[512];
+  long long file_size = -1;
+  char etag[sizeof(downloader->probe_response.etag)] = "";
+  char last_modified[sizeof(downloader->probe_response.last_modified)] = "";
+  int count = 0;
+  int valid = fgets(line, sizeof(line), file) && strncmp(line, STATE_FILE_MAGIC, strlen(STATE_FILE_MAGIC)) == 0;
+  while (valid && fgets(line, sizeof(line), file)) {
+    // 行超过缓冲区时状态文件不是本程序写的或已损坏
+    if (!strchr(line, '\n') && !feof(file)) {
+      valid = 0;
+      break;
+    }
+    trim_line(line);
+    long long start, end;
+    if (strncmp(line, "size ", 5) == 0) {
+      file_size = atoll(line + 5);
+    }
+    else if (strncmp(line, "etag ", 5) == 0) {
+      if (copy_field(etag, sizeof(etag), line + 5) != 0) {
+        valid = 0;
+        break;
+      }
+    }
+    else if (strncmp(line, "modified ", 9) == 0) {
+      if (copy_field(last_modified, sizeof(last_modified), line + 9) != 0) {
+        valid = 0;
+        break;
+      }
+    }
+    else if (sscanf(line, "done %lld %lld", &start, &end) == 2) {
+      if (start < 0 || end <= start || count >= RESUME_MAX_RANGES) {
+        valid = 0;
+        break;
+      }
+      ranges[count][0] = start;
+      ranges[count][1] = end;
+      count++;
+    }
+  }
+  fclose(file);
+
+  // 服务器上的文件已经变化（大小或校验标识不同）时不能接着下载
+  const HttpResponseInfo* probe = &downloader->probe_response;
+  if (!valid || file_size != downloader->file_size || strcmp(etag, probe->etag) != 0 ||
+    strcmp(last_modified, probe->last_modified) != 0) {
+    if (valid) {
+      printf("%s警告: 服务器上的文件已变化，忽略断点状态 %s%s\n", YELLOW, state_path, RESET);
+    }
+    free(ranges);
+    return 0;
+  }
+
+  // 没有任何校验标识时只凭大小无法确认文件未被替换，从头下载
+  if (etag[0] == '\0' && last_modified[0] == '\0') {
+    printf("%s警告: 服务器没有提供 ETag 或 Last-Modified，无法确认文件未变化，忽略断点状态 %s%s\n",
+      YELLOW, state_path, RESET);
+    free(ranges);
+    return 0;
+  }
+
+  count = merge_ranges(ranges, count);
+  long long resumed = 0;
+  for (int i = 0; i < count; i++) {
+    if (ranges[i][1] > file_size) {
+      ranges[i][1] = file_size;
+    }
+    resumed += ranges[i][1] - ranges[i][0];
+  }
+  if (count == 0) {
+    free(ranges);
+    return 0;
+  }
+
+  downloader->resume_ranges = ranges;
+  downloader->resume_range_count = count;
+  downloader->resumed_bytes = resumed;
+  return count;
+}
+
+// 收集已交给内核的区间：恢复时载入的区间加上各段从起点开始已写入的部分（调用者需持有进度锁）
+static int collect_written_ranges_locked(MultiThreadDownloader* downloader, long long (*ranges)[2], int capacity) {
+  int count = 0;
+  for (int i = 0; i < downloader->resume_range_count && count < capacity; i++) {
+    ranges[count][0] = downloader->resume_ranges[i][0];
+    ranges[count][1] = downloader->resume_ranges[i][1];
+    count++;
+  }
+
+  for (int i = 0; i < downloader->segment_count && count < capacity; i++) {
+    FileSegment* segment = &downloader->segments[i];
+    long long size = segment->end_byte - segment->start_byte + 1;
+    long long written = atomic_load(&segment->written_bytes);
+    if (written > size) {
+      written = size;
+    }
+    if (written > 0) {
+      ranges[count][0] = segment->start_byte;
+      ranges[count][1] = segment->start_byte + written;
+      count++;
+    }
+  }
+  return count;
+}
+
+// 已交给内核的字节数（重复下载的部分会重复计算，只用于判断是否需要建立检查点）
+static long long written_bytes_estimate(MultiThreadDownloader* downloader) {
+  long long total = downloader->resumed_bytes;
+  pthread_mutex_lock(&downloader->progress_mutex);
+  for (int i = 0; i < downloader->segment_count; i++) {
+    total += atomic_load(&downloader->segments[i].written_bytes);
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return total;
+}
+
+int checkpoint_save(MultiThreadDownloader* downloader, int fd) {
+  if (!downloader->state_path) {
+    return -1;
+  }
+
+  int capacity = downloader->resume_range_count + downloader->segment_capacity;
+  long long (*ranges)[2] = malloc(sizeof(ranges[0]) * capacity);
+  if (!ranges) {
+    return -1;
+  }
+
+  // 先记下位置再同步：记录的数据在 fdatasync 之前已经交给内核，同步后一定落盘
+  pthread_mutex_lock(&downloader->progress_mutex);
+  int count = collect_written_ranges_locked(downloader, ranges, capacity);
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  count = merge_ranges(ranges, count);
+  if (count > RESUME_MAX_RANGES) {
+    count = RESUME_MAX_RANGES; // 少记录的区间下次重新下载
+  }
+
+  double sync_start_ms = get_monotonic_ms();
+  if (fdatasync(fd) != 0) {
+    fprintf(stderr, "%s警告: 同步输出文件失败: %s%s\n", YELLOW, strerror(errno), RESET);
+    free(ranges);
+    return -1;
+  }
+  double sync_ms = get_monotonic_ms() - sync_start_ms;
+
+  // 写入临时文件后重命名，中途崩溃时旧的状态文件仍然完整
+  char temp_path[PATH_MAX + 8];
+  snprintf(temp_path, sizeof(temp_path), "%s.tmp", downloader->state_path);
+  FILE* file = fopen(temp_path, "w");
+  if (!file) {
+    fprintf(stderr, "%s警告: 无法写入断点状态 %s: %s%s\n", YELLOW, temp_path, strerror(errno), RESET);
+    free(ranges);
+    return -1;
+  }
+
+  fprintf(file, "%s\n", STATE_FILE_MAGIC);
+  fprintf(file, "size %lld\n", downloader->file_size);
+  fprintf(file, "etag %s\n", downloader->probe_response.etag);
+  fprintf(file, "modified %s\n", downloader->probe_response.last_modified);
+  for (int i = 0; i < count; i++) {
+    fprintf(file, "done %lld %lld\n", ranges[i][0], ranges[i][1]);
+  }
+  free(ranges);
+
+  int failed = fflush(file) != 0 || fdatasync(fileno(file)) != 0;
+  if (fclose(file) != 0 || failed || rename(temp_path, downloader->state_path) != 0) {
+    fprintf(stderr, "%s警告: 无法写入断点状态 %s: %s%s\n", YELLOW, downloader->state_path, strerror(errno), RESET);
+    unlink(temp_path);
+    return -1;
+  }
+
+  downloader->checkpoint_count++;
+  downloader->checkpoint_sync_ms += sync_ms;
+  return 0;
+}
+
+void* checkpoint_worker(void* arg) {
+  MultiThreadDownloader* downloader = (MultiThreadDownloader*)arg;
+  const DownloadOptions* options = get_download_options();
+
+  int fd = open(downloader->partial_path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "%s警告: 无法打开 %s，不建立检查点: %s%s\n", YELLOW, downloader->partial_path, strerror(errno), RESET);
+    pthread_exit(NULL);
+  }
+
+  long long checkpoint_bytes = written_bytes_estimate(downloader);
+  long long flushed_bytes = checkpoint_bytes;
+  double checkpoint_ms = get_monotonic_ms();
+
+  while (!downloader->should_stop) {
+    usleep(CHECKPOINT_POLL_MS * 1000);
+    long long written = written_bytes_estimate(downloader);
+    if (written != flushed_bytes) {
+      // 新数据先在后台开始回写，检查点的 fdatasync 只需等待剩余的部分
+      sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+      flushed_bytes = written;
+    }
+    if (written == checkpoint_bytes) {
+      continue;
+    }
+
+    double now_ms = get_monotonic_ms();
+    if ((options->checkpoint_bytes > 0 && written - checkpoint_bytes >= options->checkpoint_bytes) ||
+      (options->checkpoint_interval > 0 && now_ms - checkpoint_ms >= options->checkpoint_interval * 1000.0)) {
+      if (checkpoint_save(downloader, fd) == 0) {
+        checkpoint_bytes = written;
+        checkpoint_ms = now_ms;
+      }
+    }
+  }
+
+  close(fd);
+  pthread_exit(NULL);
+}
@@ -1,6 +1,36 @@
 #include "../include/config.h"
 #include "../include/common.h"
 
+static DownloadOptions download_options = {
+  .engine = DOWNLOAD_ENGINE_THREADS,
+  .event_loops = 1,
+  .io_backend = IO_BACKEND_STDIO,
+  .output_mode = OUTPUT_MODE_DIRECT,
+  .connect_timeout = CONNECT_TIMEOUT_DEFAULT,
+  .low_speed_limit = LOW_SPEED_LIMIT_DEFAULT,
+  .low_speed_time = LOW_SPEED_TIME_DEFAULT,
+  .hedge_speed_ratio = 0,
+  .hedge_stall_ms = 0,
+  .write_buffer = WRITE_BUFFER_DEFAULT,
+  .write_policy = WRITE_POLICY_COALESCE,
+  .write_chunk = WRITE_CHUNK_DEFAULT,
+  .checkpoint_bytes = CHECKPOINT_BYTES_DEFAULT,
+  .checkpoint_interval = CHECKPOINT_INTERVAL_DEFAULT,
+  .mmap_window = MMAP_WINDOW_DEFAULT,
+};
+
+DownloadOptions* get_download_options() {
+  return &download_options;
+}
+
+int get_io_idle_timeout_ms() {
+  // 低速检测开启时，窗口内没有收到任何数据就已经低于阈值，不必再等固定的超时
+  if (download_options.low_speed_limit > 0) {
+    return download_options.low_speed_time * 1000;
+  }
+  return SOCKET_IO_TIMEOUT * 1000;
+}
+
 int set_config(Config* config) {
   // CLI颜色定义
   const char* BLUE = "\033[34m";
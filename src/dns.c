@@ -0,0 +1,351 @@
+#include "../include/common.h"
+#include "../include/dns.h"
+#include "../include/utils.h"
+
+// DNS 缓存（进程内共享，条目在进程生命周期内保留）
+static DnsCacheEntry* dns_cache = NULL;
+static DnsCacheStats dns_stats = { 0 };
+static pthread_mutex_t dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_cond = PTHREAD_COND_INITIALIZER;
+
+// 查找缓存条目（调用者持有锁）
+static DnsCacheEntry* find_entry_locked(const char* hostname) {
+  for (DnsCacheEntry* entry = dns_cache; entry; entry = entry->next) {
+    if (strcasecmp(entry->host, hostname) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// 比较两个地址的 IP 部分（忽略端口）
+static int same_address(const struct sockaddr_storage* a, const struct sockaddr_storage* b) {
+  if (a->ss_family != b->ss_family) {
+    return 0;
+  }
+  if (a->ss_family == AF_INET) {
+    return ((const struct sockaddr_in*)a)->sin_addr.s_addr == ((const struct sockaddr_in*)b)->sin_addr.s_addr;
+  }
+  if (a->ss_family == AF_INET6) {
+    return memcmp(&((const struct sockaddr_in6*)a)->sin6_addr, &((const struct sockaddr_in6*)b)->sin6_addr,
+      sizeof(struct in6_addr)) == 0;
+  }
+  return 0;
+}
+
+// 查找地址在条目中的位置（调用者持有锁），找不到返回-1
+static int find_address_locked(const DnsCacheEntry* entry, const struct sockaddr* address) {
+  for (int i = 0; i < entry->addresses.count; i++) {
+    if (same_address(&entry->addresses.addresses[i], (const struct sockaddr_storage*)address)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// 按各地址实测吞吐量做平滑加权轮询，选出下一个连接使用的地址（调用者持有锁）
+// 尚未测量的地址使用已测地址的平均吞吐量作为权重，保证每个地址都会被尝试
+static int pick_address_locked(DnsCacheEntry* entry) {
+  int count = entry->addresses.count;
+  double now_ms = get_monotonic_ms();
+  double measured_rate = 0.0;
+  int measured = 0;
+  int eligible = 0;
+
+  for (int i = 0; i < count; i++) {
+    DnsAddressStats* stats = &entry->address_stats[i];
+    if (stats->rate > 0) {
+      measured_rate += stats->rate;
+      measured++;
+    }
+    if (stats->demoted_until_ms <= now_ms) {
+      eligible++;
+    }
+  }
+  double default_weight = measured > 0 ? measured_rate / measured : 1.0;
+
+  int best = -1;
+  double total_weight = 0.0;
+  for (int i = 0; i < count; i++) {
+    DnsAddressStats* stats = &entry->address_stats[i];
+    // 所有地址都被降级时忽略降级，仍然轮流尝试
+    if (eligible > 0 && stats->demoted_until_ms > now_ms) {
+      continue;
+    }
+
+    double weight = stats->rate > 0 ? stats->rate : default_weight;
+    stats->current_weight += weight;
+    total_weight += weight;
+    if (best < 0 || stats->current_weight > entry->address_stats[best].current_weight) {
+      best = i;
+    }
+  }
+
+  if (best >= 0) {
+    entry->address_stats[best].current_weight -= total_weight;
+  }
+  return best;
+}
+
+// 把选中的地址移到列表最前面
+static void move_address_first(DnsAddressList* addresses, int index) {
+  addresses->preferred = index >= 0;
+  if (index <= 0) {
+    return;
+  }
+
+  struct sockaddr_storage address = addresses->addresses[index];
+  socklen_t length = addresses->lengths[index];
+  memmove(&addresses->addresses[1], &addresses->addresses[0], sizeof(struct sockaddr_storage) * index);
+  memmove(&addresses->lengths[1], &addresses->lengths[0], sizeof(socklen_t) * index);
+  addresses->addresses[0] = address;
+  addresses->lengths[0] = length;
+}
+
+// 降级地址：一段时间内不为新连接选择（调用者持有锁）
+static void demote_address_locked(DnsAddressStats* stats) {
+  stats->demoted_until_ms = get_monotonic_ms() + STRIPE_DEMOTE_TIME * 1000.0;
+}
+
+// 查找条目，不存在或已过期时标记为正在解析（调用者持有锁）
+// 返回1表示调用者需要调用 resolve_entry 完成解析，0表示命中缓存或已有线程在解析，-1表示内存不足
+static int claim_entry_locked(const char* hostname, DnsCacheEntry** result) {
+  DnsCacheEntry* entry = find_entry_locked(hostname);
+  if (!entry) {
+    entry = calloc(1, sizeof(DnsCacheEntry));
+    if (!entry) {
+      return -1;
+    }
+    snprintf(entry->host, sizeof(entry->host), "%s", hostname);
+    entry->next = dns_cache;
+    dns_cache = entry;
+  }
+  *result = entry;
+
+  if (entry->pending || entry->expires_ms > get_monotonic_ms()) {
+    dns_stats.hits++;
+    return 0;
+  }
+
+  entry->pending = 1;
+  dns_stats.misses++;
+  return 1;
+}
+
+// 调用 getaddrinfo 并填充条目，完成后唤醒等待的线程（调用时不持有锁）
+static void resolve_entry(DnsCacheEntry* entry) {
+  struct addrinfo hints, * result = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;      // 保留 IPv4 和 IPv6 地址
+  hints.ai_socktype = SOCK_STREAM;  // TCP
+
+  double start_ms = get_monotonic_ms();
+  int status = getaddrinfo(entry->host, NULL, &hints, &result);
+  double elapsed_ms = get_monotonic_ms() - start_ms;
+
+  DnsAddressList addresses;
+  memset(&addresses, 0, sizeof(addresses));
+  if (status == 0) {
+    for (struct addrinfo* info = result; info && addresses.count < DNS_MAX_ADDRESSES; info = info->ai_next) {
+      if (info->ai_addrlen > sizeof(struct sockaddr_storage)) {
+        continue;
+      }
+      memcpy(&addresses.addresses[addresses.count], info->ai_addr, info->ai_addrlen);
+      addresses.lengths[addresses.count] = info->ai_addrlen;
+      addresses.count++;
+    }
+    freeaddrinfo(result);
+    if (addresses.count == 0) {
+      status = EAI_NONAME;
+    }
+  }
+
+  // 重新解析后保留仍然存在的地址的统计
+  DnsAddressStats address_stats[DNS_MAX_ADDRESSES];
+  memset(address_stats, 0, sizeof(address_stats));
+
+  pthread_mutex_lock(&dns_mutex);
+  for (int i = 0; i < addresses.count; i++) {
+    int previous = find_address_locked(entry, (const struct sockaddr*)&addresses.addresses[i]);
+    if (previous >= 0) {
+      address_stats[i] = entry->address_stats[previous];
+    }
+    else {
+      address_stats[i].address = addresses.addresses[i];
+    }
+  }
+  entry->addresses = addresses;
+  memcpy(entry->address_stats, address_stats, sizeof(address_stats));
+  entry->status = status;
+  // 解析失败不缓存，下次查找时重新解析
+  entry->expires_ms = status == 0 ? get_monotonic_ms() + DNS_CACHE_TTL * 1000.0 : 0;
+  entry->pending = 0;
+  dns_stats.resolutions++;
+  dns_stats.resolve_ms += elapsed_ms;
+  pthread_cond_broadcast(&dns_cond);
+  pthread_mutex_unlock(&dns_mutex);
+}
+
+int dns_resolve(const char* hostname, DnsAddressList* addresses) {
+  if (!hostname || !addresses) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = NULL;
+  int claimed = claim_entry_locked(hostname, &entry);
+  if (claimed < 0) {
+    pthread_mutex_unlock(&dns_mutex);
+    fprintf(stderr, "错误: DNS 缓存内存分配失败\n");
+    return -1;
+  }
+  if (claimed == 1) {
+    pthread_mutex_unlock(&dns_mutex);
+    resolve_entry(entry);
+    pthread_mutex_lock(&dns_mutex);
+  }
+
+  // 等待其他线程（或预解析线程）正在进行的解析
+  while (entry->pending) {
+    pthread_cond_wait(&dns_cond, &dns_mutex);
+  }
+
+  int status = entry->status;
+  if (status == 0) {
+    *addresses = entry->addresses;
+    move_address_first(addresses, pick_address_locked(entry));
+  }
+  pthread_mutex_unlock(&dns_mutex);
+
+  if (status != 0) {
+    fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+    return -1;
+  }
+  return 0;
+}
+
+static void* dns_prefetch_worker(void* arg) {
+  resolve_entry((DnsCacheEntry*)arg);
+  return NULL;
+}
+
+void dns_prefetch(const char* hostname) {
+  if (!hostname || hostname[0] == '\0') {
+    return;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = NULL;
+  int claimed = claim_entry_locked(hostname, &entry);
+  pthread_mutex_unlock(&dns_mutex);
+  if (claimed != 1) {
+    return;
+  }
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, dns_prefetch_worker, entry) != 0) {
+    resolve_entry(entry); // 无法创建线程时同步解析
+    return;
+  }
+  pthread_detach(thread);
+}
+
+void dns_report_connect(const char* hostname, const struct sockaddr* address, int success) {
+  if (!hostname || !address) {
+    return;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = find_entry_locked(hostname);
+  int index = entry && !entry->pending ? find_address_locked(entry, address) : -1;
+  if (index >= 0) {
+    DnsAddressStats* stats = &entry->address_stats[index];
+    if (success) {
+      stats->connections++;
+    }
+    else {
+      stats->failures++;
+      demote_address_locked(stats);
+    }
+  }
+  pthread_mutex_unlock(&dns_mutex);
+}
+
+void dns_report_transfer(const char* hostname, const struct sockaddr* address, long long bytes, double elapsed_ms, int failed) {
+  if (!hostname || !address) {
+    return;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = find_entry_locked(hostname);
+  int index = entry && !entry->pending ? find_address_locked(entry, address) : -1;
+  if (index < 0) {
+    pthread_mutex_unlock(&dns_mutex);
+    return;
+  }
+
+  DnsAddressStats* stats = &entry->address_stats[index];
+  if (bytes > 0) {
+    stats->bytes += bytes;
+  }
+  if (failed) {
+    stats->failures++;
+    demote_address_locked(stats);
+  }
+
+  // 传输量足够时更新吞吐量，并与最快的地址比较
+  if (bytes >= STRIPE_MIN_SAMPLE_BYTES && elapsed_ms > 0) {
+    double rate = bytes / elapsed_ms;
+    stats->rate = stats->rate > 0 ? stats->rate * 0.7 + rate * 0.3 : rate;
+
+    double fastest = 0.0;
+    for (int i = 0; i < entry->addresses.count; i++) {
+      if (i != index && entry->address_stats[i].rate > fastest) {
+        fastest = entry->address_stats[i].rate;
+      }
+    }
+    if (fastest > 0 && stats->rate < fastest * STRIPE_SLOW_RATIO) {
+      demote_address_locked(stats);
+    }
+  }
+  pthread_mutex_unlock(&dns_mutex);
+}
+
+int dns_address_demoted(const char* hostname, const struct sockaddr* address) {
+  if (!hostname || !address) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = find_entry_locked(hostname);
+  int index = entry && !entry->pending ? find_address_locked(entry, address) : -1;
+  int demoted = index >= 0 && entry->address_stats[index].demoted_until_ms > get_monotonic_ms();
+  pthread_mutex_unlock(&dns_mutex);
+  return demoted;
+}
+
+int dns_get_address_stats(const char* hostname, DnsAddressStats* stats, int max_count) {
+  if (!hostname || !stats) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  DnsCacheEntry* entry = find_entry_locked(hostname);
+  int count = 0;
+  if (entry && !entry->pending) {
+    count = entry->addresses.count < max_count ? entry->addresses.count : max_count;
+    memcpy(stats, entry->address_stats, sizeof(DnsAddressStats) * count);
+  }
+  pthread_mutex_unlock(&dns_mutex);
+  return count;
+}
+
+void dns_get_stats(DnsCacheStats* stats) {
+  if (!stats) {
+    return;
+  }
+
+  pthread_mutex_lock(&dns_mutex);
+  *stats = dns_stats;
+  pthread_mutex_unlock(&dns_mutex);
+}
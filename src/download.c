@@ -5,6 +5,8 @@
 #include "../include/http.h"
 #include "../include/progress.h"
 #include "../include/utils.h"
+#include "../include/config.h"
+#include "../include/ratelimit.h"
 ssize_t recv_data_with_timeout(int sockfd, void* buffer, size_t length, int timeout_ms) {
   struct timeval timeout;
   timeout.tv_sec = timeout_ms / 1000;
@@ -39,6 +41,70 @@ int recv_full_data(int sockfd, void* buffer, size_t total_length, int timeout_ms
   return 0;
 }
 
+// 通过 splice 把响应体从 socket 经管道直接写入输出文件，数据不复制到用户态。
+// 文件系统或 socket 不支持 splice 时返回1，由调用者使用普通收发
+static int receive_content_splice(int sockfd, FILE* output_file, long long content_length, DownloadProgress* progress) {
+  int pipe_fds[2];
+  if (create_splice_pipe(pipe_fds) != 0) {
+    return 1;
+  }
+
+  // 已缓冲的数据先落盘，splice 从当前文件末尾按偏移继续写入
+  if (fflush(output_file) != 0) {
+    close_splice_pipe(pipe_fds);
+    return 1;
+  }
+  int file_fd = fileno(output_file);
+  long long file_offset = ftello(output_file);
+  if (file_offset < 0) {
+    close_splice_pipe(pipe_fds);
+    return 1;
+  }
+
+  int result = 0;
+  int first_chunk = 1;
+  while (progress->downloaded_size < content_length) {
+    long long remaining = content_length - progress->downloaded_size;
+    size_t length = remaining < SPLICE_PIPE_SIZE ? (size_t)remaining : SPLICE_PIPE_SIZE;
+
+    ssize_t moved = splice_socket_to_file(sockfd, pipe_fds, file_fd, file_offset, length);
+    // 只有第一次从 socket 搬运就失败（没有数据离开 socket）时才能改用 recv + fwrite
+    if (moved < 0 && first_chunk && errno == EINVAL) {
+      result = 1; // 不支持 splice，改用 recv + fwrite
+      break;
+    }
+    if (moved <= 0) {
+      clear_progress_line();
+      if (moved == 0) {
+        fprintf(stderr, "连接意外关闭，已下载 %lld/%lld 字节\n",
+          progress->downloaded_size, content_length);
+      }
+      else {
+        perror("splice 接收数据失败");
+      }
+      result = -1;
+      break;
+    }
+    first_chunk = 0;
+
+    file_offset += moved;
+    progress->downloaded_size += moved;
+
+    // 每块数据较大，按秒刷新进度即可
+    time_t current_time = time(NULL);
+    if (current_time > progress->last_update_time) {
+      update_download_progress(progress);
+      progress->last_update_time = current_time;
+    }
+  }
+
+  close_splice_pipe(pipe_fds);
+
+  // 文件位置与 splice 写入保持一致
+  fseeko(output_file, 0, SEEK_END);
+  return result;
+}
+
 int download_content_with_length(int sockfd, FILE* output_file, long long content_length, DownloadProgress* progress, HttpReadBuffer* remaining_buffer) {
   const size_t BUFFER_SIZE = 8192;
   char buffer[BUFFER_SIZE];
@@ -75,6 +141,14 @@ int download_content_with_length(int sockfd, FILE* output_file, long long conten
     update_download_progress(progress);
   }
 
+  // splice 零拷贝后端，不支持时继续使用下面的 recv + fwrite；限速时需要逐次取令牌，只用 recv
+  if (get_download_options()->io_backend == IO_BACKEND_SPLICE && !ratelimit_enabled() &&
+    progress->downloaded_size < content_length) {
+    if (receive_content_splice(sockfd, output_file, content_length, progress) < 0) {
+      return -1;
+    }
+  }
+
   while (progress->downloaded_size < content_length) {
     // 计算本次接收的数据量
     size_t bytes_to_receive = BUFFER_SIZE;
@@ -84,7 +158,9 @@ int download_content_with_length(int sockfd, FILE* output_file, long long conten
     }
 
     // 接收数据
+    bytes_to_receive = ratelimit_acquire(progress->rate_limiter, bytes_to_receive);
     ssize_t bytes_received = recv(sockfd, buffer, bytes_to_receive, 0);
+    ratelimit_refund(progress->rate_limiter, bytes_to_receive, bytes_received);
 
     if (bytes_received <= 0) {
       clear_progress_line();
@@ -187,7 +263,9 @@ int download_content_until_close(int sockfd, FILE* output_file, DownloadProgress
       return -1;
     }
 
-    ssize_t bytes_received = recv(sockfd, buffer, BUFFER_SIZE, 0);
+    size_t bytes_to_receive = ratelimit_acquire(progress->rate_limiter, BUFFER_SIZE);
+    ssize_t bytes_received = recv(sockfd, buffer, bytes_to_receive, 0);
+    ratelimit_refund(progress->rate_limiter, bytes_to_receive, bytes_received);
 
     if (bytes_received == 0) {
       // 连接正常关闭
@@ -286,6 +364,10 @@ int download_file_http(const char* url, const char* output_filename, const char*
 
   printf("%s下载文件将保存到: %s%s%s%s\n", BOLD, RESET, BLUE, full_output_path, RESET);
 
+  // 本次下载的限速令牌桶，重定向后继续使用
+  RateBucket rate_bucket = { 0 };
+  RateLimiter rate_limiter;
+
   for (int redirect_iter = 0; redirect_iter <= MAX_REDIRECTS; redirect_iter++) {
     // 变量初始化
     URLInfo url_info = { 0 };
@@ -307,9 +389,11 @@ int download_file_http(const char* url, const char* output_filename, const char*
       fprintf(stderr, "%s错误: 无法解析URL%s\n", RED, RESET);
       return DOWNLOAD_ERROR_URL_PARSE;
     }
+    ratelimit_init(&rate_limiter, url_info.host, &rate_bucket);
+    progress.rate_limiter = &rate_limiter;
     printf("%sHost: %s%s%s%s, %sPort: %s%s%d%s, %sPath: %s%s%s%s\n", BOLD, RESET, BLUE, url_info.host, RESET, BOLD, RESET, BLUE, url_info.port, RESET, BOLD, RESET, BLUE, url_info.path, RESET);
 
-    char ip_str[INET_ADDRSTRLEN];
+    char ip_str[INET6_ADDRSTRLEN];
 
     // 域名解析
     if (url_info.host_type == UNALLOWED) {
@@ -332,7 +416,7 @@ int download_file_http(const char* url, const char* output_filename, const char*
 
     // 建立TCP连接
     // printf("正在连接服务器...\n");
-    sockfd = create_tcp_connection(ip_str, url_info.port);
+    sockfd = connect_to_host(url_info.host, url_info.port);
     if (sockfd < 0) {
       fprintf(stderr, "%s错误: 无法连接到服务器%s\n", RED, RESET);
       return DOWNLOAD_ERROR_CONNECTION;
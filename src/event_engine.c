@@ -0,0 +1,839 @@
+#include "../include/common.h"
+#include "../include/event_engine.h"
+#include "../include/multithread.h"
+#include "../include/http.h"
+#include "../include/https.h"
+#include "../include/parser.h"
+#include "../include/net.h"
+#include "../include/pool.h"
+#include "../include/config.h"
+#include "../include/utils.h"
+#include "../include/ratelimit.h"
+#include <sys/epoll.h>
+
+#define EVENT_RECV_BUFFER_SIZE 65536      // 每个事件循环的接收缓冲区大小
+#define EVENT_MAX_READS_PER_WAKEUP 8      // 单个连接每次唤醒最多读取次数，避免饿死其他连接
+#define EVENT_MAX_EVENTS 64               // 单次 epoll_wait 返回的最大事件数
+#define EVENT_SWEEP_INTERVAL_MS 100       // 启动/重试/超时检查间隔
+
+#define EVENT_IO_AGAIN -2                 // 非阻塞读写需要等待
+#define EVENT_RATE_WAIT -3                // 限速令牌不足，暂停读取
+
+// 段连接状态机
+typedef enum {
+  EVENT_SEGMENT_START,        // 等待发起连接
+  EVENT_SEGMENT_CONNECTING,   // TCP 连接中
+  EVENT_SEGMENT_HANDSHAKE,    // TLS 握手中
+  EVENT_SEGMENT_SENDING,      // 发送 Range 请求
+  EVENT_SEGMENT_HEADERS,      // 接收响应头
+  EVENT_SEGMENT_BODY,         // 接收响应体
+  EVENT_SEGMENT_RETRY_WAIT,   // 等待重试
+  EVENT_SEGMENT_DONE,         // 已完成
+  EVENT_SEGMENT_FAILED        // 已失败
+} EventSegmentState;
+
+// 单个段的非阻塞下载上下文
+typedef struct {
+  ThreadDownloadParams* thread;       // 段对应的线程参数（复用线程模式的数据结构）
+  EventSegmentState state;            // 状态机状态
+  int sockfd;                         // 当前连接的 socket
+  HttpsConnection* https_connection;  // 握手中的 HTTPS 连接
+  PooledConnection* connection;       // 可收发数据的连接
+  FILE* temp_file;                    // 段临时文件
+  char request[REQUEST_BUFFER];       // Range 请求
+  size_t request_len;                 // 请求长度
+  size_t request_sent;                // 已发送长度
+  char header[READ_BUFFER_SIZE];      // 响应头缓冲区
+  size_t header_len;                  // 已接收的响应头长度
+  HttpResponseInfo response_info;     // 响应头解析结果
+  long long expected_bytes;           // 段大小
+  int overflow;                       // 收到了超出段范围的数据（连接不可复用）
+  unsigned int registered_events;     // 当前注册的 epoll 事件，0 表示未注册
+  int attempt_reused;                 // 本次尝试是否使用了连接池中的连接
+  long long attempt_bytes;            // 本次尝试收到的字节数
+  double speed_window_ms;             // 低速检测当前窗口的开始时间，0表示尚未开始
+  long long speed_window_bytes;       // 低速检测窗口开始时本次尝试收到的字节数
+  int retries;                        // 已重试次数
+  double retry_at_ms;                 // 下次重试时间
+  double last_activity_ms;            // 最后一次收发数据时间
+  double throttled_since_ms;          // 因限速暂停读取的开始时间
+  double throttled_until_ms;          // 暂停读取到该时刻后恢复，0表示没有暂停
+} EventSegment;
+
+// 事件循环（负责 first, first + step, ... 号段）
+typedef struct {
+  MultiThreadDownloader* downloader;  // 下载器
+  const URLInfo* url_info;            // 下载 URL
+  const char* ip_str;                 // 解析后的服务器地址
+  EventSegment* segments;             // 全部段上下文
+  int first;                          // 负责的第一个段
+  int step;                           // 段序号步长（事件循环数量）
+  int epoll_fd;                       // epoll 实例
+  int failed_segments;                // 失败的段数
+  pthread_t pthread_id;               // 事件循环线程
+  char buffer[EVENT_RECV_BUFFER_SIZE]; // 接收缓冲区
+} EventLoop;
+
+static void segment_set_events(EventLoop* loop, EventSegment* event_segment, unsigned int events) {
+  if (event_segment->registered_events == events || event_segment->sockfd < 0) {
+    return;
+  }
+
+  struct epoll_event event = { 0 };
+  event.events = events;
+  event.data.ptr = event_segment;
+
+  if (events == 0) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, event_segment->sockfd, &event);
+  }
+  else if (event_segment->registered_events == 0) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, event_segment->sockfd, &event);
+  }
+  else {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, event_segment->sockfd, &event);
+  }
+  event_segment->registered_events = events;
+}
+
+// 关闭或归还当前连接
+static void segment_close_connection(EventLoop* loop, EventSegment* event_segment, int reusable) {
+  segment_set_events(loop, event_segment, 0);
+
+  if (event_segment->connection) {
+    connection_pool_release(event_segment->connection, reusable);
+  }
+#ifdef WITH_OPENSSL
+  else if (event_segment->https_connection) {
+    close_https_connection(event_segment->https_connection);
+  }
+#endif
+  else if (event_segment->sockfd >= 0) {
+    close(event_segment->sockfd);
+  }
+
+  event_segment->connection = NULL;
+  event_segment->https_connection = NULL;
+  event_segment->sockfd = -1;
+  event_segment->throttled_until_ms = 0;
+}
+
+static void segment_fail(EventLoop* loop, EventSegment* event_segment, const char* message, int retryable) {
+  FileSegment* segment = event_segment->thread->segment;
+
+  segment_close_connection(loop, event_segment, 0);
+  snprintf(segment->error_message, sizeof(segment->error_message), "%s", message);
+
+  // 复用的连接在收到任何数据前失败，说明已被服务器关闭，立即换新连接
+  if (event_segment->attempt_reused && event_segment->attempt_bytes == 0) {
+    event_segment->state = EVENT_SEGMENT_START;
+    return;
+  }
+
+  event_segment->retries++;
+  if (!retryable || event_segment->retries >= RETRY_MAX_ATTEMPTS) {
+    event_segment->state = EVENT_SEGMENT_FAILED;
+    segment->state = THREAD_STATE_ERROR;
+    loop->failed_segments++;
+    if (event_segment->temp_file) {
+      fclose(event_segment->temp_file);
+      event_segment->temp_file = NULL;
+    }
+    return;
+  }
+
+  event_segment->state = EVENT_SEGMENT_RETRY_WAIT;
+  event_segment->retry_at_ms = get_monotonic_ms() + retry_backoff_ms(event_segment->retries);
+  segment->state = THREAD_STATE_IDLE;
+}
+
+static void segment_finish(EventLoop* loop, EventSegment* event_segment) {
+  int reusable = event_segment->response_info.status_code == 206 &&
+    !event_segment->response_info.connection_close && !event_segment->overflow;
+
+  // 响应体完整读取后把连接归还到连接池
+  segment_close_connection(loop, event_segment, reusable);
+
+  if (event_segment->temp_file) {
+    fclose(event_segment->temp_file);
+    event_segment->temp_file = NULL;
+  }
+
+  event_segment->state = EVENT_SEGMENT_DONE;
+  event_segment->thread->segment->state = THREAD_STATE_COMPLETED;
+}
+
+static void segment_start(EventLoop* loop, EventSegment* event_segment) {
+  ThreadDownloadParams* thread = event_segment->thread;
+  FileSegment* segment = thread->segment;
+
+  if (thread->should_stop || loop->downloader->should_stop) {
+    return;
+  }
+
+  // 打开段输出文件 - 支持断点续传
+  if (!event_segment->temp_file) {
+    event_segment->temp_file = open_segment_output(thread);
+    if (!event_segment->temp_file) {
+      char message[256];
+      snprintf(message, sizeof(message), "无法创建临时文件: %s", strerror(errno));
+      segment_fail(loop, event_segment, message, 0);
+      return;
+    }
+  }
+
+  int request_len = build_range_request(loop->url_info, segment, event_segment->request, sizeof(event_segment->request));
+  if (request_len < 0) {
+    segment_fail(loop, event_segment, "请求构建失败", 0);
+    return;
+  }
+
+  event_segment->request_len = request_len;
+  event_segment->request_sent = 0;
+  event_segment->header_len = 0;
+  event_segment->overflow = 0;
+  event_segment->attempt_bytes = 0;
+  event_segment->speed_window_ms = 0;
+  event_segment->attempt_reused = 0;
+  ratelimit_init(&thread->rate_limiter, loop->url_info->host, &loop->downloader->rate_bucket);
+  event_segment->last_activity_ms = get_monotonic_ms();
+  segment->state = THREAD_STATE_CONNECTING;
+  thread->start_time = time(NULL);
+
+  // 优先复用连接池中的空闲连接（探测请求留下的连接）
+  event_segment->connection = connection_pool_acquire_idle(loop->url_info);
+  if (event_segment->connection) {
+    event_segment->attempt_reused = 1;
+    event_segment->sockfd = event_segment->connection->https_connection ?
+      event_segment->connection->https_connection->sockfd : event_segment->connection->sockfd;
+    set_socket_nonblocking(event_segment->sockfd, 1);
+    event_segment->state = EVENT_SEGMENT_SENDING;
+    segment_set_events(loop, event_segment, EPOLLOUT);
+    return;
+  }
+
+  // 每个新连接按分流权重选择地址，主机有多个地址时各段分散到不同地址
+  char ip_str[INET6_ADDRSTRLEN];
+  if (loop->url_info->host_type != DOMAIN || resolve_hostname(loop->url_info->host, ip_str, sizeof(ip_str)) != 0) {
+    snprintf(ip_str, sizeof(ip_str), "%s", loop->ip_str);
+  }
+  event_segment->sockfd = create_tcp_connection_nonblocking(ip_str, loop->url_info->port);
+  if (event_segment->sockfd < 0) {
+    segment_fail(loop, event_segment, "TCP连接失败", 1);
+    return;
+  }
+
+  event_segment->state = EVENT_SEGMENT_CONNECTING;
+  segment_set_events(loop, event_segment, EPOLLOUT);
+}
+
+// 非阻塞读取，返回读取字节数，0表示连接关闭，-1表示错误，EVENT_IO_AGAIN表示需要等待
+static ssize_t segment_read_raw(EventSegment* event_segment, void* buffer, size_t length, unsigned int* wait_events) {
+  *wait_events = EPOLLIN;
+
+#ifdef WITH_OPENSSL
+  if (event_segment->connection->https_connection) {
+    SSL* ssl = event_segment->connection->https_connection->ssl;
+    int bytes_received = SSL_read(ssl, buffer, length);
+    if (bytes_received > 0) {
+      return bytes_received;
+    }
+
+    int ssl_error = SSL_get_error(ssl, bytes_received);
+    switch (ssl_error) {
+    case SSL_ERROR_WANT_READ:
+      return EVENT_IO_AGAIN;
+    case SSL_ERROR_WANT_WRITE:
+      *wait_events = EPOLLOUT;
+      return EVENT_IO_AGAIN;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_SYSCALL:
+      return bytes_received == 0 ? 0 : -1;
+    case SSL_ERROR_SSL:
+      return ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING ? 0 : -1;
+    default:
+      return -1;
+    }
+  }
+#endif
+
+  ssize_t bytes_received = recv(event_segment->connection->sockfd, buffer, length, 0);
+  if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return EVENT_IO_AGAIN;
+  }
+  return bytes_received;
+}
+
+// 限速读取：先取令牌，没用掉的令牌归还。令牌不足时不能在事件循环线程里等待（会拖住同一循环的其他连接），
+// 记下恢复时间并返回 EVENT_RATE_WAIT，由调用者暂停该连接的读事件
+static ssize_t segment_read(EventSegment* event_segment, void* buffer, size_t length, unsigned int* wait_events) {
+  RateLimiter* limiter = &event_segment->thread->rate_limiter;
+  int wait_ms = 0;
+  size_t granted = ratelimit_try_acquire(limiter, length, &wait_ms);
+  if (granted == 0 && wait_ms > 0) {
+    double now = get_monotonic_ms();
+    event_segment->throttled_since_ms = now;
+    event_segment->throttled_until_ms = now + wait_ms;
+    return EVENT_RATE_WAIT;
+  }
+  ssize_t bytes_received = segment_read_raw(event_segment, buffer, granted, wait_events);
+  ratelimit_refund(limiter, granted, bytes_received);
+  return bytes_received;
+}
+
+// 非阻塞发送，返回发送字节数，-1表示错误，EVENT_IO_AGAIN表示需要等待
+static ssize_t segment_write(EventSegment* event_segment, const void* buffer, size_t length, unsigned int* wait_events) {
+  *wait_events = EPOLLOUT;
+
+#ifdef WITH_OPENSSL
+  if (event_segment->connection->https_connection) {
+    SSL* ssl = event_segment->connection->https_connection->ssl;
+    int bytes_sent = SSL_write(ssl, buffer, length);
+    if (bytes_sent > 0) {
+      return bytes_sent;
+    }
+
+    int ssl_error = SSL_get_error(ssl, bytes_sent);
+    if (ssl_error == SSL_ERROR_WANT_WRITE) {
+      return EVENT_IO_AGAIN;
+    }
+    if (ssl_error == SSL_ERROR_WANT_READ) {
+      *wait_events = EPOLLIN;
+      return EVENT_IO_AGAIN;
+    }
+    return -1;
+  }
+#endif
+
+  ssize_t bytes_sent = send(event_segment->connection->sockfd, buffer, length, MSG_NOSIGNAL);
+  if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return EVENT_IO_AGAIN;
+  }
+  return bytes_sent;
+}
+
+// 写入响应体数据，返回0继续，-1表示段已结束（完成或失败）
+static int segment_write_body(EventLoop* loop, EventSegment* event_segment, const char* data, size_t length) {
+  ThreadDownloadParams* thread = event_segment->thread;
+  FileSegment* segment = thread->segment;
+
+  long long remaining = event_segment->expected_bytes - segment->downloaded_bytes;
+  if ((long long)length > remaining) {
+    length = (size_t)remaining;
+    event_segment->overflow = 1; // 缓冲区中有多余数据
+  }
+
+  if (length > 0 && fwrite(data, 1, length, event_segment->temp_file) != length) {
+    segment_fail(loop, event_segment, "文件写入失败", 0);
+    return -1;
+  }
+
+  // 更新进度（使用互斥锁保护）
+  pthread_mutex_lock(thread->progress_mutex);
+  segment->downloaded_bytes += length;
+  pthread_mutex_unlock(thread->progress_mutex);
+
+  // 计算下载速度
+  time_t elapsed = time(NULL) - thread->start_time;
+  if (elapsed > 0) {
+    thread->download_speed = (double)segment->downloaded_bytes / elapsed;
+  }
+
+  if (segment->downloaded_bytes >= event_segment->expected_bytes) {
+    segment_finish(loop, event_segment);
+    return -1;
+  }
+  return 0;
+}
+
+static void segment_on_headers(EventLoop* loop, EventSegment* event_segment, size_t header_end) {
+  FileSegment* segment = event_segment->thread->segment;
+  HttpResponseInfo* response_info = &event_segment->response_info;
+
+  if (parse_http_response_block(event_segment->header, header_end, response_info) != 0) {
+    segment_fail(loop, event_segment, "响应头解析失败", 1);
+    return;
+  }
+
+  // 服务器忽略 Range 时只有从文件开头请求才能使用返回的数据
+  int usable = response_info->status_code == 206 ||
+    (response_info->status_code == 200 && segment->start_byte + segment->downloaded_bytes == 0);
+  if (!usable) {
+    char message[256];
+    snprintf(message, sizeof(message), "HTTP错误: %d", response_info->status_code);
+    segment_fail(loop, event_segment, message, determine_status_action(response_info->status_code) == STATUS_ACTION_RETRY);
+    return;
+  }
+
+  event_segment->state = EVENT_SEGMENT_BODY;
+  segment->state = THREAD_STATE_DOWNLOADING;
+
+  // 响应头之后已读入的数据属于响应体
+  if (event_segment->header_len > header_end) {
+    segment_write_body(loop, event_segment, event_segment->header + header_end, event_segment->header_len - header_end);
+  }
+}
+
+// 在响应头缓冲区中查找空行，返回响应头结束位置，未找到返回0
+static size_t find_header_end(const char* data, size_t length, size_t search_from) {
+  for (size_t i = search_from; i < length; i++) {
+    if (data[i] != '\n') {
+      continue;
+    }
+    if (i >= 1 && data[i - 1] == '\n') {
+      return i + 1;
+    }
+    if (i >= 3 && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+static void segment_on_readable(EventLoop* loop, EventSegment* event_segment) {
+  unsigned int wait_events = EPOLLIN;
+
+  for (int reads = 0; ; reads++) {
+    ssize_t bytes_received;
+
+    if (event_segment->state == EVENT_SEGMENT_HEADERS) {
+      size_t space = sizeof(event_segment->header) - event_segment->header_len;
+      if (space == 0) {
+        segment_fail(loop, event_segment, "响应头过长", 0);
+        return;
+      }
+      bytes_received = segment_read(event_segment, event_segment->header + event_segment->header_len, space, &wait_events);
+    }
+    else {
+      long long remaining = event_segment->expected_bytes - event_segment->thread->segment->downloaded_bytes;
+      size_t bytes_to_read = remaining < EVENT_RECV_BUFFER_SIZE ? (size_t)remaining : EVENT_RECV_BUFFER_SIZE;
+      bytes_received = segment_read(event_segment, loop->buffer, bytes_to_read, &wait_events);
+    }
+
+    if (bytes_received == EVENT_IO_AGAIN) {
+      break;
+    }
+    if (bytes_received == EVENT_RATE_WAIT) {
+      segment_set_events(loop, event_segment, 0); // 到时间后由事件循环恢复
+      return;
+    }
+    if (bytes_received <= 0) {
+      char message[256];
+      snprintf(message, sizeof(message), "网络接收失败 (已下载: %lld/%lld)",
+        event_segment->thread->segment->downloaded_bytes, event_segment->expected_bytes);
+      segment_fail(loop, event_segment, message, 1);
+      return;
+    }
+
+    event_segment->attempt_bytes += bytes_received;
+    event_segment->last_activity_ms = get_monotonic_ms();
+
+    if (event_segment->state == EVENT_SEGMENT_HEADERS) {
+      size_t search_from = event_segment->header_len > 3 ? event_segment->header_len - 3 : 0;
+      event_segment->header_len += bytes_received;
+      size_t header_end = find_header_end(event_segment->header, event_segment->header_len, search_from);
+      if (header_end > 0) {
+        segment_on_headers(loop, event_segment, header_end);
+      }
+    }
+    else if (segment_write_body(loop, event_segment, loop->buffer, bytes_received) != 0) {
+      return;
+    }
+
+    if (event_segment->state != EVENT_SEGMENT_HEADERS && event_segment->state != EVENT_SEGMENT_BODY) {
+      return; // 段已完成或失败
+    }
+
+    // 其他连接也需要处理；TLS 已解密但未读取的数据不会触发 epoll，需要读完
+    if (reads + 1 >= EVENT_MAX_READS_PER_WAKEUP) {
+#ifdef WITH_OPENSSL
+      if (event_segment->connection->https_connection && SSL_pending(event_segment->connection->https_connection->ssl) > 0) {
+        continue;
+      }
+#endif
+      break;
+    }
+  }
+
+  segment_set_events(loop, event_segment, wait_events);
+}
+
+static void segment_on_writable(EventLoop* loop, EventSegment* event_segment) {
+  while (event_segment->request_sent < event_segment->request_len) {
+    unsigned int wait_events = EPOLLOUT;
+    ssize_t bytes_sent = segment_write(event_segment, event_segment->request + event_segment->request_sent,
+      event_segment->request_len - event_segment->request_sent, &wait_events);
+
+    if (bytes_sent == EVENT_IO_AGAIN) {
+      segment_set_events(loop, event_segment, wait_events);
+      return;
+    }
+    if (bytes_sent <= 0) {
+      segment_fail(loop, event_segment, "请求发送失败", 1);
+      return;
+    }
+    event_segment->request_sent += bytes_sent;
+  }
+
+  // 请求已完整发送，等待响应
+  event_segment->state = EVENT_SEGMENT_HEADERS;
+  event_segment->last_activity_ms = get_monotonic_ms();
+  segment_set_events(loop, event_segment, EPOLLIN);
+}
+
+static void segment_on_handshake(EventLoop* loop, EventSegment* event_segment) {
+#ifdef WITH_OPENSSL
+  int result = ssl_handshake_step(event_segment->https_connection);
+  if (result == SSL_ERROR_WANT_READ) {
+    segment_set_events(loop, event_segment, EPOLLIN);
+    return;
+  }
+  if (result == SSL_ERROR_WANT_WRITE) {
+    segment_set_events(loop, event_segment, EPOLLOUT);
+    return;
+  }
+  if (result != 0) {
+    segment_fail(loop, event_segment, "TLS握手失败", 1);
+    return;
+  }
+
+  event_segment->connection = pooled_connection_create(loop->url_info, -1, event_segment->https_connection);
+  if (!event_segment->connection) {
+    segment_fail(loop, event_segment, "内存分配失败", 0);
+    return;
+  }
+  event_segment->https_connection = NULL;
+  event_segment->state = EVENT_SEGMENT_SENDING;
+  segment_on_writable(loop, event_segment);
+#else
+  segment_fail(loop, event_segment, "HTTPS支持未编译", 0);
+#endif
+}
+
+static void segment_on_connected(EventLoop* loop, EventSegment* event_segment) {
+  int socket_error = 0;
+  socklen_t error_length = sizeof(socket_error);
+  if (getsockopt(event_segment->sockfd, SOL_SOCKET, SO_ERROR, &socket_error, &error_length) != 0 || socket_error != 0) {
+    char message[256];
+    snprintf(message, sizeof(message), "TCP连接失败: %s", strerror(socket_error ? socket_error : errno));
+    segment_fail(loop, event_segment, message, 1);
+    return;
+  }
+
+  event_segment->last_activity_ms = get_monotonic_ms();
+
+  if (loop->url_info->protocol_type == PROTOCOL_HTTPS) {
+#ifdef WITH_OPENSSL
+    event_segment->https_connection = https_connection_attach(event_segment->sockfd, loop->url_info->host, loop->url_info->port);
+    if (!event_segment->https_connection) {
+      segment_fail(loop, event_segment, "SSL初始化失败", 1);
+      return;
+    }
+    event_segment->state = EVENT_SEGMENT_HANDSHAKE;
+    segment_on_handshake(loop, event_segment);
+#else
+    segment_fail(loop, event_segment, "HTTPS支持未编译", 0);
+#endif
+    return;
+  }
+
+  event_segment->connection = pooled_connection_create(loop->url_info, event_segment->sockfd, NULL);
+  if (!event_segment->connection) {
+    segment_fail(loop, event_segment, "内存分配失败", 0);
+    return;
+  }
+  event_segment->state = EVENT_SEGMENT_SENDING;
+  segment_on_writable(loop, event_segment);
+}
+
+static void segment_on_event(EventLoop* loop, EventSegment* event_segment) {
+  switch (event_segment->state) {
+  case EVENT_SEGMENT_CONNECTING:
+    segment_on_connected(loop, event_segment);
+    break;
+  case EVENT_SEGMENT_HANDSHAKE:
+    segment_on_handshake(loop, event_segment);
+    break;
+  case EVENT_SEGMENT_SENDING:
+    segment_on_writable(loop, event_segment);
+    break;
+  case EVENT_SEGMENT_HEADERS:
+  case EVENT_SEGMENT_BODY:
+    segment_on_readable(loop, event_segment);
+    break;
+  default:
+    break;
+  }
+}
+
+// 启动等待中的段、处理到期的重试和超时的连接，返回尚未结束的段数
+// 低速检测：响应体在 low_speed_time 秒内的平均速度低于 low_speed_limit 时返回1（限速时按每个连接分到的速率降低阈值）
+static int segment_too_slow(EventSegment* event_segment, double now) {
+  const DownloadOptions* options = get_download_options();
+  long long limit = ratelimit_low_speed_limit(&event_segment->thread->rate_limiter,
+    event_segment->thread->downloader->thread_count);
+  if (limit <= 0) {
+    return 0;
+  }
+  if (event_segment->speed_window_ms == 0) {
+    event_segment->speed_window_ms = now;
+    event_segment->speed_window_bytes = event_segment->attempt_bytes;
+    return 0;
+  }
+
+  double elapsed = now - event_segment->speed_window_ms;
+  if (elapsed < options->low_speed_time * 1000.0) {
+    return 0;
+  }
+  long long bytes = event_segment->attempt_bytes - event_segment->speed_window_bytes;
+  event_segment->speed_window_ms = now;
+  event_segment->speed_window_bytes = event_segment->attempt_bytes;
+  return bytes * 1000.0 / elapsed < limit;
+}
+
+static int event_loop_sweep(EventLoop* loop) {
+  double now = get_monotonic_ms();
+  int pending = 0;
+
+  for (int i = loop->first; i < loop->downloader->thread_count; i += loop->step) {
+    EventSegment* event_segment = &loop->segments[i];
+
+    switch (event_segment->state) {
+    case EVENT_SEGMENT_RETRY_WAIT:
+      if (now < event_segment->retry_at_ms) {
+        break;
+      }
+      // fall through
+    case EVENT_SEGMENT_START:
+      segment_start(loop, event_segment);
+      break;
+    case EVENT_SEGMENT_CONNECTING:
+      if (now - event_segment->last_activity_ms > get_download_options()->connect_timeout * 1000.0) {
+        segment_fail(loop, event_segment, "连接超时", 1);
+      }
+      break;
+    case EVENT_SEGMENT_HANDSHAKE:
+    case EVENT_SEGMENT_SENDING:
+    case EVENT_SEGMENT_HEADERS:
+      if (event_segment->throttled_until_ms > 0) {
+        break; // 因限速暂停读取，不算空闲
+      }
+      if (now - event_segment->last_activity_ms > get_io_idle_timeout_ms()) {
+        segment_fail(loop, event_segment, "连接超时", 1);
+      }
+      break;
+    case EVENT_SEGMENT_BODY:
+      if (event_segment->throttled_until_ms > 0) {
+        break;
+      }
+      if (now - event_segment->last_activity_ms > get_io_idle_timeout_ms()) {
+        segment_fail(loop, event_segment, "连接超时", 1);
+      }
+      else if (segment_too_slow(event_segment, now)) {
+        segment_fail(loop, event_segment, "传输速度过低", 1);
+      }
+      break;
+    default:
+      break;
+    }
+
+    if (event_segment->state != EVENT_SEGMENT_DONE && event_segment->state != EVENT_SEGMENT_FAILED) {
+      pending++;
+    }
+  }
+
+  return pending;
+}
+
+// 恢复限速等待已到期的连接，返回到下一个连接恢复的毫秒数（不超过 EVENT_SWEEP_INTERVAL_MS）。
+// 暂停的时间不计入空闲超时；TLS 层可能已有解密好的数据而不会触发 epoll，恢复时直接读取一次
+static int event_loop_resume_throttled(EventLoop* loop) {
+  double now = get_monotonic_ms();
+  double timeout_ms = EVENT_SWEEP_INTERVAL_MS;
+
+  for (int i = loop->first; i < loop->downloader->thread_count; i += loop->step) {
+    EventSegment* event_segment = &loop->segments[i];
+    if (event_segment->throttled_until_ms <= 0) {
+      continue;
+    }
+    if (now < event_segment->throttled_until_ms) {
+      if (event_segment->throttled_until_ms - now < timeout_ms) {
+        timeout_ms = event_segment->throttled_until_ms - now;
+      }
+      continue;
+    }
+
+    event_segment->throttled_until_ms = 0;
+    event_segment->last_activity_ms += now - event_segment->throttled_since_ms;
+    if (event_segment->state == EVENT_SEGMENT_HEADERS || event_segment->state == EVENT_SEGMENT_BODY) {
+      segment_on_readable(loop, event_segment);
+      if (event_segment->throttled_until_ms > 0 && event_segment->throttled_until_ms - now < timeout_ms) {
+        timeout_ms = event_segment->throttled_until_ms - now;
+      }
+    }
+  }
+  return timeout_ms > 0 ? (int)timeout_ms + 1 : 0;
+}
+
+static void event_loop_run(EventLoop* loop) {
+  struct epoll_event events[EVENT_MAX_EVENTS];
+  double last_sweep_ms = 0;
+
+  while (!loop->downloader->should_stop) {
+    double now = get_monotonic_ms();
+    if (now - last_sweep_ms >= EVENT_SWEEP_INTERVAL_MS) {
+      if (event_loop_sweep(loop) == 0) {
+        break;
+      }
+      last_sweep_ms = now;
+    }
+
+    int wait_ms = event_loop_resume_throttled(loop);
+    int event_count = epoll_wait(loop->epoll_fd, events, EVENT_MAX_EVENTS, wait_ms);
+    if (event_count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "错误: epoll_wait 失败: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < event_count; i++) {
+      EventSegment* event_segment = events[i].data.ptr;
+      segment_on_event(loop, event_segment);
+
+      // 段结束后立即检查，让完成的连接尽快被其他段复用
+      if (event_segment->state == EVENT_SEGMENT_DONE || event_segment->state == EVENT_SEGMENT_FAILED ||
+        event_segment->state == EVENT_SEGMENT_START) {
+        last_sweep_ms = 0;
+      }
+    }
+  }
+
+  // 停止或出错时关闭所有未完成的连接
+  for (int i = loop->first; i < loop->downloader->thread_count; i += loop->step) {
+    EventSegment* event_segment = &loop->segments[i];
+    if (event_segment->state != EVENT_SEGMENT_DONE && event_segment->state != EVENT_SEGMENT_FAILED) {
+      segment_close_connection(loop, event_segment, 0);
+      event_segment->thread->segment->state = THREAD_STATE_STOPPED;
+      event_segment->state = EVENT_SEGMENT_FAILED;
+      loop->failed_segments++;
+    }
+    if (event_segment->temp_file) {
+      fclose(event_segment->temp_file);
+      event_segment->temp_file = NULL;
+    }
+  }
+}
+
+static void* event_loop_worker(void* arg) {
+  event_loop_run((EventLoop*)arg);
+  pthread_exit(NULL);
+}
+
+int event_engine_download(MultiThreadDownloader* downloader) {
+  if (!downloader || !downloader->threads || downloader->thread_count <= 0) {
+    return -1;
+  }
+
+  // 初始化时已跟随重定向并解析好最终地址
+  URLInfo url_info = downloader->mirrors[0].url_info;
+
+  // 所有段连接同一个服务器，只解析一次
+  char ip_str[INET6_ADDRSTRLEN];
+  if (url_info.host_type == DOMAIN) {
+    if (resolve_hostname(url_info.host, ip_str, sizeof(ip_str)) != 0) {
+      fprintf(stderr, "错误: 无法解析主机名 %s\n", url_info.host);
+      return -1;
+    }
+  }
+  else {
+    strncpy(ip_str, url_info.host, sizeof(ip_str) - 1);
+    ip_str[sizeof(ip_str) - 1] = '\0';
+  }
+
+#ifdef WITH_OPENSSL
+  if (url_info.protocol_type == PROTOCOL_HTTPS && init_openssl() != 0) {
+    return -1;
+  }
+#endif
+
+  int loop_count = get_download_options()->event_loops;
+  if (loop_count < 1) {
+    loop_count = 1;
+  }
+  if (loop_count > MAX_EVENT_LOOPS) {
+    loop_count = MAX_EVENT_LOOPS;
+  }
+  if (loop_count > downloader->thread_count) {
+    loop_count = downloader->thread_count;
+  }
+
+  EventSegment* segments = calloc(downloader->thread_count, sizeof(EventSegment));
+  EventLoop* loops = calloc(loop_count, sizeof(EventLoop));
+  if (!segments || !loops) {
+    fprintf(stderr, "错误: 内存分配失败\n");
+    free(segments);
+    free(loops);
+    return -1;
+  }
+
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    segments[i].thread = thread;
+    segments[i].state = EVENT_SEGMENT_START;
+    segments[i].sockfd = -1;
+    segments[i].expected_bytes = thread->segment->end_byte - thread->segment->start_byte + 1;
+  }
+
+  int started_loops = 0;
+  for (int i = 0; i < loop_count; i++) {
+    EventLoop* loop = &loops[i];
+    loop->downloader = downloader;
+    loop->url_info = &url_info;
+    loop->ip_str = ip_str;
+    loop->segments = segments;
+    loop->first = i;
+    loop->step = loop_count;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+      fprintf(stderr, "错误: 无法创建 epoll 实例: %s\n", strerror(errno));
+      downloader->should_stop = 1;
+      break;
+    }
+
+    // 第一个事件循环在当前线程运行
+    if (i > 0 && pthread_create(&loop->pthread_id, NULL, event_loop_worker, loop) != 0) {
+      fprintf(stderr, "错误: 创建事件循环线程 %d 失败\n", i);
+      close(loop->epoll_fd);
+      downloader->should_stop = 1;
+      break;
+    }
+    started_loops++;
+  }
+
+  if (started_loops > 0) {
+    event_loop_run(&loops[0]);
+  }
+
+  int failed_segments = 0;
+  for (int i = 0; i < started_loops; i++) {
+    if (i > 0) {
+      pthread_join(loops[i].pthread_id, NULL);
+    }
+    close(loops[i].epoll_fd);
+    failed_segments += loops[i].failed_segments;
+  }
+
+  // 未能启动的事件循环负责的段都算失败
+  for (int i = started_loops; i < loop_count; i++) {
+    for (int j = i; j < downloader->thread_count; j += loop_count) {
+      downloader->segments[j].state = THREAD_STATE_ERROR;
+      failed_segments++;
+    }
+  }
+
+  free(segments);
+  free(loops);
+  return failed_segments;
+}
@@ -0,0 +1,942 @@
+#include "../include/common.h"
+#include "../include/h2.h"
+#include "../include/hpack.h"
+#include "../include/event_engine.h"
+#include "../include/multithread.h"
+#include "../include/https.h"
+#include "../include/http.h"
+#include "../include/net.h"
+#include "../include/config.h"
+#include "../include/utils.h"
+#include "../include/ratelimit.h"
+#include <poll.h>
+
+// CLI颜色定义
+static const char* YELLOW = "\033[33m";
+static const char* CYAN = "\033[36m";
+static const char* RESET = "\033[0m";
+
+#ifdef WITH_OPENSSL
+
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_MAX_FRAME_SIZE 16384           // 接收的最大帧长度（SETTINGS_MAX_FRAME_SIZE 默认值）
+#define H2_READ_BUFFER_SIZE (4 * (H2_MAX_FRAME_SIZE + H2_FRAME_HEADER_SIZE)) // 连接的接收缓冲区大小
+#define H2_MAX_HEADER_BLOCK (64 * 1024)   // 一个响应头块（含 CONTINUATION）的最大长度
+#define H2_DEFAULT_WINDOW 65535           // 协议规定的初始窗口大小
+#define H2_POLL_INTERVAL_MS 100           // 等待数据时检查重试和超时的间隔
+#define H2_NOT_NEGOTIATED 1               // 服务器没有通过 ALPN 选择 h2
+#define H2_NO_STREAMS 2                   // 服务器的 SETTINGS_MAX_CONCURRENT_STREAMS 为0，不允许打开流
+
+static const char H2_CONNECTION_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// 帧类型（RFC 9113 第 6 节）
+enum {
+  H2_FRAME_DATA = 0x0,
+  H2_FRAME_HEADERS = 0x1,
+  H2_FRAME_PRIORITY = 0x2,
+  H2_FRAME_RST_STREAM = 0x3,
+  H2_FRAME_SETTINGS = 0x4,
+  H2_FRAME_PUSH_PROMISE = 0x5,
+  H2_FRAME_PING = 0x6,
+  H2_FRAME_GOAWAY = 0x7,
+  H2_FRAME_WINDOW_UPDATE = 0x8,
+  H2_FRAME_CONTINUATION = 0x9
+};
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+
+#define H2_ERROR_PROTOCOL 0x1
+#define H2_ERROR_REFUSED_STREAM 0x7
+#define H2_ERROR_CANCEL 0x8
+
+// 段对应的流状态
+typedef enum {
+  H2_STREAM_IDLE,             // 等待发出请求
+  H2_STREAM_OPEN,             // 已发出请求，等待响应头
+  H2_STREAM_BODY,             // 接收响应体
+  H2_STREAM_RETRY_WAIT,       // 等待重试
+  H2_STREAM_DONE,             // 已完成
+  H2_STREAM_FAILED            // 已失败
+} H2StreamState;
+
+// 单个段的流上下文
+typedef struct {
+  ThreadDownloadParams* thread;       // 段对应的线程参数（复用线程模式的数据结构）
+  H2StreamState state;                // 状态
+  unsigned int stream_id;             // 当前请求的流 ID，0表示没有
+  FILE* output_file;                  // 段输出文件
+  long long expected_bytes;           // 段大小
+  long long unacked_bytes;            // 已写入文件但尚未通过 WINDOW_UPDATE 归还的字节数
+  int retries;                        // 已重试次数
+  double retry_at_ms;                 // 下次重试时间
+} H2Stream;
+
+// 一个 HTTP/2 连接及其上的所有流
+typedef struct {
+  MultiThreadDownloader* downloader;  // 下载器
+  const URLInfo* url_info;            // 下载 URL
+  H2Stream* streams;                  // 全部段的流上下文
+  HttpsConnection* connection;        // 当前连接，NULL表示需要（重新）连接
+  unsigned int next_stream_id;        // 下一个请求使用的流 ID（客户端使用奇数）
+  unsigned int max_streams;           // 服务器允许同时打开的流数
+  int open_streams;                   // 当前打开的流数
+  int goaway;                         // 服务器已发送 GOAWAY，不再在此连接上发出请求
+  long long connection_unacked;       // 连接级尚未归还的窗口
+  HpackTable decoder;                 // 响应头的 HPACK 动态表
+  unsigned char header_block[H2_MAX_HEADER_BLOCK]; // 正在接收的头部块
+  size_t header_block_length;         // 头部块已接收长度
+  unsigned int header_stream;         // 正在接收头部块的流（等待 CONTINUATION），0表示没有
+  int header_end_stream;              // 头部块所在的 HEADERS 帧是否带 END_STREAM
+  unsigned char buffer[H2_READ_BUFFER_SIZE]; // 接收缓冲区
+  size_t buffer_start;                // 未处理数据的开始位置
+  size_t buffer_end;                  // 未处理数据的结束位置
+  RateLimiter rate_limiter;           // 连接的限速器（所有流共享）
+  int connection_failures;            // 连续建立连接失败的次数
+  double reconnect_at_ms;             // 下次建立连接的时间
+  double last_activity_ms;            // 最后一次收到数据的时间
+  double speed_window_ms;             // 低速检测当前窗口的开始时间，0表示尚未开始
+  long long speed_window_bytes;       // 低速检测窗口开始时连接收到的字节数
+  long long connection_bytes;         // 当前连接收到的字节数
+  int failed_streams;                 // 失败的段数
+  int connection_count;               // 建立过的连接数
+  int request_count;                  // 发出的流请求数
+} H2Session;
+
+// 响应头解码上下文
+typedef struct {
+  int status_code;
+} H2ResponseHeaders;
+
+static void write_frame_header(unsigned char* header, size_t length, int type, int flags, unsigned int stream_id) {
+  header[0] = (length >> 16) & 0xff;
+  header[1] = (length >> 8) & 0xff;
+  header[2] = length & 0xff;
+  header[3] = type;
+  header[4] = flags;
+  header[5] = (stream_id >> 24) & 0x7f;
+  header[6] = (stream_id >> 16) & 0xff;
+  header[7] = (stream_id >> 8) & 0xff;
+  header[8] = stream_id & 0xff;
+}
+
+static unsigned int read_uint32(const unsigned char* data) {
+  return ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16) | ((unsigned int)data[2] << 8) | data[3];
+}
+
+static int send_frame(H2Session* session, int type, int flags, unsigned int stream_id, const void* payload, size_t length) {
+  unsigned char frame[H2_FRAME_HEADER_SIZE + 1024];
+  if (length > sizeof(frame) - H2_FRAME_HEADER_SIZE) {
+    return -1;
+  }
+  write_frame_header(frame, length, type, flags, stream_id);
+  if (length > 0) {
+    memcpy(frame + H2_FRAME_HEADER_SIZE, payload, length);
+  }
+  return ssl_send_data(session->connection, (const char*)frame, H2_FRAME_HEADER_SIZE + length);
+}
+
+static int send_window_update(H2Session* session, unsigned int stream_id, long long increment) {
+  unsigned char payload[4] = {
+    (increment >> 24) & 0x7f, (increment >> 16) & 0xff, (increment >> 8) & 0xff, increment & 0xff
+  };
+  return send_frame(session, H2_FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+static int send_rst_stream(H2Session* session, unsigned int stream_id, unsigned int error_code) {
+  unsigned char payload[4] = {
+    (error_code >> 24) & 0xff, (error_code >> 16) & 0xff, (error_code >> 8) & 0xff, error_code & 0xff
+  };
+  return send_frame(session, H2_FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static H2Stream* find_stream(H2Session* session, unsigned int stream_id) {
+  for (int i = 0; i < session->downloader->thread_count; i++) {
+    if (session->streams[i].stream_id == stream_id) {
+      return &session->streams[i];
+    }
+  }
+  return NULL;
+}
+
+// 结束流的当前请求（不再接收它的帧），需要时通知服务器停止发送
+static void stream_detach(H2Session* session, H2Stream* stream, int reset) {
+  if (stream->stream_id == 0) {
+    return;
+  }
+  if (reset && session->connection) {
+    send_rst_stream(session, stream->stream_id, H2_ERROR_CANCEL);
+  }
+  stream->stream_id = 0;
+  stream->unacked_bytes = 0;
+  session->open_streams--;
+}
+
+static void stream_fail(H2Session* session, H2Stream* stream, const char* message, int retryable, int reset) {
+  FileSegment* segment = stream->thread->segment;
+
+  stream_detach(session, stream, reset);
+  snprintf(segment->error_message, sizeof(segment->error_message), "%s", message);
+
+  stream->retries++;
+  if (!retryable || stream->retries >= RETRY_MAX_ATTEMPTS) {
+    stream->state = H2_STREAM_FAILED;
+    segment->state = THREAD_STATE_ERROR;
+    session->failed_streams++;
+    if (stream->output_file) {
+      fclose(stream->output_file);
+      stream->output_file = NULL;
+    }
+    return;
+  }
+
+  stream->state = H2_STREAM_RETRY_WAIT;
+  stream->retry_at_ms = get_monotonic_ms() + retry_backoff_ms(stream->retries);
+  segment->state = THREAD_STATE_IDLE;
+}
+
+static void stream_finish(H2Session* session, H2Stream* stream, int reset) {
+  stream_detach(session, stream, reset);
+
+  if (stream->output_file) {
+    fclose(stream->output_file);
+    stream->output_file = NULL;
+  }
+
+  stream->state = H2_STREAM_DONE;
+  stream->thread->segment->state = THREAD_STATE_COMPLETED;
+}
+
+// 发出段剩余部分的请求（HEADERS 帧带 END_STREAM，GET 请求没有请求体）
+static int stream_start(H2Session* session, H2Stream* stream) {
+  ThreadDownloadParams* thread = stream->thread;
+  FileSegment* segment = thread->segment;
+  const URLInfo* url_info = session->url_info;
+
+  if (segment->downloaded_bytes >= stream->expected_bytes) {
+    stream_finish(session, stream, 0);
+    return 0;
+  }
+
+  // 打开段输出文件 - 支持断点续传
+  if (!stream->output_file) {
+    stream->output_file = open_segment_output(thread);
+    if (!stream->output_file) {
+      char message[256];
+      snprintf(message, sizeof(message), "无法创建临时文件: %s", strerror(errno));
+      stream_fail(session, stream, message, 0, 0);
+      return 0;
+    }
+  }
+
+  char authority[600];
+  char range[64];
+  if (url_info->port == 443) {
+    snprintf(authority, sizeof(authority), "%s", url_info->host);
+  }
+  else {
+    snprintf(authority, sizeof(authority), "%s:%d", url_info->host, url_info->port);
+  }
+  snprintf(range, sizeof(range), "bytes=%lld-%lld", segment->start_byte + segment->downloaded_bytes, segment->end_byte);
+
+  const char* headers[][2] = {
+    { ":method", "GET" },
+    { ":scheme", "https" },
+    { ":authority", authority },
+    { ":path", url_info->path[0] ? url_info->path : "/" },
+    { "user-agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36" },
+    { "accept", "*/*" },
+    { "range", range },
+  };
+
+  unsigned char block[H2_MAX_FRAME_SIZE];
+  size_t block_length = 0;
+  for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+    int written = hpack_encode_header(block + block_length, sizeof(block) - block_length, headers[i][0], headers[i][1]);
+    if (written < 0) {
+      stream_fail(session, stream, "请求构建失败", 0, 0);
+      return 0;
+    }
+    block_length += written;
+  }
+
+  unsigned char frame[H2_FRAME_HEADER_SIZE + H2_MAX_FRAME_SIZE];
+  unsigned int stream_id = session->next_stream_id;
+  write_frame_header(frame, block_length, H2_FRAME_HEADERS, H2_FLAG_END_STREAM | H2_FLAG_END_HEADERS, stream_id);
+  memcpy(frame + H2_FRAME_HEADER_SIZE, block, block_length);
+  if (ssl_send_data(session->connection, (const char*)frame, H2_FRAME_HEADER_SIZE + block_length) != 0) {
+    return -1; // 连接错误
+  }
+
+  session->next_stream_id += 2;
+  session->open_streams++;
+  session->request_count++;
+  stream->stream_id = stream_id;
+  stream->unacked_bytes = 0;
+  stream->state = H2_STREAM_OPEN;
+  segment->state = THREAD_STATE_CONNECTING;
+  thread->start_time = time(NULL);
+  return 0;
+}
+
+static void on_response_header(void* context, const char* name, size_t name_length, const char* value, size_t value_length) {
+  H2ResponseHeaders* headers = context;
+  if (name_length == 7 && memcmp(name, ":status", 7) == 0 && value_length == 3) {
+    headers->status_code = (value[0] - '0') * 100 + (value[1] - '0') * 10 + (value[2] - '0');
+  }
+}
+
+// 处理完整的响应头块，返回0继续，-1表示连接错误
+static int on_header_block(H2Session* session, unsigned int stream_id, int end_stream) {
+  H2ResponseHeaders headers = { 0 };
+
+  // 即使流已经不需要，也必须解码以保持动态表同步
+  if (hpack_decode_block(&session->decoder, session->header_block, session->header_block_length,
+    on_response_header, &headers) != 0) {
+    return -1;
+  }
+
+  H2Stream* stream = find_stream(session, stream_id);
+  if (!stream) {
+    return 0;
+  }
+  FileSegment* segment = stream->thread->segment;
+
+  if (stream->state == H2_STREAM_OPEN) {
+    // 1xx 临时响应之后还有最终响应
+    if (headers.status_code >= 100 && headers.status_code < 200 && !end_stream) {
+      return 0;
+    }
+
+    // 服务器忽略 Range 时只有从文件开头请求才能使用返回的数据
+    int usable = headers.status_code == 206 ||
+      (headers.status_code == 200 && segment->start_byte + segment->downloaded_bytes == 0);
+    if (!usable) {
+      char message[256];
+      snprintf(message, sizeof(message), "HTTP错误: %d", headers.status_code);
+      stream_fail(session, stream, message, determine_status_action(headers.status_code) == STATUS_ACTION_RETRY, !end_stream);
+      return 0;
+    }
+
+    stream->state = H2_STREAM_BODY;
+    segment->state = THREAD_STATE_DOWNLOADING;
+  }
+
+  // 响应体之前就结束的流，或者响应体不完整时收到了尾部字段
+  if (end_stream && stream->state == H2_STREAM_BODY) {
+    char message[256];
+    snprintf(message, sizeof(message), "流提前结束 (已下载: %lld/%lld)", segment->downloaded_bytes, stream->expected_bytes);
+    stream_fail(session, stream, message, 1, 0);
+  }
+  return 0;
+}
+
+// 写入 DATA 帧中的数据，返回0继续，-1表示连接错误
+static int on_data(H2Session* session, unsigned int stream_id, int flags, const unsigned char* payload, size_t length) {
+  // 流量控制按整个帧（含填充）计算，不需要的流的数据也要归还连接窗口
+  size_t frame_length = length;
+  session->connection_unacked += frame_length;
+  if (session->connection_unacked >= H2_CONNECTION_WINDOW / 2) {
+    if (send_window_update(session, 0, session->connection_unacked) != 0) {
+      return -1;
+    }
+    session->connection_unacked = 0;
+  }
+
+  size_t padding = 0;
+  if (flags & H2_FLAG_PADDED) {
+    if (length < 1 || payload[0] >= length) {
+      return -1;
+    }
+    padding = payload[0];
+    payload++;
+    length--;
+  }
+  length -= padding;
+
+  H2Stream* stream = find_stream(session, stream_id);
+  if (!stream || stream->state != H2_STREAM_BODY) {
+    return 0;
+  }
+
+  ThreadDownloadParams* thread = stream->thread;
+  FileSegment* segment = thread->segment;
+  int end_stream = (flags & H2_FLAG_END_STREAM) != 0;
+
+  long long remaining = stream->expected_bytes - segment->downloaded_bytes;
+  if ((long long)length > remaining) {
+    length = (size_t)remaining;
+  }
+  if (length > 0 && fwrite(payload, 1, length, stream->output_file) != length) {
+    stream_fail(session, stream, "文件写入失败", 0, !end_stream);
+    return 0;
+  }
+
+  // 更新进度（使用互斥锁保护）
+  pthread_mutex_lock(thread->progress_mutex);
+  segment->downloaded_bytes += length;
+  pthread_mutex_unlock(thread->progress_mutex);
+
+  time_t elapsed = time(NULL) - thread->start_time;
+  if (elapsed > 0) {
+    thread->download_speed = (double)segment->downloaded_bytes / elapsed;
+  }
+
+  if (segment->downloaded_bytes >= stream->expected_bytes) {
+    stream_finish(session, stream, !end_stream);
+    return 0;
+  }
+  if (end_stream) {
+    char message[256];
+    snprintf(message, sizeof(message), "流提前结束 (已下载: %lld/%lld)", segment->downloaded_bytes, stream->expected_bytes);
+    stream_fail(session, stream, message, 1, 0);
+    return 0;
+  }
+
+  // 数据已写入文件，窗口用掉一半时归还
+  stream->unacked_bytes += frame_length;
+  if (stream->unacked_bytes >= H2_STREAM_WINDOW / 2) {
+    if (send_window_update(session, stream_id, stream->unacked_bytes) != 0) {
+      return -1;
+    }
+    stream->unacked_bytes = 0;
+  }
+  return 0;
+}
+
+// 处理 HEADERS/CONTINUATION 帧中的头部块片段
+static int on_header_fragment(H2Session* session, int type, int flags, unsigned int stream_id,
+  const unsigned char* payload, size_t length) {
+  if (type == H2_FRAME_HEADERS) {
+    size_t padding = 0;
+    if (flags & H2_FLAG_PADDED) {
+      if (length < 1) {
+        return -1;
+      }
+      padding = payload[0];
+      payload++;
+      length--;
+    }
+    if (flags & H2_FLAG_PRIORITY) {
+      if (length < 5) {
+        return -1;
+      }
+      payload += 5;
+      length -= 5;
+    }
+    if (padding > length) {
+      return -1;
+    }
+    length -= padding;
+
+    session->header_block_length = 0;
+    session->header_stream = stream_id;
+    session->header_end_stream = (flags & H2_FLAG_END_STREAM) != 0;
+  }
+  else if (stream_id == 0 || stream_id != session->header_stream) {
+    return -1; // 没有等待中的头部块或流不匹配的 CONTINUATION 是 PROTOCOL_ERROR（RFC 9113 §6.10）
+  }
+
+  if (length > sizeof(session->header_block) - session->header_block_length) {
+    return -1;
+  }
+  memcpy(session->header_block + session->header_block_length, payload, length);
+  session->header_block_length += length;
+
+  if (!(flags & H2_FLAG_END_HEADERS)) {
+    return 0;
+  }
+  session->header_stream = 0;
+  return on_header_block(session, stream_id, session->header_end_stream);
+}
+
+static int on_settings(H2Session* session, int flags, const unsigned char* payload, size_t length) {
+  if (flags & H2_FLAG_ACK) {
+    return 0;
+  }
+  if (length % 6 != 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < length; i += 6) {
+    int identifier = (payload[i] << 8) | payload[i + 1];
+    unsigned int value = read_uint32(payload + i + 2);
+    if (identifier == H2_SETTINGS_MAX_CONCURRENT_STREAMS) {
+      session->max_streams = value;
+    }
+  }
+  // 并发流上限为0时请求永远发不出去，作为连接错误处理（首个 SETTINGS 由调用者回退到 epoll 引擎）
+  if (session->max_streams == 0) {
+    return -1;
+  }
+  return send_frame(session, H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+}
+
+static int on_goaway(H2Session* session, const unsigned char* payload, size_t length) {
+  if (length < 8) {
+    return -1;
+  }
+
+  // 编号大于 last_stream_id 的流服务器没有处理，换新连接后重新请求，不计为失败
+  unsigned int last_stream_id = read_uint32(payload) & 0x7fffffff;
+  session->goaway = 1;
+  for (int i = 0; i < session->downloader->thread_count; i++) {
+    H2Stream* stream = &session->streams[i];
+    if (stream->stream_id > last_stream_id) {
+      stream_detach(session, stream, 0);
+      stream->state = H2_STREAM_IDLE;
+      stream->thread->segment->state = THREAD_STATE_IDLE;
+    }
+  }
+  return 0;
+}
+
+static int on_rst_stream(H2Session* session, unsigned int stream_id, const unsigned char* payload, size_t length) {
+  if (length != 4) {
+    return -1;
+  }
+
+  H2Stream* stream = find_stream(session, stream_id);
+  if (!stream) {
+    return 0;
+  }
+
+  unsigned int error_code = read_uint32(payload);
+  if (error_code == H2_ERROR_REFUSED_STREAM) {
+    // 服务器未处理该请求（例如超出并发流上限），立即重新排队
+    stream_detach(session, stream, 0);
+    stream->state = H2_STREAM_IDLE;
+    stream->thread->segment->state = THREAD_STATE_IDLE;
+    return 0;
+  }
+
+  char message[256];
+  snprintf(message, sizeof(message), "流被服务器重置 (错误码: %u)", error_code);
+  stream_fail(session, stream, message, 1, 0);
+  return 0;
+}
+
+// 处理一个完整的帧，返回0继续，-1表示连接错误
+static int handle_frame(H2Session* session, int type, int flags, unsigned int stream_id,
+  const unsigned char* payload, size_t length) {
+  // 头部块的 CONTINUATION 帧必须紧跟在后面
+  if (session->header_stream != 0 && type != H2_FRAME_CONTINUATION) {
+    return -1;
+  }
+
+  switch (type) {
+  case H2_FRAME_DATA:
+    return on_data(session, stream_id, flags, payload, length);
+  case H2_FRAME_HEADERS:
+  case H2_FRAME_CONTINUATION:
+    return on_header_fragment(session, type, flags, stream_id, payload, length);
+  case H2_FRAME_RST_STREAM:
+    return on_rst_stream(session, stream_id, payload, length);
+  case H2_FRAME_SETTINGS:
+    return stream_id == 0 ? on_settings(session, flags, payload, length) : -1;
+  case H2_FRAME_PING:
+    if (length != 8) {
+      return -1;
+    }
+    return (flags & H2_FLAG_ACK) ? 0 : send_frame(session, H2_FRAME_PING, H2_FLAG_ACK, 0, payload, length);
+  case H2_FRAME_GOAWAY:
+    return on_goaway(session, payload, length);
+  case H2_FRAME_PUSH_PROMISE:
+    return -1; // 已通过 SETTINGS_ENABLE_PUSH 禁用服务器推送
+  default:
+    return 0; // PRIORITY、WINDOW_UPDATE（客户端不发送数据）和未知类型的帧忽略
+  }
+}
+
+// 缓冲区中是否已有完整的帧（或者无法接收的过大帧）
+static int frame_buffered(const H2Session* session) {
+  size_t available = session->buffer_end - session->buffer_start;
+  if (available < H2_FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  const unsigned char* header = session->buffer + session->buffer_start;
+  size_t frame_length = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+  return frame_length > H2_MAX_FRAME_SIZE || available >= H2_FRAME_HEADER_SIZE + frame_length;
+}
+
+// 从缓冲区取出一个完整的帧，返回1表示取到，0表示数据不足，-1表示帧过大
+static int next_frame(H2Session* session, int* type, int* flags, unsigned int* stream_id,
+  const unsigned char** payload, size_t* length) {
+  size_t available = session->buffer_end - session->buffer_start;
+  if (available < H2_FRAME_HEADER_SIZE) {
+    return 0;
+  }
+
+  const unsigned char* header = session->buffer + session->buffer_start;
+  size_t frame_length = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+  if (frame_length > H2_MAX_FRAME_SIZE) {
+    return -1;
+  }
+  if (available < H2_FRAME_HEADER_SIZE + frame_length) {
+    return 0;
+  }
+
+  *type = header[3];
+  *flags = header[4];
+  *stream_id = read_uint32(header + 5) & 0x7fffffff;
+  *payload = header + H2_FRAME_HEADER_SIZE;
+  *length = frame_length;
+  session->buffer_start += H2_FRAME_HEADER_SIZE + frame_length;
+  return 1;
+}
+
+// 读取连接上的数据（限速），返回读取的字节数，连接关闭或出错返回-1
+static ssize_t session_fill(H2Session* session) {
+  if (session->buffer_start > 0) {
+    memmove(session->buffer, session->buffer + session->buffer_start, session->buffer_end - session->buffer_start);
+    session->buffer_end -= session->buffer_start;
+    session->buffer_start = 0;
+  }
+
+  size_t space = sizeof(session->buffer) - session->buffer_end;
+  size_t granted = ratelimit_acquire(&session->rate_limiter, space);
+  ssize_t bytes_received = ssl_recv_data(session->connection, session->buffer + session->buffer_end, granted);
+  ratelimit_refund(&session->rate_limiter, granted, bytes_received);
+  if (bytes_received <= 0) {
+    return -1;
+  }
+
+  session->buffer_end += bytes_received;
+  session->connection_bytes += bytes_received;
+  session->last_activity_ms = get_monotonic_ms();
+  return bytes_received;
+}
+
+// 关闭连接，其上未完成的请求计为一次失败并等待重试
+static void session_fail_connection(H2Session* session, const char* message) {
+  for (int i = 0; i < session->downloader->thread_count; i++) {
+    H2Stream* stream = &session->streams[i];
+    if (stream->stream_id != 0) {
+      stream_fail(session, stream, message, 1, 0);
+    }
+  }
+
+  if (session->connection) {
+    close_https_connection(session->connection);
+    session->connection = NULL;
+  }
+  hpack_table_free(&session->decoder);
+  session->open_streams = 0;
+  session->header_stream = 0;
+  session->buffer_start = 0;
+  session->buffer_end = 0;
+}
+
+// 建立连接并交换连接前言和 SETTINGS，返回0成功，H2_NOT_NEGOTIATED 表示服务器只支持 HTTP/1.1，
+// H2_NO_STREAMS 表示服务器不允许打开流，失败返回-1
+static int session_connect(H2Session* session) {
+  const URLInfo* url_info = session->url_info;
+
+  int sockfd = connect_to_host(url_info->host, url_info->port);
+  if (sockfd < 0) {
+    return -1;
+  }
+
+  HttpsConnection* connection = https_connection_attach(sockfd, url_info->host, url_info->port);
+  if (!connection) {
+    close(sockfd);
+    return -1;
+  }
+  if (https_connection_offer_h2(connection) != 0 || ssl_handshake_step(connection) != 0) {
+    close_https_connection(connection);
+    return -1;
+  }
+  if (!connection->http2) {
+    close_https_connection(connection);
+    return H2_NOT_NEGOTIATED;
+  }
+
+  session->connection = connection;
+  session->connection_count++;
+  session->next_stream_id = 1;
+  session->max_streams = H2_DEFAULT_MAX_STREAMS;
+  session->open_streams = 0;
+  session->goaway = 0;
+  session->connection_unacked = 0;
+  session->header_stream = 0;
+  session->buffer_start = 0;
+  session->buffer_end = 0;
+  session->connection_bytes = 0;
+  session->speed_window_ms = 0;
+  session->last_activity_ms = get_monotonic_ms();
+  hpack_table_init(&session->decoder);
+
+  // 连接前言 + SETTINGS（禁用推送，设置流的初始接收窗口）+ 扩大连接窗口
+  unsigned char settings[12] = {
+    0, H2_SETTINGS_ENABLE_PUSH, 0, 0, 0, 0,
+    0, H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    (H2_STREAM_WINDOW >> 24) & 0xff, (H2_STREAM_WINDOW >> 16) & 0xff, (H2_STREAM_WINDOW >> 8) & 0xff, H2_STREAM_WINDOW & 0xff
+  };
+  if (ssl_send_data(connection, H2_CONNECTION_PREFACE, sizeof(H2_CONNECTION_PREFACE) - 1) != 0 ||
+    send_frame(session, H2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) != 0 ||
+    send_window_update(session, 0, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW) != 0) {
+    session_fail_connection(session, "HTTP/2 连接初始化失败");
+    return -1;
+  }
+
+  // 服务器的第一个帧必须是 SETTINGS，收到后再发出请求，不超过它的并发流上限
+  int type = -1;
+  int flags;
+  unsigned int stream_id;
+  const unsigned char* payload;
+  size_t length;
+  int result;
+  while ((result = next_frame(session, &type, &flags, &stream_id, &payload, &length)) == 0) {
+    if (session_fill(session) < 0) {
+      break;
+    }
+  }
+  if (result != 1 || type != H2_FRAME_SETTINGS || (flags & H2_FLAG_ACK) ||
+    on_settings(session, flags, payload, length) != 0) {
+    int no_streams = result == 1 && session->max_streams == 0;
+    session_fail_connection(session, "HTTP/2 连接初始化失败");
+    return no_streams ? H2_NO_STREAMS : -1;
+  }
+  return 0;
+}
+
+// 低速检测：连接在 low_speed_time 秒内的平均速度低于 low_speed_limit 时返回1（所有流共用一个连接，限速时按整个限速计算）
+static int session_too_slow(H2Session* session, double now) {
+  const DownloadOptions* options = get_download_options();
+  long long limit = ratelimit_low_speed_limit(&session->rate_limiter, 1);
+  if (limit <= 0 || session->open_streams == 0) {
+    session->speed_window_ms = 0;
+    return 0;
+  }
+  if (session->speed_window_ms == 0) {
+    session->speed_window_ms = now;
+    session->speed_window_bytes = session->connection_bytes;
+    return 0;
+  }
+
+  double elapsed = now - session->speed_window_ms;
+  if (elapsed < options->low_speed_time * 1000.0) {
+    return 0;
+  }
+  long long bytes = session->connection_bytes - session->speed_window_bytes;
+  session->speed_window_ms = now;
+  session->speed_window_bytes = session->connection_bytes;
+  return bytes * 1000.0 / elapsed < limit;
+}
+
+// 在并发流上限内发出排队的请求，返回尚未结束的段数
+static int session_sweep(H2Session* session, double now) {
+  int pending = 0;
+
+  for (int i = 0; i < session->downloader->thread_count; i++) {
+    H2Stream* stream = &session->streams[i];
+
+    if (stream->state == H2_STREAM_RETRY_WAIT && now >= stream->retry_at_ms) {
+      stream->state = H2_STREAM_IDLE;
+    }
+    if (stream->state == H2_STREAM_IDLE && session->connection && !session->goaway &&
+      session->open_streams < (int)session->max_streams && stream_start(session, stream) != 0) {
+      session_fail_connection(session, "请求发送失败");
+    }
+    if (stream->state != H2_STREAM_DONE && stream->state != H2_STREAM_FAILED) {
+      pending++;
+    }
+  }
+  return pending;
+}
+
+// 所有段都不再重试时结束
+static void session_fail_all(H2Session* session, const char* message) {
+  for (int i = 0; i < session->downloader->thread_count; i++) {
+    H2Stream* stream = &session->streams[i];
+    if (stream->state != H2_STREAM_DONE && stream->state != H2_STREAM_FAILED) {
+      stream->retries = RETRY_MAX_ATTEMPTS;
+      stream_fail(session, stream, message, 0, 0);
+    }
+  }
+}
+
+static void session_run(H2Session* session) {
+  MultiThreadDownloader* downloader = session->downloader;
+
+  while (!downloader->should_stop) {
+    double now = get_monotonic_ms();
+    if (session_sweep(session, now) == 0) {
+      break;
+    }
+
+    if (!session->connection) {
+      if (now < session->reconnect_at_ms) {
+        usleep(H2_POLL_INTERVAL_MS * 1000);
+        continue;
+      }
+      if (session_connect(session) != 0) {
+        session->connection_failures++;
+        if (session->connection_failures >= RETRY_MAX_ATTEMPTS) {
+          session_fail_all(session, "HTTP/2 连接失败");
+          break;
+        }
+        session->reconnect_at_ms = now + retry_backoff_ms(session->connection_failures);
+      }
+      continue;
+    }
+
+    // 服务器发送 GOAWAY 后等已发出的请求完成，再换新连接请求剩余的段
+    if (session->goaway && session->open_streams == 0) {
+      session_fail_connection(session, "连接已关闭");
+      continue;
+    }
+
+    // 先处理缓冲区中已有的帧；缓冲区和 TLS 层都没有数据时等待，期间定期检查重试和超时
+    if (!frame_buffered(session)) {
+      if (SSL_pending(session->connection->ssl) == 0) {
+        struct pollfd poll_fd = { .fd = session->connection->sockfd, .events = POLLIN };
+        int ready = poll(&poll_fd, 1, H2_POLL_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR) {
+          session_fail_connection(session, "连接等待失败");
+          continue;
+        }
+        // 没有打开的流时也检查超时：请求发不出去的连接不会无限等待
+        if (ready <= 0) {
+          if (now - session->last_activity_ms > get_io_idle_timeout_ms()) {
+            session_fail_connection(session, "连接超时");
+          }
+          continue;
+        }
+      }
+
+      if (session_fill(session) < 0) {
+        session_fail_connection(session, "网络接收失败");
+        continue;
+      }
+    }
+
+    int type;
+    int flags;
+    unsigned int stream_id;
+    const unsigned char* payload;
+    size_t length;
+    int result;
+    while ((result = next_frame(session, &type, &flags, &stream_id, &payload, &length)) == 1) {
+      if (handle_frame(session, type, flags, stream_id, payload, length) != 0) {
+        result = -1;
+        break;
+      }
+      if (!session->connection) {
+        break;
+      }
+    }
+    if (result < 0) {
+      if (session->connection) {
+        unsigned char goaway[8] = { 0, 0, 0, 0, 0, 0, 0, H2_ERROR_PROTOCOL };
+        send_frame(session, H2_FRAME_GOAWAY, 0, 0, goaway, sizeof(goaway));
+      }
+      session_fail_connection(session, "HTTP/2 协议错误");
+      continue;
+    }
+
+    session->connection_failures = 0;
+    if (session_too_slow(session, get_monotonic_ms())) {
+      session_fail_connection(session, "传输速度过低");
+    }
+  }
+
+  // 停止或出错时关闭连接和所有未完成的段
+  if (session->connection) {
+    unsigned char goaway[8] = { 0 };
+    send_frame(session, H2_FRAME_GOAWAY, 0, 0, goaway, sizeof(goaway));
+    close_https_connection(session->connection);
+    session->connection = NULL;
+  }
+  hpack_table_free(&session->decoder);
+
+  for (int i = 0; i < downloader->thread_count; i++) {
+    H2Stream* stream = &session->streams[i];
+    if (stream->state != H2_STREAM_DONE && stream->state != H2_STREAM_FAILED) {
+      stream->thread->segment->state = THREAD_STATE_STOPPED;
+      stream->state = H2_STREAM_FAILED;
+      session->failed_streams++;
+    }
+    if (stream->output_file) {
+      fclose(stream->output_file);
+      stream->output_file = NULL;
+    }
+  }
+}
+
+int h2_engine_download(MultiThreadDownloader* downloader) {
+  if (!downloader || !downloader->threads || downloader->thread_count <= 0) {
+    return -1;
+  }
+
+  // 初始化时已跟随重定向并解析好最终地址
+  URLInfo url_info = downloader->mirrors[0].url_info;
+  if (url_info.protocol_type != PROTOCOL_HTTPS) {
+    printf("%sHTTP/2 需要 HTTPS，改用 epoll 引擎%s\n", YELLOW, RESET);
+    return event_engine_download(downloader);
+  }
+  if (init_openssl() != 0) {
+    return -1;
+  }
+
+  H2Session* session = calloc(1, sizeof(H2Session));
+  H2Stream* streams = calloc(downloader->thread_count, sizeof(H2Stream));
+  if (!session || !streams) {
+    fprintf(stderr, "错误: 内存分配失败\n");
+    free(session);
+    free(streams);
+    return -1;
+  }
+
+  session->downloader = downloader;
+  session->url_info = &url_info;
+  session->streams = streams;
+  ratelimit_init(&session->rate_limiter, url_info.host, &downloader->rate_bucket);
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    streams[i].thread = thread;
+    streams[i].state = H2_STREAM_IDLE;
+    streams[i].expected_bytes = thread->segment->end_byte - thread->segment->start_byte + 1;
+  }
+
+  // 第一个连接决定是否使用 HTTP/2；连接失败时在下载循环中重试
+  int connect_result = session_connect(session);
+  if (connect_result == H2_NOT_NEGOTIATED || connect_result == H2_NO_STREAMS) {
+    printf("%s%s，改用 epoll 引擎%s\n", YELLOW,
+      connect_result == H2_NOT_NEGOTIATED ? "服务器未通过 ALPN 选择 HTTP/2" : "HTTP/2 服务器不允许打开流", RESET);
+    free(streams);
+    free(session);
+    return event_engine_download(downloader);
+  }
+  if (connect_result != 0) {
+    session->connection_failures = 1;
+    session->reconnect_at_ms = get_monotonic_ms() + retry_backoff_ms(1);
+  }
+  else {
+    printf("%sHTTP/2: 服务器允许 %u 个并发流%s\n", CYAN, session->max_streams, RESET);
+  }
+
+  session_run(session);
+
+  printf("%sHTTP/2: %d 个连接, %d 个流请求%s\n", CYAN, session->connection_count, session->request_count, RESET);
+  int failed_streams = session->failed_streams;
+  free(streams);
+  free(session);
+  return failed_streams;
+}
+
+#else
+
+int h2_engine_download(MultiThreadDownloader* downloader) {
+  printf("%sHTTPS 支持未编译，改用 epoll 引擎%s\n", YELLOW, RESET);
+  return event_engine_download(downloader);
+}
+
+#endif
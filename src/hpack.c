@@ -0,0 +1,440 @@
+#include "../include/common.h"
+#include "../include/hpack.h"
+
+#define HPACK_TABLE_CAPACITY (HPACK_TABLE_SIZE / 32)
+#define HPACK_ENTRY_OVERHEAD 32 // RFC 7541 4.1：每个条目额外计算的大小
+#define HPACK_HUFFMAN_MAX_BITS 30 // Huffman 码的最大长度
+
+// 静态表（RFC 7541 附录 A），索引从1开始
+static const char* static_table[][2] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+#define HPACK_STATIC_COUNT ((int)(sizeof(static_table) / sizeof(static_table[0])))
+
+// Huffman 码（RFC 7541 附录 B）是规范 Huffman 码：同一长度的码按符号值连续递增，
+// 因此只需保存每种长度的码数和按 (长度, 符号) 排序的符号即可解码
+static const unsigned char huffman_symbols[256] = {
+  48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+  52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+  110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+  77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+  119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+  43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+  179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+  163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+  158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+  144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+  212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+  2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+  21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+};
+
+// 各长度（0-30 位）的码数，EOS 不在其中
+static const unsigned short huffman_counts[HPACK_HUFFMAN_MAX_BITS + 1] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3
+};
+
+// Huffman 解码，返回解码后的长度，失败返回-1
+static int huffman_decode(const unsigned char* data, size_t length, char* output, size_t output_size) {
+  // 每种长度的第一个码和它在符号表中的位置
+  unsigned long first_code[HPACK_HUFFMAN_MAX_BITS + 1];
+  int first_symbol[HPACK_HUFFMAN_MAX_BITS + 1];
+  unsigned long code = 0;
+  int symbol = 0;
+  for (int bits = 1; bits <= HPACK_HUFFMAN_MAX_BITS; bits++) {
+    code <<= 1;
+    first_code[bits] = code;
+    first_symbol[bits] = symbol;
+    code += huffman_counts[bits];
+    symbol += huffman_counts[bits];
+  }
+
+  size_t written = 0;
+  code = 0;
+  int bits = 0;
+  for (size_t i = 0; i < length; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = (code << 1) | ((data[i] >> bit) & 1);
+      bits++;
+      if (bits > HPACK_HUFFMAN_MAX_BITS) {
+        return -1; // EOS 或无效的码
+      }
+      if (code - first_code[bits] < huffman_counts[bits]) {
+        if (written >= output_size) {
+          return -1;
+        }
+        output[written++] = (char)huffman_symbols[first_symbol[bits] + (code - first_code[bits])];
+        code = 0;
+        bits = 0;
+      }
+    }
+  }
+
+  // 末尾只能是不足8位、全为1的填充（EOS 的前缀）
+  if (bits >= 8 || code != (1UL << bits) - 1) {
+    return -1;
+  }
+  return (int)written;
+}
+
+// 解码 N 位前缀的整数（RFC 7541 5.1）
+static int decode_integer(const unsigned char** position, const unsigned char* end, int prefix_bits, size_t* value) {
+  if (*position >= end) {
+    return -1;
+  }
+
+  size_t prefix_max = (1U << prefix_bits) - 1;
+  size_t result = **position & prefix_max;
+  (*position)++;
+  if (result < prefix_max) {
+    *value = result;
+    return 0;
+  }
+
+  for (int shift = 0; *position < end && shift <= 28; shift += 7) {
+    unsigned char byte = **position;
+    (*position)++;
+    result += (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// 编码 N 位前缀的整数，flags 为第一个字节中前缀之外的高位
+static int encode_integer(unsigned char* output, size_t output_size, size_t value, int prefix_bits, unsigned char flags) {
+  size_t prefix_max = (1U << prefix_bits) - 1;
+  size_t written = 0;
+
+  if (output_size == 0) {
+    return -1;
+  }
+  if (value < prefix_max) {
+    output[written++] = flags | (unsigned char)value;
+    return (int)written;
+  }
+
+  output[written++] = flags | (unsigned char)prefix_max;
+  value -= prefix_max;
+  while (value >= 0x80) {
+    if (written >= output_size) {
+      return -1;
+    }
+    output[written++] = (unsigned char)(value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  if (written >= output_size) {
+    return -1;
+  }
+  output[written++] = (unsigned char)value;
+  return (int)written;
+}
+
+// 解码一个字符串字面量到 scratch 中，成功后 scratch 向后移动
+static int decode_string(const unsigned char** position, const unsigned char* end,
+  char** scratch, char* scratch_end, const char** string, size_t* string_length) {
+  if (*position >= end) {
+    return -1;
+  }
+
+  int huffman = (**position & 0x80) != 0;
+  size_t length;
+  if (decode_integer(position, end, 7, &length) != 0 || length > (size_t)(end - *position)) {
+    return -1;
+  }
+
+  if (huffman) {
+    int decoded = huffman_decode(*position, length, *scratch, scratch_end - *scratch);
+    if (decoded < 0) {
+      return -1;
+    }
+    *string_length = decoded;
+  }
+  else {
+    if (length > (size_t)(scratch_end - *scratch)) {
+      return -1;
+    }
+    memcpy(*scratch, *position, length);
+    *string_length = length;
+  }
+
+  *string = *scratch;
+  *scratch += *string_length;
+  *position += length;
+  return 0;
+}
+
+void hpack_table_init(HpackTable* table) {
+  memset(table, 0, sizeof(HpackTable));
+  table->max_size = HPACK_TABLE_SIZE;
+}
+
+// 淘汰最旧的条目
+static void table_evict(HpackTable* table) {
+  HpackEntry* entry = &table->entries[(table->first + table->count - 1) % HPACK_TABLE_CAPACITY];
+  table->size -= entry->name_length + entry->value_length + HPACK_ENTRY_OVERHEAD;
+  free(entry->name);
+  memset(entry, 0, sizeof(HpackEntry));
+  table->count--;
+}
+
+void hpack_table_free(HpackTable* table) {
+  while (table->count > 0) {
+    table_evict(table);
+  }
+  table->size = 0;
+}
+
+// 加入新条目，超出上限时先淘汰旧条目；name/value 可能指向即将被淘汰的条目，先复制
+static int table_insert(HpackTable* table, const char* name, size_t name_length, const char* value, size_t value_length) {
+  size_t entry_size = name_length + value_length + HPACK_ENTRY_OVERHEAD;
+  char* buffer = malloc(name_length + value_length + 2);
+  if (!buffer) {
+    return -1;
+  }
+  memcpy(buffer, name, name_length);
+  buffer[name_length] = '\0';
+  memcpy(buffer + name_length + 1, value, value_length);
+  buffer[name_length + 1 + value_length] = '\0';
+
+  while (table->count > 0 && table->size + entry_size > table->max_size) {
+    table_evict(table);
+  }
+
+  // 比整个表还大的条目使表变空，但不加入（RFC 7541 4.4）
+  if (entry_size > table->max_size) {
+    free(buffer);
+    return 0;
+  }
+
+  table->first = (table->first + HPACK_TABLE_CAPACITY - 1) % HPACK_TABLE_CAPACITY;
+  HpackEntry* entry = &table->entries[table->first];
+  entry->name = buffer;
+  entry->name_length = name_length;
+  entry->value = buffer + name_length + 1;
+  entry->value_length = value_length;
+  table->count++;
+  table->size += entry_size;
+  return 0;
+}
+
+// 按索引查找静态表或动态表中的字段
+static int table_lookup(const HpackTable* table, size_t index, const char** name, size_t* name_length,
+  const char** value, size_t* value_length) {
+  if (index == 0) {
+    return -1;
+  }
+  if (index <= HPACK_STATIC_COUNT) {
+    *name = static_table[index - 1][0];
+    *name_length = strlen(*name);
+    *value = static_table[index - 1][1];
+    *value_length = strlen(*value);
+    return 0;
+  }
+
+  size_t dynamic_index = index - HPACK_STATIC_COUNT - 1;
+  if (dynamic_index >= (size_t)table->count) {
+    return -1;
+  }
+  const HpackEntry* entry = &table->entries[(table->first + dynamic_index) % HPACK_TABLE_CAPACITY];
+  *name = entry->name;
+  *name_length = entry->name_length;
+  *value = entry->value;
+  *value_length = entry->value_length;
+  return 0;
+}
+
+int hpack_decode_block(HpackTable* table, const unsigned char* data, size_t length, HpackHeaderCallback callback, void* context) {
+  // 解码出的字符串放在临时缓冲区中（Huffman 解码后最多为原长度的 8/5）
+  size_t scratch_size = length * 2 + 16;
+  char* scratch_start = malloc(scratch_size);
+  if (!scratch_start) {
+    return -1;
+  }
+  char* scratch = scratch_start;
+  char* scratch_end = scratch_start + scratch_size;
+
+  const unsigned char* position = data;
+  const unsigned char* end = data + length;
+  int result = 0;
+  int allow_size_update = 1; // 动态表大小更新只能出现在头部块开头
+
+  while (position < end) {
+    unsigned char first = *position;
+    const char* name;
+    const char* value;
+    size_t name_length;
+    size_t value_length;
+    size_t index;
+
+    if (first & 0x80) {
+      // 索引字段
+      if (decode_integer(&position, end, 7, &index) != 0 ||
+        table_lookup(table, index, &name, &name_length, &value, &value_length) != 0) {
+        result = -1;
+        break;
+      }
+      callback(context, name, name_length, value, value_length);
+      allow_size_update = 0;
+      continue;
+    }
+
+    if ((first & 0xe0) == 0x20) {
+      // 动态表大小更新
+      if (!allow_size_update || decode_integer(&position, end, 5, &index) != 0 || index > HPACK_TABLE_SIZE) {
+        result = -1;
+        break;
+      }
+      table->max_size = index;
+      while (table->count > 0 && table->size > table->max_size) {
+        table_evict(table);
+      }
+      continue;
+    }
+
+    // 字面量字段：带索引（01）、不索引（0000）、永不索引（0001）
+    int incremental = (first & 0xc0) == 0x40;
+    if (decode_integer(&position, end, incremental ? 6 : 4, &index) != 0) {
+      result = -1;
+      break;
+    }
+    if (index > 0) {
+      const char* unused_value;
+      size_t unused_length;
+      if (table_lookup(table, index, &name, &name_length, &unused_value, &unused_length) != 0) {
+        result = -1;
+        break;
+      }
+    }
+    else if (decode_string(&position, end, &scratch, scratch_end, &name, &name_length) != 0) {
+      result = -1;
+      break;
+    }
+    if (decode_string(&position, end, &scratch, scratch_end, &value, &value_length) != 0) {
+      result = -1;
+      break;
+    }
+
+    callback(context, name, name_length, value, value_length);
+    allow_size_update = 0;
+
+    if (incremental && table_insert(table, name, name_length, value, value_length) != 0) {
+      result = -1;
+      break;
+    }
+  }
+
+  free(scratch_start);
+  return result;
+}
+
+// 编码不使用 Huffman 的字符串字面量
+static int encode_string(unsigned char* output, size_t output_size, const char* string) {
+  size_t length = strlen(string);
+  int written = encode_integer(output, output_size, length, 7, 0x00);
+  if (written < 0 || length > output_size - written) {
+    return -1;
+  }
+  memcpy(output + written, string, length);
+  return written + (int)length;
+}
+
+int hpack_encode_header(unsigned char* output, size_t output_size, const char* name, const char* value) {
+  int name_index = 0;
+  for (int i = 0; i < HPACK_STATIC_COUNT; i++) {
+    if (strcmp(static_table[i][0], name) != 0) {
+      continue;
+    }
+    if (strcmp(static_table[i][1], value) == 0) {
+      return encode_integer(output, output_size, i + 1, 7, 0x80);
+    }
+    if (name_index == 0) {
+      name_index = i + 1;
+    }
+  }
+
+  // 不索引的字面量：引用静态表中的名称，或者直接给出名称
+  int written = encode_integer(output, output_size, name_index, 4, 0x00);
+  if (written < 0) {
+    return -1;
+  }
+  if (name_index == 0) {
+    int name_written = encode_string(output + written, output_size - written, name);
+    if (name_written < 0) {
+      return -1;
+    }
+    written += name_written;
+  }
+
+  int value_written = encode_string(output + written, output_size - written, value);
+  if (value_written < 0) {
+    return -1;
+  }
+  return written + value_written;
+}
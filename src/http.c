@@ -130,6 +130,11 @@ int parse_status_line(const char* status_line, HttpResponseInfo* response_info)
     return -1;
   }
 
+  // HTTP/1.0 默认不保持连接
+  if (strcmp(http_version, "HTTP/1.0") == 0) {
+    response_info->connection_close = 1;
+  }
+
   // 提供默认值
   if (parsed_fields == 2) {
     strncpy(response_info->status_message, "OK", sizeof(response_info->status_message) - 1);
@@ -218,6 +223,9 @@ int process_header_field(const char* name, const char* value, HttpResponseInfo*
     if (strcasecmp(value, "close") == 0) {
       response_info->connection_close = 1;
     }
+    else if (strcasecmp(value, "keep-alive") == 0) {
+      response_info->connection_close = 0;
+    }
   }
   else if (strcasecmp(name, "Location") == 0) {
     strncpy(response_info->location, value,
@@ -233,6 +241,12 @@ int process_header_field(const char* name, const char* value, HttpResponseInfo*
   else if (strcasecmp(name, "Content-Range") == 0) {
     strncpy(response_info->content_range, value, sizeof(response_info->content_range) - 1);
   }
+  else if (strcasecmp(name, "ETag") == 0) {
+    strncpy(response_info->etag, value, sizeof(response_info->etag) - 1);
+  }
+  else if (strcasecmp(name, "Last-Modified") == 0) {
+    strncpy(response_info->last_modified, value, sizeof(response_info->last_modified) - 1);
+  }
   else if (strcasecmp(name, "Set-Cookie") == 0) {
     if (strlen(response_info->cookies) + strlen(value) < sizeof(response_info->cookies)) {
       if (strlen(response_info->cookies) > 0) {
@@ -347,4 +361,49 @@ int parse_http_response_headers(int sockfd, HttpResponseInfo* response_info, Htt
   }
 
   return 0;
-}
\ No newline at end of file
+}
+
+int parse_http_response_block(const char* header_block, size_t length, HttpResponseInfo* response_info) {
+  char line_buffer[8192];
+  int line_count = 0;
+  size_t position = 0;
+
+  // 初始化响应信息结构体
+  memset(response_info, 0, sizeof(HttpResponseInfo));
+  response_info->content_length = -1; // 未知长度
+
+  while (position < length) {
+    const char* line_start = header_block + position;
+    const char* line_end = memchr(line_start, '\n', length - position);
+    size_t line_length = line_end ? (size_t)(line_end - line_start) : length - position;
+    position += line_length + (line_end ? 1 : 0);
+
+    // 去掉行尾的\r
+    if (line_length > 0 && line_start[line_length - 1] == '\r') {
+      line_length--;
+    }
+
+    if (line_length == 0) {
+      break; // 空行表示头部结束
+    }
+    if (line_length >= sizeof(line_buffer)) {
+      return -1;
+    }
+
+    memcpy(line_buffer, line_start, line_length);
+    line_buffer[line_length] = '\0';
+
+    if (line_count == 0) {
+      if (parse_status_line(line_buffer, response_info) != 0) {
+        return -1;
+      }
+    }
+    else if (parse_header_field(line_buffer, response_info) != 0) {
+      fprintf(stderr, "警告：无法解析头部字段: %s\n", line_buffer);
+    }
+
+    line_count++;
+  }
+
+  return line_count > 0 ? 0 : -1;
+}
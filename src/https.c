@@ -6,13 +6,30 @@
 #include "../include/http.h"
 #include "../include/progress.h"
 #include "../include/utils.h"
+#include "../include/ratelimit.h"
 #ifdef WITH_OPENSSL
 
 // 全局初始化标志
 static int openssl_initialized = 0;
 
+// 进程内共享的 SSL 上下文和客户端会话缓存
+#define TLS_SESSION_CACHE_SIZE 32
+
+typedef struct {
+  char key[528];              // host:port
+  SSL_SESSION* session;       // 最近一次可恢复的会话
+} TlsSessionEntry;
+
+static SSL_CTX* shared_ssl_ctx = NULL;
+static TlsSessionEntry session_cache[TLS_SESSION_CACHE_SIZE];
+static int session_cache_next = 0;
+static TlsHandshakeStats handshake_stats = { 0 };
+static pthread_mutex_t tls_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 int init_openssl() {
+  pthread_mutex_lock(&tls_mutex);
   if (openssl_initialized) {
+    pthread_mutex_unlock(&tls_mutex);
     return 0; // 已初始化
   }
 
@@ -22,23 +39,89 @@ int init_openssl() {
   SSL_library_init();
 
   openssl_initialized = 1;
+  pthread_mutex_unlock(&tls_mutex);
   // printf("OpenSSL 库初始化成功\n");
   return 0;
 }
 
 void cleanup_openssl() {
+  pthread_mutex_lock(&tls_mutex);
   if (!openssl_initialized) {
+    pthread_mutex_unlock(&tls_mutex);
     return;
   }
 
+  // 释放缓存的会话和共享上下文（仍在使用的 SSL 对象各自持有上下文引用）
+  for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (session_cache[i].session) {
+      SSL_SESSION_free(session_cache[i].session);
+    }
+  }
+  memset(session_cache, 0, sizeof(session_cache));
+  session_cache_next = 0;
+
+  if (shared_ssl_ctx) {
+    SSL_CTX_free(shared_ssl_ctx);
+    shared_ssl_ctx = NULL;
+  }
+
   // 清理 OpenSSL 库
   EVP_cleanup();
   ERR_free_strings();
 
   openssl_initialized = 0;
+  pthread_mutex_unlock(&tls_mutex);
   // printf("OpenSSL 库清理完成\n");
 }
 
+// 保存服务器下发的会话（TLS 1.3 的票据在握手之后才到达）
+static int on_new_session(SSL* ssl, SSL_SESSION* session) {
+  const char* key = SSL_get_app_data(ssl);
+  if (!key || !SSL_SESSION_is_resumable(session)) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&tls_mutex);
+  TlsSessionEntry* entry = NULL;
+  for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (session_cache[i].session && strcmp(session_cache[i].key, key) == 0) {
+      entry = &session_cache[i];
+      break;
+    }
+  }
+  if (!entry) {
+    entry = &session_cache[session_cache_next];
+    session_cache_next = (session_cache_next + 1) % TLS_SESSION_CACHE_SIZE;
+  }
+
+  if (entry->session) {
+    SSL_SESSION_free(entry->session);
+  }
+  strncpy(entry->key, key, sizeof(entry->key) - 1);
+  entry->key[sizeof(entry->key) - 1] = '\0';
+  entry->session = session;
+  pthread_mutex_unlock(&tls_mutex);
+
+  return 1; // 会话的引用由缓存持有
+}
+
+// 查找可恢复的会话，返回的引用由调用者释放
+static SSL_SESSION* lookup_session(const char* key) {
+  SSL_SESSION* session = NULL;
+
+  pthread_mutex_lock(&tls_mutex);
+  for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (session_cache[i].session && strcmp(session_cache[i].key, key) == 0) {
+      session = session_cache[i].session;
+      SSL_SESSION_up_ref(session);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&tls_mutex);
+
+  return session;
+}
+
 SSL_CTX* create_ssl_context() {
   if (!openssl_initialized) {
     fprintf(stderr, "错误: OpenSSL 库未初始化\n");
@@ -56,10 +139,38 @@ SSL_CTX* create_ssl_context() {
   // 设置验证模式
   SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
 
+  // 客户端会话缓存：由 on_new_session 按主机保存，连接时显式恢复
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+
   // printf("SSL 上下文创建成功\n");
   return ctx;
 }
 
+SSL_CTX* get_shared_ssl_context() {
+  pthread_mutex_lock(&tls_mutex);
+  if (!shared_ssl_ctx && openssl_initialized) {
+    shared_ssl_ctx = create_ssl_context();
+  }
+  SSL_CTX* ctx = shared_ssl_ctx;
+  pthread_mutex_unlock(&tls_mutex);
+
+  if (!ctx) {
+    fprintf(stderr, "错误: OpenSSL 库未初始化\n");
+  }
+  return ctx;
+}
+
+void get_tls_handshake_stats(TlsHandshakeStats* stats) {
+  if (!stats) {
+    return;
+  }
+
+  pthread_mutex_lock(&tls_mutex);
+  *stats = handshake_stats;
+  pthread_mutex_unlock(&tls_mutex);
+}
+
 void close_https_connection(HttpsConnection* https_connection) {
   if (!https_connection) return;
 
@@ -72,22 +183,18 @@ void close_https_connection(HttpsConnection* https_connection) {
     close(https_connection->sockfd);
   }
 
-  if (https_connection->ctx) {
-    SSL_CTX_free(https_connection->ctx);
-  }
+  // ctx 为共享上下文，不在这里释放
 
   free(https_connection);
   // printf("HTTPS 连接已关闭\n");
 }
 
-HttpsConnection* create_https_connection(const char* hostname, int port) {
+HttpsConnection* https_connection_attach(int sockfd, const char* hostname, int port) {
   if (!openssl_initialized) {
     fprintf(stderr, "错误: OpenSSL 库未初始化\n");
     return NULL;
   }
 
-  // printf("正在建立 HTTPS 连接到 %s:%d...\n", hostname, port);
-
   // 分配内存
   HttpsConnection* https_connection = malloc(sizeof(HttpsConnection));
   if (!https_connection) {
@@ -96,58 +203,32 @@ HttpsConnection* create_https_connection(const char* hostname, int port) {
   }
 
   // 初始化结构体
-  https_connection->ctx = NULL;
-  https_connection->ssl = NULL;
-  https_connection->sockfd = -1;
+  memset(https_connection, 0, sizeof(HttpsConnection));
+  https_connection->sockfd = sockfd;
+  snprintf(https_connection->session_key, sizeof(https_connection->session_key), "%s:%d", hostname, port);
 
-  // 创建 SSL 上下文
-  https_connection->ctx = create_ssl_context();
+  // 使用进程内共享的 SSL 上下文
+  https_connection->ctx = get_shared_ssl_context();
   if (!https_connection->ctx) {
     fprintf(stderr, "错误: SSL 上下文创建失败\n");
     free(https_connection);
     return NULL;
   }
 
-  // 解析主机名为 IP 地址
-  char ip_str[INET_ADDRSTRLEN];
-  if (resolve_hostname(hostname, ip_str, sizeof(ip_str)) != 0) {
-    fprintf(stderr, "错误: 无法解析主机名 %s\n", hostname);
-    SSL_CTX_free(https_connection->ctx);
-    free(https_connection);
-    return NULL;
-  }
-
-  // printf("已解析 %s -> %s\n", hostname, ip_str);
-
-  // 建立 TCP 连接
-  https_connection->sockfd = create_tcp_connection(ip_str, port);
-  if (https_connection->sockfd < 0) {
-    fprintf(stderr, "错误: TCP 连接建立失败\n");
-    SSL_CTX_free(https_connection->ctx);
-    free(https_connection);
-    return NULL;
-  }
-
-  // printf("TCP 连接建立成功\n");
-
   // 创建 SSL 对象
   https_connection->ssl = SSL_new(https_connection->ctx);
   if (!https_connection->ssl) {
     fprintf(stderr, "错误: 无法创建 SSL 对象\n");
     ERR_print_errors_fp(stderr);
-    close(https_connection->sockfd);
-    SSL_CTX_free(https_connection->ctx);
     free(https_connection);
     return NULL;
   }
 
   // 将 SSL 对象与 socket 关联
-  if (SSL_set_fd(https_connection->ssl, https_connection->sockfd) != 1) {
+  if (SSL_set_fd(https_connection->ssl, sockfd) != 1) {
     fprintf(stderr, "错误: 无法将 SSL 对象与 socket 关联\n");
     ERR_print_errors_fp(stderr);
     SSL_free(https_connection->ssl);
-    close(https_connection->sockfd);
-    SSL_CTX_free(https_connection->ctx);
     free(https_connection);
     return NULL;
   }
@@ -157,21 +238,39 @@ HttpsConnection* create_https_connection(const char* hostname, int port) {
     fprintf(stderr, "警告: 无法设置 SNI\n");
   }
 
-  // 执行 SSL 握手
-  // printf("正在执行 SSL 握手...\n");
+  // 有同一主机的缓存会话时尝试恢复，省去完整握手
+  SSL_set_app_data(https_connection->ssl, https_connection->session_key);
+  SSL_SESSION* cached_session = lookup_session(https_connection->session_key);
+  if (cached_session) {
+    SSL_set_session(https_connection->ssl, cached_session);
+    SSL_SESSION_free(cached_session);
+  }
+
+  return https_connection;
+}
+
+int ssl_handshake_step(HttpsConnection* https_connection) {
+  if (!https_connection || !https_connection->ssl) {
+    return -1;
+  }
+
+  if (https_connection->handshake_started_ms == 0) {
+    https_connection->handshake_started_ms = get_monotonic_ms();
+  }
+
   int ssl_connect_result = SSL_connect(https_connection->ssl);
   if (ssl_connect_result != 1) {
     int ssl_error = SSL_get_error(https_connection->ssl, ssl_connect_result);
+
+    // 非阻塞 socket 上握手尚未完成
+    if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
+      return ssl_error;
+    }
+
     fprintf(stderr, "错误: SSL 握手失败 (错误代码: %d)\n", ssl_error);
 
     // 错误信息
     switch (ssl_error) {
-    case SSL_ERROR_WANT_READ:
-      fprintf(stderr, "SSL_ERROR_WANT_READ: 需要更多数据\n");
-      break;
-    case SSL_ERROR_WANT_WRITE:
-      fprintf(stderr, "SSL_ERROR_WANT_WRITE: 需要写入数据\n");
-      break;
     case SSL_ERROR_SYSCALL:
       fprintf(stderr, "SSL_ERROR_SYSCALL: 系统调用错误\n");
       perror("系统错误");
@@ -184,11 +283,69 @@ HttpsConnection* create_https_connection(const char* hostname, int port) {
       fprintf(stderr, "未知的 SSL 错误\n");
       break;
     }
+    return -1;
+  }
 
-    SSL_free(https_connection->ssl);
-    close(https_connection->sockfd);
-    SSL_CTX_free(https_connection->ctx);
-    free(https_connection);
+  // 记录 ALPN 协商结果、握手类型和耗时
+  const unsigned char* alpn = NULL;
+  unsigned int alpn_length = 0;
+  SSL_get0_alpn_selected(https_connection->ssl, &alpn, &alpn_length);
+  https_connection->http2 = alpn_length == 2 && memcmp(alpn, "h2", 2) == 0;
+  https_connection->session_reused = SSL_session_reused(https_connection->ssl);
+  https_connection->handshake_ms = get_monotonic_ms() - https_connection->handshake_started_ms;
+
+  pthread_mutex_lock(&tls_mutex);
+  if (https_connection->session_reused) {
+    handshake_stats.resumed_handshakes++;
+    handshake_stats.resumed_handshake_ms += https_connection->handshake_ms;
+  }
+  else {
+    handshake_stats.full_handshakes++;
+    handshake_stats.full_handshake_ms += https_connection->handshake_ms;
+  }
+  pthread_mutex_unlock(&tls_mutex);
+
+  return 0;
+}
+
+int https_connection_offer_h2(HttpsConnection* https_connection) {
+  // ALPN 协议列表：每项为 1 字节长度 + 协议名，按优先顺序排列
+  static const unsigned char protocols[] = { 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+
+  if (!https_connection || !https_connection->ssl) {
+    return -1;
+  }
+  // 注意 SSL_set_alpn_protos 成功时返回0
+  return SSL_set_alpn_protos(https_connection->ssl, protocols, sizeof(protocols)) == 0 ? 0 : -1;
+}
+
+HttpsConnection* create_https_connection(const char* hostname, int port) {
+  if (!openssl_initialized) {
+    fprintf(stderr, "错误: OpenSSL 库未初始化\n");
+    return NULL;
+  }
+
+  // printf("正在建立 HTTPS 连接到 %s:%d...\n", hostname, port);
+
+  // 建立 TCP 连接（多个地址时并发尝试）
+  int sockfd = connect_to_host(hostname, port);
+  if (sockfd < 0) {
+    fprintf(stderr, "错误: TCP 连接建立失败\n");
+    return NULL;
+  }
+
+  // printf("TCP 连接建立成功\n");
+
+  HttpsConnection* https_connection = https_connection_attach(sockfd, hostname, port);
+  if (!https_connection) {
+    close(sockfd);
+    return NULL;
+  }
+
+  // 执行 SSL 握手（阻塞 socket 上一次完成）
+  // printf("正在执行 SSL 握手...\n");
+  if (ssl_handshake_step(https_connection) != 0) {
+    close_https_connection(https_connection);
     return NULL;
   }
 
@@ -470,7 +627,9 @@ int download_https_content_with_length(HttpsConnection* https_connection, FILE*
     }
 
     // 通过 SSL 接收数据
+    bytes_to_receive = ratelimit_acquire(progress->rate_limiter, bytes_to_receive);
     ssize_t bytes_received = ssl_recv_data(https_connection, buffer, bytes_to_receive);
+    ratelimit_refund(progress->rate_limiter, bytes_to_receive, bytes_received);
 
     if (bytes_received <= 0) {
       clear_progress_line();
@@ -551,7 +710,9 @@ int download_https_content_until_close(HttpsConnection* https_connection, FILE*
   }
 
   while (1) {
-    ssize_t bytes_received = ssl_recv_data(https_connection, buffer, BUFFER_SIZE);
+    size_t bytes_to_receive = ratelimit_acquire(progress->rate_limiter, BUFFER_SIZE);
+    ssize_t bytes_received = ssl_recv_data(https_connection, buffer, bytes_to_receive);
+    ratelimit_refund(progress->rate_limiter, bytes_to_receive, bytes_received);
 
     if (bytes_received == 0) {
       // 没有读取到数据
@@ -673,6 +834,10 @@ int download_file_https(const char* url, const char* output_filename, const char
     return DOWNLOAD_ERROR_NETWORK;
   }
 
+  // 本次下载的限速令牌桶，重定向后继续使用
+  RateBucket rate_bucket = { 0 };
+  RateLimiter rate_limiter;
+
   for (int redirect_iter = 0; redirect_iter <= MAX_REDIRECTS; redirect_iter++) {
     // 变量初始化
     URLInfo url_info = { 0 };
@@ -695,6 +860,8 @@ int download_file_https(const char* url, const char* output_filename, const char
       cleanup_openssl();
       return DOWNLOAD_ERROR_URL_PARSE;
     }
+    ratelimit_init(&rate_limiter, url_info.host, &rate_bucket);
+    progress.rate_limiter = &rate_limiter;
 
     // 检查协议类型
     if (url_info.protocol_type != PROTOCOL_HTTPS) {
@@ -708,7 +875,7 @@ int download_file_https(const char* url, const char* output_filename, const char
       BOLD, RESET, BLUE, url_info.port, RESET,
       BOLD, RESET, BLUE, url_info.path, RESET);
 
-    char ip_str[INET_ADDRSTRLEN];
+    char ip_str[INET6_ADDRSTRLEN];
 
     // 域名解析
     if (url_info.host_type == UNALLOWED) {
@@ -7,6 +7,13 @@
 #include "../include/multithread.h"
 #include "../include/utils.h"
 #include "../include/progress.h"
+#include "../include/config.h"
+#include "../include/test.h"
+#include "../include/uring.h"
+#include "../include/ratelimit.h"
+#include "../include/dns.h"
+#include "../include/metalink.h"
+#include "../include/pipeline.h"
 
 // CLI颜色定义
 const char* BLUE = "\033[34m";
@@ -20,6 +27,21 @@ const char* CLEAR_LINE = "\r\033[K";
 
 #define MAX_SIZE 2048
 
+// 拿到 URL 后立即在后台解析域名，与参数解析、用户输入和 OpenSSL 初始化同时进行
+static void start_early_resolution(const char* url) {
+  URLInfo url_info = { 0 };
+  if (parse_url(url, &url_info) != 0) {
+    return; // 由 download_file_auto 报告错误
+  }
+
+  dns_prefetch(url_info.host);
+#ifdef WITH_OPENSSL
+  if (url_info.protocol_type == PROTOCOL_HTTPS) {
+    init_openssl();
+  }
+#endif
+}
+
 int getchoice(char* greet, char* choices[]) {
   int choosen = 0;
   int selected;
@@ -63,6 +85,24 @@ int cli_choice(int argc, char* argv[]) {
       return -1;
     }
     const char* url = argv[2];
+
+    // Metalink 文件：使用优先级最高的地址，其余地址作为镜像，文件大小和分块哈希用于校验
+    MetalinkInfo metalink = { 0 };
+    if (metalink_is_file(url)) {
+      if (metalink_parse_file(url, &metalink) != 0) {
+        return -1;
+      }
+      DownloadOptions* options = get_download_options();
+      options->metalink = &metalink;
+      url = metalink.urls[0].url;
+      for (int i = 1; i < metalink.url_count; i++) {
+        options->mirrors[options->mirror_count++] = metalink.urls[i].url;
+        start_early_resolution(metalink.urls[i].url);
+      }
+      printf("%s✓ Metalink: %s (%d 个下载地址, %d 个分块哈希)%s\n", GREEN,
+        metalink.file_name[0] ? metalink.file_name : "未命名", metalink.url_count, metalink.piece_count, RESET);
+    }
+    start_early_resolution(url);
     const char* output_filename = NULL;
     const char* download_dir = NULL;
     int use_multithread = 0;
@@ -74,8 +114,8 @@ int cli_choice(int argc, char* argv[]) {
       if (next_is_thread_count) {
         // 处理线程数参数
         thread_count = atoi(argv[i]);
-        if (thread_count <= 0 || thread_count > MAX_THREADS) {
-          printf("%s错误: 线程数必须在1到%d之间%s\n", RED, MAX_THREADS, RESET);
+        if (thread_count <= 0 || thread_count > MAX_EVENT_CONNECTIONS) {
+          printf("%s错误: 线程数必须在1到%d之间%s\n", RED, MAX_EVENT_CONNECTIONS, RESET);
           return -1;
         }
         printf("%s设置线程数为: %d%s\n", BLUE, thread_count, RESET);
@@ -88,13 +128,257 @@ int cli_choice(int argc, char* argv[]) {
         printf("%s✓ 启用多线程下载模式%s\n", GREEN, RESET);
 
         // 检查下一个参数是否是线程数
-        if (i + 1 < argc && argv[i + 1][0] != '-' && isdigit(argv[i + 1][0])) {
+        if (i + 1 < argc && strcmp(argv[i + 1], "auto") == 0) {
+          // 从少量连接开始，按实测吞吐量逐步增加，最多 MAX_THREADS 个
+          get_download_options()->auto_connections = 1;
+          thread_count = MAX_THREADS;
+          printf("%s自动调节连接数（最多 %d 个）%s\n", BLUE, thread_count, RESET);
+          i++;
+        }
+        else if (i + 1 < argc && argv[i + 1][0] != '-' && isdigit(argv[i + 1][0])) {
           next_is_thread_count = 1;
         }
         else {
           printf("%s使用默认线程数: %d%s\n", BLUE, thread_count, RESET);
         }
       }
+      else if (strcmp(argv[i], "--epoll") == 0) {
+        get_download_options()->engine = DOWNLOAD_ENGINE_EPOLL;
+        printf("%s✓ 使用 epoll 事件驱动引擎%s\n", GREEN, RESET);
+      }
+      else if (strcmp(argv[i], "--http2") == 0) {
+        get_download_options()->engine = DOWNLOAD_ENGINE_HTTP2;
+        printf("%s✓ 使用 HTTP/2 引擎%s\n", GREEN, RESET);
+      }
+      else if (strcmp(argv[i], "--event-loops") == 0) {
+        if (i + 1 >= argc || !isdigit(argv[i + 1][0])) {
+          printf("%s错误: --event-loops 需要指定事件循环线程数%s\n", RED, RESET);
+          return -1;
+        }
+        int event_loops = atoi(argv[++i]);
+        if (event_loops <= 0 || event_loops > MAX_EVENT_LOOPS) {
+          printf("%s错误: 事件循环线程数必须在1到%d之间%s\n", RED, MAX_EVENT_LOOPS, RESET);
+          return -1;
+        }
+        get_download_options()->event_loops = event_loops;
+      }
+      else if (strcmp(argv[i], "--connect-timeout") == 0) {
+        if (i + 1 >= argc || !isdigit(argv[i + 1][0])) {
+          printf("%s错误: --connect-timeout 需要指定秒数%s\n", RED, RESET);
+          return -1;
+        }
+        int connect_timeout = atoi(argv[++i]);
+        if (connect_timeout <= 0) {
+          printf("%s错误: 连接超时必须大于0秒%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->connect_timeout = connect_timeout;
+      }
+      else if (strcmp(argv[i], "--mirror") == 0) {
+        DownloadOptions* options = get_download_options();
+        if (i + 1 >= argc) {
+          printf("%s错误: --mirror 需要指定镜像URL%s\n", RED, RESET);
+          return -1;
+        }
+        if (options->mirror_count >= MAX_MIRRORS - 1) {
+          printf("%s错误: 最多指定 %d 个镜像%s\n", RED, MAX_MIRRORS - 1, RESET);
+          return -1;
+        }
+        options->mirrors[options->mirror_count++] = argv[++i];
+        start_early_resolution(argv[i]);
+      }
+      else if (strcmp(argv[i], "--low-speed-limit") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --low-speed-limit 需要指定字节/秒%s\n", RED, RESET);
+          return -1;
+        }
+        int limit = atoi(argv[++i]);
+        if (limit < 0) {
+          printf("%s错误: 低速阈值不能为负数%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->low_speed_limit = limit;
+      }
+      else if (strcmp(argv[i], "--low-speed-time") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --low-speed-time 需要指定秒数%s\n", RED, RESET);
+          return -1;
+        }
+        int seconds = atoi(argv[++i]);
+        if (seconds <= 0) {
+          printf("%s错误: 低速检测时间必须大于0秒%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->low_speed_time = seconds;
+      }
+      else if (strcmp(argv[i], "--hedge-ratio") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --hedge-ratio 需要指定比例%s\n", RED, RESET);
+          return -1;
+        }
+        double ratio = atof(argv[++i]);
+        if (ratio < 0 || ratio >= 1) {
+          printf("%s错误: 对冲比例必须在 0 到 1 之间%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->hedge_speed_ratio = ratio;
+      }
+      else if (strcmp(argv[i], "--hedge-stall") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --hedge-stall 需要指定毫秒数%s\n", RED, RESET);
+          return -1;
+        }
+        int stall_ms = atoi(argv[++i]);
+        if (stall_ms < 0) {
+          printf("%s错误: 停滞时间不能为负数%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->hedge_stall_ms = stall_ms;
+      }
+      else if (strcmp(argv[i], "--write-buffer") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --write-buffer 需要指定大小（如 64M）%s\n", RED, RESET);
+          return -1;
+        }
+        long long budget = ratelimit_parse_rate(argv[++i]);
+        if (budget < 0) {
+          printf("%s错误: 无效的写入队列大小 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+        get_download_options()->write_buffer = budget;
+      }
+      else if (strcmp(argv[i], "--mmap-window") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --mmap-window 需要指定大小（如 16M）%s\n", RED, RESET);
+          return -1;
+        }
+        long long window = ratelimit_parse_rate(argv[++i]);
+        if (window <= 0) {
+          printf("%s错误: 无效的映射窗口大小 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+        get_download_options()->mmap_window = window;
+      }
+      else if (strcmp(argv[i], "--write-policy") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --write-policy 需要指定 coalesce 或 strict%s\n", RED, RESET);
+          return -1;
+        }
+        i++;
+        if (strcmp(argv[i], "coalesce") == 0) {
+          get_download_options()->write_policy = WRITE_POLICY_COALESCE;
+        }
+        else if (strcmp(argv[i], "strict") == 0) {
+          get_download_options()->write_policy = WRITE_POLICY_STRICT;
+        }
+        else {
+          printf("%s错误: 未知的写入策略 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--write-chunk") == 0 || strcmp(argv[i], "--checkpoint-size") == 0) {
+        const char* option = argv[i];
+        if (i + 1 >= argc) {
+          printf("%s错误: %s 需要指定大小（如 4M）%s\n", RED, option, RESET);
+          return -1;
+        }
+        long long size = ratelimit_parse_rate(argv[++i]);
+        if (size < 0 || (size == 0 && strcmp(option, "--write-chunk") == 0)) {
+          printf("%s错误: 无效的大小 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+        if (strcmp(option, "--write-chunk") == 0) {
+          get_download_options()->write_chunk = size;
+        }
+        else {
+          get_download_options()->checkpoint_bytes = size;
+        }
+      }
+      else if (strcmp(argv[i], "--checkpoint-interval") == 0) {
+        if (i + 1 >= argc || !isdigit(argv[i + 1][0])) {
+          printf("%s错误: --checkpoint-interval 需要指定秒数%s\n", RED, RESET);
+          return -1;
+        }
+        get_download_options()->checkpoint_interval = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--limit-rate") == 0 || strcmp(argv[i], "--limit-download") == 0) {
+        const char* option = argv[i];
+        if (i + 1 >= argc) {
+          printf("%s错误: %s 需要指定速率（如 500K、2M）%s\n", RED, option, RESET);
+          return -1;
+        }
+        long long rate = ratelimit_parse_rate(argv[++i]);
+        if (rate < 0) {
+          printf("%s错误: 无效的速率 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+        if (strcmp(option, "--limit-rate") == 0) {
+          ratelimit_set_global(rate);
+        }
+        else {
+          ratelimit_set_download(rate);
+        }
+      }
+      else if (strcmp(argv[i], "--limit-host") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --limit-host 需要指定 <主机>=<速率>%s\n", RED, RESET);
+          return -1;
+        }
+        char host[256];
+        const char* value = argv[++i];
+        const char* separator = strrchr(value, '=');
+        long long rate = separator ? ratelimit_parse_rate(separator + 1) : -1;
+        if (!separator || separator == value || (size_t)(separator - value) >= sizeof(host) || rate < 0) {
+          printf("%s错误: 无效的主机限速 '%s'，格式为 <主机>=<速率>%s\n", RED, value, RESET);
+          return -1;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(separator - value), value);
+        if (ratelimit_set_host(host, rate) != 0) {
+          printf("%s错误: 最多为 %d 个主机单独限速%s\n", RED, RATE_LIMIT_MAX_HOSTS, RESET);
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--limit-file") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --limit-file 需要指定文件路径%s\n", RED, RESET);
+          return -1;
+        }
+        if (ratelimit_set_control_file(argv[++i]) != 0) {
+          return -1;
+        }
+      }
+      else if (strcmp(argv[i], "--temp-files") == 0) {
+        get_download_options()->output_mode = OUTPUT_MODE_TEMP_FILES;
+      }
+      else if (strcmp(argv[i], "--direct-io") == 0) {
+        get_download_options()->direct_io = 1;
+      }
+      else if (strcmp(argv[i], "--io-backend") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --io-backend 需要指定 stdio、uring、splice 或 mmap%s\n", RED, RESET);
+          return -1;
+        }
+        i++;
+        if (strcmp(argv[i], "stdio") == 0) {
+          get_download_options()->io_backend = IO_BACKEND_STDIO;
+        }
+        else if (strcmp(argv[i], "uring") == 0) {
+          get_download_options()->io_backend = IO_BACKEND_URING;
+          if (!uring_available()) {
+            printf("%s警告: 当前内核不支持 io_uring，将使用 stdio 后端%s\n", YELLOW, RESET);
+          }
+        }
+        else if (strcmp(argv[i], "splice") == 0) {
+          get_download_options()->io_backend = IO_BACKEND_SPLICE;
+        }
+        else if (strcmp(argv[i], "mmap") == 0) {
+          get_download_options()->io_backend = IO_BACKEND_MMAP;
+        }
+        else {
+          printf("%s错误: 未知的 I/O 后端 '%s'%s\n", RED, argv[i], RESET);
+          return -1;
+        }
+      }
       else if (argv[i][0] != '-') {
         // 非选项参数，按顺序分配给 output_filename 和 download_dir
         if (output_filename == NULL) {
@@ -112,6 +396,23 @@ int cli_choice(int argc, char* argv[]) {
       }
     }
 
+    // 线程模式每个连接一个线程，epoll 和 HTTP/2 引擎可以使用更多连接
+    if (get_download_options()->engine == DOWNLOAD_ENGINE_THREADS && thread_count > MAX_THREADS) {
+      printf("%s错误: 线程数必须在1到%d之间（使用 --epoll 或 --http2 时最多 %d）%s\n", RED, MAX_THREADS, MAX_EVENT_CONNECTIONS, RESET);
+      return -1;
+    }
+
+    // Metalink 下载默认使用其中的文件名，并通过分段引擎逐块校验
+    if (get_download_options()->metalink) {
+      if (output_filename == NULL && metalink.file_name[0]) {
+        output_filename = metalink.file_name;
+      }
+      if (!use_multithread) {
+        use_multithread = 1;
+        printf("%s✓ Metalink 下载启用多线程模式 (线程数: %d)%s\n", GREEN, thread_count, RESET);
+      }
+    }
+
     // 设置默认值和给出相应警告
     if (output_filename == NULL) {
       output_filename = "Downloaded_File";
@@ -138,6 +439,8 @@ int cli_choice(int argc, char* argv[]) {
     // printf("%s线程数: %s%d%s\n", BOLD, BLUE, thread_count, RESET);
 
     int result = download_file_auto(url, output_filename, download_dir, use_multithread, thread_count);
+    get_download_options()->metalink = NULL;
+    metalink_free(&metalink);
     if (result != DOWNLOAD_SUCCESS) {
       fprintf(stderr, "%s下载失败，错误代码: %d%s\n", RED, result, RESET);
       return result;
@@ -148,6 +451,48 @@ int cli_choice(int argc, char* argv[]) {
     download_test();
     return 0;
   }
+  else if (strcmp(argv[1], "--bench") == 0) {
+    if (argc < 3) {
+      printf("%s错误: 请提供基准测试URL%s\n", RED, RESET);
+      printf("用法：%s --bench <URL> [线程数]\n", argv[0]);
+      return -1;
+    }
+    int thread_count = argc > 3 ? atoi(argv[3]) : 4;
+    if (thread_count <= 0 || thread_count > MAX_THREADS) {
+      printf("%s错误: 线程数必须在1到%d之间%s\n", RED, MAX_THREADS, RESET);
+      return -1;
+    }
+    return download_benchmark(argv[2], thread_count);
+  }
+  else if (strcmp(argv[1], "--batch") == 0) {
+    if (argc < 3) {
+      printf("%s错误: 请提供 URL 列表文件%s\n", RED, RESET);
+      printf("用法：%s --batch <URL列表文件> [下载目录] [--pipeline <深度>]\n", argv[0]);
+      return -1;
+    }
+    const char* download_dir = NULL;
+    int depth = PIPELINE_DEFAULT_DEPTH;
+    for (int i = 3; i < argc; i++) {
+      if (strcmp(argv[i], "--pipeline") == 0) {
+        if (i + 1 >= argc) {
+          printf("%s错误: --pipeline 需要指定流水线深度%s\n", RED, RESET);
+          return -1;
+        }
+        depth = atoi(argv[++i]);
+        if (depth < 1 || depth > PIPELINE_MAX_DEPTH) {
+          printf("%s错误: 流水线深度必须在1到%d之间%s\n", RED, PIPELINE_MAX_DEPTH, RESET);
+          return -1;
+        }
+      }
+      else if (argv[i][0] != '-' && download_dir == NULL) {
+        download_dir = argv[i];
+      }
+      else {
+        printf("%s警告: 未知选项 '%s' 被忽略%s\n", YELLOW, argv[i], RESET);
+      }
+    }
+    return pipeline_download_batch(argv[2], download_dir, depth) == 0 ? 0 : -1;
+  }
   // else if (strcmp(argv[1], "--config") == 0 || strcmp(argv[1], "-c") == 0) {
   //   return choice_config();
   // }
@@ -175,10 +520,38 @@ int cli_choice(int argc, char* argv[]) {
     printf("  --test, -t           运行测试\n");
     printf("  --config, -c       打开设置菜单\n");
     printf("  --multithread, -m    启用多线程下载（与 --download 配合使用）\n");
+    printf("  -m auto              从 %d 个连接开始，按实测吞吐量自动增减连接数（日志写入 <输出文件>.autotune.log）\n", AUTOTUNE_INITIAL_CONNECTIONS);
+    printf("  --epoll              使用 epoll 事件驱动引擎下载分段（最多 %d 个连接）\n", MAX_EVENT_CONNECTIONS);
+    printf("  --event-loops <N>    epoll 引擎的事件循环线程数（默认 1，最多 %d）\n", MAX_EVENT_LOOPS);
+    printf("  --http2              HTTPS 下载通过 ALPN 协商 HTTP/2，所有分段作为一个连接上的并发流（最多 %d 个）\n", MAX_EVENT_CONNECTIONS);
+    printf("  --io-backend <B>     HTTP 响应体的 I/O 方式: stdio（默认）、uring、splice（零拷贝）或 mmap（直接接收到映射的输出文件）\n");
+    printf("  --mmap-window <S>    mmap 后端每个连接同时映射的输出文件大小，限制占用的内存（默认 %dM）\n", MMAP_WINDOW_DEFAULT / (1024 * 1024));
+    printf("  --connect-timeout <S> TCP 连接超时秒数（默认 %d），多个地址时 IPv6/IPv4 交替并发尝试\n", CONNECT_TIMEOUT_DEFAULT);
+    printf("  --low-speed-limit <B> 连接在检测窗口内的平均速度低于该值（字节/秒）时中止并重试（默认 %d，0 关闭）\n", LOW_SPEED_LIMIT_DEFAULT);
+    printf("  --low-speed-time <S> 低速检测的时间窗口秒数，也是分段下载收发无数据的超时（默认 %d）\n", LOW_SPEED_TIME_DEFAULT);
+    printf("  --temp-files         多线程下载时每段写临时文件再合并（默认预分配输出文件直接写入）\n");
+    printf("  --write-buffer <S>   多线程下载由写入线程合并写文件，S 为写入队列的内存上限（可带 K/M/G 后缀，默认 %dM，0 由下载线程直接写）\n", WRITE_BUFFER_DEFAULT / (1024 * 1024));
+    printf("  --write-policy <P>   写入策略: coalesce（默认，攒成大块写入，只在检查点同步）或 strict（每次接收后立即写入文件）\n");
+    printf("  --direct-io          写入线程以 O_DIRECT 写预分配的输出文件，不占用页缓存（文件系统不支持时自动改用页缓存）\n");
+    printf("  --write-chunk <S>    coalesce 策略下不使用写入线程时每次写入的大小（默认 %dM）\n", WRITE_CHUNK_DEFAULT / (1024 * 1024));
+    printf("  --checkpoint-size <S> 新写入的数据达到该大小时 fdatasync 并保存断点状态 <输出文件>.chd-state（默认 %dM，0 不按大小）\n", CHECKPOINT_BYTES_DEFAULT / (1024 * 1024));
+    printf("  --checkpoint-interval <S> 距上次检查点超过该秒数时建立检查点（默认 %d，0 不按时间；两者都为 0 时不保存断点状态）\n", CHECKPOINT_INTERVAL_DEFAULT);
+    printf("  --mirror <URL>       同一文件的镜像地址（可重复，最多 %d 个），按各镜像实测吞吐量分配分段\n", MAX_MIRRORS - 1);
+    printf("  --hedge-ratio <F>    段速度低于其他段中位数的该比例时为剩余部分发出对冲请求（默认关闭，建议 %.2f）\n", HEDGE_SPEED_RATIO_SUGGESTED);
+    printf("  --hedge-stall <MS>   段无进展超过该毫秒数时发出对冲请求（默认关闭，建议 %d；-m auto 时不对冲）\n", HEDGE_STALL_MS_SUGGESTED);
+    printf("  --limit-rate <R>     所有下载共享的总速率上限（字节/秒，可带 K/M/G 后缀，0 不限）\n");
+    printf("  --limit-host <H>=<R> 对某个主机的总速率上限（可重复，最多 %d 个主机）\n", RATE_LIMIT_MAX_HOSTS);
+    printf("  --limit-download <R> 每个下载（所有分段合计）的速率上限\n");
+    printf("  --limit-file <文件>  从文件读取限速设置（每行 global <R>、download <R> 或 host <H> <R>），下载中修改文件即时生效\n");
+    printf("  -d <文件.meta4>      从 Metalink 文件读取下载地址、文件大小和分块哈希，每个分块下载完立即校验\n");
+    printf("  --bench <URL> [N]    用各个 I/O 后端下载同一 URL，比较吞吐量和 CPU 时间\n");
+    printf("  --batch <列表> [目录] 下载列表中的所有 URL（每行一个，可跟文件名），同一主机的文件在一个连接上流水线请求\n");
+    printf("  --pipeline <N>       --batch 时同一连接上未收到响应的请求数上限（默认 %d，最多 %d）\n", PIPELINE_DEFAULT_DEPTH, PIPELINE_MAX_DEPTH);
     printf("\n示例:\n");
     printf("  %s -d http://example.com/file.zip\n", argv[0]);
     printf("  %s -d http://example.com/file.zip myfile.zip\n", argv[0]);
     printf("  %s -d http://example.com/file.zip myfile.zip /tmp --multithread\n", argv[0]);
+    printf("  %s -d http://example.com/file.zip myfile.zip /tmp -m 64 --epoll\n", argv[0]);
     printf("\n可能的错误代码如下：\n");
     printf("  %d: 下载成功\n", DOWNLOAD_SUCCESS);
     printf("  %d: URL解析错误\n", DOWNLOAD_ERROR_URL_PARSE);
@@ -190,6 +563,7 @@ int cli_choice(int argc, char* argv[]) {
     printf("  %d: 文件写入错误\n", DOWNLOAD_ERROR_FILE_WRITE);
     printf("  %d: 网络错误\n", DOWNLOAD_ERROR_NETWORK);
     printf("  %d: 内存分配错误\n", DOWNLOAD_ERROR_MEMORY);
+    printf("  %d: Metalink 校验失败\n", DOWNLOAD_ERROR_VERIFY);
     return 0;
   }
 }
@@ -237,6 +611,7 @@ int choice_download() {
       printf("%s错误: URL不能为空，请重新输入%s\n", RED, RESET);
     }
   }
+  start_early_resolution(input_url);
 
   // 获取输出文件名
   printf("%s%s请输入保存文件名（留空则使用默认名\"Downloaded_File\"）: %s", BOLD, BLUE, RESET);
@@ -292,10 +667,14 @@ int choice_download() {
 
   // 获取线程数
   if (strcasecmp(multithread_choice, "y") == 0 || strcasecmp(multithread_choice, "yes") == 0) {
-    printf("%s%s请输入线程数 (默认: %d): %s", BOLD, CYAN, thread_count, RESET);
+    printf("%s%s请输入线程数，输入 auto 自动调节 (默认: %d): %s", BOLD, CYAN, thread_count, RESET);
     char thread_input[10];
     if (fgets(thread_input, sizeof(thread_input), stdin) != NULL) {
-      if (thread_input[0] != '\n') {
+      if (strncasecmp(thread_input, "auto", 4) == 0) {
+        get_download_options()->auto_connections = 1;
+        thread_count = MAX_THREADS;
+      }
+      else if (thread_input[0] != '\n') {
         int input_threads = atoi(thread_input);
         if (input_threads > 0 && input_threads <= MAX_THREADS) {
           thread_count = input_threads;
@@ -456,6 +835,7 @@ int download_file_auto(const char* url, const char* output_filename, const char*
     if (downloader) {
       // 开始多线程下载
       int multithread_result = multithread_download(downloader);
+      DownloadResult error_code = downloader->error_code;
 
       // 清理资源
       destroy_multithread_downloader(downloader);
@@ -464,6 +844,10 @@ int download_file_auto(const char* url, const char* output_filename, const char*
         printf("\n%s-------------------------下载已结束--------------------------%s\n\n", BOLD, RESET);
         return DOWNLOAD_SUCCESS;
       }
+      else if (get_download_options()->metalink) {
+        // 单线程下载无法逐块校验，Metalink 下载不回退
+        return error_code;
+      }
       else {
         printf("%s警告：多线程下载失败，将回退到单线程下载%s\n", YELLOW, RESET);
       }
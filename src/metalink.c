@@ -0,0 +1,421 @@
+#include "../include/common.h"
+#include "../include/metalink.h"
+
+#ifdef WITH_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#define METALINK_MAX_FILE_SIZE (64 * 1024 * 1024) // Metalink 文件本身的最大大小
+#define METALINK_HASH_BUFFER_SIZE (256 * 1024)     // 计算哈希时每次读取的大小
+
+int metalink_is_file(const char* argument) {
+  if (!argument || strstr(argument, "://")) {
+    return 0;
+  }
+  size_t length = strlen(argument);
+  return length > 6 && strcasecmp(argument + length - 6, ".meta4") == 0;
+}
+
+// 读取整个文件，返回以 '\0' 结尾的内容
+static char* read_whole_file(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  char* content = NULL;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long size = ftell(file);
+    if (size >= 0 && size <= METALINK_MAX_FILE_SIZE && fseek(file, 0, SEEK_SET) == 0) {
+      content = malloc(size + 1);
+      if (content && fread(content, 1, size, file) == (size_t)size) {
+        content[size] = '\0';
+      }
+      else {
+        free(content);
+        content = NULL;
+      }
+    }
+  }
+
+  fclose(file);
+  return content;
+}
+
+// 解码 XML 预定义实体，原地修改
+static void decode_xml_entities(char* text) {
+  static const struct { const char* entity; char value; } entities[] = {
+    { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+  };
+
+  char* out = text;
+  for (char* in = text; *in;) {
+    int decoded = 0;
+    if (*in == '&') {
+      for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+        size_t length = strlen(entities[i].entity);
+        if (strncmp(in, entities[i].entity, length) == 0) {
+          *out++ = entities[i].value;
+          in += length;
+          decoded = 1;
+          break;
+        }
+      }
+    }
+    if (!decoded) {
+      *out++ = *in++;
+    }
+  }
+  *out = '\0';
+}
+
+// 复制标签内的文本并去掉首尾空白、解码实体
+static void copy_element_text(const char* start, const char* end, char* buffer, size_t buffer_size) {
+  while (start < end && isspace((unsigned char)*start)) {
+    start++;
+  }
+  while (end > start && isspace((unsigned char)end[-1])) {
+    end--;
+  }
+
+  size_t length = (size_t)(end - start);
+  if (length >= buffer_size) {
+    length = buffer_size - 1;
+  }
+  memcpy(buffer, start, length);
+  buffer[length] = '\0';
+  decode_xml_entities(buffer);
+}
+
+// 读取标签属性的值，找不到返回-1
+static int get_attribute(const char* attributes, const char* attributes_end, const char* name,
+  char* value, size_t value_size) {
+  size_t name_length = strlen(name);
+
+  for (const char* p = attributes; p + name_length < attributes_end; p++) {
+    // 属性名前必须是空白，避免 "type" 匹配到 "mediatype"
+    if (!isspace((unsigned char)p[-1]) || strncmp(p, name, name_length) != 0) {
+      continue;
+    }
+
+    const char* q = p + name_length;
+    while (q < attributes_end && isspace((unsigned char)*q)) {
+      q++;
+    }
+    if (q >= attributes_end || *q != '=') {
+      continue;
+    }
+    q++;
+    while (q < attributes_end && isspace((unsigned char)*q)) {
+      q++;
+    }
+    if (q >= attributes_end || (*q != '"' && *q != '\'')) {
+      continue;
+    }
+
+    char quote = *q++;
+    const char* value_end = memchr(q, quote, attributes_end - q);
+    if (!value_end) {
+      return -1;
+    }
+    copy_element_text(q, value_end, value, value_size);
+    return 0;
+  }
+  return -1;
+}
+
+// 哈希算法的强度排序，不支持的算法返回0
+static int hash_rank(const char* hash_type) {
+  static const char* ranked[] = { "md5", "sha-1", "sha-224", "sha-256", "sha-384", "sha-512" };
+  if (!metalink_hash_supported(hash_type)) {
+    return 0;
+  }
+  for (int i = 0; i < (int)(sizeof(ranked) / sizeof(ranked[0])); i++) {
+    if (strcasecmp(hash_type, ranked[i]) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// 按优先级插入下载地址，已满时替换优先级最低的地址
+static void add_url(MetalinkInfo* info, const char* url, int priority) {
+  if (strncasecmp(url, "http://", 7) != 0 && strncasecmp(url, "https://", 8) != 0) {
+    return; // 只支持 HTTP/HTTPS（忽略 ftp、torrent 等）
+  }
+
+  int position = info->url_count;
+  if (info->url_count == MAX_MIRRORS) {
+    if (priority >= info->urls[MAX_MIRRORS - 1].priority) {
+      return;
+    }
+    position = MAX_MIRRORS - 1;
+  }
+  else {
+    info->url_count++;
+  }
+
+  // 相同优先级保持文件中的顺序
+  while (position > 0 && info->urls[position - 1].priority > priority) {
+    info->urls[position] = info->urls[position - 1];
+    position--;
+  }
+  snprintf(info->urls[position].url, sizeof(info->urls[position].url), "%s", url);
+  info->urls[position].priority = priority;
+}
+
+// 追加一个分块哈希
+static int add_piece_hash(MetalinkInfo* info, const char* hash, int* capacity) {
+  if (info->piece_count == *capacity) {
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 256;
+    void* grown = realloc(info->piece_hashes, sizeof(*info->piece_hashes) * new_capacity);
+    if (!grown) {
+      return -1;
+    }
+    info->piece_hashes = grown;
+    *capacity = new_capacity;
+  }
+  snprintf(info->piece_hashes[info->piece_count++], METALINK_HASH_LENGTH, "%s", hash);
+  return 0;
+}
+
+int metalink_parse_file(const char* path, MetalinkInfo* info) {
+  memset(info, 0, sizeof(MetalinkInfo));
+  info->file_size = -1;
+
+  char* content = read_whole_file(path);
+  if (!content) {
+    fprintf(stderr, "错误: 无法读取 Metalink 文件 %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  int file_count = 0;         // 已遇到的 <file> 数量
+  int in_file = 0;            // 是否在第一个 <file> 中
+  int in_pieces = 0;          // 是否在使用的 <pieces> 中
+  int piece_capacity = 0;
+  int result = 0;
+
+  char* p = content;
+  while (result == 0 && (p = strchr(p, '<')) != NULL) {
+    // 跳过注释、处理指令和 CDATA 以外的声明
+    if (strncmp(p, "<!--", 4) == 0) {
+      char* end = strstr(p + 4, "-->");
+      p = end ? end + 3 : p + strlen(p);
+      continue;
+    }
+    if (p[1] == '?' || p[1] == '!') {
+      char* end = strchr(p, '>');
+      p = end ? end + 1 : p + strlen(p);
+      continue;
+    }
+
+    char* tag_end = strchr(p, '>');
+    if (!tag_end) {
+      break;
+    }
+
+    int closing = p[1] == '/';
+    char* name = p + (closing ? 2 : 1);
+    char* name_end = name;
+    while (name_end < tag_end && !isspace((unsigned char)*name_end) && *name_end != '/') {
+      name_end++;
+    }
+    // 去掉命名空间前缀
+    for (char* c = name; c < name_end; c++) {
+      if (*c == ':') {
+        name = c + 1;
+      }
+    }
+    size_t name_length = (size_t)(name_end - name);
+    int self_closing = tag_end[-1] == '/';
+    const char* text = tag_end + 1;
+    const char* text_end = strchr(text, '<');
+    if (!text_end) {
+      text_end = text + strlen(text);
+    }
+    p = tag_end + 1;
+
+#define TAG_IS(tag) (name_length == strlen(tag) && strncmp(name, tag, name_length) == 0)
+    if (closing) {
+      if (TAG_IS("file")) {
+        in_file = 0;
+      }
+      else if (TAG_IS("pieces")) {
+        in_pieces = 0;
+      }
+      continue;
+    }
+
+    char value[2048];
+    if (TAG_IS("file")) {
+      if (++file_count == 1 && !self_closing) {
+        in_file = 1;
+        if (get_attribute(name_end, tag_end, "name", value, sizeof(value)) == 0) {
+          // 只使用文件名部分，不允许写到下载目录之外
+          const char* base = strrchr(value, '/');
+          base = base ? base + 1 : value;
+          // 过长的文件名截断后可能不是原来的扩展名，不使用
+          size_t length = strlen(base);
+          if (strcmp(base, ".") != 0 && strcmp(base, "..") != 0 && length < sizeof(info->file_name)) {
+            memcpy(info->file_name, base, length + 1);
+          }
+        }
+      }
+    }
+    else if (!in_file) {
+      continue;
+    }
+    else if (TAG_IS("size")) {
+      copy_element_text(text, text_end, value, sizeof(value));
+      info->file_size = atoll(value);
+    }
+    else if (TAG_IS("pieces")) {
+      // 只使用第一组支持的分块哈希
+      char type[16] = "";
+      get_attribute(name_end, tag_end, "type", type, sizeof(type));
+      if (!self_closing && info->piece_hash_type[0] == '\0' && metalink_hash_supported(type) &&
+        get_attribute(name_end, tag_end, "length", value, sizeof(value)) == 0 && atoll(value) > 0) {
+        info->piece_length = atoll(value);
+        snprintf(info->piece_hash_type, sizeof(info->piece_hash_type), "%s", type);
+        in_pieces = 1;
+      }
+    }
+    else if (TAG_IS("hash")) {
+      char hash[METALINK_HASH_LENGTH];
+      copy_element_text(text, text_end, hash, sizeof(hash));
+      if (in_pieces) {
+        if (add_piece_hash(info, hash, &piece_capacity) != 0) {
+          fprintf(stderr, "错误: 内存分配失败\n");
+          result = -1;
+        }
+      }
+      else {
+        // 整个文件有多个哈希时使用最强的已支持算法
+        char type[16] = "";
+        get_attribute(name_end, tag_end, "type", type, sizeof(type));
+        if (hash_rank(type) > hash_rank(info->hash_type)) {
+          snprintf(info->hash_type, sizeof(info->hash_type), "%s", type);
+          snprintf(info->hash, sizeof(info->hash), "%s", hash);
+        }
+      }
+    }
+    else if (TAG_IS("url")) {
+      int priority = METALINK_DEFAULT_PRIORITY;
+      if (get_attribute(name_end, tag_end, "priority", value, sizeof(value)) == 0 && atoi(value) > 0) {
+        priority = atoi(value);
+      }
+      copy_element_text(text, text_end, value, sizeof(value));
+      add_url(info, value, priority);
+    }
+#undef TAG_IS
+  }
+
+  free(content);
+
+  if (result == 0 && file_count == 0) {
+    fprintf(stderr, "错误: Metalink 文件中没有 <file> 元素\n");
+    result = -1;
+  }
+  else if (result == 0 && info->url_count == 0) {
+    fprintf(stderr, "错误: Metalink 文件中没有 HTTP/HTTPS 下载地址\n");
+    result = -1;
+  }
+
+  if (result != 0) {
+    metalink_free(info);
+  }
+  return result;
+}
+
+void metalink_free(MetalinkInfo* info) {
+  if (!info) {
+    return;
+  }
+  free(info->piece_hashes);
+  info->piece_hashes = NULL;
+  info->piece_count = 0;
+}
+
+#ifdef WITH_OPENSSL
+// Metalink 算法名对应的 OpenSSL 摘要
+static const EVP_MD* metalink_digest(const char* hash_type) {
+  if (!hash_type) {
+    return NULL;
+  }
+  if (strcasecmp(hash_type, "md5") == 0) {
+    return EVP_md5();
+  }
+  if (strcasecmp(hash_type, "sha-1") == 0) {
+    return EVP_sha1();
+  }
+  if (strcasecmp(hash_type, "sha-224") == 0) {
+    return EVP_sha224();
+  }
+  if (strcasecmp(hash_type, "sha-256") == 0) {
+    return EVP_sha256();
+  }
+  if (strcasecmp(hash_type, "sha-384") == 0) {
+    return EVP_sha384();
+  }
+  if (strcasecmp(hash_type, "sha-512") == 0) {
+    return EVP_sha512();
+  }
+  return NULL;
+}
+#endif
+
+int metalink_hash_supported(const char* hash_type) {
+#ifdef WITH_OPENSSL
+  return metalink_digest(hash_type) != NULL;
+#else
+  (void)hash_type;
+  return 0;
+#endif
+}
+
+int metalink_hash_range(int fd, long long offset, long long length, const char* hash_type, char* hex, size_t hex_size) {
+#ifdef WITH_OPENSSL
+  const EVP_MD* digest = metalink_digest(hash_type);
+  if (!digest || hex_size < (size_t)EVP_MD_size(digest) * 2 + 1) {
+    return -1;
+  }
+
+  EVP_MD_CTX* context = EVP_MD_CTX_new();
+  unsigned char* buffer = malloc(METALINK_HASH_BUFFER_SIZE);
+  int result = context && buffer && EVP_DigestInit_ex(context, digest, NULL) == 1 ? 0 : -1;
+
+  while (result == 0 && length > 0) {
+    size_t chunk = length < METALINK_HASH_BUFFER_SIZE ? (size_t)length : METALINK_HASH_BUFFER_SIZE;
+    ssize_t bytes_read = pread(fd, buffer, chunk, offset);
+    if (bytes_read <= 0 || EVP_DigestUpdate(context, buffer, bytes_read) != 1) {
+      result = -1;
+      break;
+    }
+    offset += bytes_read;
+    length -= bytes_read;
+  }
+
+  unsigned char value[EVP_MAX_MD_SIZE];
+  unsigned int value_length = 0;
+  if (result == 0 && EVP_DigestFinal_ex(context, value, &value_length) == 1) {
+    for (unsigned int i = 0; i < value_length; i++) {
+      snprintf(hex + i * 2, 3, "%02x", value[i]);
+    }
+  }
+  else {
+    result = -1;
+  }
+
+  free(buffer);
+  EVP_MD_CTX_free(context);
+  return result;
+#else
+  (void)fd;
+  (void)offset;
+  (void)length;
+  (void)hash_type;
+  (void)hex;
+  (void)hex_size;
+  return -1;
+#endif
+}
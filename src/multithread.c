@@ -7,6 +7,23 @@
 #include "../include/utils.h"
 #include "../include/progress.h"
 #include "../include/menu.h"
+#include "../include/pool.h"
+#include "../include/config.h"
+#include "../include/event_engine.h"
+#include "../include/h2.h"
+#include "../include/autotune.h"
+#include "../include/dns.h"
+#include "../include/uring.h"
+#include "../include/metalink.h"
+#include "../include/redirect.h"
+#include "../include/ratelimit.h"
+#include "../include/writer.h"
+#include "../include/checkpoint.h"
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <setjmp.h>
+#include <linux/fs.h>
 // CLI颜色定义
 static const char* BLUE = "\033[34m";
 static const char* CYAN = "\033[36m";
@@ -28,10 +45,11 @@ MultiThreadDownloader* create_multithread_downloader(const char* url, const char
     return NULL;
   }
 
-  // 限制线程数量
-  if (thread_count > MAX_THREADS) {
-    printf("%s警告: 线程数量过多，限制为 %d%s\n", YELLOW, MAX_THREADS, RESET);
-    thread_count = MAX_THREADS;
+  // 限制线程数量（epoll 和 HTTP/2 引擎不为每个连接创建线程，上限更高）
+  int max_connections = get_download_options()->engine != DOWNLOAD_ENGINE_THREADS ? MAX_EVENT_CONNECTIONS : MAX_THREADS;
+  if (thread_count > max_connections) {
+    printf("%s警告: 线程数量过多，限制为 %d%s\n", YELLOW, max_connections, RESET);
+    thread_count = max_connections;
   }
 
   // 分配内存
@@ -49,6 +67,9 @@ MultiThreadDownloader* create_multithread_downloader(const char* url, const char
   downloader->thread_count = thread_count;
   downloader->file_size = -1;
   downloader->should_stop = 0;
+  downloader->error_code = DOWNLOAD_ERROR_NETWORK;
+  downloader->mirrors[0].url = downloader->url; // 主 URL 作为第一个下载地址
+  downloader->mirror_count = 1;
 
   // 初始化互斥锁
   if (pthread_mutex_init(&downloader->progress_mutex, NULL) != 0 ||
@@ -65,6 +86,403 @@ MultiThreadDownloader* create_multithread_downloader(const char* url, const char
   return downloader;
 }
 
+void build_output_path(const MultiThreadDownloader* downloader, char* buffer, size_t buffer_size) {
+  if (downloader->download_dir && strlen(downloader->download_dir) > 0) {
+    if (downloader->download_dir[strlen(downloader->download_dir) - 1] == '/') {
+      snprintf(buffer, buffer_size, "%s%s", downloader->download_dir, downloader->output_filename);
+    }
+    else {
+      snprintf(buffer, buffer_size, "%s/%s", downloader->download_dir, downloader->output_filename);
+    }
+  }
+  else {
+    snprintf(buffer, buffer_size, "%s", downloader->output_filename);
+  }
+}
+
+// 创建 .chd-partial 输出文件并预分配到完整大小
+// 返回1表示使用直接写入，0表示文件系统不支持、改用临时文件，-1表示失败（如磁盘空间不足）
+static int prepare_direct_output(MultiThreadDownloader* downloader) {
+  char full_output_path[4096];
+  build_output_path(downloader, full_output_path, sizeof(full_output_path));
+
+  char partial_path[4096 + sizeof(PARTIAL_FILE_SUFFIX)];
+  snprintf(partial_path, sizeof(partial_path), "%s%s", full_output_path, PARTIAL_FILE_SUFFIX);
+  char state_path[4096 + sizeof(STATE_FILE_SUFFIX)];
+  snprintf(state_path, sizeof(state_path), "%s%s", full_output_path, STATE_FILE_SUFFIX);
+
+  // 上次中断的下载留下了检查点：输出文件完整存在且服务器上的文件没有变化时，只下载缺少的区间
+  struct stat partial_stat;
+  if (checkpoint_enabled() && stat(partial_path, &partial_stat) == 0 &&
+    partial_stat.st_size == downloader->file_size && checkpoint_load(downloader, state_path) > 0) {
+    downloader->partial_path = strdup(partial_path);
+    downloader->state_path = strdup(state_path);
+    printf("%s✓ 从检查点继续: %s 已完成 %s (%d 个区间)%s\n", GREEN, partial_path,
+      format_file_size(downloader->resumed_bytes), downloader->resume_range_count, RESET);
+    return 1;
+  }
+  unlink(state_path); // 旧的状态文件描述的是被覆盖前的内容
+
+  int fd = open(partial_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("%s警告: 无法创建 %s (%s)，使用临时文件下载%s\n", YELLOW, partial_path, strerror(errno), RESET);
+    return 0;
+  }
+
+  // fallocate 一次性分配磁盘块，空间不足时立即失败；不支持时退回 ftruncate 创建稀疏文件
+  if (fallocate(fd, 0, 0, downloader->file_size) != 0) {
+    if (errno == ENOSPC) {
+      fprintf(stderr, "%s错误: 磁盘空间不足，无法分配 %s%s\n", RED, format_file_size(downloader->file_size), RESET);
+      close(fd);
+      unlink(partial_path);
+      return -1;
+    }
+    if (ftruncate(fd, downloader->file_size) != 0) {
+      printf("%s警告: 无法预分配输出文件 (%s)，使用临时文件下载%s\n", YELLOW, strerror(errno), RESET);
+      close(fd);
+      unlink(partial_path);
+      return 0;
+    }
+  }
+  close(fd);
+
+  downloader->partial_path = strdup(partial_path);
+  if (checkpoint_enabled()) {
+    downloader->state_path = strdup(state_path);
+  }
+  printf("%s✓ 已预分配输出文件: %s%s\n", GREEN, partial_path, RESET);
+  return 1;
+}
+
+// 完成直接写入：校验大小后把 .chd-partial 原子地重命名为输出文件
+static int finalize_direct_output(MultiThreadDownloader* downloader) {
+  char full_output_path[4096];
+  build_output_path(downloader, full_output_path, sizeof(full_output_path));
+
+  struct stat st;
+  if (stat(downloader->partial_path, &st) != 0) {
+    fprintf(stderr, "错误: 无法访问输出文件 %s: %s\n", downloader->partial_path, strerror(errno));
+    return -1;
+  }
+  if (st.st_size != downloader->file_size) {
+    fprintf(stderr, "错误: 输出文件大小不匹配 (实际: %lld, 期望: %lld)\n",
+      (long long)st.st_size, downloader->file_size);
+    return -1;
+  }
+
+  if (rename(downloader->partial_path, full_output_path) != 0) {
+    fprintf(stderr, "错误: 无法重命名 %s 为 %s: %s\n",
+      downloader->partial_path, full_output_path, strerror(errno));
+    return -1;
+  }
+
+  printf("输出文件: %s\n", full_output_path);
+  return 0;
+}
+
+FILE* open_segment_output(ThreadDownloadParams* thread_params) {
+  FileSegment* segment = thread_params->segment;
+
+  if (thread_params->direct_output) {
+    // 直接写入：打开预分配的输出文件，定位到段内已下载数据之后
+    FILE* file = fopen(thread_params->temp_filename, "r+b");
+    if (file && fseeko(file, thread_params->output_offset + segment->downloaded_bytes, SEEK_SET) != 0) {
+      fclose(file);
+      return NULL;
+    }
+    return file;
+  }
+
+  // 临时文件 - 支持断点续传，已有数据时追加写入
+  return fopen(thread_params->temp_filename, segment->downloaded_bytes > 0 ? "ab" : "wb");
+}
+
+// 关闭未被第一段接手的探测连接（响应体没有读完，不能复用）
+static void release_probe_stream(MultiThreadDownloader* downloader) {
+  if (downloader->probe_connection) {
+    connection_pool_release(downloader->probe_connection, 0);
+    downloader->probe_connection = NULL;
+  }
+}
+
+// 按缓存的永久重定向改写 URL，返回应用的重定向次数
+static int apply_cached_redirects(char* url, size_t url_size) {
+  char target[2048];
+  int hops = 0;
+  while (hops < REDIRECT_MAX_HOPS && redirect_cache_lookup(url, target, sizeof(target)) == 0) {
+    snprintf(url, url_size, "%s", target);
+    hops++;
+  }
+  return hops;
+}
+
+// Mirrors
+// 比较镜像与主 URL 的元数据，一致返回NULL，否则返回不一致的原因
+static const char* mirror_metadata_mismatch(const MirrorInfo* primary, const HttpResponseInfo* info, long long file_size) {
+  if (info->content_length != file_size) {
+    return "文件大小不一致";
+  }
+  if (primary->etag[0] && info->etag[0] && strcmp(primary->etag, info->etag) != 0) {
+    return "ETag 不一致";
+  }
+  if (primary->last_modified[0] && info->last_modified[0] && strcmp(primary->last_modified, info->last_modified) != 0) {
+    return "Last-Modified 不一致";
+  }
+  return NULL;
+}
+
+// 探测 --mirror 指定的镜像，大小和 ETag/Last-Modified 与主 URL 一致且支持 Range 的加入下载地址
+static void setup_mirrors(MultiThreadDownloader* downloader) {
+  DownloadOptions* options = get_download_options();
+  if (options->mirror_count == 0) {
+    return;
+  }
+  if (options->engine != DOWNLOAD_ENGINE_THREADS) {
+    printf("%s警告: %s 引擎不支持多镜像下载，只使用主 URL%s\n", YELLOW,
+      options->engine == DOWNLOAD_ENGINE_HTTP2 ? "HTTP/2" : "epoll", RESET);
+    return;
+  }
+
+  // 主 URL 的元数据优先使用启动探测的响应头
+  HttpResponseInfo primary_info = { 0 };
+  if (downloader->probe_response.status_code == 206) {
+    primary_info = downloader->probe_response;
+  }
+  else if (send_head_request(downloader->url, &primary_info) != 0 || primary_info.status_code != 200) {
+    printf("%s警告: 无法获取主 URL 的元数据，不使用镜像%s\n", YELLOW, RESET);
+    return;
+  }
+  // Metalink 的各个镜像是独立的服务器，ETag/Last-Modified 不可比，只比较大小，内容由分块哈希保证
+  if (!options->metalink) {
+    snprintf(downloader->mirrors[0].etag, sizeof(downloader->mirrors[0].etag), "%s", primary_info.etag);
+    snprintf(downloader->mirrors[0].last_modified, sizeof(downloader->mirrors[0].last_modified), "%s", primary_info.last_modified);
+  }
+
+  for (int i = 0; i < options->mirror_count && downloader->mirror_count < MAX_MIRRORS; i++) {
+    // 镜像同样先跟随重定向，之后的分段请求直接发往最终地址
+    char url[2048];
+    snprintf(url, sizeof(url), "%s", options->mirrors[i]);
+    apply_cached_redirects(url, sizeof(url));
+
+    HttpResponseInfo info = { 0 };
+    const char* reason = NULL;
+    int head_result;
+    int redirects = 0;
+    while ((head_result = send_head_request(url, &info)) == 0 &&
+      determine_status_action(info.status_code) == STATUS_ACTION_REDIRECT && redirects++ < REDIRECT_MAX_HOPS) {
+      char next_url[2048];
+      if (resolve_redirect_location(url, info.location, next_url, sizeof(next_url)) != 0) {
+        break;
+      }
+      if (info.status_code == 301 || info.status_code == 308) {
+        redirect_cache_store(url, next_url);
+      }
+      snprintf(url, sizeof(url), "%s", next_url);
+      memset(&info, 0, sizeof(info));
+    }
+
+    if (head_result != 0) {
+      reason = "HEAD 请求失败";
+    }
+    else if (info.status_code != 200) {
+      reason = "服务器返回非 200 状态码";
+    }
+    else {
+      reason = mirror_metadata_mismatch(&downloader->mirrors[0], &info, downloader->file_size);
+    }
+    if (!reason && !strstr(info.accept_ranges, "bytes") && !test_range_request(url)) {
+      reason = "不支持 Range 请求";
+    }
+
+    if (reason) {
+      printf("%s警告: 忽略镜像 %s (%s)%s\n", YELLOW, url, reason, RESET);
+      continue;
+    }
+
+    MirrorInfo* mirror = &downloader->mirrors[downloader->mirror_count];
+    memset(mirror, 0, sizeof(MirrorInfo));
+    if (parse_url(url, &mirror->url_info) != 0) {
+      printf("%s警告: 忽略镜像 %s (URL 无效)%s\n", YELLOW, url, RESET);
+      continue;
+    }
+    downloader->mirror_count++;
+    mirror->url = strdup(url);
+    snprintf(mirror->etag, sizeof(mirror->etag), "%s", info.etag);
+    snprintf(mirror->last_modified, sizeof(mirror->last_modified), "%s", info.last_modified);
+    printf("%s✓ 镜像可用: %s%s\n", GREEN, url, RESET);
+  }
+}
+
+// 为下一次请求选择下载地址：按各地址单连接吞吐量平滑加权轮询，跳过已停用的镜像和失败后暂停中的地址
+// （所有地址都在暂停中时不考虑暂停）。尚未测量的地址使用已测地址的平均吞吐量作为权重
+static int select_mirror(MultiThreadDownloader* downloader) {
+  if (downloader->mirror_count <= 1) {
+    return 0;
+  }
+
+  double now_ms = get_monotonic_ms();
+  pthread_mutex_lock(&downloader->progress_mutex);
+  int ready = 0;
+  for (int i = 0; i < downloader->mirror_count; i++) {
+    MirrorInfo* mirror = &downloader->mirrors[i];
+    if (!mirror->dropped && mirror->cooldown_until_ms <= now_ms) {
+      ready++;
+    }
+  }
+
+  double measured_rate = 0.0;
+  int measured = 0;
+  for (int i = 0; i < downloader->mirror_count; i++) {
+    MirrorInfo* mirror = &downloader->mirrors[i];
+    if (!mirror->dropped && mirror->rate > 0) {
+      measured_rate += mirror->rate;
+      measured++;
+    }
+  }
+  double default_weight = measured > 0 ? measured_rate / measured : 1.0;
+
+  int best = -1;
+  double total_weight = 0.0;
+  for (int i = 0; i < downloader->mirror_count; i++) {
+    MirrorInfo* mirror = &downloader->mirrors[i];
+    if (mirror->dropped || (ready > 0 && mirror->cooldown_until_ms > now_ms)) {
+      continue;
+    }
+
+    double weight = mirror->rate > 0 ? mirror->rate : default_weight;
+    mirror->current_weight += weight;
+    total_weight += weight;
+    if (best < 0 || mirror->current_weight > downloader->mirrors[best].current_weight) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    best = 0; // 镜像全部停用时使用主 URL
+  }
+  else {
+    downloader->mirrors[best].current_weight -= total_weight;
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return best;
+}
+
+// 记录一次请求的结果，更新地址的字节数和吞吐量
+static void record_mirror_result(ThreadDownloadParams* thread_params, long long bytes, double elapsed_ms, int failed) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (!downloader || downloader->mirror_count <= 1) {
+    return;
+  }
+
+  pthread_mutex_lock(&downloader->progress_mutex);
+  MirrorInfo* mirror = &downloader->mirrors[thread_params->mirror_index];
+  if (bytes > 0) {
+    mirror->bytes += bytes;
+  }
+  if (bytes >= STRIPE_MIN_SAMPLE_BYTES && elapsed_ms > 0) {
+    double rate = bytes / elapsed_ms;
+    mirror->rate = mirror->rate > 0 ? mirror->rate * 0.7 + rate * 0.3 : rate;
+  }
+  // 吞吐量为0（尚未测量）时减半不起作用，失败单独计数：连续失败的地址暂停分配请求，暂停时间逐次加倍
+  if (failed) {
+    mirror->failures++;
+    mirror->rate *= 0.5;
+    double cooldown_ms = MIRROR_COOLDOWN_MS;
+    for (int i = 1; i < mirror->consecutive_failures && cooldown_ms < MIRROR_COOLDOWN_MAX_MS; i++) {
+      cooldown_ms *= 2;
+    }
+    mirror->consecutive_failures++;
+    mirror->cooldown_until_ms = get_monotonic_ms() + (cooldown_ms < MIRROR_COOLDOWN_MAX_MS ? cooldown_ms : MIRROR_COOLDOWN_MAX_MS);
+  }
+  else {
+    mirror->consecutive_failures = 0;
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+}
+
+// 检查分段响应与主 URL 的元数据是否一致，镜像中途换了文件时停用该镜像
+// 一致返回0，不一致返回-1
+static int verify_mirror_response(ThreadDownloadParams* thread_params, const HttpResponseInfo* response_info) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (!downloader || downloader->mirror_count <= 1) {
+    return 0;
+  }
+
+  const char* reason = NULL;
+  const char* total = strrchr(response_info->content_range, '/');
+  if (response_info->status_code == 206 && total && strcmp(total + 1, "*") != 0 &&
+    atoll(total + 1) != downloader->file_size) {
+    reason = "文件大小不一致";
+  }
+  else if (downloader->mirrors[0].etag[0] && response_info->etag[0] &&
+    strcmp(downloader->mirrors[0].etag, response_info->etag) != 0) {
+    reason = "ETag 不一致";
+  }
+  if (!reason) {
+    return 0;
+  }
+
+  // 主 URL 定义了文件内容，不停用；镜像停用后后续请求改用其他地址
+  if (thread_params->mirror_index != 0) {
+    pthread_mutex_lock(&downloader->progress_mutex);
+    downloader->mirrors[thread_params->mirror_index].dropped = 1;
+    pthread_mutex_unlock(&downloader->progress_mutex);
+  }
+  snprintf(thread_params->segment->error_message, sizeof(thread_params->segment->error_message),
+    "镜像%s，已停用", reason);
+  return -1;
+}
+
+// 按 Metalink 的分块哈希准备逐块校验，分块信息不完整或算法不支持时只校验整个文件
+static void setup_piece_verification(MultiThreadDownloader* downloader) {
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  if (!metalink || metalink->piece_count == 0) {
+    return;
+  }
+
+  long long expected_pieces = (downloader->file_size + metalink->piece_length - 1) / metalink->piece_length;
+  if (metalink->piece_count != expected_pieces) {
+    printf("%s警告: Metalink 分块数量 (%d) 与文件大小不符，不做逐块校验%s\n", YELLOW, metalink->piece_count, RESET);
+    return;
+  }
+
+  downloader->piece_states = calloc(metalink->piece_count, sizeof(PieceState));
+  if (downloader->piece_states) {
+    printf("%s✓ 逐块校验: %d 个分块 (%lld KB, %s)%s\n", GREEN, metalink->piece_count,
+      metalink->piece_length / 1024, metalink->piece_hash_type, RESET);
+  }
+}
+
+// 从检查点继续时，按已完成区间之间的空缺建立分段，前 thread_count 段分配给初始线程，
+// 其余的段由先完成的线程接手；空缺超过段数组容量时最后一段延伸到文件末尾
+static int calculate_resume_segments(MultiThreadDownloader* downloader, int thread_count) {
+  int count = 0;
+  long long position = 0;
+  for (int i = 0; i <= downloader->resume_range_count; i++) {
+    long long gap_end = i < downloader->resume_range_count ? downloader->resume_ranges[i][0] : downloader->file_size;
+    if (gap_end > position && count == downloader->segment_capacity) {
+      downloader->segments[count - 1].end_byte = downloader->file_size - 1;
+      break;
+    }
+    if (gap_end > position) {
+      FileSegment* segment = &downloader->segments[count];
+      memset(segment, 0, sizeof(FileSegment));
+      segment->start_byte = position;
+      segment->end_byte = gap_end - 1;
+      segment->thread_id = count < thread_count ? count : -1;
+      segment->state = THREAD_STATE_IDLE;
+      segment->duplicate_of = -1;
+      segment->duplicate_index = -1;
+      printf("%s段 %d:%s %s%lld-%lld (%s)%s\n", BOLD, count, RESET, BLUE, segment->start_byte, segment->end_byte,
+        format_file_size(segment->end_byte - segment->start_byte + 1), RESET);
+      count++;
+    }
+    if (i < downloader->resume_range_count) {
+      position = downloader->resume_ranges[i][1];
+    }
+  }
+  return count;
+}
+
 int initialize_multithread_download(MultiThreadDownloader* downloader) {
   
 
@@ -74,13 +492,20 @@ int initialize_multithread_download(MultiThreadDownloader* downloader) {
 
   // 检查 Range 支持并获取文件大小
   long long file_size = 0;
-  int range_support = check_range_support(downloader->url, &file_size);
+  int range_support = probe_range_stream(downloader, &file_size);
 
   if (range_support < 0) {
     fprintf(stderr, "错误: 无法检查 Range 支持\n");
     return -1;
   }
 
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  if (metalink && metalink->file_size >= 0 && file_size > 0 && file_size != metalink->file_size) {
+    fprintf(stderr, "错误: 服务器返回的文件大小 (%lld) 与 Metalink 不一致 (%lld)\n", file_size, metalink->file_size);
+    downloader->error_code = DOWNLOAD_ERROR_VERIFY;
+    return -1;
+  }
+
   if (range_support == 0 || file_size <= MIN_SEGMENT_SIZE) {
     // CLI颜色定义
     const char* BLUE = "\033[34m";
@@ -92,48 +517,127 @@ int initialize_multithread_download(MultiThreadDownloader* downloader) {
     const char* GREEN = "\033[32m";
     const char* CLEAR_LINE = "\r\033[K";
     printf("%s警告: 将使用单线程下载 (Range不支持或文件过小)%s\n", YELLOW, RESET);
+    release_probe_stream(downloader);
     downloader->thread_count = 1;
     downloader->file_size = file_size > 0 ? file_size : -1;
     return 0; // 退化到单线程
   }
 
   downloader->file_size = file_size;
+  if (parse_url(downloader->url, &downloader->mirrors[0].url_info) != 0) {
+    fprintf(stderr, "错误: 无法解析URL %s\n", downloader->url);
+    downloader->error_code = DOWNLOAD_ERROR_URL_PARSE;
+    return -1;
+  }
+
+  // 探测镜像，元数据与主 URL 一致的镜像参与分段下载
+  setup_mirrors(downloader);
+  setup_piece_verification(downloader);
+
+  // 优先预分配输出文件直接写入，文件系统不支持时退回临时文件
+  downloader->direct_output = 0;
+  if (get_download_options()->output_mode == OUTPUT_MODE_DIRECT) {
+    int prepare_result = prepare_direct_output(downloader);
+    if (prepare_result < 0) {
+      downloader->error_code = DOWNLOAD_ERROR_FILE_OPEN;
+      return -1;
+    }
+    downloader->direct_output = prepare_result;
+  }
+
+  // epoll 和 HTTP/2 引擎自己建立连接，不接手探测连接
+  if (get_download_options()->engine != DOWNLOAD_ENGINE_THREADS) {
+    release_probe_stream(downloader);
+  }
+
+  // 线程模式下直接写入时启用动态调度：空闲线程拆分其他段的剩余部分，
+  // 临时文件按段合并、epoll 引擎按段建立连接，仍使用静态分段
+  downloader->dynamic_segments = downloader->direct_output &&
+    get_download_options()->engine == DOWNLOAD_ENGINE_THREADS;
+  downloader->segment_capacity = downloader->thread_count *
+    (downloader->dynamic_segments ? MAX_SEGMENTS_PER_THREAD : 1);
+
+  // 自动连接数依赖动态调度：新增的连接拆分已有段的剩余部分，撤下的连接完成当前段后退出
+  downloader->auto_connections = get_download_options()->auto_connections && downloader->dynamic_segments;
+  if (get_download_options()->auto_connections && !downloader->auto_connections) {
+    printf("%s警告: 自动连接数需要线程模式并直接写入输出文件，使用固定的 %d 个连接%s\n",
+      YELLOW, downloader->thread_count, RESET);
+  }
+  // 连接数固定时可以为慢段发出对冲请求（自动连接数模式由调节器增减连接）。
+  // 对冲请求只使用已退出线程空出的槽位，总连接数不超过 -t
+  const DownloadOptions* options = get_download_options();
+  downloader->hedging = downloader->dynamic_segments && !downloader->auto_connections &&
+    (options->hedge_speed_ratio > 0 || options->hedge_stall_ms > 0);
+
+  int thread_capacity = downloader->thread_count;
+  int initial_threads = downloader->thread_count;
+  if (downloader->auto_connections && initial_threads > AUTOTUNE_INITIAL_CONNECTIONS) {
+    initial_threads = AUTOTUNE_INITIAL_CONNECTIONS;
+  }
 
   // 分配内存
-  downloader->segments = malloc(sizeof(FileSegment) * downloader->thread_count);
+  downloader->segments = malloc(sizeof(FileSegment) * downloader->segment_capacity);
   downloader->threads = malloc(sizeof(ThreadDownloadParams) * downloader->thread_count);
 
   if (!downloader->segments || !downloader->threads) {
     fprintf(stderr, "错误: 内存分配失败\n");
     free(downloader->segments);
     free(downloader->threads);
+    downloader->segments = NULL;
+    downloader->threads = NULL;
+    downloader->error_code = DOWNLOAD_ERROR_MEMORY;
     return -1;
   }
 
-  // 计算文件分段
-  int actual_threads = calculate_file_segments(file_size, downloader->thread_count, downloader->segments);
-  if (actual_threads < 0) {
-    fprintf(stderr, "错误: 文件分段计算失败\n");
-    return -1;
+  // 计算文件分段（从检查点继续时只为缺少的区间分段）
+  int actual_threads;
+  if (downloader->resume_range_count > 0) {
+    actual_threads = initial_threads;
+    downloader->segment_count = calculate_resume_segments(downloader, initial_threads);
+    if (downloader->segment_count == 0 || downloader->segments[0].start_byte != 0) {
+      release_probe_stream(downloader); // 文件开头已经下载，探测连接的响应体没有用
+    }
+  }
+  else {
+    actual_threads = calculate_file_segments(file_size, initial_threads, downloader->segments);
+    if (actual_threads < 0) {
+      fprintf(stderr, "错误: 文件分段计算失败\n");
+      return -1;
+    }
+    downloader->segment_count = actual_threads;
   }
 
   downloader->thread_count = actual_threads;
+  if (!downloader->auto_connections) {
+    thread_capacity = actual_threads;
+  }
 
-  // 初始化线程参数
-  for (int i = 0; i < downloader->thread_count; i++) {
+  // 初始化线程参数（自动连接数模式下多出的槽位留给之后新增的连接）
+  downloader->thread_capacity = thread_capacity;
+  for (int i = 0; i < thread_capacity; i++) {
     ThreadDownloadParams* thread = &downloader->threads[i];
     memset(thread, 0, sizeof(ThreadDownloadParams));
 
     thread->thread_id = i;
     thread->url = strdup(downloader->url);
-    thread->segment = &downloader->segments[i];
+    thread->segment = i < actual_threads && i < downloader->segment_count ? &downloader->segments[i] : NULL;
     thread->should_stop = 0;
     thread->progress_mutex = &downloader->progress_mutex;
-
-    // 生成临时文件名
-    thread->temp_filename = malloc(256);
-    snprintf(thread->temp_filename, 256, "%s.part%d",
-      downloader->output_filename, i);
+    thread->downloader = downloader;
+    thread->active_sockfd = -1;
+
+    if (downloader->direct_output) {
+      // 所有段写入同一个输出文件的各自偏移
+      thread->direct_output = 1;
+      thread->output_offset = thread->segment ? thread->segment->start_byte : 0;
+      thread->temp_filename = strdup(downloader->partial_path);
+    }
+    else {
+      // 生成临时文件名
+      thread->temp_filename = malloc(256);
+      snprintf(thread->temp_filename, 256, "%s.part%d",
+        downloader->output_filename, i);
+    }
   }
 
   printf("%s✓ 多线程下载初始化完成\n%s", GREEN, RESET);
@@ -146,11 +650,29 @@ void destroy_multithread_downloader(MultiThreadDownloader* downloader) {
 
   // 确保所有线程已停止
   stop_multithread_download(downloader);
+  async_writer_destroy(downloader->writer, NULL);
+
+  // 关闭连接池中的空闲连接
+  connection_pool_cleanup();
 
   // 清理内存
+  if (downloader->threads) {
+    for (int i = 0; i < downloader->thread_capacity; i++) {
+      free(downloader->threads[i].url);
+      free(downloader->threads[i].temp_filename);
+    }
+  }
+  for (int i = 1; i < downloader->mirror_count; i++) {
+    free(downloader->mirrors[i].url);
+  }
+  free(downloader->piece_states);
+  release_probe_stream(downloader);
   free(downloader->url);
   free(downloader->output_filename);
   free(downloader->download_dir);
+  free(downloader->partial_path);
+  free(downloader->state_path);
+  free(downloader->resume_ranges);
   free(downloader->segments);
   free(downloader->threads);
 
@@ -166,134 +688,1303 @@ void destroy_multithread_downloader(MultiThreadDownloader* downloader) {
 
 
 
-// Workers
-// 下载线程Worker函数
-void* thread_download_worker(void* arg) {
-  ThreadDownloadParams* thread_params = (ThreadDownloadParams*)arg;
+// Scheduler
+// 段的目标字节数。动态调度时其他线程会缩短段的结束位置，下载循环每次写入前重新读取
+static long long segment_target_bytes(ThreadDownloadParams* thread_params) {
+  pthread_mutex_lock(thread_params->progress_mutex);
+  FileSegment* segment = thread_params->segment;
+  long long target = segment->end_byte - segment->start_byte + 1;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+  return target > 0 ? target : 0;
+}
 
-  // 使用带重试的下载函数
-  int result = download_segment_with_retry(thread_params);
+// 段中已计入的下载字节数（段被缩短后可能多写了一部分，不超过段大小）（调用者需持有进度锁）
+static long long segment_downloaded_locked(const FileSegment* segment) {
+  long long size = segment->end_byte - segment->start_byte + 1;
+  if (size < 0) {
+    size = 0;
+  }
+  return segment->downloaded_bytes < size ? segment->downloaded_bytes : size;
+}
 
-  // 返回结果
-  pthread_exit((void*)(intptr_t)result);
+// 段剩余的字节数（调用者需持有进度锁）
+static long long segment_remaining_locked(const FileSegment* segment) {
+  return segment->end_byte - segment->start_byte + 1 - segment_downloaded_locked(segment);
 }
 
-// 进度条线程Worker函数
-void* progress_display_worker(void* arg) {
-  MultiThreadDownloader* downloader = (MultiThreadDownloader*)arg;
+// 所有段覆盖的已下载字节数（调用者需持有进度锁）
+// 重复下载的段与原段从同一位置开始向后写，只计算超出原段已下载位置的部分
+static long long segments_downloaded_locked(MultiThreadDownloader* downloader) {
+  long long total = downloader->resumed_bytes; // 从检查点恢复的区间不属于任何段
+  for (int i = 0; i < downloader->segment_count; i++) {
+    FileSegment* segment = &downloader->segments[i];
+    long long downloaded = segment_downloaded_locked(segment);
 
-  while (!downloader->should_stop) {
-    display_multithread_progress(downloader);
-    usleep(50000); // 每0.05秒更新一次
+    if (segment->duplicate_of >= 0) {
+      FileSegment* original = &downloader->segments[segment->duplicate_of];
+      long long original_end = original->start_byte + segment_downloaded_locked(original);
+      long long duplicate_end = segment->start_byte + downloaded;
+      total += duplicate_end > original_end ? duplicate_end - original_end : 0;
+    }
+    else {
+      total += downloaded;
+    }
   }
+  return total;
+}
 
-  // 最后显示一次完整进度
-  display_multithread_progress(downloader);
-  printf("\n");
+// 结束被另一方抢先完成的段。段的结束位置已被缩短，正在接收数据的线程读到下一块时就会停止；
+// 长时间没有进展的连接可能一直阻塞在 recv 中，关闭其读方向让线程立即返回（调用者需持有进度锁）
+static void cancel_stalled_segment_locked(MultiThreadDownloader* downloader, FileSegment* segment) {
+  if (segment->thread_id < 0 || segment->sample_ms == 0 ||
+    get_monotonic_ms() - segment->last_progress_ms < 2 * HEDGE_CHECK_INTERVAL_MS) {
+    return;
+  }
+  ThreadDownloadParams* thread = &downloader->threads[segment->thread_id];
+  int sockfd = thread->active_sockfd;
+  if (thread->segment == segment && sockfd >= 0) {
+    shutdown(sockfd, SHUT_RD);
+  }
+}
 
-  pthread_exit(NULL);
+// 段结束后更新调度状态（调用者需持有进度锁）
+// 成功时重复下载的另一方的剩余部分已经写好，把它截断到已下载的位置让它尽快结束；失败时放弃段，留给其他线程接手
+static void segment_scheduler_finish_locked(MultiThreadDownloader* downloader, FileSegment* segment, int result) {
+  if (result != 0) {
+    segment->thread_id = -1;
+    return;
+  }
+
+  int partner = segment->duplicate_of >= 0 ? segment->duplicate_of : segment->duplicate_index;
+  if (partner >= 0) {
+    FileSegment* other = &downloader->segments[partner];
+    if (segment_remaining_locked(other) > 0) {
+      other->end_byte = other->start_byte + other->downloaded_bytes - 1;
+      cancel_stalled_segment_locked(downloader, other);
+      if (segment->hedge && segment->duplicate_of >= 0) {
+        downloader->hedge_won_count++;
+      }
+    }
+  }
 }
 
+// 段是否可以被空闲线程接手：已被放弃、尚未完成，且没有仍在进行的重复下载（调用者需持有进度锁）
+static int segment_is_orphan_locked(MultiThreadDownloader* downloader, const FileSegment* segment) {
+  if (segment->thread_id >= 0 || segment_remaining_locked(segment) <= 0) {
+    return 0;
+  }
+  int partner = segment->duplicate_of >= 0 ? segment->duplicate_of : segment->duplicate_index;
+  return partner < 0 || downloader->segments[partner].thread_id < 0;
+}
 
+// 为完成当前段的线程领取下一段工作：
+// 1. 接手被其他线程放弃的段；
+// 2. 把剩余最多的段从剩余部分的中点拆开，领取后半部分（每部分不小于 MIN_SEGMENT_SIZE）；
+// 3. 已无法拆分且剩余数据不超过 ENDGAME_REMAINING_PERCENT 时进入收尾阶段，
+//    重复下载预计最晚完成的段，先完成的一方结束另一方
+// @param should_wait 没有领取到段但稍后可能进入收尾阶段时置1
+// @return 领取到的段，没有可做的工作时返回NULL
+static FileSegment* segment_scheduler_next(MultiThreadDownloader* downloader, ThreadDownloadParams* thread_params, int* should_wait) {
+  FileSegment* next = NULL;
+  *should_wait = 0;
 
+  pthread_mutex_lock(&downloader->progress_mutex);
 
+  if (thread_params->segment) {
+    segment_scheduler_finish_locked(downloader, thread_params->segment, 0);
+  }
 
+  for (int i = 0; i < downloader->segment_count && !next; i++) {
+    if (segment_is_orphan_locked(downloader, &downloader->segments[i])) {
+      next = &downloader->segments[i];
+    }
+  }
 
+  // 拆分剩余最多的段（正在被重复下载的段不再拆分）；被撤下的线程的段优先拆分，让它尽快退出
+  if (!next && downloader->segment_count < downloader->segment_capacity) {
+    FileSegment* victim = NULL;
+    long long victim_remaining = 0;
+    int victim_retiring = 0;
+    for (int i = 0; i < downloader->segment_count; i++) {
+      FileSegment* segment = &downloader->segments[i];
+      if (segment->thread_id < 0 || segment->duplicate_of >= 0 || segment->duplicate_index >= 0) {
+        continue;
+      }
+      long long remaining = segment_remaining_locked(segment);
+      int retiring = downloader->threads[segment->thread_id].retiring && remaining >= 2 * MIN_SEGMENT_SIZE;
+      if (retiring > victim_retiring || (retiring == victim_retiring && remaining > victim_remaining)) {
+        victim = segment;
+        victim_remaining = remaining;
+        victim_retiring = retiring;
+      }
+    }
 
-// !!MAIN ENTRANCE!!
-int multithread_download(MultiThreadDownloader* downloader) {
-  
+    if (victim && victim_remaining >= 2 * MIN_SEGMENT_SIZE) {
+      // 拆分点离原线程的写入位置至少 MIN_SEGMENT_SIZE，原线程在途的数据不会越过拆分点
+      long long split = victim->start_byte + victim->downloaded_bytes + victim_remaining / 2;
+      next = &downloader->segments[downloader->segment_count++];
+      memset(next, 0, sizeof(FileSegment));
+      next->start_byte = split;
+      next->end_byte = victim->end_byte;
+      next->duplicate_of = -1;
+      next->duplicate_index = -1;
+      victim->end_byte = split - 1;
+      downloader->steal_count++;
+    }
+  }
 
-  if (!downloader) {
-    return -1;
+  // 收尾阶段：按剩余字节/当前速度估计完成时间，重复下载最慢的段
+  if (!next && downloader->segment_count < downloader->segment_capacity) {
+    FileSegment* slowest = NULL;
+    double slowest_eta = -1.0;
+    for (int i = 0; i < downloader->segment_count; i++) {
+      FileSegment* segment = &downloader->segments[i];
+      if (segment->thread_id < 0 || segment->duplicate_of >= 0 || segment->duplicate_index >= 0) {
+        continue;
+      }
+      long long remaining = segment_remaining_locked(segment);
+      if (remaining < ENDGAME_MIN_REMAINING) {
+        continue;
+      }
+      double speed = downloader->threads[segment->thread_id].download_speed;
+      double eta = speed > 0 ? remaining / speed : 1e18;
+      if (eta > slowest_eta) {
+        slowest = segment;
+        slowest_eta = eta;
+      }
+    }
+
+    long long total_remaining = downloader->file_size - segments_downloaded_locked(downloader);
+    int endgame = total_remaining * 100 <= downloader->file_size * ENDGAME_REMAINING_PERCENT;
+    if (slowest && !endgame) {
+      *should_wait = 1; // 其他线程仍在下载，等剩余数据足够少时再重复下载
+    }
+    else if (slowest) {
+      int slowest_index = (int)(slowest - downloader->segments);
+      next = &downloader->segments[downloader->segment_count];
+      memset(next, 0, sizeof(FileSegment));
+      next->start_byte = slowest->start_byte + slowest->downloaded_bytes;
+      next->end_byte = slowest->end_byte;
+      next->duplicate_of = slowest_index;
+      next->duplicate_index = -1;
+      slowest->duplicate_index = downloader->segment_count++;
+      downloader->endgame_count++;
+    }
   }
 
-  // 首先初始化多线程下载
-  int init_result = initialize_multithread_download(downloader);
-  if (init_result < 0) {
-    return -1;
+  if (next) {
+    next->thread_id = thread_params->thread_id;
+    next->state = THREAD_STATE_IDLE;
+    next->error_message[0] = '\0';
+    thread_params->segment = next;
+    thread_params->output_offset = next->start_byte;
+    thread_params->download_speed = 0.0;
   }
 
-  if (init_result == 0) {
-    // 退化到单线程下载
-    printf("%s使用单线程下载模式...%s\n", YELLOW, RESET);
-    return download_file_fallback_single_thread(downloader);
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return next;
+}
+
+long long multithread_downloaded_bytes(MultiThreadDownloader* downloader) {
+  pthread_mutex_lock(&downloader->progress_mutex);
+  long long downloaded = segments_downloaded_locked(downloader);
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return downloaded;
+}
+
+// 空闲的线程槽位：优先复用已退出并回收的槽位（进度显示的行数不会无限增长），没有时返回-1
+static int find_worker_slot(MultiThreadDownloader* downloader) {
+  for (int i = 0; i < downloader->thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    if (thread->finished && thread->pthread_id == 0) {
+      return i;
+    }
   }
+  return downloader->thread_count < downloader->thread_capacity ? downloader->thread_count : -1;
+}
 
-  printf("\n%s%s=== 开始多线程下载 ===%s\n", BOLD, GREEN, RESET);
-  downloader->start_time = time(NULL);
-  downloader->should_stop = 0;
-  downloader->completed_threads = 0;
+// 准备槽位 index 的线程参数（调用者需持有进度锁），segment 为NULL时线程启动后向调度器领取分段
+static void prepare_worker_locked(MultiThreadDownloader* downloader, int index, FileSegment* segment) {
+  ThreadDownloadParams* thread = &downloader->threads[index];
+  thread->segment = segment;
+  thread->should_stop = 0;
+  thread->retiring = 0;
+  thread->finished = 0;
+  thread->download_speed = 0.0;
+  thread->active_sockfd = -1;
+  if (segment) {
+    segment->thread_id = index;
+    thread->output_offset = segment->start_byte;
+  }
+  if (index == downloader->thread_count) {
+    downloader->thread_count++;
+  }
+}
+
+int add_download_worker(MultiThreadDownloader* downloader) {
+  if (!downloader->dynamic_segments) {
+    return -1;
+  }
+
+  int index = find_worker_slot(downloader);
+  if (index < 0) {
+    return -1;
+  }
+
+  ThreadDownloadParams* thread = &downloader->threads[index];
+  pthread_mutex_lock(&downloader->progress_mutex);
+  prepare_worker_locked(downloader, index, NULL); // 启动后通过调度器拆分其他段
+  pthread_mutex_unlock(&downloader->progress_mutex);
+
+  if (pthread_create(&thread->pthread_id, NULL, thread_download_worker, thread) != 0) {
+    thread->pthread_id = 0;
+    thread->finished = 1;
+    return -1;
+  }
+  return index;
+}
+
+// Hedging
+// 采样段的下载速度，更新指数加权平均和最近一次有进展的时间（调用者需持有进度锁）
+static void sample_segment_rate_locked(FileSegment* segment, double now_ms) {
+  if (segment->sample_ms == 0) {
+    segment->sampled_bytes = segment->downloaded_bytes;
+    segment->sample_ms = now_ms;
+    segment->first_sample_ms = now_ms;
+    segment->last_progress_ms = now_ms;
+    segment->rate_ewma = 0.0;
+    return;
+  }
+
+  double elapsed = now_ms - segment->sample_ms;
+  if (elapsed <= 0) {
+    return;
+  }
+  long long delta = segment->downloaded_bytes - segment->sampled_bytes;
+  double rate = delta > 0 ? delta / elapsed : 0.0;
+  segment->rate_ewma = HEDGE_EWMA_ALPHA * rate + (1 - HEDGE_EWMA_ALPHA) * segment->rate_ewma;
+  if (delta > 0) {
+    segment->last_progress_ms = now_ms;
+  }
+  segment->sampled_bytes = segment->downloaded_bytes;
+  segment->sample_ms = now_ms;
+}
+
+static int compare_rates(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// 对冲请求的写入位置超过原请求后，原请求在对冲请求的起点结束，两段各自成为普通段，
+// 对冲请求的剩余部分之后还可以被空闲线程拆分（调用者需持有进度锁）
+static void settle_hedges_locked(MultiThreadDownloader* downloader) {
+  for (int i = 0; i < downloader->segment_count; i++) {
+    FileSegment* hedge = &downloader->segments[i];
+    if (!hedge->hedge || hedge->duplicate_of < 0) {
+      continue;
+    }
+    FileSegment* original = &downloader->segments[hedge->duplicate_of];
+    if (segment_remaining_locked(original) <= 0 ||
+      hedge->start_byte + hedge->downloaded_bytes <= original->start_byte + original->downloaded_bytes) {
+      continue;
+    }
+
+    original->end_byte = hedge->start_byte - 1;
+    original->duplicate_index = -1;
+    hedge->duplicate_of = -1;
+    downloader->hedge_won_count++;
+    cancel_stalled_segment_locked(downloader, original);
+  }
+}
+
+// 采样所有活动段并找出需要对冲的慢段：速度低于中位数的 hedge_speed_ratio，或 hedge_stall_ms 内没有进展。
+// 正在被重复下载的段和剩余不足 ENDGAME_MIN_REMAINING 的段不对冲（调用者需持有进度锁）
+// @return 预计最晚完成的慢段序号，没有时返回-1
+static int find_straggler_locked(MultiThreadDownloader* downloader, double now_ms) {
+  const DownloadOptions* options = get_download_options();
+  double rates[MAX_THREADS];
+  int rate_count = 0;
+  int active_hedges = 0;
+
+  for (int i = 0; i < downloader->segment_count; i++) {
+    FileSegment* segment = &downloader->segments[i];
+    if (segment->thread_id < 0 || segment_remaining_locked(segment) <= 0) {
+      segment->sample_ms = 0; // 被放弃的段由其他线程接手后重新采样
+      continue;
+    }
+    sample_segment_rate_locked(segment, now_ms);
+    if (segment->hedge && segment->duplicate_of >= 0) {
+      active_hedges++;
+    }
+    if (now_ms - segment->first_sample_ms >= HEDGE_WARMUP_MS && rate_count < MAX_THREADS) {
+      rates[rate_count++] = segment->rate_ewma;
+    }
+  }
+
+  if (active_hedges >= HEDGE_MAX_ACTIVE) {
+    return -1;
+  }
+
+  // 至少三个段参与比较时中位数才有意义
+  double median = 0.0;
+  if (rate_count >= 3) {
+    qsort(rates, rate_count, sizeof(double), compare_rates);
+    median = rates[rate_count / 2];
+  }
+
+  int straggler = -1;
+  double straggler_eta = -1.0;
+  for (int i = 0; i < downloader->segment_count; i++) {
+    FileSegment* segment = &downloader->segments[i];
+    if (segment->thread_id < 0 || segment->duplicate_of >= 0 || segment->duplicate_index >= 0 ||
+      segment->sample_ms == 0) {
+      continue;
+    }
+    long long remaining = segment_remaining_locked(segment);
+    if (remaining < ENDGAME_MIN_REMAINING) {
+      continue;
+    }
+
+    int stalled = options->hedge_stall_ms > 0 && now_ms - segment->last_progress_ms >= options->hedge_stall_ms;
+    int slow = options->hedge_speed_ratio > 0 && median > 0 &&
+      now_ms - segment->first_sample_ms >= HEDGE_WARMUP_MS &&
+      segment->rate_ewma < median * options->hedge_speed_ratio;
+    if (!stalled && !slow) {
+      continue;
+    }
+
+    double eta = segment->rate_ewma > 0 ? remaining / segment->rate_ewma : 1e18;
+    if (eta > straggler_eta) {
+      straggler = i;
+      straggler_eta = eta;
+    }
+  }
+  return straggler;
+}
+
+// 为慢段的剩余部分发出对冲请求：新建一个从原段当前位置开始的重复段，用已退出线程空出的槽位下载
+static void hedge_stragglers(MultiThreadDownloader* downloader) {
+  int index = find_worker_slot(downloader);
+
+  pthread_mutex_lock(&downloader->progress_mutex);
+  settle_hedges_locked(downloader);
+  int straggler = find_straggler_locked(downloader, get_monotonic_ms());
+  if (straggler < 0 || index < 0 || downloader->segment_count >= downloader->segment_capacity) {
+    pthread_mutex_unlock(&downloader->progress_mutex);
+    return;
+  }
+
+  FileSegment* original = &downloader->segments[straggler];
+  FileSegment* hedge = &downloader->segments[downloader->segment_count];
+  memset(hedge, 0, sizeof(FileSegment));
+  hedge->start_byte = original->start_byte + segment_downloaded_locked(original);
+  hedge->end_byte = original->end_byte;
+  hedge->duplicate_of = straggler;
+  hedge->duplicate_index = -1;
+  hedge->hedge = 1;
+  hedge->state = THREAD_STATE_IDLE;
+  original->duplicate_index = downloader->segment_count++;
+  downloader->hedge_count++;
+  prepare_worker_locked(downloader, index, hedge);
+  pthread_mutex_unlock(&downloader->progress_mutex);
+
+  ThreadDownloadParams* thread = &downloader->threads[index];
+  if (pthread_create(&thread->pthread_id, NULL, thread_download_worker, thread) != 0) {
+    // 放弃对冲段：清空其范围并解除与原段的关联
+    pthread_mutex_lock(&downloader->progress_mutex);
+    hedge->thread_id = -1;
+    hedge->end_byte = hedge->start_byte - 1;
+    hedge->duplicate_of = -1;
+    original->duplicate_index = -1;
+    pthread_mutex_unlock(&downloader->progress_mutex);
+    thread->pthread_id = 0;
+    thread->finished = 1;
+  }
+}
+
+void hedge_run(MultiThreadDownloader* downloader) {
+  while (!downloader->should_stop) {
+    usleep(HEDGE_CHECK_INTERVAL_MS * 1000);
+
+    // 回收已退出的线程（动态调度的结果按段是否完整判断），所有线程退出后结束
+    int active = 0;
+    for (int i = 0; i < downloader->thread_count; i++) {
+      ThreadDownloadParams* thread = &downloader->threads[i];
+      if (thread->finished && thread->pthread_id != 0) {
+        pthread_join(thread->pthread_id, NULL);
+        thread->pthread_id = 0;
+      }
+      else if (thread->pthread_id != 0) {
+        active++;
+      }
+    }
+    if (active == 0) {
+      break;
+    }
+
+    hedge_stragglers(downloader);
+  }
+}
+
+// Piece Verification
+// 分块 [start, end) 是否已被各段写入的前缀完整覆盖（调用者需持有进度锁）
+static int piece_covered_locked(MultiThreadDownloader* downloader, long long start, long long end) {
+  long long position = start;
+  int advanced = 1;
+  while (position < end && advanced) {
+    advanced = 0;
+    for (int i = 0; i < downloader->segment_count; i++) {
+      FileSegment* segment = &downloader->segments[i];
+      long long written_end = segment->start_byte + segment_downloaded_locked(segment);
+      if (segment->start_byte <= position && written_end > position) {
+        position = written_end;
+        advanced = 1;
+      }
+    }
+  }
+  return position >= end;
+}
+
+// 计算分块的哈希并与 Metalink 比对，一致返回0
+static int verify_piece(MultiThreadDownloader* downloader, int fd, int index) {
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  long long start = (long long)index * metalink->piece_length;
+  long long length = downloader->file_size - start < metalink->piece_length ?
+    downloader->file_size - start : metalink->piece_length;
+
+  char hash[METALINK_HASH_LENGTH];
+  if (metalink_hash_range(fd, start, length, metalink->piece_hash_type, hash, sizeof(hash)) != 0) {
+    return -1;
+  }
+  return strcasecmp(hash, metalink->piece_hashes[index]) == 0 ? 0 : -1;
+}
+
+// 段写入 [from, to)（段内偏移）后校验刚好写完的分块：
+// 本段对某个分块的最后一个字节落盘时，检查其他段是否也已写完该分块，完整则立即计算哈希。
+// 校验失败的分块标记为待重新下载，由下载线程在领取下一段前单独重新下载
+static void verify_landed_pieces(ThreadDownloadParams* thread_params, FILE* file, long long from, long long to) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (!downloader || !downloader->piece_states || !thread_params->direct_output || to <= from) {
+    return;
+  }
+
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  long long base = thread_params->output_offset;
+  pthread_mutex_lock(thread_params->progress_mutex);
+  long long segment_end = thread_params->segment->end_byte + 1;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+
+  for (long long index = (base + from) / metalink->piece_length;
+    index < metalink->piece_count && index * metalink->piece_length < base + to; index++) {
+    long long piece_start = index * metalink->piece_length;
+    long long piece_end = piece_start + metalink->piece_length < downloader->file_size ?
+      piece_start + metalink->piece_length : downloader->file_size;
+    long long contribution_end = piece_end < segment_end ? piece_end : segment_end;
+    if (contribution_end <= base + from || contribution_end > base + to) {
+      continue;
+    }
+
+    pthread_mutex_lock(thread_params->progress_mutex);
+    int claimed = downloader->piece_states[index] == PIECE_PENDING &&
+      piece_covered_locked(downloader, piece_start, piece_end);
+    if (claimed) {
+      downloader->piece_states[index] = PIECE_VERIFYING;
+    }
+    pthread_mutex_unlock(thread_params->progress_mutex);
+    if (!claimed) {
+      continue;
+    }
+
+    fflush(file);
+    int verified = verify_piece(downloader, fileno(file), (int)index) == 0;
+
+    pthread_mutex_lock(thread_params->progress_mutex);
+    downloader->piece_states[index] = verified ? PIECE_VERIFIED : PIECE_CORRUPT;
+    if (verified) {
+      downloader->verified_pieces++;
+    }
+    pthread_mutex_unlock(thread_params->progress_mutex);
+  }
+}
+
+// 停用返回了错误数据的镜像（至少保留一个可用地址）
+static void drop_corrupt_mirror(MultiThreadDownloader* downloader, int mirror_index) {
+  pthread_mutex_lock(&downloader->progress_mutex);
+  int active = 0;
+  for (int i = 0; i < downloader->mirror_count; i++) {
+    active += !downloader->mirrors[i].dropped;
+  }
+  if (active > 1) {
+    downloader->mirrors[mirror_index].dropped = 1;
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+}
+
+// 单独重新下载一个分块并重新校验，成功返回0。
+// 重新下载的数据仍校验失败时停用这次使用的镜像，换其他镜像再试。
+// 直接使用线程自己的参数（低速看门狗按线程检查连接），结束后恢复线程原来的段和输出位置
+// @param thread_params 执行重新下载的线程；path 为分块所在的文件
+static int refetch_piece(ThreadDownloadParams* thread_params, const char* path, int index) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+
+  FileSegment segment = { 0 };
+  segment.start_byte = (long long)index * metalink->piece_length;
+  segment.end_byte = segment.start_byte + metalink->piece_length - 1;
+  if (segment.end_byte >= downloader->file_size) {
+    segment.end_byte = downloader->file_size - 1;
+  }
+  segment.thread_id = thread_params->thread_id;
+  segment.duplicate_of = -1;
+  segment.duplicate_index = -1;
+
+  pthread_mutex_lock(&downloader->progress_mutex);
+  FileSegment* saved_segment = thread_params->segment;
+  long long saved_output_offset = thread_params->output_offset;
+  int saved_direct_output = thread_params->direct_output;
+  char* saved_temp_filename = thread_params->temp_filename;
+  thread_params->segment = &segment;
+  thread_params->direct_output = 1;
+  thread_params->output_offset = segment.start_byte;
+  thread_params->temp_filename = (char*)path;
+  downloader->corrupt_pieces++;
+  pthread_mutex_unlock(&downloader->progress_mutex);
+
+  int result = -1;
+  for (int attempt = 0; attempt < downloader->mirror_count; attempt++) {
+    segment.downloaded_bytes = 0;
+    if (download_segment_with_retry(thread_params) != 0) {
+      break;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      break;
+    }
+    int verify_result = verify_piece(downloader, fd, index);
+    close(fd);
+    if (verify_result == 0) {
+      result = 0;
+      break;
+    }
+    if (downloader->mirror_count > 1) {
+      drop_corrupt_mirror(downloader, thread_params->mirror_index);
+    }
+  }
+
+  pthread_mutex_lock(&downloader->progress_mutex);
+  thread_params->segment = saved_segment;
+  thread_params->output_offset = saved_output_offset;
+  thread_params->direct_output = saved_direct_output;
+  thread_params->temp_filename = saved_temp_filename;
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return result;
+}
+
+// 重新下载校验失败的分块（每个分块由一个线程认领）
+static void refetch_corrupt_pieces(ThreadDownloadParams* thread_params) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (!downloader || !downloader->piece_states || !thread_params->direct_output) {
+    return;
+  }
+
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  for (int index = 0; index < metalink->piece_count && !thread_params->should_stop; index++) {
+    pthread_mutex_lock(&downloader->progress_mutex);
+    int claimed = downloader->piece_states[index] == PIECE_CORRUPT;
+    if (claimed) {
+      downloader->piece_states[index] = PIECE_REFETCHING;
+    }
+    pthread_mutex_unlock(&downloader->progress_mutex);
+    if (!claimed) {
+      continue;
+    }
+
+    int verified = refetch_piece(thread_params, thread_params->temp_filename, index) == 0;
+
+    pthread_mutex_lock(&downloader->progress_mutex);
+    downloader->piece_states[index] = verified ? PIECE_VERIFIED : PIECE_CORRUPT;
+    if (verified) {
+      downloader->verified_pieces++;
+    }
+    pthread_mutex_unlock(&downloader->progress_mutex);
+  }
+}
+
+// 下载结束后校验输出文件：补充校验尚未校验的分块，失败的分块单独重新下载；
+// 没有分块哈希时校验整个文件的哈希。全部通过返回0
+static int verify_downloaded_file(MultiThreadDownloader* downloader, const char* path) {
+  const MetalinkInfo* metalink = get_download_options()->metalink;
+  if (!metalink) {
+    return 0;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s错误: 无法打开 %s 进行校验: %s%s\n", RED, path, strerror(errno), RESET);
+    return -1;
+  }
+
+  int result = 0;
+  if (downloader->piece_states) {
+    for (int index = 0; index < metalink->piece_count; index++) {
+      if (downloader->piece_states[index] == PIECE_VERIFIED) {
+        continue;
+      }
+      if (verify_piece(downloader, fd, index) != 0) {
+        downloader->piece_states[index] = PIECE_REFETCHING;
+        if (refetch_piece(&downloader->threads[0], path, index) != 0) {
+          fprintf(stderr, "%s错误: 分块 %d 重新下载后仍然校验失败%s\n", RED, index, RESET);
+          result = -1;
+          break;
+        }
+      }
+      downloader->piece_states[index] = PIECE_VERIFIED;
+      downloader->verified_pieces++;
+    }
+
+    printf("%s分块校验: %d/%d 个分块通过 (%s), 单独重新下载 %d 次%s\n", CYAN, downloader->verified_pieces,
+      metalink->piece_count, metalink->piece_hash_type, downloader->corrupt_pieces, RESET);
+  }
+  else if (metalink->hash_type[0]) {
+    char hash[METALINK_HASH_LENGTH];
+    if (metalink_hash_range(fd, 0, downloader->file_size, metalink->hash_type, hash, sizeof(hash)) != 0 ||
+      strcasecmp(hash, metalink->hash) != 0) {
+      fprintf(stderr, "%s错误: 文件 %s 校验失败%s\n", RED, metalink->hash_type, RESET);
+      result = -1;
+    }
+    else {
+      printf("%s✓ 文件校验通过 (%s)%s\n", GREEN, metalink->hash_type, RESET);
+    }
+  }
+
+  close(fd);
+  return result;
+}
+
+// Workers
+// 下载线程Worker函数
+void* thread_download_worker(void* arg) {
+  ThreadDownloadParams* thread_params = (ThreadDownloadParams*)arg;
+  MultiThreadDownloader* downloader = thread_params->downloader;
+
+  // 使用带重试的下载函数；自动连接数模式下新增的线程没有初始段，直接向调度器领取
+  int result = thread_params->segment ? download_segment_with_retry(thread_params) : 0;
+  if (result == 0) {
+    refetch_corrupt_pieces(thread_params);
+  }
+
+  // 动态调度：当前段完成后继续拆分/接手其他段，直到没有剩余工作；被自动调节器撤下的线程完成当前段后退出
+  while (result == 0 && downloader && downloader->dynamic_segments && !thread_params->should_stop &&
+    !thread_params->retiring) {
+    refetch_corrupt_pieces(thread_params);
+    int should_wait = 0;
+    if (!segment_scheduler_next(downloader, thread_params, &should_wait)) {
+      if (!should_wait) {
+        break;
+      }
+      usleep(100000);
+      continue;
+    }
+    result = download_segment_with_retry(thread_params);
+  }
+
+  if (downloader && downloader->dynamic_segments && thread_params->segment) {
+    pthread_mutex_lock(&downloader->progress_mutex);
+    segment_scheduler_finish_locked(downloader, thread_params->segment, result);
+    pthread_mutex_unlock(&downloader->progress_mutex);
+  }
+
+  thread_params->finished = 1;
+
+  // 返回结果
+  pthread_exit((void*)(intptr_t)result);
+}
+
+// 进度条线程Worker函数
+void* progress_display_worker(void* arg) {
+  MultiThreadDownloader* downloader = (MultiThreadDownloader*)arg;
+
+  while (!downloader->should_stop) {
+    display_multithread_progress(downloader);
+    usleep(50000); // 每0.05秒更新一次
+  }
+
+  // 最后显示一次完整进度
+  display_multithread_progress(downloader);
+  printf("\n");
+
+  pthread_exit(NULL);
+}
+
+
+
+
+
+
+
+// 低速看门狗线程Worker函数：连接在 low_speed_time 秒内的平均速度低于 low_speed_limit 时关闭其读方向，
+// 阻塞在 recv 中的线程立即返回失败，由重试换一个连接继续；限速时阈值按每个连接分到的速率降低
+void* stall_watchdog_worker(void* arg) {
+  MultiThreadDownloader* downloader = (MultiThreadDownloader*)arg;
+  const DownloadOptions* options = get_download_options();
+  double window_ms = options->low_speed_time * 1000.0;
+
+  while (!downloader->should_stop) {
+    usleep(LOW_SPEED_CHECK_INTERVAL_MS * 1000);
+    double now_ms = get_monotonic_ms();
+
+    pthread_mutex_lock(&downloader->progress_mutex);
+    int connections = 0;
+    for (int i = 0; i < downloader->thread_count; i++) {
+      if (downloader->threads[i].active_sockfd >= 0 && !downloader->threads[i].finished) {
+        connections++;
+      }
+    }
+
+    for (int i = 0; i < downloader->thread_count; i++) {
+      ThreadDownloadParams* thread = &downloader->threads[i];
+      int sockfd = thread->active_sockfd;
+      if (sockfd < 0 || thread->finished || !thread->segment || thread->watchdog_start_ms == 0 ||
+        now_ms - thread->watchdog_start_ms < window_ms) {
+        continue;
+      }
+
+      long long bytes = thread->segment->downloaded_bytes - thread->watchdog_bytes;
+      long long limit = ratelimit_low_speed_limit(&thread->rate_limiter, connections);
+      if (bytes * 1000.0 / (now_ms - thread->watchdog_start_ms) < limit) {
+        thread->watchdog_aborted = limit;
+        thread->watchdog_start_ms = 0;
+        shutdown(sockfd, SHUT_RD);
+      }
+      else {
+        thread->watchdog_start_ms = now_ms;
+        thread->watchdog_bytes = thread->segment->downloaded_bytes;
+      }
+    }
+    pthread_mutex_unlock(&downloader->progress_mutex);
+  }
+
+  pthread_exit(NULL);
+}
+
+// 主机有多个地址时显示各地址的分流统计
+static void print_address_stats(const MultiThreadDownloader* downloader) {
+  URLInfo url_info = { 0 };
+  if (parse_url(downloader->url, &url_info) != 0) {
+    return;
+  }
+
+  DnsAddressStats address_stats[DNS_MAX_ADDRESSES];
+  int count = dns_get_address_stats(url_info.host, address_stats, DNS_MAX_ADDRESSES);
+  if (count < 2) {
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    DnsAddressStats* stats = &address_stats[i];
+    char ip_str[INET6_ADDRSTRLEN];
+    const void* address = stats->address.ss_family == AF_INET6 ?
+      (const void*)&((struct sockaddr_in6*)&stats->address)->sin6_addr :
+      (const void*)&((struct sockaddr_in*)&stats->address)->sin_addr;
+    if (inet_ntop(stats->address.ss_family, address, ip_str, sizeof(ip_str)) == NULL) {
+      continue;
+    }
+
+    printf("%s  地址 %s: %.2f MB, 连接 %d 次, 失败 %d 次, 单连接 %.2f MB/s%s\n", CYAN, ip_str,
+      stats->bytes / (1024.0 * 1024.0), stats->connections, stats->failures,
+      stats->rate * 1000.0 / (1024 * 1024), RESET);
+  }
+}
+
+// 输出各个镜像的下载量（只有一个下载地址时不输出）
+static void print_mirror_stats(const MultiThreadDownloader* downloader) {
+  if (downloader->mirror_count <= 1) {
+    return;
+  }
+
+  for (int i = 0; i < downloader->mirror_count; i++) {
+    const MirrorInfo* mirror = &downloader->mirrors[i];
+    printf("%s  镜像 %s: %.2f MB, 失败 %d 次, 单连接 %.2f MB/s%s%s\n", CYAN, mirror->url,
+      mirror->bytes / (1024.0 * 1024.0), mirror->failures, mirror->rate * 1000.0 / (1024 * 1024),
+      mirror->dropped ? " (数据不一致，已停用)" : "", RESET);
+  }
+}
+
+// 下载失败时建立最后一个检查点（所有下载线程已退出，数据都已交给内核）
+// @return 成功返回0，不建立检查点或失败返回-1
+static int save_final_checkpoint(MultiThreadDownloader* downloader) {
+  if (!downloader->state_path || !downloader->partial_path) {
+    return -1;
+  }
+  int fd = open(downloader->partial_path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = checkpoint_save(downloader, fd);
+  close(fd);
+  return result;
+}
+
+// 输出写入线程的统计：排队延迟和背压时间用于区分瓶颈在网络还是磁盘
+static void print_writer_stats(const MultiThreadDownloader* downloader) {
+  const WriterStats* stats = &downloader->writer_stats;
+  if (stats->write_calls == 0) {
+    return;
+  }
+
+  printf("%s写入线程: %.2f MB, pwritev %lld 次 (平均 %.0f KB), 平均耗时 %.2f ms, 最长 %.1f ms%s\n", CYAN,
+    stats->written_bytes / (1024.0 * 1024.0), stats->write_calls,
+    stats->written_bytes / 1024.0 / stats->write_calls, stats->write_ms / stats->write_calls,
+    stats->max_write_ms, RESET);
+
+  // 网络线程等待写入的时间占比（按连接数和下载时长折算）
+  double elapsed_ms = (double)(time(NULL) - downloader->start_time) * 1000.0;
+  int connections = downloader->peak_connections > 0 ? downloader->peak_connections : downloader->thread_count;
+  double blocked = elapsed_ms > 0 && connections > 0 ? stats->backpressure_ms / (elapsed_ms * connections) : 0.0;
+  printf("%s写队列: 峰值 %.2f/%.1f MB, 块平均排队 %.1f ms, 背压等待 %lld 次 (%.1f ms), %s%s\n", CYAN,
+    stats->peak_queued_bytes / (1024.0 * 1024.0), stats->budget_bytes / (1024.0 * 1024.0),
+    stats->blocks > 0 ? stats->queue_wait_ms / stats->blocks : 0.0,
+    stats->backpressure_waits, stats->backpressure_ms,
+    blocked > 0.05 ? "瓶颈在磁盘写入" : "瓶颈在网络接收", RESET);
+  if (stats->direct_bytes > 0) {
+    printf("%s直接 I/O: %.2f MB 绕过页缓存, %.2f MB 经页缓存写入（不对齐的段首段尾）%s\n", CYAN,
+      stats->direct_bytes / (1024.0 * 1024.0), (stats->written_bytes - stats->direct_bytes) / (1024.0 * 1024.0), RESET);
+  }
+}
+
+// !!MAIN ENTRANCE!!
+int multithread_download(MultiThreadDownloader* downloader) {
+  
+
+  if (!downloader) {
+    return -1;
+  }
+
+  // 首先初始化多线程下载
+  int init_result = initialize_multithread_download(downloader);
+  if (init_result < 0) {
+    return -1;
+  }
+
+  if (init_result == 0) {
+    // 退化到单线程下载
+    printf("%s使用单线程下载模式...%s\n", YELLOW, RESET);
+    return download_file_fallback_single_thread(downloader);
+  }
+
+  printf("\n%s%s=== 开始多线程下载 ===%s\n", BOLD, GREEN, RESET);
+  downloader->start_time = time(NULL);
+  downloader->should_stop = 0;
+  downloader->completed_threads = 0;
   downloader->error_count = 0;
 
-  // 创建并启动所有下载线程
-  for (int i = 0; i < downloader->thread_count; i++) {
-    ThreadDownloadParams* thread = &downloader->threads[i];
+  DownloadOptions* options = get_download_options();
+  if (options->engine == DOWNLOAD_ENGINE_EPOLL) {
+    printf("%s事件驱动引擎: %d 个连接, %d 个事件循环%s\n", CYAN, downloader->thread_count,
+      options->event_loops < downloader->thread_count ? options->event_loops : downloader->thread_count, RESET);
+  }
+  else if (options->engine == DOWNLOAD_ENGINE_HTTP2) {
+    printf("%sHTTP/2 引擎: %d 个分段在一个连接上并发请求%s\n", CYAN, downloader->thread_count, RESET);
+  }
+
+  // 线程模式下由写入线程合并写文件，网络线程只负责接收；严格写入策略和 Metalink 分块校验需要数据立即写入文件，
+  // io_uring/splice 后端自行写文件，这些情况仍由网络线程直接写（要求直接 I/O 时改用写入线程的对齐缓冲块）
+  if (options->engine == DOWNLOAD_ENGINE_THREADS && options->write_buffer > 0 && !downloader->piece_states &&
+    options->write_policy != WRITE_POLICY_STRICT &&
+    (options->io_backend == IO_BACKEND_STDIO || ratelimit_enabled() || options->direct_io)) {
+    downloader->writer = async_writer_create(downloader->thread_capacity, options->write_buffer);
+    if (downloader->writer) {
+      for (int i = 0; i < downloader->thread_capacity; i++) {
+        downloader->threads[i].write_ring = async_writer_ring(downloader->writer, i);
+      }
+    }
+    else {
+      fprintf(stderr, "警告: 无法创建写入线程，由下载线程直接写文件\n");
+    }
+  }
+
+  // 直接 I/O 只用于写入线程写预分配的输出文件，文件内容不进入页缓存
+  if (options->direct_io) {
+    if (downloader->writer && downloader->partial_path) {
+      if (async_writer_enable_direct_io(downloader->writer, downloader->partial_path) == 0) {
+        printf("%s直接 I/O: 输出文件绕过页缓存写入%s\n", CYAN, RESET);
+      }
+    }
+    else {
+      printf("%s警告: 直接 I/O 需要线程引擎、预分配的输出文件、coalesce 写入策略和写入队列，使用页缓存写入%s\n",
+        YELLOW, RESET);
+    }
+  }
+
+  if (options->engine == DOWNLOAD_ENGINE_THREADS && options->io_backend == IO_BACKEND_MMAP && !downloader->writer &&
+    !ratelimit_enabled()) {
+    if (downloader->partial_path) {
+      printf("%smmap 后端: 每个连接映射 %s 的输出文件窗口%s\n", CYAN, format_file_size(options->mmap_window), RESET);
+    }
+    else {
+      printf("%s警告: mmap 后端需要预分配的输出文件，使用 stdio 后端%s\n", YELLOW, RESET);
+    }
+  }
+
+  // 显示进度的线程
+  pthread_t progress_thread;
+  if (pthread_create(&progress_thread, NULL, progress_display_worker, downloader) != 0) {
+    fprintf(stderr, "警告: 无法创建进度显示线程\n");
+  }
+
+  // 线程模式下由看门狗中止速度过低的连接（epoll 引擎在事件循环中检查）
+  pthread_t watchdog_thread = 0;
+  if (options->engine == DOWNLOAD_ENGINE_THREADS && options->low_speed_limit > 0 &&
+    pthread_create(&watchdog_thread, NULL, stall_watchdog_worker, downloader) != 0) {
+    fprintf(stderr, "警告: 无法创建低速看门狗线程\n");
+    watchdog_thread = 0;
+  }
+
+  // 定期同步输出文件并记录已落盘的区间，中断后再次下载时从检查点继续
+  pthread_t checkpoint_thread = 0;
+  if (downloader->state_path &&
+    pthread_create(&checkpoint_thread, NULL, checkpoint_worker, downloader) != 0) {
+    fprintf(stderr, "警告: 无法创建检查点线程\n");
+    checkpoint_thread = 0;
+  }
+
+  int total_errors = 0;
+  if (options->engine != DOWNLOAD_ENGINE_THREADS) {
+    // 事件循环驱动所有段的非阻塞连接，或者所有段作为同一个 HTTP/2 连接上的流
+    total_errors = options->engine == DOWNLOAD_ENGINE_HTTP2 ?
+      h2_engine_download(downloader) : event_engine_download(downloader);
+    if (total_errors < 0) {
+      total_errors = downloader->thread_count;
+    }
+    downloader->completed_threads = downloader->thread_count - total_errors;
+  }
+  else {
+    // 创建并启动所有下载线程
+    for (int i = 0; i < downloader->thread_count; i++) {
+      ThreadDownloadParams* thread = &downloader->threads[i];
+
+      if (pthread_create(&thread->pthread_id, NULL, thread_download_worker, thread) != 0) {
+        fprintf(stderr, "错误: 创建线程 %d 失败\n", i);
+        downloader->should_stop = 1; // 停止其他线程
+        downloader->error_count++;
+        continue;
+      }
+    }
+
+    if (downloader->auto_connections && !downloader->should_stop) {
+      // 按实测吞吐量增减连接，直到所有线程退出（已退出的线程由调节器回收）
+      autotune_run(downloader);
+    }
+    else if (downloader->hedging && !downloader->should_stop) {
+      // 为慢段发出对冲请求，直到所有线程退出（已退出的线程由监视器回收）
+      hedge_run(downloader);
+    }
+
+    // 等待所有下载线程完成
+    for (int i = 0; i < downloader->thread_count; i++) {
+      ThreadDownloadParams* thread = &downloader->threads[i];
+
+      if (thread->pthread_id != 0) {
+        void* thread_result;
+        if (pthread_join(thread->pthread_id, &thread_result) == 0) {
+          thread->pthread_id = 0; // 已回收，避免销毁时重复 join
+          int result = (int)(intptr_t)thread_result;
+          if (result != 0) {
+            total_errors++;
+          }
+          else {
+            downloader->completed_threads++;
+          }
+        }
+      }
+    }
+  }
+
+  // 停止进度显示和看门狗线程
+  downloader->should_stop = 1;
+  pthread_join(progress_thread, NULL);
+  if (watchdog_thread) {
+    pthread_join(watchdog_thread, NULL);
+  }
+
+  // 下载线程退出前已排空各自的队列，此时停止写入线程
+  if (downloader->writer) {
+    async_writer_destroy(downloader->writer, &downloader->writer_stats);
+    downloader->writer = NULL;
+    for (int i = 0; i < downloader->thread_capacity; i++) {
+      downloader->threads[i].write_ring = NULL;
+    }
+  }
+  if (checkpoint_thread) {
+    pthread_join(checkpoint_thread, NULL);
+  }
+
+  // 动态调度时线程的失败可能已被其他线程接手或重复下载弥补，按段是否下载完整判断结果
+  if (downloader->dynamic_segments) {
+    total_errors = 0;
+    pthread_mutex_lock(&downloader->progress_mutex);
+    for (int i = 0; i < downloader->segment_count; i++) {
+      if (segment_remaining_locked(&downloader->segments[i]) > 0) {
+        total_errors++;
+      }
+    }
+    pthread_mutex_unlock(&downloader->progress_mutex);
+
+    printf("%s动态调度: 共 %d 个分段, 拆分 %d 次, 收尾重复下载 %d 次%s\n", CYAN,
+      downloader->segment_count, downloader->steal_count, downloader->endgame_count, RESET);
+    if (downloader->hedge_count > 0) {
+      printf("%s对冲请求: 发出 %d 次, 先于原请求完成 %d 次%s\n", CYAN,
+        downloader->hedge_count, downloader->hedge_won_count, RESET);
+    }
+  }
+
+  if (downloader->auto_connections) {
+    char log_path[4096 + 32];
+    build_output_path(downloader, log_path, sizeof(log_path) - 32);
+    printf("%s自动连接数: 最多同时使用 %d 个连接, 决策日志: %s.autotune.log%s\n", CYAN,
+      downloader->peak_connections, log_path, RESET);
+  }
+
+  // 检查下载结果
+  if (total_errors > 0) {
+    fprintf(stderr, "\n%s错误: %d 个%s下载失败%s\n", RED, total_errors,
+      downloader->dynamic_segments ? "分段" : "线程", RESET);
+    // 保存最后的检查点，保留已下载的数据供下次继续
+    if (save_final_checkpoint(downloader) == 0) {
+      printf("%s已保存断点状态 %s，再次下载同一文件时从检查点继续%s\n", YELLOW, downloader->state_path, RESET);
+      return -1;
+    }
+    cleanup_temp_files(downloader);
+    return -1;
+  }
+
+  if (downloader->direct_output) {
+    // 各段已写入最终位置，无需合并；Metalink 下载先完成校验再重命名
+    if (verify_downloaded_file(downloader, downloader->partial_path) != 0) {
+      downloader->error_code = DOWNLOAD_ERROR_VERIFY;
+      cleanup_temp_files(downloader);
+      return -1;
+    }
+    if (finalize_direct_output(downloader) != 0) {
+      downloader->error_code = DOWNLOAD_ERROR_FILE_WRITE;
+      cleanup_temp_files(downloader);
+      return -1;
+    }
+    if (downloader->state_path) {
+      unlink(downloader->state_path);
+    }
+  }
+  else {
+    printf("\n%s%s=== 合并文件 ===%s\n", BOLD, CYAN, RESET);
+
+    // 合并所有临时文件
+    int merge_result = merge_temp_files(downloader);
+    if (merge_result != 0) {
+      fprintf(stderr, "%s错误: 文件合并失败%s\n", RED, RESET);
+      downloader->error_code = DOWNLOAD_ERROR_FILE_WRITE;
+      cleanup_temp_files(downloader);
+      return -1;
+    }
+
+    // 清理临时文件
+    cleanup_temp_files(downloader);
+
+    char output_path[4096];
+    build_output_path(downloader, output_path, sizeof(output_path));
+    if (verify_downloaded_file(downloader, output_path) != 0) {
+      downloader->error_code = DOWNLOAD_ERROR_VERIFY;
+      return -1;
+    }
+  }
+
+  // 连接复用统计
+  ConnectionPoolStats pool_stats;
+  connection_pool_get_stats(&pool_stats);
+  printf("%s连接池: 复用 %lld 次, 新建 %lld 次, 淘汰 %lld 个%s\n", CYAN,
+    pool_stats.hits, pool_stats.misses, pool_stats.evictions, RESET);
+  DnsCacheStats dns_stats;
+  dns_get_stats(&dns_stats);
+  printf("%sDNS 缓存: 命中 %lld 次, 未命中 %lld 次, 解析 %lld 次 (共 %.1f ms)%s\n", CYAN,
+    dns_stats.hits, dns_stats.misses, dns_stats.resolutions, dns_stats.resolve_ms, RESET);
+  print_address_stats(downloader);
+  print_mirror_stats(downloader);
+  print_writer_stats(downloader);
+  if (downloader->checkpoint_count > 0) {
+    printf("%s检查点: %d 次, fdatasync 平均 %.1f ms%s\n", CYAN, downloader->checkpoint_count,
+      downloader->checkpoint_sync_ms / downloader->checkpoint_count, RESET);
+  }
+#ifdef WITH_OPENSSL
+  TlsHandshakeStats tls_stats;
+  get_tls_handshake_stats(&tls_stats);
+  if (tls_stats.full_handshakes + tls_stats.resumed_handshakes > 0) {
+    printf("%sTLS 握手: 完整 %lld 次 (平均 %.1f ms), 恢复 %lld 次 (平均 %.1f ms)%s\n", CYAN,
+      tls_stats.full_handshakes,
+      tls_stats.full_handshakes > 0 ? tls_stats.full_handshake_ms / tls_stats.full_handshakes : 0.0,
+      tls_stats.resumed_handshakes,
+      tls_stats.resumed_handshakes > 0 ? tls_stats.resumed_handshake_ms / tls_stats.resumed_handshakes : 0.0,
+      RESET);
+  }
+#endif
+
+  printf("%s%s✓ 多线程下载完成！%s\n", GREEN, BOLD, RESET);
+  return 0;
+}
+
+
+
 
-    if (pthread_create(&thread->pthread_id, NULL, thread_download_worker, thread) != 0) {
-      fprintf(stderr, "错误: 创建线程 %d 失败\n", i);
-      downloader->should_stop = 1; // 停止其他线程
-      downloader->error_count++;
-      continue;
-    }
-  }
 
-  // 显示进度的线程
-  pthread_t progress_thread;
-  if (pthread_create(&progress_thread, NULL, progress_display_worker, downloader) != 0) {
-    fprintf(stderr, "警告: 无法创建进度显示线程\n");
-  }
 
-  // 等待所有下载线程完成
-  int total_errors = 0;
-  for (int i = 0; i < downloader->thread_count; i++) {
-    ThreadDownloadParams* thread = &downloader->threads[i];
+// 临时文件合并到输出文件的方式，按顺序尝试
+typedef enum {
+  MERGE_REFLINK = 0,          // FICLONERANGE 共享数据块（btrfs/XFS 等），不读写数据
+  MERGE_COPY_FILE_RANGE = 1,  // copy_file_range 在内核中复制（部分文件系统在服务端或存储设备上完成）
+  MERGE_USER_COPY = 2         // pread/pwrite 经用户态缓冲区复制
+} MergeMethod;
 
-    if (thread->pthread_id != 0) {
-      void* thread_result;
-      if (pthread_join(thread->pthread_id, &thread_result) == 0) {
-        int result = (int)(intptr_t)thread_result;
-        if (result != 0) {
-          total_errors++;
-        }
-        else {
-          downloader->completed_threads++;
-        }
+static const char* MERGE_METHOD_NAMES[] = { "reflink", "copy_file_range", "复制" };
+
+// 一个临时文件在输出文件中的位置和合并结果
+typedef struct {
+  const char* path;           // 临时文件路径
+  long long offset;           // 在输出文件中的起始偏移
+  long long size;             // 临时文件大小
+  MergeMethod method;         // 实际使用的合并方式
+  int result;                 // 0表示成功
+} MergePart;
+
+// 并行合并的共享状态：各工作线程依次领取下一个临时文件
+typedef struct {
+  MergePart* parts;
+  int part_count;
+  _Atomic int next_part;
+  int output_fd;
+  _Atomic int reflink_supported; // 第一次 reflink 因文件系统不支持而失败后不再尝试
+} MergeJob;
+
+// copy_file_range 复制整个临时文件；文件系统不支持时返回1，由调用者改用用户态复制
+static int merge_copy_file_range(int input_fd, int output_fd, const MergePart* part) {
+  loff_t input_offset = 0;
+  loff_t output_offset = part->offset;
+  while (input_offset < part->size) {
+    ssize_t copied = copy_file_range(input_fd, &input_offset, output_fd, &output_offset,
+      (size_t)(part->size - input_offset), 0);
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (input_offset == 0 && (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOSYS)) {
+        return 1;
       }
+      return -1;
+    }
+    if (copied == 0) {
+      errno = EIO; // 临时文件比开始合并时短
+      return -1;
     }
   }
+  return 0;
+}
 
-  // 停止进度显示线程
-  downloader->should_stop = 1;
-  pthread_join(progress_thread, NULL);
-
-  // 检查下载结果
-  if (total_errors > 0) {
-    fprintf(stderr, "\n%s错误: %d 个线程下载失败%s\n", RED, total_errors, RESET);
-    cleanup_temp_files(downloader);
+// 经用户态缓冲区按偏移复制整个临时文件（最后的退路）
+static int merge_user_copy(int input_fd, int output_fd, const MergePart* part) {
+  char* buffer = malloc(MERGE_COPY_BUFFER_SIZE);
+  if (!buffer) {
+    errno = ENOMEM;
     return -1;
   }
 
-  printf("\n%s%s=== 合并文件 ===%s\n", BOLD, CYAN, RESET);
-
-  // 合并所有临时文件
-  int merge_result = merge_temp_files(downloader);
-  if (merge_result != 0) {
-    fprintf(stderr, "%s错误: 文件合并失败%s\n", RED, RESET);
-    cleanup_temp_files(downloader);
-    return -1;
+  long long copied = 0;
+  int result = 0;
+  while (copied < part->size) {
+    size_t length = part->size - copied < MERGE_COPY_BUFFER_SIZE ? (size_t)(part->size - copied) : MERGE_COPY_BUFFER_SIZE;
+    ssize_t bytes_read = pread(input_fd, buffer, length, copied);
+    if (bytes_read <= 0) {
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_read == 0) {
+        errno = EIO;
+      }
+      result = -1;
+      break;
+    }
+    ssize_t written = 0;
+    while (written < bytes_read) {
+      ssize_t n = pwrite(output_fd, buffer + written, bytes_read - written, part->offset + copied + written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        result = -1;
+        break;
+      }
+      written += n;
+    }
+    if (result != 0) {
+      break;
+    }
+    copied += bytes_read;
   }
 
-  // 清理临时文件
-  cleanup_temp_files(downloader);
-  printf("%s%s✓ 多线程下载完成！%s\n", GREEN, BOLD, RESET);
-  return 0;
+  free(buffer);
+  return result;
 }
 
+// 把一个临时文件合并到输出文件的对应偏移：reflink -> copy_file_range -> 用户态复制
+static int merge_part(MergeJob* job, MergePart* part) {
+  if (part->size == 0) {
+    part->method = MERGE_REFLINK;
+    return 0;
+  }
 
+  int input_fd = open(part->path, O_RDONLY | O_CLOEXEC);
+  if (input_fd < 0) {
+    fprintf(stderr, "错误: 无法打开临时文件 %s: %s\n", part->path, strerror(errno));
+    return -1;
+  }
 
+  // reflink 要求偏移按文件系统块对齐（最后一段可以到文件末尾），不满足时返回 EINVAL，这一段改用复制
+  if (atomic_load(&job->reflink_supported)) {
+    struct file_clone_range range = {
+      .src_fd = input_fd,
+      .src_offset = 0,
+      .src_length = (unsigned long long)part->size,
+      .dest_offset = (unsigned long long)part->offset
+    };
+    if (ioctl(job->output_fd, FICLONERANGE, &range) == 0) {
+      part->method = MERGE_REFLINK;
+      close(input_fd);
+      return 0;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == ENOSYS) {
+      atomic_store(&job->reflink_supported, 0);
+    }
+  }
 
+  part->method = MERGE_COPY_FILE_RANGE;
+  int result = merge_copy_file_range(input_fd, job->output_fd, part);
+  if (result > 0) {
+    part->method = MERGE_USER_COPY;
+    result = merge_user_copy(input_fd, job->output_fd, part);
+  }
+  if (result != 0) {
+    fprintf(stderr, "错误: 合并 %s 失败: %s\n", part->path, strerror(errno));
+  }
+  close(input_fd);
+  return result;
+}
 
+static void* merge_worker(void* arg) {
+  MergeJob* job = (MergeJob*)arg;
+  int index;
+  while ((index = atomic_fetch_add(&job->next_part, 1)) < job->part_count) {
+    job->parts[index].result = merge_part(job, &job->parts[index]);
+  }
+  return NULL;
+}
 
 // Inner utils:
 int merge_temp_files(MultiThreadDownloader* downloader) {
@@ -304,90 +1995,109 @@ int merge_temp_files(MultiThreadDownloader* downloader) {
 
   // 构造完整输出路径
   char full_output_path[4096];
-  if (downloader->download_dir && strlen(downloader->download_dir) > 0) {
-    if (downloader->download_dir[strlen(downloader->download_dir) - 1] == '/') {
-      snprintf(full_output_path, sizeof(full_output_path), "%s%s",
-        downloader->download_dir, downloader->output_filename);
-    }
-    else {
-      snprintf(full_output_path, sizeof(full_output_path), "%s/%s",
-        downloader->download_dir, downloader->output_filename);
-    }
-  }
-  else {
-    strcpy(full_output_path, downloader->output_filename);
-  }
-
-  // 打开最终输出文件
-  FILE* output_file = fopen(full_output_path, "wb");
-  if (!output_file) {
-    fprintf(stderr, "错误: 无法创建输出文件 %s: %s\n",
-      full_output_path, strerror(errno));
-    return -1;
-  }
-
-  printf("合并到: %s\n", full_output_path);
+  build_output_path(downloader, full_output_path, sizeof(full_output_path));
 
-  // 按顺序合并所有段文件
-  const size_t BUFFER_SIZE = 65536; // 64KB 缓冲区
-  char* buffer = malloc(BUFFER_SIZE);
-  if (!buffer) {
-    fclose(output_file);
+  // 各临时文件按顺序首尾相接，先算出每个文件在输出文件中的偏移
+  MergePart* parts = calloc(downloader->thread_count, sizeof(MergePart));
+  if (!parts) {
     fprintf(stderr, "错误: 内存分配失败\n");
     return -1;
   }
 
   long long total_merged = 0;
-
   for (int i = 0; i < downloader->thread_count; i++) {
     ThreadDownloadParams* thread = &downloader->threads[i];
-
-    printf("合并段 %d: %s\n", i, thread->temp_filename);
-
-    FILE* temp_file = fopen(thread->temp_filename, "rb");
-    if (!temp_file) {
-      fprintf(stderr, "错误: 无法打开临时文件 %s: %s\n",
-        thread->temp_filename, strerror(errno));
-      free(buffer);
-      fclose(output_file);
+    struct stat temp_stat;
+    if (stat(thread->temp_filename, &temp_stat) != 0) {
+      fprintf(stderr, "错误: 无法打开临时文件 %s: %s\n", thread->temp_filename, strerror(errno));
+      free(parts);
       return -1;
     }
 
     // 验证文件大小
-    fseek(temp_file, 0, SEEK_END);
-    long temp_file_size = ftell(temp_file);
-    fseek(temp_file, 0, SEEK_SET);
-
     long long expected_size = thread->segment->end_byte - thread->segment->start_byte + 1;
-    if (temp_file_size != expected_size) {
-      fprintf(stderr, "警告: 段 %d 大小不匹配 (实际: %ld, 期望: %lld)\n",
-        i, temp_file_size, expected_size);
+    if (temp_stat.st_size != expected_size) {
+      fprintf(stderr, "警告: 段 %d 大小不匹配 (实际: %lld, 期望: %lld)\n",
+        i, (long long)temp_stat.st_size, expected_size);
     }
 
-    // 复制文件内容
-    size_t bytes_read;
-    long long segment_copied = 0;
+    parts[i].path = thread->temp_filename;
+    parts[i].offset = total_merged;
+    parts[i].size = temp_stat.st_size;
+    total_merged += temp_stat.st_size;
+  }
 
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, temp_file)) > 0) {
-      if (fwrite(buffer, 1, bytes_read, output_file) != bytes_read) {
-        fprintf(stderr, "错误: 写入输出文件失败\n");
-        fclose(temp_file);
-        free(buffer);
-        fclose(output_file);
-        return -1;
+  // 打开最终输出文件
+  int output_fd = open(full_output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (output_fd < 0) {
+    fprintf(stderr, "错误: 无法创建输出文件 %s: %s\n",
+      full_output_path, strerror(errno));
+    free(parts);
+    return -1;
+  }
+
+  printf("合并到: %s\n", full_output_path);
+  double start_ms = get_monotonic_ms();
+
+  MergeJob job = { .parts = parts, .part_count = downloader->thread_count, .output_fd = output_fd };
+  atomic_init(&job.next_part, 0);
+  atomic_init(&job.reflink_supported, 1);
+
+  // 先试着 reflink 第一段：成功说明文件系统共享数据块，不需要预分配空间；
+  // 否则预分配输出文件，空间不足时在复制前失败，各段并行复制时也不会产生碎片
+  int result = 0;
+  if (ftruncate(output_fd, total_merged) != 0) {
+    fprintf(stderr, "错误: 写入输出文件失败: %s\n", strerror(errno));
+    result = -1;
+  }
+  else {
+    atomic_store(&job.next_part, 1);
+    parts[0].result = merge_part(&job, &parts[0]);
+    if (parts[0].result == 0 && parts[0].method != MERGE_REFLINK && total_merged > 0 &&
+      fallocate(output_fd, 0, 0, total_merged) != 0 && errno == ENOSPC) {
+      fprintf(stderr, "%s错误: 磁盘空间不足，无法合并 %s%s\n", RED, format_file_size(total_merged), RESET);
+      result = -1;
+    }
+  }
+
+  if (result == 0 && parts[0].result == 0) {
+    int worker_count = downloader->thread_count - 1 < MERGE_MAX_THREADS ? downloader->thread_count - 1 : MERGE_MAX_THREADS;
+    pthread_t workers[MERGE_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+      if (pthread_create(&workers[started], NULL, merge_worker, &job) == 0) {
+        started++;
       }
-      segment_copied += bytes_read;
-      total_merged += bytes_read;
     }
+    merge_worker(&job); // 当前线程也参与合并，线程创建失败时由它完成所有段
+    for (int i = 0; i < started; i++) {
+      pthread_join(workers[i], NULL);
+    }
+  }
 
-    fclose(temp_file);
-    printf("  段 %d 合并完成 (%lld 字节)\n", i, segment_copied);
+  if (close(output_fd) != 0 && result == 0) {
+    fprintf(stderr, "错误: 写入输出文件失败: %s\n", strerror(errno));
+    result = -1;
   }
 
-  free(buffer);
-  fclose(output_file);
+  int method_counts[3] = { 0 };
+  for (int i = 0; i < downloader->thread_count && result == 0; i++) {
+    if (parts[i].result != 0) {
+      result = -1;
+      break;
+    }
+    method_counts[parts[i].method]++;
+    printf("  段 %d 合并完成 (%lld 字节, %s)\n", i, parts[i].size, MERGE_METHOD_NAMES[parts[i].method]);
+  }
+  free(parts);
+  if (result != 0) {
+    return -1;
+  }
 
-  printf("文件合并完成，总大小: %lld 字节\n", total_merged);
+  double elapsed_ms = get_monotonic_ms() - start_ms;
+  printf("文件合并完成，总大小: %lld 字节，耗时 %.2f 秒 (reflink %d 段, copy_file_range %d 段, 复制 %d 段)\n",
+    total_merged, elapsed_ms / 1000.0, method_counts[MERGE_REFLINK], method_counts[MERGE_COPY_FILE_RANGE],
+    method_counts[MERGE_USER_COPY]);
 
   // 验证合并后的文件大小
   if (downloader->file_size > 0 && total_merged != downloader->file_size) {
@@ -404,6 +2114,17 @@ void cleanup_temp_files(MultiThreadDownloader* downloader) {
 
   printf("清理临时文件...\n");
 
+  // 直接写入模式只有一个未完成的输出文件（成功时已被重命名）和它的断点状态
+  if (downloader->direct_output) {
+    if (downloader->partial_path && unlink(downloader->partial_path) == 0) {
+      printf("  已删除: %s\n", downloader->partial_path);
+    }
+    if (downloader->state_path) {
+      unlink(downloader->state_path);
+    }
+    return;
+  }
+
   for (int i = 0; i < downloader->thread_count; i++) {
     ThreadDownloadParams* thread = &downloader->threads[i];
 
@@ -427,96 +2148,27 @@ int send_head_request(const char* url, HttpResponseInfo* response_info) {
     return -1;
   }
 
-  // 建立连接
-  int sockfd = -1;
-  char ip_str[INET_ADDRSTRLEN];
-
-  // 域名解析
-  if (url_info.host_type == DOMAIN) {
-    if (resolve_hostname(url_info.host, ip_str, sizeof(ip_str)) != 0) {
-      fprintf(stderr, "错误: 域名解析失败\n");
-      return -1;
-    }
-  }
-  else {
-    strcpy(ip_str, url_info.host);
-  }
-
-  // 建立连接
-  if (url_info.protocol_type == PROTOCOL_HTTPS) {
-#ifdef WITH_OPENSSL
-    // 对于 HTTPS，我们需要使用 SSL 连接
-    if (init_openssl() != 0) {
-      return -1;
-    }
-
-    HttpsConnection* https_connection = create_https_connection(url_info.host, url_info.port);
-    if (!https_connection) {
-      cleanup_openssl();
-      return -1;
-    }
-
-    // 构建 HEAD 请求
-    char request[REQUEST_BUFFER];
-    int request_len = snprintf(request, sizeof(request),
-      "HEAD %s HTTP/1.1\r\n"
-      "Host: %s\r\n"
-      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-      "Accept: */*\r\n"
-      "Connection: close\r\n"
-      "\r\n", url_info.path, url_info.host);
-
-    // 发送请求
-    if (ssl_send_data(https_connection, request, request_len) != 0) {
-      close_https_connection(https_connection);
-      cleanup_openssl();
-      return -1;
-    }
-
-    // 接收响应
-    HttpReadBuffer read_buffer = { 0 };
-    int result = parse_https_response_headers(https_connection, response_info, &read_buffer);
+  // 构建 HEAD 请求
+  char request[REQUEST_BUFFER];
+  int request_len = snprintf(request, sizeof(request),
+    "HEAD %s HTTP/1.1\r\n"
+    "Host: %s\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+    "Accept: */*\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    url_info.path, url_info.host);
 
-    close_https_connection(https_connection);
-    cleanup_openssl();
-    return result;
-#else
-    fprintf(stderr, "错误: HTTPS 支持未编译\n");
+  // 通过连接池发送请求，探测用的连接留给后续段下载复用
+  PooledConnection* connection = NULL;
+  HttpReadBuffer read_buffer = { 0 };
+  if (pooled_connection_request(&url_info, request, request_len, &connection, response_info, &read_buffer) != 0) {
     return -1;
-#endif
   }
-  else {
-    // HTTP 连接
-    sockfd = create_tcp_connection(ip_str, url_info.port);
-    if (sockfd < 0) {
-      return -1;
-    }
-
-    // 构建 HEAD 请求
-    char request[REQUEST_BUFFER];
-    int request_len = snprintf(request, sizeof(request),
-      "HEAD %s HTTP/1.1\r\n"
-      "Host: %s\r\n"
-      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-      "Accept: */*\r\n"
-      "Connection: close\r\n"
-      "\r\n",
-      url_info.path, url_info.host);
-
-    // 发送请求
-    if (send(sockfd, request, request_len, 0) != request_len) {
-      close(sockfd);
-      return -1;
-    }
 
-    // 接收响应
-    HttpReadBuffer read_buffer = { 0 };
-    read_buffer.sockfd = sockfd;
-    int result = parse_http_response_headers(sockfd, response_info, &read_buffer);
-
-    close(sockfd);
-    return result;
-  }
+  // HEAD 响应没有响应体
+  connection_pool_release(connection, !response_info->connection_close);
+  return 0;
 }
 
 // 检查服务器是否支持 Range 请求
@@ -578,135 +2230,207 @@ int test_range_request(const char* url) {
     return 0;
   }
 
-  int sockfd = -1;
-  char ip_str[INET_ADDRSTRLEN];
+  // printf("发送测试 Range 请求 (bytes=0-1023)...\n");
 
-  // 域名解析
-  if (url_info.host_type == DOMAIN) {
-    if (resolve_hostname(url_info.host, ip_str, sizeof(ip_str)) != 0) {
-      return 0;
-    }
+  // 构建带 Range 的 GET 请求
+  char request[REQUEST_BUFFER];
+  int request_len = snprintf(request, sizeof(request),
+    "GET %s HTTP/1.1\r\n"
+    "Host: %s\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+    "Range: bytes=0-1023\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    url_info.path, url_info.host);
+
+  // 发送请求并接收响应头
+  PooledConnection* connection = NULL;
+  HttpResponseInfo response_info = { 0 };
+  HttpReadBuffer read_buffer = { 0 };
+  if (pooled_connection_request(&url_info, request, request_len, &connection, &response_info, &read_buffer) != 0) {
+    return 0;
   }
-  else {
-    strcpy(ip_str, url_info.host);
+
+  // printf("测试 Range 请求状态码: %d\n", response_info.status_code);
+
+  int range_support = 0;
+  if (response_info.status_code == 206) {
+    printf("%s✓ 服务器支持 Range 请求 (返回 206 Partial Content)%s\n", GREEN, RESET);
+    range_support = 1;
+  }
+  else if (response_info.status_code == 200) {
+    printf("%s✗ 服务器忽略了 Range 请求 (返回完整文件)%s\n", RED, RESET);
   }
 
-  // printf("发送测试 Range 请求 (bytes=0-1023)...\n");
+  // 读完 1KB 的测试响应体后连接可以继续复用
+  int reusable = range_support && !response_info.connection_close &&
+    response_info.content_length >= 0 &&
+    pooled_connection_drain(connection, &read_buffer, response_info.content_length) == 0;
+  connection_pool_release(connection, reusable);
 
-  if (url_info.protocol_type == PROTOCOL_HTTPS) {
-#ifdef WITH_OPENSSL
-    if (init_openssl() != 0) {
-      return 0;
-    }
+  return range_support;
+}
 
-    HttpsConnection* https_connection = create_https_connection(url_info.host, url_info.port);
-    if (!https_connection) {
-      cleanup_openssl();
-      return 0;
-    }
+// 发送启动探测请求：GET Range: bytes=0-，响应体正好是第一段的数据
+static int send_probe_request(const char* url, PooledConnection** connection, HttpResponseInfo* response_info,
+  HttpReadBuffer* read_buffer) {
+  URLInfo url_info = { 0 };
+  if (parse_url(url, &url_info) != 0) {
+    fprintf(stderr, "错误: 无法解析URL %s\n", url);
+    return -1;
+  }
 
-    // 构建带 Range 的 GET 请求
-    char request[REQUEST_BUFFER];
-    int request_len = snprintf(request, sizeof(request),
-      "GET %s HTTP/1.1\r\n"
-      "Host: %s\r\n"
-      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-      "Range: bytes=0-1023\r\n"
-      "Connection: close\r\n"
-      "\r\n",
-      url_info.path, url_info.host);
-
-    // 发送请求
-    if (ssl_send_data(https_connection, request, request_len) != 0) {
-      close_https_connection(https_connection);
-      cleanup_openssl();
-      return 0;
-    }
+  char request[REQUEST_BUFFER];
+  int request_len = snprintf(request, sizeof(request),
+    "GET %s HTTP/1.1\r\n"
+    "Host: %s\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+    "Accept: */*\r\n"
+    "Range: bytes=0-\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    url_info.path, url_info.host);
 
-    // 接收响应头
-    HttpResponseInfo response_info = { 0 };
-    HttpReadBuffer read_buffer = { 0 };
-    if (parse_https_response_headers(https_connection, &response_info, &read_buffer) == 0) {
-      close_https_connection(https_connection);
-      cleanup_openssl();
+  memset(response_info, 0, sizeof(HttpResponseInfo));
+  memset(read_buffer, 0, sizeof(HttpReadBuffer));
+  return pooled_connection_request(&url_info, request, request_len, connection, response_info, read_buffer);
+}
 
-      // printf("测试 Range 请求状态码: %d\n", response_info.status_code);
+// 读完重定向响应的响应体后归还连接，长度未知时关闭连接
+static void release_redirect_response(PooledConnection* connection, HttpResponseInfo* response_info,
+  HttpReadBuffer* read_buffer) {
+  int reusable = !response_info->connection_close && response_info->content_length >= 0 &&
+    pooled_connection_drain(connection, read_buffer, response_info->content_length) == 0;
+  connection_pool_release(connection, reusable);
+}
 
-      if (response_info.status_code == 206) {
-        printf("%s✓ 服务器支持 Range 请求 (返回 206 Partial Content)%s\n", GREEN, RESET);
-        return 1;
-      }
-      else if (response_info.status_code == 200) {
-        printf("%s✗ 服务器忽略了 Range 请求 (返回完整文件)%s\n", RED, RESET);
-        return 0;
-      }
+int probe_range_stream(MultiThreadDownloader* downloader, long long* file_size) {
+  char url[2048];
+  snprintf(url, sizeof(url), "%s", downloader->url);
+  int cached = apply_cached_redirects(url, sizeof(url));
+
+  // 跟随重定向直到拿到文件本身，301/308 记入缓存，下次下载直接请求最终地址
+  PooledConnection* connection = NULL;
+  HttpResponseInfo* response_info = &downloader->probe_response;
+  int redirects = 0;
+  int request_result;
+  while ((request_result = send_probe_request(url, &connection, response_info, &downloader->probe_buffer)) == 0 &&
+    determine_status_action(response_info->status_code) == STATUS_ACTION_REDIRECT) {
+    char next_url[2048];
+    if (redirects >= REDIRECT_MAX_HOPS ||
+      resolve_redirect_location(url, response_info->location, next_url, sizeof(next_url)) != 0) {
+      connection_pool_release(connection, 0);
+      fprintf(stderr, "错误: 重定向次数过多或缺少有效的 Location 头\n");
+      return -1;
     }
-
-    close_https_connection(https_connection);
-    cleanup_openssl();
-#endif
-  }
-  else {
-    // HTTP 测试
-    sockfd = create_tcp_connection(ip_str, url_info.port);
-    if (sockfd < 0) {
-      return 0;
+    if (response_info->status_code == 301 || response_info->status_code == 308) {
+      redirect_cache_store(url, next_url);
     }
+    release_redirect_response(connection, response_info, &downloader->probe_buffer);
+    snprintf(url, sizeof(url), "%s", next_url);
+    redirects++;
+  }
 
-    // 构建带 Range 的 GET 请求
-    char request[REQUEST_BUFFER];
-    int request_len = snprintf(request, sizeof(request),
-      "GET %s HTTP/1.1\r\n"
-      "Host: %s\r\n"
-      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-      "Range: bytes=0-1023\r\n"
-      "Connection: close\r\n"
-      "\r\n",
-      url_info.path, url_info.host);
-
-    // 发送请求
-    if (send(sockfd, request, request_len, 0) != request_len) {
-      close(sockfd);
-      return 0;
+  // 缓存的重定向目标已失效：删除缓存，从原始 URL 重新探测
+  if (cached > 0 && (request_result != 0 || response_info->status_code >= 400)) {
+    if (request_result == 0) {
+      connection_pool_release(connection, 0);
+    }
+    char stale_target[2048];
+    redirect_cache_remove(downloader->url);
+    if (redirect_cache_lookup(downloader->url, stale_target, sizeof(stale_target)) != 0) {
+      printf("%s警告: 缓存的重定向已失效，重新解析 %s%s\n", YELLOW, downloader->url, RESET);
+      return probe_range_stream(downloader, file_size);
     }
+    return check_range_support(url, file_size);
+  }
+
+  // 所有段和重试直接使用最终地址
+  if (strcmp(url, downloader->url) != 0) {
+    printf("%s重定向: 使用最终地址 %s%s%s\n", YELLOW, url, redirects == 0 ? " (来自缓存)" : "", RESET);
+    free(downloader->url);
+    downloader->url = strdup(url);
+    downloader->mirrors[0].url = downloader->url;
+  }
 
-    // 接收响应头
-    HttpResponseInfo response_info = { 0 };
-    HttpReadBuffer read_buffer = { 0 };
-    read_buffer.sockfd = sockfd;
+  if (request_result != 0) {
+    return check_range_support(downloader->url, file_size);
+  }
 
-    if (parse_http_response_headers(sockfd, &response_info, &read_buffer) == 0) {
-      close(sockfd);
+  // 206 的 Content-Range (bytes 0-N/总大小) 给出文件大小
+  const char* total = strrchr(response_info->content_range, '/');
+  if (response_info->status_code == 206 && total && atoll(total + 1) > 0) {
+    *file_size = atoll(total + 1);
+    downloader->probe_connection = connection;
+    return 1;
+  }
 
-      printf("测试 Range 请求状态码: %d\n", response_info.status_code);
+  // 其余情况响应体没有读取，连接不能复用
+  connection_pool_release(connection, 0);
+  response_info->status_code = 0;
 
-      if (response_info.status_code == 206) {
-        printf("✓ 服务器支持 Range 请求 (返回 206 Partial Content)\n");
-        return 1;
-      }
-      else if (response_info.status_code == 200) {
-        printf("✗ 服务器忽略了 Range 请求 (返回完整文件)\n");
-        return 0;
-      }
-    }
+  if (response_info->content_length > 0 && response_info->content_range[0] == '\0') {
+    // 服务器忽略了 Range，返回完整文件
+    *file_size = response_info->content_length;
+    printf("%s✗ 服务器忽略了 Range 请求 (返回完整文件)%s\n", RED, RESET);
+    return 0;
+  }
+
+  // 其他响应（如空文件的 416、未知大小的 Content-Range）交给 HEAD 检查
+  return check_range_support(downloader->url, file_size);
+}
 
-    close(sockfd);
+// 解析 206 响应的 Content-Range (bytes 首-末/总大小) 给出的响应体字节数，无法解析时返回-1
+static long long content_range_length(const char* content_range) {
+  long long first = 0;
+  long long last = 0;
+  if (sscanf(content_range, "bytes %lld-%lld", &first, &last) != 2 || first < 0 || last < first) {
+    return -1;
   }
+  return last - first + 1;
+}
 
-  return 0;
+// 第一段的首次请求直接接手启动探测的响应流。接手成功返回1，连接、响应头、已读数据和响应体长度写入输出参数。
+// 服务器可能只返回请求范围的一部分，响应体按 Content-Range 的结束位置计算；不能覆盖整个段时放弃探测连接
+static int claim_probe_stream(ThreadDownloadParams* thread_params, PooledConnection** connection,
+  HttpResponseInfo* response_info, HttpReadBuffer* read_buffer, long long* response_bytes) {
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (!downloader || thread_params->mirror_index != 0) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&downloader->progress_mutex);
+  FileSegment* segment = thread_params->segment;
+  int claimed = downloader->probe_connection && segment->start_byte == 0 && segment->downloaded_bytes == 0;
+  if (claimed) {
+    long long length = content_range_length(downloader->probe_response.content_range);
+    if (length < segment->end_byte + 1) {
+      release_probe_stream(downloader);
+      claimed = 0;
+    }
+    else {
+      *connection = downloader->probe_connection;
+      *response_info = downloader->probe_response;
+      *read_buffer = downloader->probe_buffer;
+      *response_bytes = length;
+      downloader->probe_connection = NULL;
+    }
+  }
+  pthread_mutex_unlock(&downloader->progress_mutex);
+  return claimed;
 }
 
 int build_range_request(const URLInfo* url_info, FileSegment* segment, char* buffer, size_t buffer_size) {
-  // 使用当前的start_byte，在断点续传时会自动调整
+  // 从已下载位置继续请求，断点续传时不会重复下载
   int length = snprintf(buffer, buffer_size,
     "GET %s HTTP/1.1\r\n"
     "Host: %s\r\n"
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
     "Accept: */*\r\n"
     "Range: bytes=%lld-%lld\r\n"
-    "Connection: close\r\n"
+    "Connection: keep-alive\r\n"
     "\r\n",
-    url_info->path, url_info->host, segment->start_byte, segment->end_byte);
+    url_info->path, url_info->host, segment->start_byte + segment->downloaded_bytes, segment->end_byte);
 
   if (length >= (int)buffer_size) {
     return -1;
@@ -747,11 +2471,16 @@ void display_multithread_progress(MultiThreadDownloader* downloader) {
   char total_file_size_str[64];
   strcpy(total_file_size_str, format_file_size(downloader->file_size));
 
-  for (int i = 0; i < downloader->thread_count; i++) {
-    FileSegment* segment = &downloader->segments[i];
-    ThreadDownloadParams* thread = &downloader->threads[i];
+  total_downloaded = segments_downloaded_locked(downloader);
 
-    total_downloaded += segment->downloaded_bytes;
+  // 自动连接数模式下线程数会变化，本次显示使用同一个快照
+  int thread_count = downloader->thread_count;
+  for (int i = 0; i < thread_count; i++) {
+    ThreadDownloadParams* thread = &downloader->threads[i];
+    FileSegment* segment = thread->segment;
+    if (!segment) {
+      continue;
+    }
 
     switch (segment->state) {
     case THREAD_STATE_DOWNLOADING:
@@ -774,32 +2503,51 @@ void display_multithread_progress(MultiThreadDownloader* downloader) {
 
   pthread_mutex_unlock(&downloader->progress_mutex);
 
-  // 是否是第一次显示
-  static int first_display = 1;
-  static int lines_printed = 0;
+  int show_thread_rows = thread_count <= MAX_THREADS;
 
-  if (first_display) {
+  // 是否是第一次显示（按下载器记录，同一进程内多次下载互不影响）
+  if (downloader->progress_lines == 0) {
     printf("文件: %s%s%s\n", YELLOW, downloader->output_filename, RESET);
     printf("总大小: %s%s%s\n\n", BLUE, format_file_size(downloader->file_size), RESET);
-
-    // 为每个线程预留一行，加上总进度行和空行
-    lines_printed = downloader->thread_count + 2;
-    first_display = 0;
   }
   else {
     // 非第一次显示，回到开始位置
-    printf("\033[%dA", lines_printed);  // 向上移动 lines_printed 行
+    printf("\033[%dA", downloader->progress_lines);  // 向上移动 progress_lines 行
   }
 
-  // 显示各个线程的进度条
-  for (int i = 0; i < downloader->thread_count; i++) {
-    FileSegment* segment = &downloader->segments[i];
+  // 为每个线程预留一行，加上总进度行和空行；连接数很多时只显示一行汇总。线程增加时新行追加在下方
+  downloader->progress_lines = (show_thread_rows ? thread_count : 1) + 2;
+
+  if (!show_thread_rows) {
+    int waiting_threads = thread_count - active_threads - completed_threads - error_threads;
+    printf("\r\033[K%s连接:%s %d 个  %s%d%s 下载  %s%d%s 完成  %s%d%s 等待",
+      BOLD, RESET, thread_count,
+      CYAN, active_threads, RESET,
+      GREEN, completed_threads, RESET,
+      WHITE, waiting_threads, RESET);
+    if (error_threads > 0) {
+      printf("  %s%d%s 错误", RED, error_threads, RESET);
+    }
+    printf("\n");
+  }
+
+  // 显示各个线程的进度条（动态调度时显示线程当前负责的段）
+  for (int i = 0; show_thread_rows && i < thread_count; i++) {
     ThreadDownloadParams* thread = &downloader->threads[i];
+    FileSegment* segment = thread->segment;
+    if (!segment) {
+      printf("\r\033[K%s线程 %d:%s [%s等待%s] 领取分段中\n", BOLD, i, RESET, WHITE, RESET);
+      continue;
+    }
 
+    pthread_mutex_lock(&downloader->progress_mutex);
     long long segment_size = segment->end_byte - segment->start_byte + 1;
-    double segment_progress = 0.0;
+    long long segment_downloaded = segment_downloaded_locked(segment);
+    pthread_mutex_unlock(&downloader->progress_mutex);
+
+    double segment_progress = 100.0;
     if (segment_size > 0) {
-      segment_progress = (double)segment->downloaded_bytes * 100.0 / segment_size;
+      segment_progress = (double)segment_downloaded * 100.0 / segment_size;
     }
 
     // 线程状态颜色
@@ -827,6 +2575,10 @@ void display_multithread_progress(MultiThreadDownloader* downloader) {
       status_color = RED;
       status_text = "错误";
       break;
+    case THREAD_STATE_STOPPED:
+      status_color = WHITE;
+      status_text = "停止";
+      break;
     }
 
     // 清除当前行并显示线程信息
@@ -853,8 +2605,8 @@ void display_multithread_progress(MultiThreadDownloader* downloader) {
     // 显示线程百分比和下载量
     printf("%s%6.2f%%%s ", YELLOW, segment_progress, RESET);
     printf("%s%s%s/%s%s%s ",
-      BLUE, format_file_size(segment->downloaded_bytes), RESET,
-      WHITE, format_file_size(segment_size), RESET);
+      BLUE, format_file_size(segment_downloaded), RESET,
+      WHITE, format_file_size(segment_size > 0 ? segment_size : 0), RESET);
 
     // 显示线程速度
     if (segment->state == THREAD_STATE_DOWNLOADING) {
@@ -927,6 +2679,14 @@ void display_multithread_progress(MultiThreadDownloader* downloader) {
     printf(" %s%d%s错误", RED, error_threads, RESET);
   }
 
+  // 写队列积压说明磁盘跟不上网络
+  if (downloader->writer) {
+    WriterStats writer_stats;
+    async_writer_get_stats(downloader->writer, &writer_stats);
+    printf(" 写队列: %s%s%s", writer_stats.queued_bytes * 2 > writer_stats.budget_bytes ? RED : BLUE,
+      format_file_size(writer_stats.queued_bytes), RESET);
+  }
+
   // ETA
   if (downloader->file_size > 0 && total_speed > 0 && total_progress < 100.0) {
     long long remaining_bytes = downloader->file_size - total_downloaded;
@@ -992,16 +2752,30 @@ int download_segment(ThreadDownloadParams* thread_params) {
   segment->state = THREAD_STATE_CONNECTING;
   thread_params->start_time = time(NULL);
 
-  // 解析 URL
+  // 有镜像时每次请求重新选择下载地址，失败重试和新领取的段会换到其他镜像；
+  // 第一段的首次请求使用主 URL，以便接手启动探测的响应流
+  const char* url = thread_params->url;
+  MultiThreadDownloader* downloader = thread_params->downloader;
+  if (downloader && downloader->mirror_count > 1) {
+    int probe_pending = downloader->probe_connection && segment->start_byte == 0 && segment->downloaded_bytes == 0;
+    thread_params->mirror_index = probe_pending ? 0 : select_mirror(downloader);
+    url = downloader->mirrors[thread_params->mirror_index].url;
+  }
+
+  // 使用初始化时解析好的地址（已跟随重定向）
   URLInfo url_info = { 0 };
-  if (parse_url(thread_params->url, &url_info) != 0) {
+  if (downloader && downloader->mirrors[thread_params->mirror_index].url_info.host[0]) {
+    url_info = downloader->mirrors[thread_params->mirror_index].url_info;
+  }
+  else if (parse_url(url, &url_info) != 0) {
     snprintf(segment->error_message, sizeof(segment->error_message), "URL解析失败");
     segment->state = THREAD_STATE_ERROR;
     return -1;
   }
+  ratelimit_init(&thread_params->rate_limiter, url_info.host, downloader ? &downloader->rate_bucket : NULL);
 
   // 域名解析
-  char ip_str[INET_ADDRSTRLEN];
+  char ip_str[INET6_ADDRSTRLEN];
   if (url_info.host_type == DOMAIN) {
     if (resolve_hostname(url_info.host, ip_str, sizeof(ip_str)) != 0) {
       snprintf(segment->error_message, sizeof(segment->error_message), "域名解析失败");
@@ -1019,17 +2793,8 @@ int download_segment(ThreadDownloadParams* thread_params) {
     return -1;
   }
 
-  // 打开临时文件 - 支持断点续传
-  FILE* temp_file;
-  if (segment->downloaded_bytes > 0) {
-    // 断点续传模式，追加写入
-    temp_file = fopen(thread_params->temp_filename, "ab");
-  }
-  else {
-    // 新下载，覆盖写入
-    temp_file = fopen(thread_params->temp_filename, "wb");
-  }
-
+  // 打开段输出文件 - 支持断点续传
+  FILE* temp_file = open_segment_output(thread_params);
   if (!temp_file) {
     snprintf(segment->error_message, sizeof(segment->error_message),
       "无法创建临时文件: %s", strerror(errno));
@@ -1038,6 +2803,8 @@ int download_segment(ThreadDownloadParams* thread_params) {
   }
 
   int result = -1;
+  long long start_bytes = segment->downloaded_bytes;
+  double start_ms = get_monotonic_ms();
 
   if (url_info.protocol_type == PROTOCOL_HTTPS) {
 #ifdef WITH_OPENSSL
@@ -1051,460 +2818,1129 @@ int download_segment(ThreadDownloadParams* thread_params) {
     result = download_http_segment(&url_info, thread_params, temp_file);
   }
 
-  fclose(temp_file);
+  if (fclose(temp_file) != 0 && result == 0) {
+    snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败: %s", strerror(errno));
+    result = -1;
+  }
+
+  pthread_mutex_lock(thread_params->progress_mutex);
+  long long transferred = segment->downloaded_bytes - start_bytes;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+  record_mirror_result(thread_params, transferred, get_monotonic_ms() - start_ms,
+    result != 0 && !thread_params->should_stop);
 
   if (result == 0) {
     segment->state = THREAD_STATE_COMPLETED;
   }
   else {
     segment->state = THREAD_STATE_ERROR;
-    // 只在非重试模式下删除临时文件（保留断点续传文件）
-    if (segment->downloaded_bytes == 0) {
+    // 只在非重试模式下删除临时文件（保留断点续传文件）；共享的输出文件不能删除
+    if (segment->downloaded_bytes == 0 && !thread_params->direct_output) {
       unlink(thread_params->temp_filename);
     }
-  }
+  }
+
+  return result;
+}
+
+int calculate_file_segments(long long file_size, int thread_count, FileSegment* segments) {
+  
+
+  if (!segments || file_size <= 0 || thread_count <= 0) {
+    return -1;
+  }
+
+  // 如果文件太小，减少线程数量
+  long long min_total_size = MIN_SEGMENT_SIZE * thread_count;
+  if (file_size < min_total_size) {
+    thread_count = (int)(file_size / MIN_SEGMENT_SIZE);
+    if (thread_count < 1) {
+      thread_count = 1;
+    }
+    printf("文件较小，调整线程数为: %d\n", thread_count);
+  }
+
+  // 计算每个段的大小
+  long long segment_size = file_size / thread_count;
+  long long remaining_bytes = file_size % thread_count;
+
+  // 段足够大时边界按 SEGMENT_ALIGN 对齐，零头都归最后一段：临时文件可以 reflink 合并，直接 I/O 的段首不经过页缓存
+  if (segment_size >= SEGMENT_ALIGN) {
+    segment_size -= segment_size % SEGMENT_ALIGN;
+    remaining_bytes = 0;
+  }
+
+  printf("%s文件分段策略:%s\n", BOLD, RESET);
+  printf("%s总大小: %s%lld 字节（%lld MB）%s\n", BOLD, BLUE, file_size, file_size / (1024 * 1024), RESET);
+  printf("%s线程数: %s%d%s\n", BOLD, BLUE, thread_count, RESET);
+  printf("%s基础段大小: %s%lld 字节（%lld MB）%s\n", BOLD, BLUE, segment_size, segment_size / (1024 * 1024), RESET);
+
+  // 分配文件段
+  long long current_pos = 0;
+  for (int i = 0; i < thread_count; i++) {
+    segments[i].thread_id = i;
+    segments[i].start_byte = current_pos;
+
+    // 最后一个段包含所有剩余字节
+    if (i == thread_count - 1) {
+      segments[i].end_byte = file_size - 1;
+    }
+    else {
+      segments[i].end_byte = current_pos + segment_size - 1;
+      // 将剩余字节分配给前面的段
+      if (remaining_bytes > 0) {
+        segments[i].end_byte++;
+        remaining_bytes--;
+      }
+    }
+
+    segments[i].downloaded_bytes = 0;
+    segments[i].written_bytes = 0;
+    segments[i].state = THREAD_STATE_IDLE;
+    segments[i].duplicate_of = -1;
+    segments[i].duplicate_index = -1;
+    segments[i].error_message[0] = '\0';
+
+    long long actual_size = segments[i].end_byte - segments[i].start_byte + 1;
+    printf("%s段 %d:%s %s%lld-%lld (%s)%s\n", BOLD, i, RESET, BLUE, segments[i].start_byte, segments[i].end_byte, format_file_size(actual_size), RESET);
+
+    current_pos = segments[i].end_byte + 1;
+  }
+
+  return thread_count;
+}
+
+int download_file_fallback_single_thread(MultiThreadDownloader* downloader) {
+  // printf("执行单线程下载...\n");
+
+  // 构造完整输出路径
+  char full_output_path[4096];
+  if (downloader->download_dir && strlen(downloader->download_dir) > 0) {
+    snprintf(full_output_path, sizeof(full_output_path), "%s/%s",
+      downloader->download_dir, downloader->output_filename);
+  }
+  else {
+    strcpy(full_output_path, downloader->output_filename);
+  }
+
+  // 使用现有的单线程下载函数
+  return download_file_auto(downloader->url, downloader->output_filename,
+    downloader->download_dir, 0, 1);
+}
+
+int download_segment_with_retry(ThreadDownloadParams* thread_params) {
+  FileSegment* segment = thread_params->segment;
+  long long segment_size = segment->end_byte - segment->start_byte + 1;
+
+  for (int retry = 0; retry < RETRY_MAX_ATTEMPTS; retry++) {
+    // 第一次重试立即从连接池换一个连接，之后指数退避并随机抖动
+    int delay_ms = retry_backoff_ms(retry);
+
+    // 检查是否有已下载的部分文件
+    if (retry > 0 && thread_params->direct_output) {
+      // 直接写入模式下已写入的字节数记录在段进度中
+      if (segment->downloaded_bytes > 0) {
+        printf("线程 %d: 断点续传从 %lld 字节开始 (已下载: %lld)\n",
+          thread_params->thread_id, segment->start_byte + segment->downloaded_bytes, segment->downloaded_bytes);
+      }
+      printf("线程 %d: 第 %d 次重试 (等待 %d ms)...\n", thread_params->thread_id, retry + 1, delay_ms);
+      usleep(delay_ms * 1000);
+    }
+    else if (retry > 0) {
+      // 检查临时文件是否存在并获取已下载大小
+      long existing_size = 0;
+      FILE* temp_file = fopen(thread_params->temp_filename, "rb");
+      if (temp_file) {
+        fseek(temp_file, 0, SEEK_END);
+        existing_size = ftell(temp_file);
+        fclose(temp_file);
+      }
+
+      if (existing_size > 0 && existing_size <= segment_size) {
+        // 段起点保持不变，请求从已下载部分之后继续
+        segment->downloaded_bytes = existing_size;
+        printf("线程 %d: 断点续传从 %lld 字节开始 (已下载: %ld)\n",
+          thread_params->thread_id, segment->start_byte + existing_size, existing_size);
+      }
+      else {
+        // 文件不存在或大小异常，重新下载整个段
+        segment->downloaded_bytes = 0;
+      }
+
+      printf("线程 %d: 第 %d 次重试 (等待 %d ms)...\n", thread_params->thread_id, retry + 1, delay_ms);
+      usleep(delay_ms * 1000);
+    }
+
+    // 等待重试期间段可能已被收尾阶段的重复下载完成（结束位置被缩短到已下载的位置）
+    if (retry > 0 && segment->downloaded_bytes >= segment_target_bytes(thread_params)) {
+      segment->state = THREAD_STATE_COMPLETED;
+      return 0;
+    }
+
+    // 每次尝试都从连接池借用连接，失败的连接不会被归还
+    int result = download_segment(thread_params);
+    if (result == 0) {
+      return 0; // 成功
+    }
+
+    // 被停止（用户中断或下载失败）时不再重试
+    if (thread_params->should_stop) {
+      return -1;
+    }
+
+    // 连接被关闭是因为重复下载的另一方已经完成了本段，不必重试
+    if (thread_params->direct_output && segment->downloaded_bytes >= segment_target_bytes(thread_params)) {
+      segment->state = THREAD_STATE_COMPLETED;
+      return 0;
+    }
+
+    if (thread_params->watchdog_aborted) {
+      const DownloadOptions* options = get_download_options();
+      printf("线程 %d: 连接在 %d 秒内的平均速度低于 %lld 字节/秒，已中止\n",
+        thread_params->thread_id, options->low_speed_time, thread_params->watchdog_aborted);
+      thread_params->watchdog_aborted = 0;
+    }
+
+    // 如果不是最后一次重试，继续尝试
+    if (retry < RETRY_MAX_ATTEMPTS - 1) {
+      printf("线程 %d: 下载失败，准备重试...\n", thread_params->thread_id);
+      // 重置线程状态
+      segment->state = THREAD_STATE_IDLE;
+    }
+  }
+
+  printf("线程 %d: 重试 %d 次后仍然失败\n", thread_params->thread_id, RETRY_MAX_ATTEMPTS);
+  return -1;
+}
+
+#define URING_BUFFER_COUNT 4               // 在途的接收/写入缓冲区数量
+#define URING_BUFFER_SIZE (256 * 1024)      // 每次 recv(MSG_WAITALL) 的大小
+#define URING_WAIT_MS 1000                  // 单次等待完成的超时
+#define URING_ENTER_RETRIES 3               // 提交失败后为取消在途请求重试的次数
+#define URING_OP_RECV 1ULL
+#define URING_OP_WRITE 2ULL
+
+// 通过 io_uring 接收段数据：每块数据提交一条 recv -> write_fixed 链，
+// 写入在后台完成时即可提交下一块的 recv。io_uring 不可用时返回1，由调用者使用普通收发
+static int receive_segment_uring(PooledConnection* connection, ThreadDownloadParams* thread_params, FILE* temp_file,
+  long long* current_downloaded) {
+  FileSegment* segment = thread_params->segment;
+
+  if (!uring_available()) {
+    return 1;
+  }
+
+  IoUring ring;
+  if (uring_init(&ring, URING_BUFFER_COUNT * 2) != 0) {
+    return 1;
+  }
+  if (!(ring.features & IORING_FEAT_EXT_ARG)) {
+    // 无法带超时等待，接收可能永久阻塞
+    uring_destroy(&ring);
+    return 1;
+  }
+
+  char* buffers = NULL;
+  if (posix_memalign((void**)&buffers, 4096, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE) != 0) {
+    uring_destroy(&ring);
+    return 1;
+  }
+
+  struct iovec iovecs[URING_BUFFER_COUNT];
+  for (int i = 0; i < URING_BUFFER_COUNT; i++) {
+    iovecs[i].iov_base = buffers + (size_t)i * URING_BUFFER_SIZE;
+    iovecs[i].iov_len = URING_BUFFER_SIZE;
+  }
+  if (uring_register_buffers(&ring, iovecs, URING_BUFFER_COUNT) != 0) {
+    free(buffers);
+    uring_destroy(&ring);
+    return 1;
+  }
+
+  // 已缓冲的数据先落盘；各块按段内偏移定位写入，去掉追加模式避免乱序写入被追加到末尾
+  fflush(temp_file);
+  int file_fd = fileno(temp_file);
+  int file_flags = fcntl(file_fd, F_GETFL, 0);
+  if (file_flags >= 0 && (file_flags & O_APPEND)) {
+    fcntl(file_fd, F_SETFL, file_flags & ~O_APPEND);
+  }
+
+  long long received = *current_downloaded;   // 已从 socket 接收的段内偏移
+  long long written = *current_downloaded;    // 已写入文件的字节数（用于进度）
+  long long failed_offset = -1;               // 写入失败的最小段内偏移
+  size_t buffer_length[URING_BUFFER_COUNT];
+  long long buffer_offset[URING_BUFFER_COUNT];
+  int buffer_busy[URING_BUFFER_COUNT] = { 0 };
+  int busy_count = 0;
+  int recv_in_flight = 0;
+  int recv_buffer = -1;
+  int result = 0;
+  int enter_failures = 0;
+  double last_data_ms = get_monotonic_ms();
+
+  while (1) {
+    // 段的结束位置可能被动态调度缩短
+    long long target_bytes = segment_target_bytes(thread_params);
+    int can_receive = result == 0 && !thread_params->should_stop && received < target_bytes;
+
+    // 同一 socket 上只保留一个在途 recv，保证数据顺序
+    if (can_receive && !recv_in_flight && busy_count < URING_BUFFER_COUNT) {
+      int index = 0;
+      while (buffer_busy[index]) {
+        index++;
+      }
+
+      long long remaining = target_bytes - received;
+      size_t length = remaining < URING_BUFFER_SIZE ? (size_t)remaining : URING_BUFFER_SIZE;
+
+      struct io_uring_sqe* recv_sqe = uring_get_sqe(&ring);
+      struct io_uring_sqe* write_sqe = uring_get_sqe(&ring);
+      uring_prep_recv(recv_sqe, connection->sockfd, iovecs[index].iov_base, length, MSG_WAITALL);
+      recv_sqe->flags |= IOSQE_IO_LINK; // recv 收满后才执行写入
+      recv_sqe->user_data = (URING_OP_RECV << 32) | index;
+      uring_prep_write_fixed(write_sqe, file_fd, iovecs[index].iov_base, length, thread_params->output_offset + received, index);
+      write_sqe->user_data = (URING_OP_WRITE << 32) | index;
+
+      buffer_busy[index] = 1;
+      buffer_length[index] = length;
+      buffer_offset[index] = received;
+      busy_count++;
+      recv_in_flight = 1;
+      recv_buffer = index;
+    }
+
+    if (busy_count == 0) {
+      break;
+    }
+
+    // 提交并等待，一次系统调用收取多个完成事件
+    // 失败时在途的 recv 仍可能写入缓冲区：继续循环，由下面取消 recv 并收取剩余的完成事件后再释放缓冲区
+    int wait_result = uring_submit_and_wait(&ring, 1, URING_WAIT_MS);
+    if (wait_result < 0 && wait_result != -ETIME && wait_result != -EINTR) {
+      if (result == 0) {
+        snprintf(segment->error_message, sizeof(segment->error_message), "io_uring 错误: %s", strerror(-wait_result));
+      }
+      result = -1;
+      if (++enter_failures >= URING_ENTER_RETRIES) {
+        break; // 无法提交取消请求，缓冲区不释放
+      }
+    }
+    else {
+      enter_failures = 0;
+    }
+
+    struct io_uring_cqe* cqe;
+    while (uring_peek_cqe(&ring, &cqe)) {
+      unsigned long long op = cqe->user_data >> 32;
+      int index = (int)(cqe->user_data & 0xffffffffULL);
+      int res = cqe->res;
+      uring_cqe_seen(&ring);
+
+      if (op == URING_OP_RECV) {
+        recv_in_flight = 0;
+        if (res > 0) {
+          last_data_ms = get_monotonic_ms();
+        }
+        if (res == (int)buffer_length[index]) {
+          received += res;
+          continue;
+        }
+
+        // 短读（连接关闭或出错）时链接的写入会被取消，已收到的部分同步写入
+        if (res > 0 && pwrite(file_fd, iovecs[index].iov_base, res, thread_params->output_offset + buffer_offset[index]) == res) {
+          received += res;
+          written += res;
+        }
+        if (result == 0) {
+          snprintf(segment->error_message, sizeof(segment->error_message),
+            "网络接收失败 (已下载: %lld/%lld)", received, target_bytes);
+        }
+        result = -1;
+      }
+      else if (op == URING_OP_WRITE) {
+        buffer_busy[index] = 0;
+        busy_count--;
+
+        if (res == -ECANCELED) {
+          continue; // 对应的 recv 未收满
+        }
+        if (res != (int)buffer_length[index]) {
+          if (failed_offset < 0 || buffer_offset[index] < failed_offset) {
+            failed_offset = buffer_offset[index];
+          }
+          snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+          result = -1;
+          continue;
+        }
+
+        written += res;
+
+        // 更新进度（使用互斥锁保护）
+        pthread_mutex_lock(thread_params->progress_mutex);
+        segment->downloaded_bytes = written;
+        pthread_mutex_unlock(thread_params->progress_mutex);
+
+        // 计算下载速度
+        time_t elapsed = time(NULL) - thread_params->start_time;
+        if (elapsed > 0) {
+          thread_params->download_speed = (double)written / elapsed;
+        }
+      }
+    }
+
+    // 停止、超时或出错时取消在途的 recv，等待剩余写入完成
+    int idle_timeout = get_monotonic_ms() - last_data_ms > get_io_idle_timeout_ms(); // 与其他分段引擎的无数据超时一致
+    if (recv_in_flight && (result != 0 || thread_params->should_stop || idle_timeout)) {
+      if (idle_timeout && result == 0) {
+        snprintf(segment->error_message, sizeof(segment->error_message),
+          "网络接收超时 (已下载: %lld/%lld)", received, target_bytes);
+        result = -1;
+      }
+      struct io_uring_sqe* cancel_sqe = uring_get_sqe(&ring);
+      if (cancel_sqe) {
+        uring_prep_cancel(cancel_sqe, (URING_OP_RECV << 32) | recv_buffer);
+        cancel_sqe->user_data = 0;
+        last_data_ms = get_monotonic_ms();
+      }
+    }
+  }
+
+  // 写入失败时回退到第一个失败位置，保证已下载部分是连续的前缀，断点续传不会留下空洞；
+  // 临时文件同时截断，直接写入的输出文件由重试覆盖
+  if (failed_offset >= 0) {
+    if (thread_params->direct_output || ftruncate(file_fd, failed_offset) == 0) {
+      written = failed_offset;
+    }
+  }
+  *current_downloaded = failed_offset >= 0 ? written : received;
+
+  pthread_mutex_lock(thread_params->progress_mutex);
+  segment->downloaded_bytes = *current_downloaded;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+
+  uring_destroy(&ring);
+  if (busy_count == 0) {
+    free(buffers); // 仍有在途请求时内核可能在 ring 销毁前写入缓冲区，宁可泄漏也不释放
+  }
+
+  // 文件位置与定位写入保持一致，后续 fwrite 接在已下载数据之后
+  fseeko(temp_file, thread_params->output_offset + *current_downloaded, SEEK_SET);
+
+  if (result == 0 && *current_downloaded < segment_target_bytes(thread_params)) {
+    result = -1; // 被停止
+  }
+  return result;
+}
+
+// 通过 splice 接收段数据：socket -> 管道 -> 临时文件的段内偏移，数据不复制到用户态。
+// 文件系统或 socket 不支持 splice 时返回1，由调用者使用普通收发
+static int receive_segment_splice(PooledConnection* connection, ThreadDownloadParams* thread_params, FILE* temp_file,
+  long long* current_downloaded) {
+  FileSegment* segment = thread_params->segment;
+
+  int pipe_fds[2];
+  if (create_splice_pipe(pipe_fds) != 0) {
+    return 1;
+  }
+
+  // 已缓冲的数据先落盘；splice 指定偏移写入时文件不能处于追加模式
+  fflush(temp_file);
+  int file_fd = fileno(temp_file);
+  int file_flags = fcntl(file_fd, F_GETFL, 0);
+  if (file_flags >= 0 && (file_flags & O_APPEND)) {
+    fcntl(file_fd, F_SETFL, file_flags & ~O_APPEND);
+  }
+
+  int result = 0;
+  int first_chunk = 1;
+  long long target_bytes;
+  while (*current_downloaded < (target_bytes = segment_target_bytes(thread_params)) && !thread_params->should_stop) {
+    long long remaining = target_bytes - *current_downloaded;
+    size_t length = remaining < SPLICE_PIPE_SIZE ? (size_t)remaining : SPLICE_PIPE_SIZE;
+
+    ssize_t moved = splice_socket_to_file(connection->sockfd, pipe_fds, file_fd,
+      thread_params->output_offset + *current_downloaded, length);
+    // 只有第一次从 socket 搬运就失败（没有数据离开 socket）时才能改用 recv + fwrite
+    if (moved < 0 && first_chunk && errno == EINVAL) {
+      result = 1; // 不支持 splice，改用 recv + fwrite
+      break;
+    }
+    if (moved <= 0) {
+      // 管道到文件写入一半失败时，已写入的部分仍是从当前偏移开始的连续数据，
+      // 临时文件按文件大小续传，直接写入模式按段进度覆盖重写
+      snprintf(segment->error_message, sizeof(segment->error_message),
+        "网络接收失败 (已下载: %lld/%lld)", *current_downloaded, target_bytes);
+      result = -1;
+      break;
+    }
+    first_chunk = 0;
+
+    *current_downloaded += moved;
+    atomic_store(&segment->written_bytes, *current_downloaded);
+
+    // 更新进度（使用互斥锁保护）
+    pthread_mutex_lock(thread_params->progress_mutex);
+    segment->downloaded_bytes = *current_downloaded;
+    pthread_mutex_unlock(thread_params->progress_mutex);
+    verify_landed_pieces(thread_params, temp_file, *current_downloaded - moved, *current_downloaded);
+
+    // 计算下载速度
+    time_t elapsed = time(NULL) - thread_params->start_time;
+    if (elapsed > 0) {
+      thread_params->download_speed = (double)*current_downloaded / elapsed;
+    }
+  }
+
+  close_splice_pipe(pipe_fds);
+
+  // 文件位置与 splice 写入保持一致，后续 fwrite 接在已下载数据之后
+  fseeko(temp_file, thread_params->output_offset + *current_downloaded, SEEK_SET);
+  return result;
+}
+
+// mmap 后端复制数据到映射时发生 SIGBUS（磁盘空间不足或文件被截断）跳回复制函数，每个线程单独设置
+static __thread sigjmp_buf mmap_fault_jump;
+static __thread volatile sig_atomic_t mmap_fault_armed;
+static pthread_once_t mmap_sigbus_once = PTHREAD_ONCE_INIT;
+
+static void mmap_sigbus_handler(int signal_number) {
+  if (mmap_fault_armed) {
+    mmap_fault_armed = 0;
+    siglongjmp(mmap_fault_jump, 1);
+  }
+  // 不是访问输出文件映射时发生的错误，按默认方式终止进程
+  signal(signal_number, SIG_DFL);
+  raise(signal_number);
+}
+
+static void install_mmap_sigbus_handler() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = mmap_sigbus_handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, NULL);
+}
+
+#define MMAP_BOUNCE_SIZE (64 * 1024) // HTTPS 连接先解密到该大小的中转缓冲区，再复制到映射
+
+// 把数据复制到映射中，发生 SIGBUS 时返回-1。只有 memcpy 处于保护范围内：
+// 跳转不会中断 SSL_read，也不会越过调用者中被修改的局部变量
+static int mmap_copy_guarded(char* destination, const char* source, size_t length) {
+  if (sigsetjmp(mmap_fault_jump, 1) != 0) {
+    return -1;
+  }
+  mmap_fault_armed = 1;
+  memcpy(destination, source, length);
+  mmap_fault_armed = 0;
+  return 0;
+}
+
+// mmap 后端的映射窗口
+typedef struct {
+  char* address;              // 映射起始地址，NULL表示尚未映射
+  long long start;            // 窗口在文件中的起始偏移（按页对齐）
+  size_t length;              // 映射长度
+} MmapWindow;
+
+// 释放映射窗口：解除映射后进程占用的内存随之释放，再让内核开始回写窗口内的脏页
+static void release_mmap_window(MmapWindow* window, int file_fd) {
+  if (!window->address) {
+    return;
+  }
+  munmap(window->address, window->length);
+  sync_file_range(file_fd, window->start, window->length, SYNC_FILE_RANGE_WRITE);
+  window->address = NULL;
+}
+
+// 接收循环：HTTP 连接直接 recv 到映射窗口中，HTTPS 连接经中转缓冲区复制，窗口写满后滑到下一段位置
+static int mmap_receive_loop(PooledConnection* connection, ThreadDownloadParams* thread_params, int file_fd,
+  MmapWindow* window, char* bounce, long long* current_downloaded) {
+  FileSegment* segment = thread_params->segment;
+  long long file_size = thread_params->downloader->file_size;
+  long long window_size = get_download_options()->mmap_window;
+  long page_size = sysconf(_SC_PAGESIZE);
+  window_size -= window_size % page_size;
+  if (window_size < page_size) {
+    window_size = page_size;
+  }
+
+  long long target_bytes;
+  while (*current_downloaded < (target_bytes = segment_target_bytes(thread_params)) && !thread_params->should_stop) {
+    long long position = thread_params->output_offset + *current_downloaded;
+    if (!window->address || position >= window->start + (long long)window->length) {
+      release_mmap_window(window, file_fd);
+      // 映射偏移必须按页对齐，窗口不超过文件末尾（访问文件末尾之后的页会产生 SIGBUS）
+      long long start = position - position % page_size;
+      long long length = file_size - start < window_size ? file_size - start : window_size;
+      void* address = mmap(NULL, (size_t)length, PROT_READ | PROT_WRITE, MAP_SHARED, file_fd, start);
+      if (address == MAP_FAILED) {
+        snprintf(segment->error_message, sizeof(segment->error_message), "映射输出文件失败: %s", strerror(errno));
+        return -1;
+      }
+      window->address = address;
+      window->start = start;
+      window->length = (size_t)length;
+    }
+
+    long long window_end = window->start + (long long)window->length;
+    long long segment_end = thread_params->output_offset + target_bytes;
+    size_t bytes_to_read = (size_t)((window_end < segment_end ? window_end : segment_end) - position);
+    char* destination = window->address + (position - window->start);
+    if (bounce && bytes_to_read > MMAP_BOUNCE_SIZE) {
+      bytes_to_read = MMAP_BOUNCE_SIZE;
+    }
+    ssize_t bytes_received = pooled_connection_recv(connection, bounce ? bounce : destination, bytes_to_read);
+    if (bytes_received > 0 && bounce && mmap_copy_guarded(destination, bounce, (size_t)bytes_received) != 0) {
+      // 本次接收的数据没有完整写入，进度停在上次接收完成处
+      snprintf(segment->error_message, sizeof(segment->error_message),
+        "写入输出文件映射失败 (SIGBUS，磁盘空间不足或文件被截断)");
+      return -1;
+    }
+    if (bytes_received <= 0) {
+      // 内核向映射复制数据时无法分配磁盘块会返回 EFAULT，而不是产生 SIGBUS
+      if (bytes_received < 0 && errno == EFAULT) {
+        snprintf(segment->error_message, sizeof(segment->error_message), "写入输出文件映射失败 (磁盘空间不足或文件被截断)");
+      }
+      else {
+        snprintf(segment->error_message, sizeof(segment->error_message),
+          "网络接收失败 (已下载: %lld/%lld)", *current_downloaded, target_bytes);
+      }
+      return -1;
+    }
 
-  return result;
-}
+    // 数据写入共享映射即进入页缓存，与 write 交给内核等价
+    *current_downloaded += bytes_received;
+    atomic_store(&segment->written_bytes, *current_downloaded);
 
-int calculate_file_segments(long long file_size, int thread_count, FileSegment* segments) {
-  
+    // 更新进度（使用互斥锁保护）
+    pthread_mutex_lock(thread_params->progress_mutex);
+    segment->downloaded_bytes = *current_downloaded;
+    pthread_mutex_unlock(thread_params->progress_mutex);
 
-  if (!segments || file_size <= 0 || thread_count <= 0) {
-    return -1;
+    // 计算下载速度
+    time_t elapsed = time(NULL) - thread_params->start_time;
+    if (elapsed > 0) {
+      thread_params->download_speed = (double)*current_downloaded / elapsed;
+    }
   }
+  return 0;
+}
 
-  // 如果文件太小，减少线程数量
-  long long min_total_size = MIN_SEGMENT_SIZE * thread_count;
-  if (file_size < min_total_size) {
-    thread_count = (int)(file_size / MIN_SEGMENT_SIZE);
-    if (thread_count < 1) {
-      thread_count = 1;
+// 通过 mmap 接收段数据：输出文件按窗口映射，recv 直接写入映射，不经过 fwrite；SSL_read 不能在中途被 SIGBUS 打断，
+// 解密到小的中转缓冲区后再复制。每个连接同时只映射一个窗口，占用的内存不超过 --mmap-window。
+// 只用于预分配的输出文件，否则返回1由调用者使用普通收发
+static int receive_segment_mmap(PooledConnection* connection, ThreadDownloadParams* thread_params, FILE* temp_file,
+  long long* current_downloaded) {
+  if (!thread_params->direct_output) {
+    return 1;
+  }
+  pthread_once(&mmap_sigbus_once, install_mmap_sigbus_handler);
+
+  // 已缓冲的数据先落盘，之后通过映射写入
+  fflush(temp_file);
+  int file_fd = fileno(temp_file);
+
+  // 内核向映射复制 recv 的数据时出错返回 EFAULT；用户态复制（HTTPS）才会产生 SIGBUS
+  char* bounce = NULL;
+  if (connection->https_connection) {
+    bounce = malloc(MMAP_BOUNCE_SIZE);
+    if (!bounce) {
+      return 1;
     }
-    printf("文件较小，调整线程数为: %d\n", thread_count);
   }
 
-  // 计算每个段的大小
-  long long segment_size = file_size / thread_count;
-  long long remaining_bytes = file_size % thread_count;
+  MmapWindow window = { 0 };
+  int result = mmap_receive_loop(connection, thread_params, file_fd, &window, bounce, current_downloaded);
+  release_mmap_window(&window, file_fd);
+  free(bounce);
 
-  printf("%s文件分段策略:%s\n", BOLD, RESET);
-  printf("%s总大小: %s%lld 字节（%lld MB）%s\n", BOLD, BLUE, file_size, file_size / (1024 * 1024), RESET);
-  printf("%s线程数: %s%d%s\n", BOLD, BLUE, thread_count, RESET);
-  printf("%s基础段大小: %s%lld 字节（%lld MB）%s\n", BOLD, BLUE, segment_size, segment_size / (1024 * 1024), RESET);
+  if (result == 0 && *current_downloaded < segment_target_bytes(thread_params)) {
+    result = -1; // 被停止
+  }
 
-  // 分配文件段
-  long long current_pos = 0;
-  for (int i = 0; i < thread_count; i++) {
-    segments[i].thread_id = i;
-    segments[i].start_byte = current_pos;
+  // 文件位置与映射写入保持一致，后续 fwrite 接在已下载数据之后
+  fseeko(temp_file, thread_params->output_offset + *current_downloaded, SEEK_SET);
+  return result;
+}
 
-    // 最后一个段包含所有剩余字节
-    if (i == thread_count - 1) {
-      segments[i].end_byte = file_size - 1;
-    }
-    else {
-      segments[i].end_byte = current_pos + segment_size - 1;
-      // 将剩余字节分配给前面的段
-      if (remaining_bytes > 0) {
-        segments[i].end_byte++;
-        remaining_bytes--;
+// 写入队列方式：接收的数据直接放入缓冲块，由写入线程合并后按偏移写入文件，
+// 网络线程不再阻塞在 fwrite/fflush 上；写入跟不上时在取缓冲块处等待（背压）
+static int receive_segment_async(PooledConnection* connection, ThreadDownloadParams* thread_params, FILE* temp_file,
+  long long* current_downloaded) {
+  FileSegment* segment = thread_params->segment;
+  WriteRing* ring = thread_params->write_ring;
+
+  // 已缓冲的数据先落盘；按偏移写入时文件不能处于追加模式
+  fflush(temp_file);
+  int file_fd = fileno(temp_file);
+  int file_flags = fcntl(file_fd, F_GETFL, 0);
+  if (file_flags >= 0 && (file_flags & O_APPEND)) {
+    fcntl(file_fd, F_SETFL, file_flags & ~O_APPEND);
+  }
+
+  int result = 0;
+  int direct_io = get_download_options()->direct_io;
+  long long start_downloaded = *current_downloaded;
+  char* block = NULL;
+  size_t capacity = 0;
+  size_t filled = 0;
+  long long block_offset = 0;
+  long long target_bytes;
+  while (*current_downloaded < (target_bytes = segment_target_bytes(thread_params)) && !thread_params->should_stop) {
+    if (!block) {
+      block = write_ring_reserve(ring, &capacity);
+      if (!block) {
+        snprintf(segment->error_message, sizeof(segment->error_message), "内存分配失败");
+        result = -1;
+        break;
+      }
+      filled = 0;
+      block_offset = thread_params->output_offset + *current_downloaded;
+      // 第一块只填到下一个块边界，之后的块在文件中按块大小对齐；直接 I/O 时第一块只填到下一个扇区边界，
+      // 段尾先收满对齐的部分，只有不足一个扇区的数据经页缓存写入
+      if (direct_io) {
+        if (block_offset % DIRECT_IO_ALIGN != 0) {
+          capacity = (size_t)(DIRECT_IO_ALIGN - block_offset % DIRECT_IO_ALIGN);
+        }
+        long long remaining = target_bytes - *current_downloaded;
+        if (remaining >= DIRECT_IO_ALIGN && remaining < (long long)capacity) {
+          capacity = (size_t)(remaining - remaining % DIRECT_IO_ALIGN);
+        }
+      }
+      else {
+        capacity -= (size_t)(block_offset % (long long)capacity);
       }
     }
 
-    segments[i].downloaded_bytes = 0;
-    segments[i].state = THREAD_STATE_IDLE;
-    segments[i].error_message[0] = '\0';
+    long long remaining = target_bytes - *current_downloaded;
+    size_t bytes_to_read = capacity - filled;
+    if (remaining < (long long)bytes_to_read) {
+      bytes_to_read = (size_t)remaining;
+    }
 
-    long long actual_size = segments[i].end_byte - segments[i].start_byte + 1;
-    printf("%s段 %d:%s %s%lld-%lld (%s)%s\n", BOLD, i, RESET, BLUE, segments[i].start_byte, segments[i].end_byte, format_file_size(actual_size), RESET);
+    bytes_to_read = ratelimit_acquire(&thread_params->rate_limiter, bytes_to_read);
+    ssize_t bytes_received = pooled_connection_recv(connection, block + filled, bytes_to_read);
+    ratelimit_refund(&thread_params->rate_limiter, bytes_to_read, bytes_received);
 
-    current_pos = segments[i].end_byte + 1;
-  }
+    if (bytes_received <= 0) {
+      snprintf(segment->error_message, sizeof(segment->error_message),
+        "网络接收失败 (已下载: %lld/%lld)", *current_downloaded, target_bytes);
+      result = -1;
+      break;
+    }
 
-  return thread_count;
-}
+    filled += bytes_received;
+    *current_downloaded += bytes_received;
+    if (filled == capacity || *current_downloaded >= target_bytes) {
+      write_ring_commit(ring, file_fd, block_offset, filled, &segment->written_bytes, *current_downloaded);
+      block = NULL;
+    }
 
-int download_file_fallback_single_thread(MultiThreadDownloader* downloader) {
-  // printf("执行单线程下载...\n");
+    // 更新进度（使用互斥锁保护）
+    pthread_mutex_lock(thread_params->progress_mutex);
+    segment->downloaded_bytes = *current_downloaded;
+    pthread_mutex_unlock(thread_params->progress_mutex);
 
-  // 构造完整输出路径
-  char full_output_path[4096];
-  if (downloader->download_dir && strlen(downloader->download_dir) > 0) {
-    snprintf(full_output_path, sizeof(full_output_path), "%s/%s",
-      downloader->download_dir, downloader->output_filename);
+    // 计算下载速度
+    time_t elapsed = time(NULL) - thread_params->start_time;
+    if (elapsed > 0) {
+      thread_params->download_speed = (double)*current_downloaded / elapsed;
+    }
   }
-  else {
-    strcpy(full_output_path, downloader->output_filename);
+
+  // 未填满的块也要写出，文件关闭前必须等本段的数据全部落盘
+  if (block) {
+    write_ring_commit(ring, file_fd, block_offset, filled, &segment->written_bytes, *current_downloaded);
+  }
+  if (write_ring_drain(ring) != 0) {
+    // 无法确定哪些块已经写入，回退到本次接收之前的进度，重试时重新下载
+    snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败: %s", strerror(errno));
+    *current_downloaded = start_downloaded;
+    pthread_mutex_lock(thread_params->progress_mutex);
+    segment->downloaded_bytes = start_downloaded;
+    pthread_mutex_unlock(thread_params->progress_mutex);
+    // 临时文件按文件大小续传，截掉可能只写入一部分的数据
+    if (!thread_params->direct_output && ftruncate(file_fd, start_downloaded) != 0) {
+      fprintf(stderr, "警告: 无法截断临时文件 %s: %s\n", thread_params->temp_filename, strerror(errno));
+    }
+    result = -1;
   }
 
-  // 使用现有的单线程下载函数
-  return download_file_auto(downloader->url, downloader->output_filename,
-    downloader->download_dir, 0, 1);
+  // 文件位置与写入线程的写入保持一致，后续 fwrite 接在已下载数据之后
+  fseeko(temp_file, thread_params->output_offset + *current_downloaded, SEEK_SET);
+  return result;
 }
 
-int download_segment_with_retry(ThreadDownloadParams* thread_params) {
-  const int MAX_RETRIES = 5;
-  const int RETRY_DELAY = 3; // 秒
+// 普通收发方式：recv 到缓冲区后 fwrite。严格写入策略（以及 Metalink 分块校验，需要数据立即可读）
+// 每次接收后刷新到文件；合并写入策略攒够 write_chunk 再写，减少 write 系统调用
+static int receive_segment_buffered(PooledConnection* connection, ThreadDownloadParams* thread_params, FILE* temp_file,
+  long long* current_downloaded) {
+  FileSegment* segment = thread_params->segment;
+  const DownloadOptions* options = get_download_options();
+  const size_t RECEIVE_SIZE = 16384;
+  int flush_each_receive = options->write_policy == WRITE_POLICY_STRICT ||
+    (thread_params->downloader && thread_params->downloader->piece_states);
+  size_t chunk = flush_each_receive || options->write_chunk < (long long)RECEIVE_SIZE ?
+    RECEIVE_SIZE : (size_t)options->write_chunk;
+
+  char* buffer = malloc(chunk);
+  if (!buffer) {
+    snprintf(segment->error_message, sizeof(segment->error_message), "内存分配失败");
+    return -1;
+  }
 
-  // 备份原始的段信息
-  long long original_start_byte = thread_params->segment->start_byte;
-  long long original_downloaded = thread_params->segment->downloaded_bytes;
+  int result = 0;
+  size_t filled = 0;
+  long long target_bytes;
+  while (*current_downloaded < (target_bytes = segment_target_bytes(thread_params)) && !thread_params->should_stop) {
+    long long remaining = target_bytes - *current_downloaded;
+    size_t bytes_to_read = chunk - filled;
+    if (remaining < (long long)bytes_to_read) {
+      bytes_to_read = (size_t)remaining;
+    }
 
-  for (int retry = 0; retry < MAX_RETRIES; retry++) {
-    // 检查是否有已下载的部分文件
-    if (retry > 0) {
-      // 检查临时文件是否存在并获取已下载大小
-      FILE* temp_file = fopen(thread_params->temp_filename, "rb");
-      if (temp_file) {
-        fseek(temp_file, 0, SEEK_END);
-        long existing_size = ftell(temp_file);
-        fclose(temp_file);
+    bytes_to_read = ratelimit_acquire(&thread_params->rate_limiter, bytes_to_read);
+    ssize_t bytes_received = pooled_connection_recv(connection, buffer + filled, bytes_to_read);
+    ratelimit_refund(&thread_params->rate_limiter, bytes_to_read, bytes_received);
 
-        if (existing_size > 0) {
-          // 更新段的起始位置为已下载的部分之后
-          thread_params->segment->downloaded_bytes = existing_size;
-          thread_params->segment->start_byte = original_start_byte + existing_size;
+    if (bytes_received <= 0) {
+      snprintf(segment->error_message, sizeof(segment->error_message), "%s (已下载: %lld/%lld)",
+        connection->https_connection ? "SSL接收失败" : "网络接收失败", *current_downloaded, target_bytes);
+      result = -1;
+      break;
+    }
 
-          printf("线程 %d: 断点续传从 %lld 字节开始 (已下载: %ld)\n",
-            thread_params->thread_id, thread_params->segment->start_byte, existing_size);
-        }
-        else {
-          // 重置到原始状态
-          thread_params->segment->start_byte = original_start_byte;
-          thread_params->segment->downloaded_bytes = 0;
-        }
-      }
-      else {
-        // 文件不存在，重置到原始状态
-        thread_params->segment->start_byte = original_start_byte;
-        thread_params->segment->downloaded_bytes = 0;
+    filled += bytes_received;
+    *current_downloaded += bytes_received;
+
+    // 缓冲区满、段已完成或严格模式下写入文件
+    if (flush_each_receive || filled == chunk || *current_downloaded >= target_bytes) {
+      if (fwrite(buffer, 1, filled, temp_file) != filled || fflush(temp_file) != 0) {
+        snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+        *current_downloaded -= filled;
+        filled = 0;
+        result = -1;
+        break;
       }
-
-      printf("线程 %d: 第 %d 次重试...\n", thread_params->thread_id, retry + 1);
-      sleep(RETRY_DELAY);
+      filled = 0;
+      atomic_store(&segment->written_bytes, *current_downloaded);
     }
 
-    int result = download_segment(thread_params);
-    if (result == 0) {
-      return 0; // 成功
+    // 更新进度（使用互斥锁保护）
+    pthread_mutex_lock(thread_params->progress_mutex);
+    segment->downloaded_bytes = *current_downloaded;
+    pthread_mutex_unlock(thread_params->progress_mutex);
+    if (flush_each_receive) {
+      verify_landed_pieces(thread_params, temp_file, *current_downloaded - bytes_received, *current_downloaded);
     }
 
-    // 如果不是最后一次重试，继续尝试
-    if (retry < MAX_RETRIES - 1) {
-      printf("线程 %d: 下载失败，准备重试...\n", thread_params->thread_id);
-      // 重置线程状态
-      thread_params->segment->state = THREAD_STATE_IDLE;
+    // 计算下载速度
+    time_t elapsed = time(NULL) - thread_params->start_time;
+    if (elapsed > 0) {
+      thread_params->download_speed = (double)*current_downloaded / elapsed;
     }
   }
 
-  printf("线程 %d: 重试 %d 次后仍然失败\n", thread_params->thread_id, MAX_RETRIES);
-  return -1;
+  // 接收中断时缓冲区里的数据仍是连续的，写入后重试从这里继续
+  if (filled > 0 && fwrite(buffer, 1, filled, temp_file) != filled) {
+    *current_downloaded -= filled;
+    result = -1;
+  }
+  free(buffer);
+
+  if (fflush(temp_file) != 0) {
+    snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+    return -1;
+  }
+  atomic_store(&segment->written_bytes, *current_downloaded);
+
+  // 写入失败时进度回退到已写入文件的位置
+  pthread_mutex_lock(thread_params->progress_mutex);
+  segment->downloaded_bytes = *current_downloaded;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+  return result;
 }
 
-int download_http_segment(const URLInfo* url_info, ThreadDownloadParams* thread_params, FILE* temp_file) {
-  FileSegment* segment = thread_params->segment;
+// 记录段开始使用的连接（用于读取 TCP_INFO 和按地址统计吞吐量）。
+// active_sockfd 只在进度锁内设置和清除，其他线程持锁时对它调用 shutdown/getsockopt 不会碰到已关闭并被复用的描述符
+static void track_segment_connection(ThreadDownloadParams* thread_params, int sockfd) {
+  thread_params->connection_start_ms = get_monotonic_ms();
+  pthread_mutex_lock(thread_params->progress_mutex);
+  thread_params->active_sockfd = sockfd;
+  thread_params->connection_start_bytes = thread_params->segment->downloaded_bytes;
+  thread_params->watchdog_start_ms = thread_params->connection_start_ms;
+  thread_params->watchdog_bytes = thread_params->connection_start_bytes;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+}
 
-  // 建立TCP连接
-  char ip_str[INET_ADDRSTRLEN];
-  if (url_info->host_type == DOMAIN) {
-    if (resolve_hostname(url_info->host, ip_str, sizeof(ip_str)) != 0) {
-      snprintf(segment->error_message, sizeof(segment->error_message), "域名解析失败");
-      return -1;
+// 归还段使用的连接，并把本次传输的字节数、耗时和结果计入对端地址的分流统计
+static void release_segment_connection(ThreadDownloadParams* thread_params, PooledConnection* connection, int reusable) {
+  // 先在锁内清除，之后才可能关闭连接
+  pthread_mutex_lock(thread_params->progress_mutex);
+  thread_params->active_sockfd = -1;
+  pthread_mutex_unlock(thread_params->progress_mutex);
+
+  if (connection->has_peer_address) {
+    long long target_bytes = segment_target_bytes(thread_params);
+    pthread_mutex_lock(thread_params->progress_mutex);
+    long long downloaded = thread_params->segment->downloaded_bytes;
+    pthread_mutex_unlock(thread_params->progress_mutex);
+
+    int failed = downloaded < target_bytes && !thread_params->should_stop;
+    dns_report_transfer(connection->host, (struct sockaddr*)&connection->peer_address,
+      downloaded - thread_params->connection_start_bytes,
+      get_monotonic_ms() - thread_params->connection_start_ms, failed);
+
+    // 被降级的地址不再复用其连接，之后的段改连其他地址
+    if (reusable && dns_address_demoted(connection->host, (struct sockaddr*)&connection->peer_address)) {
+      reusable = 0;
     }
   }
-  else {
-    strcpy(ip_str, url_info->host);
-  }
 
-  int sockfd = create_tcp_connection(ip_str, url_info->port);
-  if (sockfd < 0) {
-    snprintf(segment->error_message, sizeof(segment->error_message), "TCP连接失败");
-    return -1;
-  }
+  connection_pool_release(connection, reusable);
+}
+
+int download_http_segment(const URLInfo* url_info, ThreadDownloadParams* thread_params, FILE* temp_file) {
+  FileSegment* segment = thread_params->segment;
 
   // 构建Range请求，支持断点续传
   char request[REQUEST_BUFFER];
-  int request_len = snprintf(request, sizeof(request),
-    "GET %s HTTP/1.1\r\n"
-    "Host: %s\r\n"
-    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-    "Accept: */*\r\n"
-    "Range: bytes=%lld-%lld\r\n"
-    "Connection: close\r\n"
-    "\r\n",
-    url_info->path, url_info->host, segment->start_byte, segment->end_byte);
-
-  if (request_len >= REQUEST_BUFFER) {
-    close(sockfd);
+  int request_len = build_range_request(url_info, segment, request, sizeof(request));
+  if (request_len < 0) {
     snprintf(segment->error_message, sizeof(segment->error_message), "请求构建失败");
     return -1;
   }
 
-  // 发送请求
-  if (send(sockfd, request, request_len, 0) != request_len) {
-    close(sockfd);
-    snprintf(segment->error_message, sizeof(segment->error_message), "请求发送失败");
-    return -1;
-  }
-
-  segment->state = THREAD_STATE_DOWNLOADING;
-
-  // 解析响应头
+  // 从连接池借用连接，发送请求并解析响应头
+  PooledConnection* connection = NULL;
   HttpResponseInfo response_info = { 0 };
   HttpReadBuffer read_buffer = { 0 };
-  read_buffer.sockfd = sockfd;
+  // 响应体的长度（按段内偏移计）：接手启动探测的响应流时由其 Content-Range 决定
+  long long response_bytes = segment->end_byte - segment->start_byte + 1;
 
-  if (parse_http_response_headers(sockfd, &response_info, &read_buffer) != 0) {
-    close(sockfd);
-    snprintf(segment->error_message, sizeof(segment->error_message), "响应解析失败");
+  if (!claim_probe_stream(thread_params, &connection, &response_info, &read_buffer, &response_bytes) &&
+    pooled_connection_request(url_info, request, request_len, &connection, &response_info, &read_buffer) != 0) {
+    snprintf(segment->error_message, sizeof(segment->error_message), "TCP连接或响应失败");
     return -1;
   }
+  track_segment_connection(thread_params, connection->sockfd);
+
+  segment->state = THREAD_STATE_DOWNLOADING;
 
   // 检查状态码
   if (response_info.status_code != 206 && response_info.status_code != 200) {
-    close(sockfd);
+    release_segment_connection(thread_params, connection, 0);
     snprintf(segment->error_message, sizeof(segment->error_message),
       "HTTP错误: %d", response_info.status_code);
     return -1;
   }
+  if (verify_mirror_response(thread_params, &response_info) != 0) {
+    release_segment_connection(thread_params, connection, 0);
+    return -1;
+  }
 
   // 下载内容
-  const size_t BUFFER_SIZE = 16384;
-  char buffer[BUFFER_SIZE];
-  long long expected_bytes = segment->end_byte - segment->start_byte + 1;
+  long long expected_bytes = response_bytes;
   long long current_downloaded = segment->downloaded_bytes;
+  int reusable = response_info.status_code == 206 && !response_info.connection_close;
 
   // 首先处理缓冲区中的剩余数据
   if (read_buffer.parse_position < read_buffer.data_length) {
     size_t remaining_data = read_buffer.data_length - read_buffer.parse_position;
     size_t bytes_to_write = remaining_data;
+    long long target_bytes = segment_target_bytes(thread_params);
 
-    if (current_downloaded + bytes_to_write > expected_bytes) {
-      bytes_to_write = expected_bytes - current_downloaded;
+    if (current_downloaded + (long long)bytes_to_write > target_bytes) {
+      bytes_to_write = target_bytes > current_downloaded ? (size_t)(target_bytes - current_downloaded) : 0;
+      reusable = 0; // 缓冲区中有多余数据
     }
 
     if (fwrite(read_buffer.buffer + read_buffer.parse_position, 1, bytes_to_write, temp_file) != bytes_to_write) {
-      close(sockfd);
+      release_segment_connection(thread_params, connection, 0);
       snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
       return -1;
     }
 
     current_downloaded += bytes_to_write;
 
+    // 先刷新到文件再公布进度，逐块校验读取文件时数据已经落盘
+    if (fflush(temp_file) != 0) {
+      release_segment_connection(thread_params, connection, 0);
+      snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+      return -1;
+    }
+    atomic_store(&segment->written_bytes, current_downloaded);
+
     // 更新全局进度
     pthread_mutex_lock(thread_params->progress_mutex);
     segment->downloaded_bytes = current_downloaded;
     pthread_mutex_unlock(thread_params->progress_mutex);
+    verify_landed_pieces(thread_params, temp_file, current_downloaded - bytes_to_write, current_downloaded);
   }
 
-  // 继续下载剩余数据
-  while (current_downloaded < expected_bytes && !thread_params->should_stop) {
-    long long remaining = expected_bytes - current_downloaded;
-    size_t bytes_to_read = (remaining < BUFFER_SIZE) ? (size_t)remaining : BUFFER_SIZE;
-
-    ssize_t bytes_received = recv(sockfd, buffer, bytes_to_read, 0);
-
-    if (bytes_received <= 0) {
-      if (bytes_received == 0) {
-        // 连接关闭，检查是否下载完成
-        if (current_downloaded == expected_bytes) {
-          break; // 正常完成
-        }
-      }
-      close(sockfd);
-      snprintf(segment->error_message, sizeof(segment->error_message),
-        "网络接收失败 (已下载: %lld/%lld)", current_downloaded, expected_bytes);
+  // 写入队列 / io_uring / splice 后端，不可用时继续使用下面的 recv + fwrite；限速时需要逐次取令牌，只用 recv
+  IoBackend io_backend = ratelimit_enabled() ? IO_BACKEND_STDIO : get_download_options()->io_backend;
+  if (thread_params->write_ring) {
+    if (receive_segment_async(connection, thread_params, temp_file, &current_downloaded) < 0) {
+      release_segment_connection(thread_params, connection, 0);
       return -1;
     }
-
-    if (fwrite(buffer, 1, bytes_received, temp_file) != (size_t)bytes_received) {
-      close(sockfd);
-      snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+  }
+  else if (io_backend == IO_BACKEND_URING && current_downloaded < expected_bytes) {
+    // io_uring 的写入可能乱序完成，接收结束后再校验本次写入的分块
+    long long uring_start = current_downloaded;
+    int uring_result = receive_segment_uring(connection, thread_params, temp_file, &current_downloaded);
+    if (uring_result < 0) {
+      release_segment_connection(thread_params, connection, 0);
       return -1;
     }
-
-    current_downloaded += bytes_received;
-
-    // 更新进度（使用互斥锁保护）
-    pthread_mutex_lock(thread_params->progress_mutex);
-    segment->downloaded_bytes = current_downloaded;
-    pthread_mutex_unlock(thread_params->progress_mutex);
-
-    // 计算下载速度
-    time_t current_time = time(NULL);
-    time_t elapsed = current_time - thread_params->start_time;
-    if (elapsed > 0) {
-      thread_params->download_speed = (double)current_downloaded / elapsed;
+    atomic_store(&segment->written_bytes, current_downloaded);
+    verify_landed_pieces(thread_params, temp_file, uring_start, current_downloaded);
+  }
+  else if (io_backend == IO_BACKEND_SPLICE && current_downloaded < expected_bytes) {
+    if (receive_segment_splice(connection, thread_params, temp_file, &current_downloaded) < 0) {
+      release_segment_connection(thread_params, connection, 0);
+      return -1;
     }
+  }
+  else if (io_backend == IO_BACKEND_MMAP && current_downloaded < expected_bytes) {
+    if (receive_segment_mmap(connection, thread_params, temp_file, &current_downloaded) < 0) {
+      release_segment_connection(thread_params, connection, 0);
+      return -1;
+    }
+  }
 
-    // 强制刷新文件缓冲区
-    fflush(temp_file);
+  // 继续下载剩余数据（段的结束位置可能被动态调度缩短）
+  if (receive_segment_buffered(connection, thread_params, temp_file, &current_downloaded) < 0) {
+    release_segment_connection(thread_params, connection, 0);
+    return -1;
   }
 
-  close(sockfd);
+  // 响应体完整读取后把连接归还到连接池，供其他段和重试复用；段被缩短时响应体还有剩余，不能复用
+  release_segment_connection(thread_params, connection, reusable && current_downloaded == expected_bytes);
 
   // 检查下载是否完成
-  if (current_downloaded != expected_bytes) {
+  long long target_bytes = segment_target_bytes(thread_params);
+  if (current_downloaded < target_bytes) {
     snprintf(segment->error_message, sizeof(segment->error_message),
-      "下载不完整: %lld/%lld", current_downloaded, expected_bytes);
+      "下载不完整: %lld/%lld", current_downloaded, target_bytes);
     return -1;
   }
 
   return 0;
 }
 
+#ifdef WITH_OPENSSL
 int download_https_segment(const URLInfo* url_info, ThreadDownloadParams* thread_params, FILE* temp_file) {
   FileSegment* segment = thread_params->segment;
 
-  // 初始化 OpenSSL
-  if (init_openssl() != 0) {
-    snprintf(segment->error_message, sizeof(segment->error_message), "OpenSSL初始化失败");
-    return -1;
-  }
-
-  // 建立 HTTPS 连接
-  HttpsConnection* https_connection = create_https_connection(url_info->host, url_info->port);
-  if (!https_connection) {
-    cleanup_openssl();
-    snprintf(segment->error_message, sizeof(segment->error_message), "HTTPS连接失败");
-    return -1;
-  }
-
   // 构建 Range 请求 - 支持断点续传
   char request[REQUEST_BUFFER];
-  int request_len = snprintf(request, sizeof(request),
-    "GET %s HTTP/1.1\r\n"
-    "Host: %s\r\n"
-    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
-    "Accept: */*\r\n"
-    "Range: bytes=%lld-%lld\r\n"
-    "Connection: close\r\n"
-    "\r\n",
-    url_info->path, url_info->host, segment->start_byte, segment->end_byte);
-
-  if (request_len >= REQUEST_BUFFER) {
-    close_https_connection(https_connection);
-    cleanup_openssl();
+  int request_len = build_range_request(url_info, segment, request, sizeof(request));
+  if (request_len < 0) {
     snprintf(segment->error_message, sizeof(segment->error_message), "请求构建失败");
     return -1;
   }
 
-  // 发送请求
-  if (ssl_send_data(https_connection, request, request_len) != 0) {
-    close_https_connection(https_connection);
-    cleanup_openssl();
-    snprintf(segment->error_message, sizeof(segment->error_message), "HTTPS请求发送失败");
-    return -1;
-  }
-
-  segment->state = THREAD_STATE_DOWNLOADING;
-
-  // 解析响应头
+  // 从连接池借用 HTTPS 连接，发送请求并解析响应头
+  PooledConnection* connection = NULL;
   HttpResponseInfo response_info = { 0 };
   HttpReadBuffer read_buffer = { 0 };
+  // 响应体的长度（按段内偏移计）：接手启动探测的响应流时由其 Content-Range 决定
+  long long response_bytes = segment->end_byte - segment->start_byte + 1;
 
-  if (parse_https_response_headers(https_connection, &response_info, &read_buffer) != 0) {
-    close_https_connection(https_connection);
-    cleanup_openssl();
-    snprintf(segment->error_message, sizeof(segment->error_message), "HTTPS响应解析失败");
+  if (!claim_probe_stream(thread_params, &connection, &response_info, &read_buffer, &response_bytes) &&
+    pooled_connection_request(url_info, request, request_len, &connection, &response_info, &read_buffer) != 0) {
+    snprintf(segment->error_message, sizeof(segment->error_message), "HTTPS连接或响应失败");
     return -1;
   }
+  track_segment_connection(thread_params, connection->https_connection->sockfd);
+
+  segment->state = THREAD_STATE_DOWNLOADING;
 
   // 检查状态码
   if (response_info.status_code != 206 && response_info.status_code != 200) {
-    close_https_connection(https_connection);
-    cleanup_openssl();
+    release_segment_connection(thread_params, connection, 0);
     snprintf(segment->error_message, sizeof(segment->error_message),
       "HTTPS错误: %d", response_info.status_code);
     return -1;
   }
+  if (verify_mirror_response(thread_params, &response_info) != 0) {
+    release_segment_connection(thread_params, connection, 0);
+    return -1;
+  }
 
   // 下载内容
-  const size_t BUFFER_SIZE = 16384;
-  char buffer[BUFFER_SIZE];
-  long long expected_bytes = segment->end_byte - segment->start_byte + 1;
+  long long expected_bytes = response_bytes;
   long long current_downloaded = segment->downloaded_bytes;
+  int reusable = response_info.status_code == 206 && !response_info.connection_close;
 
   // 首先处理缓冲区中的剩余数据
   if (read_buffer.parse_position < read_buffer.data_length) {
     size_t remaining_data = read_buffer.data_length - read_buffer.parse_position;
     size_t bytes_to_write = remaining_data;
+    long long target_bytes = segment_target_bytes(thread_params);
 
-    if (current_downloaded + bytes_to_write > expected_bytes) {
-      bytes_to_write = expected_bytes - current_downloaded;
+    if (current_downloaded + (long long)bytes_to_write > target_bytes) {
+      bytes_to_write = target_bytes > current_downloaded ? (size_t)(target_bytes - current_downloaded) : 0;
+      reusable = 0; // 缓冲区中有多余数据
     }
 
     if (fwrite(read_buffer.buffer + read_buffer.parse_position, 1, bytes_to_write, temp_file) != bytes_to_write) {
-      close_https_connection(https_connection);
-      cleanup_openssl();
+      release_segment_connection(thread_params, connection, 0);
       snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
       return -1;
     }
 
     current_downloaded += bytes_to_write;
 
+    // 先刷新到文件再公布进度，逐块校验读取文件时数据已经落盘
+    if (fflush(temp_file) != 0) {
+      release_segment_connection(thread_params, connection, 0);
+      snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+      return -1;
+    }
+    atomic_store(&segment->written_bytes, current_downloaded);
+
     // 更新全局进度
     pthread_mutex_lock(thread_params->progress_mutex);
     segment->downloaded_bytes = current_downloaded;
     pthread_mutex_unlock(thread_params->progress_mutex);
+    verify_landed_pieces(thread_params, temp_file, current_downloaded - bytes_to_write, current_downloaded);
   }
 
-  // 继续下载剩余数据
-  while (current_downloaded < expected_bytes && !thread_params->should_stop) {
-    long long remaining = expected_bytes - current_downloaded;
-    size_t bytes_to_read = (remaining < BUFFER_SIZE) ? (size_t)remaining : BUFFER_SIZE;
-
-    ssize_t bytes_received = ssl_recv_data(https_connection, buffer, bytes_to_read);
-
-    if (bytes_received <= 0) {
-      if (bytes_received == 0) {
-        // 连接关闭，检查是否下载完成
-        if (current_downloaded == expected_bytes) {
-          break; // 正常完成
-        }
-      }
-      close_https_connection(https_connection);
-      cleanup_openssl();
-      snprintf(segment->error_message, sizeof(segment->error_message),
-        "SSL接收失败 (已下载: %lld/%lld)", current_downloaded, expected_bytes);
+  // 写入队列后端（SSL 解密后的数据同样放入缓冲块）；mmap 后端由 SSL_read 直接解密到输出文件映射中
+  IoBackend io_backend = ratelimit_enabled() ? IO_BACKEND_STDIO : get_download_options()->io_backend;
+  if (thread_params->write_ring) {
+    if (receive_segment_async(connection, thread_params, temp_file, &current_downloaded) < 0) {
+      release_segment_connection(thread_params, connection, 0);
       return -1;
     }
-
-    if (fwrite(buffer, 1, bytes_received, temp_file) != (size_t)bytes_received) {
-      close_https_connection(https_connection);
-      cleanup_openssl();
-      snprintf(segment->error_message, sizeof(segment->error_message), "文件写入失败");
+  }
+  else if (io_backend == IO_BACKEND_MMAP && current_downloaded < expected_bytes) {
+    if (receive_segment_mmap(connection, thread_params, temp_file, &current_downloaded) < 0) {
+      release_segment_connection(thread_params, connection, 0);
       return -1;
     }
+  }
 
-    current_downloaded += bytes_received;
-
-    // 更新进度（使用互斥锁保护）
-    pthread_mutex_lock(thread_params->progress_mutex);
-    segment->downloaded_bytes = current_downloaded;
-    pthread_mutex_unlock(thread_params->progress_mutex);
-
-    // 计算下载速度
-    time_t current_time = time(NULL);
-    time_t elapsed = current_time - thread_params->start_time;
-    if (elapsed > 0) {
-      thread_params->download_speed = (double)current_downloaded / elapsed;
-    }
-
-    // 强制刷新文件缓冲区
-    fflush(temp_file);
+  // 继续下载剩余数据（段的结束位置可能被动态调度缩短）
+  if (receive_segment_buffered(connection, thread_params, temp_file, &current_downloaded) < 0) {
+    release_segment_connection(thread_params, connection, 0);
+    return -1;
   }
 
-  close_https_connection(https_connection);
-  cleanup_openssl();
+  // 响应体完整读取后把连接归还到连接池，供其他段和重试复用；段被缩短时响应体还有剩余，不能复用
+  release_segment_connection(thread_params, connection, reusable && current_downloaded == expected_bytes);
 
   // 检查下载是否完成
-  if (current_downloaded != expected_bytes) {
+  long long target_bytes = segment_target_bytes(thread_params);
+  if (current_downloaded < target_bytes) {
     snprintf(segment->error_message, sizeof(segment->error_message),
-      "下载不完整: %lld/%lld", current_downloaded, expected_bytes);
+      "下载不完整: %lld/%lld", current_downloaded, target_bytes);
     return -1;
   }
 
   return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,33 +1,221 @@
 #include "../include/net.h"
+#include "../include/dns.h"
+#include "../include/config.h"
+#include "../include/utils.h"
+#include <poll.h>
 
 
 
-int create_tcp_connection(const char* ip_str, int port) {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) {
-    perror("Socket Created Failure");
-    return -1;
-  }
-
-  // 设置连接超时
+// 阻塞收发超时（连接建立后恢复阻塞模式使用）。单连接下载、探测和批量下载没有重试，使用固定的 SOCKET_IO_TIMEOUT；
+// 分段引擎各自按 get_io_idle_timeout_ms 和低速检测更早中止并重试
+static void set_socket_timeouts(int sockfd) {
   struct timeval timeout;
-  timeout.tv_sec = 30;  // 30秒超时
+  timeout.tv_sec = SOCKET_IO_TIMEOUT;
   timeout.tv_usec = 0;
   setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
   setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void set_address_port(struct sockaddr_storage* address, int port) {
+  if (address->ss_family == AF_INET6) {
+    ((struct sockaddr_in6*)address)->sin6_port = htons(port);
+  }
+  else {
+    ((struct sockaddr_in*)address)->sin_port = htons(port);
+  }
+}
+
+// 按 RFC 8305 排列尝试顺序：分流选出的地址最先，其余 IPv6 与 IPv4 交替
+static int order_addresses(const DnsAddressList* addresses, int order[]) {
+  int count = 0;
+  int start = 0;
+  if (addresses->preferred && addresses->count > 0) {
+    order[count++] = 0;
+    start = 1;
+  }
+
+  int ipv6[DNS_MAX_ADDRESSES], ipv4[DNS_MAX_ADDRESSES];
+  int ipv6_count = 0, ipv4_count = 0;
+  for (int i = start; i < addresses->count; i++) {
+    if (addresses->addresses[i].ss_family == AF_INET6) {
+      ipv6[ipv6_count++] = i;
+    }
+    else if (addresses->addresses[i].ss_family == AF_INET) {
+      ipv4[ipv4_count++] = i;
+    }
+  }
+
+  // 默认先尝试 IPv6；已有选中地址时下一个换成另一个地址族
+  int take_ipv6 = count == 0 || addresses->addresses[0].ss_family != AF_INET6;
+  int i6 = 0, i4 = 0;
+  while (i6 < ipv6_count || i4 < ipv4_count) {
+    if ((take_ipv6 && i6 < ipv6_count) || i4 >= ipv4_count) {
+      order[count++] = ipv6[i6++];
+    }
+    else {
+      order[count++] = ipv4[i4++];
+    }
+    take_ipv6 = !take_ipv6;
+  }
+  return count;
+}
+
+int connect_to_host(const char* hostname, int port) {
+  DnsAddressList addresses;
+  if (dns_resolve(hostname, &addresses) != 0) {
+    return -1;
+  }
+
+  int order[DNS_MAX_ADDRESSES];
+  int count = order_addresses(&addresses, order);
+  if (count == 0) {
+    fprintf(stderr, "错误: %s 没有可用的地址\n", hostname);
+    return -1;
+  }
+
+  // 正在进行的非阻塞连接
+  struct pollfd attempts[DNS_MAX_ADDRESSES];
+  int attempt_address[DNS_MAX_ADDRESSES];
+  int attempt_count = 0;
+  int next = 0;
+  int sockfd = -1;
+  int winner = -1;
+  int last_error = EHOSTUNREACH;
+  double deadline_ms = get_monotonic_ms() + get_download_options()->connect_timeout * 1000.0;
+  double next_attempt_ms = 0;
+
+  while (sockfd < 0) {
+    double now_ms = get_monotonic_ms();
+    if (now_ms >= deadline_ms) {
+      last_error = ETIMEDOUT;
+      break;
+    }
+
+    // 没有进行中的连接，或上一个连接超过间隔仍未完成时，开始连接下一个地址
+    if (next < count && (attempt_count == 0 || now_ms >= next_attempt_ms)) {
+      int index = order[next++];
+      struct sockaddr_storage* address = &addresses.addresses[index];
+      set_address_port(address, port);
+
+      int fd = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (fd < 0) {
+        last_error = errno;
+        dns_report_connect(hostname, (struct sockaddr*)address, 0);
+        continue;
+      }
+      if (connect(fd, (struct sockaddr*)address, addresses.lengths[index]) == 0) {
+        sockfd = fd;
+        winner = index;
+        break;
+      }
+      if (errno != EINPROGRESS) {
+        last_error = errno;
+        close(fd);
+        dns_report_connect(hostname, (struct sockaddr*)address, 0);
+        continue;
+      }
+
+      attempts[attempt_count].fd = fd;
+      attempts[attempt_count].events = POLLOUT;
+      attempts[attempt_count].revents = 0;
+      attempt_address[attempt_count] = index;
+      attempt_count++;
+      next_attempt_ms = now_ms + HAPPY_EYEBALLS_DELAY_MS;
+      continue;
+    }
+
+    if (attempt_count == 0) {
+      break; // 所有地址都已失败
+    }
+
+    double wait_ms = deadline_ms - now_ms;
+    if (next < count && next_attempt_ms - now_ms < wait_ms) {
+      wait_ms = next_attempt_ms - now_ms;
+    }
+    int ready = poll(attempts, attempt_count, (int)wait_ms + 1);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      last_error = errno;
+      break;
+    }
+
+    for (int i = 0; i < attempt_count && sockfd < 0; i++) {
+      if (attempts[i].revents == 0) {
+        continue;
+      }
+
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        error = errno;
+      }
+      if (error == 0) {
+        sockfd = attempts[i].fd;
+        winner = attempt_address[i];
+      }
+      else {
+        last_error = error;
+        close(attempts[i].fd);
+        next_attempt_ms = now_ms; // 失败后立即尝试下一个地址
+        dns_report_connect(hostname, (struct sockaddr*)&addresses.addresses[attempt_address[i]], 0);
+      }
+
+      attempt_count--;
+      attempts[i] = attempts[attempt_count];
+      attempt_address[i] = attempt_address[attempt_count];
+      i--;
+    }
+  }
+
+  // 关闭落选的连接。它们只是比获胜者慢，连接并没有失败，不降级
+  for (int i = 0; i < attempt_count; i++) {
+    close(attempts[i].fd);
+  }
+
+  if (sockfd < 0) {
+    fprintf(stderr, "错误: 无法连接到 %s:%d: %s\n", hostname, port, strerror(last_error));
+    return -1;
+  }
 
-  struct sockaddr_in server_addr;
+  set_socket_nonblocking(sockfd, 0);
+  set_socket_timeouts(sockfd);
+  dns_report_connect(hostname, (struct sockaddr*)&addresses.addresses[winner], 1);
+  return sockfd;
+}
+
+int create_tcp_connection_nonblocking(const char* ip_str, int port) {
+  struct sockaddr_storage server_addr;
+  socklen_t server_addr_length;
   memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(port);
 
-  if (inet_pton(AF_INET, ip_str, &server_addr.sin_addr) <= 0) {
-    close(sockfd);
+  struct sockaddr_in* addr_in = (struct sockaddr_in*)&server_addr;
+  struct sockaddr_in6* addr_in6 = (struct sockaddr_in6*)&server_addr;
+  if (inet_pton(AF_INET, ip_str, &addr_in->sin_addr) == 1) {
+    server_addr.ss_family = AF_INET;
+    server_addr_length = sizeof(struct sockaddr_in);
+  }
+  else if (inet_pton(AF_INET6, ip_str, &addr_in6->sin6_addr) == 1) {
+    server_addr.ss_family = AF_INET6;
+    server_addr_length = sizeof(struct sockaddr_in6);
+  }
+  else {
     return -1;
   }
+  set_address_port(&server_addr, port);
 
-  if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-    perror("Connection Failure");
+  int sockfd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sockfd < 0) {
+    perror("Socket Created Failure");
+    return -1;
+  }
+
+  // 与阻塞连接保持一致，连接归还到连接池后仍有收发超时
+  set_socket_timeouts(sockfd);
+
+  // 非阻塞连接通常返回 EINPROGRESS，连接结果在 socket 可写后通过 SO_ERROR 获取
+  if (connect(sockfd, (struct sockaddr*)&server_addr, server_addr_length) < 0 && errno != EINPROGRESS) {
     close(sockfd);
     return -1;
   }
@@ -35,6 +223,16 @@ int create_tcp_connection(const char* ip_str, int port) {
   return sockfd;
 }
 
+int set_socket_nonblocking(int sockfd, int enabled) {
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  if (flags < 0) {
+    return -1;
+  }
+
+  flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return fcntl(sockfd, F_SETFL, flags) < 0 ? -1 : 0;
+}
+
 int send_full_data(int sockfd, const char* buffer, size_t length) {
   size_t total_sent = 0;
 
@@ -50,3 +248,105 @@ int send_full_data(int sockfd, const char* buffer, size_t length) {
   return 0;
 }
 
+
+int create_splice_pipe(int pipe_fds[2]) {
+  if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+    return -1;
+  }
+
+  // 默认管道只有 64KiB，扩大后每次 splice 可以搬运更多数据；失败时保持默认容量
+  fcntl(pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+  return 0;
+}
+
+void close_splice_pipe(int pipe_fds[2]) {
+  if (pipe_fds[0] >= 0) {
+    close(pipe_fds[0]);
+    pipe_fds[0] = -1;
+  }
+  if (pipe_fds[1] >= 0) {
+    close(pipe_fds[1]);
+    pipe_fds[1] = -1;
+  }
+}
+
+// 文件系统不支持从管道 splice 写入时，把管道中已有的数据读出来按偏移写入文件，
+// 这些数据已经离开 socket，丢掉会在文件中留下空洞
+static int drain_pipe_to_file(int pipe_fd, int file_fd, loff_t offset, size_t pending) {
+  char buffer[65536];
+  while (pending > 0) {
+    ssize_t bytes_read = read(pipe_fd, buffer, pending < sizeof(buffer) ? pending : sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      if (bytes_read == 0) {
+        errno = EIO;
+      }
+      return -1;
+    }
+
+    ssize_t written = 0;
+    while (written < bytes_read) {
+      ssize_t n = pwrite(file_fd, buffer + written, bytes_read - written, offset + written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        if (n == 0) {
+          errno = EIO;
+        }
+        return -1;
+      }
+      written += n;
+    }
+    offset += bytes_read;
+    pending -= (size_t)bytes_read;
+  }
+  return 0;
+}
+
+ssize_t splice_socket_to_file(int sockfd, int pipe_fds[2], int file_fd, long long offset, size_t length) {
+  ssize_t in_pipe;
+  do {
+    in_pipe = splice(sockfd, NULL, pipe_fds[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+  } while (in_pipe < 0 && errno == EINTR);
+
+  if (in_pipe <= 0) {
+    return in_pipe;
+  }
+
+  // 把管道中的数据全部写到文件，splice 会更新 file_offset 而不改变文件位置
+  loff_t file_offset = offset;
+  size_t pending = (size_t)in_pipe;
+  while (pending > 0) {
+    ssize_t written = splice(pipe_fds[0], NULL, file_fd, &file_offset, pending, SPLICE_F_MOVE);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0 && errno == EINVAL) {
+      // 不支持 splice 写入文件：管道中的数据经用户态写入
+      if (drain_pipe_to_file(pipe_fds[0], file_fd, file_offset, pending) != 0) {
+        break;
+      }
+      return in_pipe;
+    }
+    if (written <= 0) {
+      if (written == 0) {
+        errno = EIO;
+      }
+      break;
+    }
+    pending -= (size_t)written;
+  }
+
+  if (pending > 0) {
+    // 数据已离开 socket 却没有写入文件：不能让调用者当作不支持 splice 改用 recv 继续，
+    // 只能按失败处理（重试时从已确认的进度重新下载）
+    if (errno == EINVAL) {
+      errno = EIO;
+    }
+    return -1;
+  }
+  return in_pipe;
+}
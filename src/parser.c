@@ -1,38 +1,32 @@
 #include "./common.h"
 #include "../include/parser.h"
+#include "../include/dns.h"
 
 
 int resolve_hostname(const char* hostname, char* ip_str, size_t ip_str_len) {
-  struct addrinfo hints, * result;
-  int status;
-
-  // 初始化hints结构
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET;      // IPv4
-  hints.ai_socktype = SOCK_STREAM; // TCP
-
-  // 进行域名解析
-  status = getaddrinfo(hostname, "80", &hints, &result);
-  if (status != 0) {
-    fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+  // 通过共享缓存解析，同一下载的各个连接和重试不再重复查询
+  DnsAddressList addresses;
+  if (dns_resolve(hostname, &addresses) != 0 || addresses.count == 0) {
     return -1;
   }
 
-  // 获取第一个结果的IP地址
-  struct sockaddr_in* addr_in = (struct sockaddr_in*)result->ai_addr;
-  const char* ip = inet_ntoa(addr_in->sin_addr);
-
-  // 检查缓冲区大小
-  if (strlen(ip) >= ip_str_len) {
-    freeaddrinfo(result);
-    return -1;
+  // 使用分流选出的地址，否则第一个IPv4地址，都没有时使用第一个地址
+  int index = 0;
+  if (!addresses.preferred) {
+    for (int i = 0; i < addresses.count; i++) {
+      if (addresses.addresses[i].ss_family == AF_INET) {
+        index = i;
+        break;
+      }
+    }
   }
 
-  // 复制IP地址字符串
-  strcpy(ip_str, ip);
-
-  // 释放结果
-  freeaddrinfo(result);
+  const void* address = addresses.addresses[index].ss_family == AF_INET6 ?
+    (const void*)&((struct sockaddr_in6*)&addresses.addresses[index])->sin6_addr :
+    (const void*)&((struct sockaddr_in*)&addresses.addresses[index])->sin_addr;
+  if (inet_ntop(addresses.addresses[index].ss_family, address, ip_str, ip_str_len) == NULL) {
+    return -1; // 缓冲区不足
+  }
   return 0;
 }
 
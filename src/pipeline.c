@@ -0,0 +1,424 @@
+#include "../include/common.h"
+#include "../include/pipeline.h"
+#include "../include/http.h"
+#include "../include/parser.h"
+#include "../include/pool.h"
+#include "../include/menu.h"
+#include "../include/ratelimit.h"
+#include "../include/redirect.h"
+#include "../include/utils.h"
+
+static const char* GREEN = "\033[32m";
+static const char* YELLOW = "\033[33m";
+static const char* RED = "\033[31m";
+static const char* CYAN = "\033[36m";
+static const char* RESET = "\033[0m";
+
+// URL 路径的最后一段作为默认文件名
+static char* default_output_filename(const char* url) {
+  URLInfo url_info = { 0 };
+  const char* name = "";
+  size_t length = 0;
+
+  if (parse_url(url, &url_info) == 0) {
+    const char* path_end = url_info.path + strcspn(url_info.path, "?#");
+    const char* slash = path_end;
+    while (slash > url_info.path && slash[-1] != '/') {
+      slash--;
+    }
+    name = slash;
+    length = path_end - slash;
+  }
+  return length > 0 ? strndup(name, length) : strdup("index.html");
+}
+
+static void free_batch_list(BatchEntry* entries, int entry_count) {
+  for (int i = 0; i < entry_count; i++) {
+    free(entries[i].url);
+    free(entries[i].output_filename);
+  }
+  free(entries);
+}
+
+static int load_batch_list(const char* list_file, BatchEntry** entries, int* entry_count) {
+  FILE* file = fopen(list_file, "r");
+  if (!file) {
+    fprintf(stderr, "%s错误: 无法打开 URL 列表 %s: %s%s\n", RED, list_file, strerror(errno), RESET);
+    return -1;
+  }
+
+  char line[4096];
+  int capacity = 0;
+  *entries = NULL;
+  *entry_count = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    char* url = line + strspn(line, " \t");
+    url[strcspn(url, "\r\n")] = '\0';
+    if (url[0] == '\0' || url[0] == '#') {
+      continue;
+    }
+
+    // URL 之后可以跟输出文件名
+    char* name = url + strcspn(url, " \t");
+    if (*name) {
+      *name++ = '\0';
+      name += strspn(name, " \t");
+      name[strcspn(name, " \t")] = '\0';
+    }
+
+    if (*entry_count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      BatchEntry* grown = realloc(*entries, capacity * sizeof(BatchEntry));
+      if (!grown) {
+        fprintf(stderr, "%s错误: 内存分配失败%s\n", RED, RESET);
+        fclose(file);
+        return -1;
+      }
+      *entries = grown;
+    }
+
+    BatchEntry* entry = &(*entries)[*entry_count];
+    entry->url = strdup(url);
+    entry->output_filename = *name ? strdup(name) : default_output_filename(url);
+    entry->status = 0;
+    (*entry_count)++;
+    if (!entry->url || !entry->output_filename) {
+      fprintf(stderr, "%s错误: 内存分配失败%s\n", RED, RESET);
+      fclose(file);
+      return -1;
+    }
+  }
+
+  fclose(file);
+  return 0;
+}
+
+static void build_output_path(const char* download_dir, const char* filename, char* output, size_t output_size) {
+  if (!download_dir || download_dir[0] == '\0') {
+    snprintf(output, output_size, "%s", filename);
+  }
+  else {
+    snprintf(output, output_size, "%s%s%s", download_dir,
+      download_dir[strlen(download_dir) - 1] == '/' ? "" : "/", filename);
+  }
+}
+
+// 读取下一个响应的响应头，多读到的数据（响应体和后续响应）留在缓冲区中
+// 返回0成功，1表示连接已关闭或出错，-1表示响应头格式错误
+static int read_response_head(PooledConnection* connection, HttpReadBuffer* buffer, HttpResponseInfo* response_info) {
+  while (1) {
+    const char* start = buffer->buffer + buffer->parse_position;
+    size_t available = buffer->data_length - buffer->parse_position;
+    const char* end = memmem(start, available, "\r\n\r\n", 4);
+    if (end) {
+      size_t head_length = end + 4 - start;
+      buffer->parse_position += head_length;
+      return parse_http_response_block(start, head_length, response_info) == 0 ? 0 : -1;
+    }
+
+    // 未解析的数据移到缓冲区开头再继续接收
+    memmove(buffer->buffer, start, available);
+    buffer->data_length = available;
+    buffer->parse_position = 0;
+    if (available == sizeof(buffer->buffer)) {
+      return -1; // 响应头过长
+    }
+
+    ssize_t bytes_received = pooled_connection_recv(connection, buffer->buffer + available, sizeof(buffer->buffer) - available);
+    if (bytes_received <= 0) {
+      return 1;
+    }
+    buffer->data_length += bytes_received;
+  }
+}
+
+// 接收长度已知的响应体，output 为NULL时丢弃；写文件失败时设置 write_error 并丢弃其余数据
+// 返回0成功，-1表示连接出错（连接上后续的数据无法再使用）
+static int receive_body(PooledConnection* connection, HttpReadBuffer* buffer, long long length,
+  FILE* output, RateLimiter* rate_limiter, int* write_error) {
+  long long remaining = length;
+
+  while (remaining > 0) {
+    size_t available = buffer->data_length - buffer->parse_position;
+    if (available == 0) {
+      size_t bytes_to_receive = ratelimit_acquire(rate_limiter, sizeof(buffer->buffer));
+      ssize_t bytes_received = pooled_connection_recv(connection, buffer->buffer, bytes_to_receive);
+      ratelimit_refund(rate_limiter, bytes_to_receive, bytes_received);
+      if (bytes_received <= 0) {
+        return -1;
+      }
+      buffer->data_length = bytes_received;
+      buffer->parse_position = 0;
+      continue;
+    }
+
+    size_t chunk = available < (unsigned long long)remaining ? available : (size_t)remaining;
+    if (output && !*write_error && fwrite(buffer->buffer + buffer->parse_position, 1, chunk, output) != chunk) {
+      *write_error = 1;
+    }
+    buffer->parse_position += chunk;
+    remaining -= chunk;
+  }
+  return 0;
+}
+
+// 把 group 中 [first, first + count) 的请求依次写入 requests，返回总长度
+static size_t build_pipeline_requests(const BatchEntry* entries, const int* group, int first, int count,
+  char* requests, size_t requests_size) {
+  size_t length = 0;
+
+  for (int i = first; i < first + count; i++) {
+    URLInfo url_info = { 0 };
+    parse_url(entries[group[i]].url, &url_info);
+    length += snprintf(requests + length, requests_size - length,
+      "GET %s HTTP/1.1\r\n"
+      "Host: %s\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+      "Accept: */*\r\n"
+      "Accept-Encoding: identity\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n",
+      url_info.path[0] ? url_info.path : "/", url_info.host);
+  }
+  return length;
+}
+
+// 在同一主机的连接上以流水线方式下载 group 中的文件
+// 无法继续流水线时返回，未完成的文件（status 为0）由调用者单独下载
+static void fetch_group(BatchEntry* entries, const int* group, int group_count, const URLInfo* origin,
+  const char* download_dir, int depth, int* connection_count) {
+  RateBucket rate_bucket = { 0 };
+  RateLimiter rate_limiter;
+  ratelimit_init(&rate_limiter, origin->host, &rate_bucket);
+
+  HttpReadBuffer* buffer = malloc(sizeof(HttpReadBuffer));
+  char* requests = malloc((size_t)depth * REQUEST_BUFFER);
+  if (!buffer || !requests) {
+    fprintf(stderr, "%s错误: 内存分配失败%s\n", RED, RESET);
+    free(buffer);
+    free(requests);
+    return;
+  }
+
+  int next_response = 0;      // 下一个要读取响应的文件（group 中的下标）
+  int pipelining = 1;         // 为0时剩余文件改为单独下载
+
+  while (pipelining && next_response < group_count) {
+    PooledConnection* connection = connection_pool_acquire(origin);
+    if (!connection) {
+      break;
+    }
+    (*connection_count)++;
+    memset(buffer, 0, sizeof(HttpReadBuffer));
+
+    // 上一个连接上已发出但没有答复的请求在新连接上重发
+    int next_request = next_response;
+    int responses = 0;        // 本连接上收到的完整响应数
+    int server_closes = 0;    // 服务器声明在本响应后关闭连接
+
+    while (next_response < group_count && !server_closes) {
+      // 未答复的请求不超过深度的一半时补足到深度，一次发出
+      if (next_request < group_count && next_request - next_response <= depth / 2) {
+        int count = depth - (next_request - next_response);
+        if (count > group_count - next_request) {
+          count = group_count - next_request;
+        }
+        size_t length = build_pipeline_requests(entries, group, next_request, count,
+          requests, (size_t)depth * REQUEST_BUFFER);
+        if (pooled_connection_send(connection, requests, length) != 0) {
+          pipelining = responses > 0;
+          break;
+        }
+        connection->request_count += count;
+        next_request += count;
+      }
+
+      HttpResponseInfo response_info;
+      int head_result = read_response_head(connection, buffer, &response_info);
+      if (head_result != 0) {
+        // 已收到过响应的连接被关闭（keep-alive 请求数上限，或关闭时未读的请求触发了 RST）时重新连接继续，
+        // 连接上一个响应都没有收到或响应格式错误时不再流水线
+        pipelining = head_result > 0 && responses > 0;
+        break;
+      }
+      if (response_info.status_code < 200) {
+        continue; // 1xx 中间响应，同一请求的最终响应随后到达
+      }
+
+      BatchEntry* entry = &entries[group[next_response]];
+      long long content_length = response_info.content_length;
+      if (response_info.status_code == 204 || response_info.status_code == 304) {
+        content_length = 0;
+      }
+      if (content_length < 0 || response_info.chunked_encoding) {
+        // 没有 Content-Length 的响应无法在流水线中确定边界
+        printf("%s警告: %s 的响应没有 Content-Length，不能继续流水线%s\n", YELLOW, entry->url, RESET);
+        pipelining = 0;
+        break;
+      }
+
+      StatusAction action = determine_status_action(response_info.status_code);
+      char output_path[PATH_MAX];
+      FILE* output = NULL;
+      int write_error = 0;
+      if (action == STATUS_ACTION_CONTINUE) {
+        build_output_path(download_dir, entry->output_filename, output_path, sizeof(output_path));
+        output = fopen(output_path, "wb");
+        if (!output) {
+          fprintf(stderr, "%s错误: 无法创建输出文件 %s: %s%s\n", RED, output_path, strerror(errno), RESET);
+          write_error = 1;
+        }
+      }
+
+      if (receive_body(connection, buffer, content_length, output, &rate_limiter, &write_error) != 0) {
+        // 响应中途断开，本文件在新连接上重新请求
+        if (output) {
+          fclose(output);
+          remove(output_path);
+        }
+        pipelining = responses > 0;
+        break;
+      }
+      if (output && fclose(output) != 0) {
+        write_error = 1;
+      }
+      responses++;
+      next_response++;
+      server_closes = response_info.connection_close;
+
+      if (action == STATUS_ACTION_CONTINUE) {
+        if (write_error) {
+          fprintf(stderr, "%s错误: 写入 %s 失败%s\n", RED, entry->output_filename, RESET);
+          entry->status = -1;
+        }
+        else {
+          printf("%s✓ %s (%s)%s\n", GREEN, entry->output_filename, format_file_size(content_length), RESET);
+          entry->status = 1;
+        }
+      }
+      else if (action == STATUS_ACTION_REDIRECT) {
+        // 重定向的文件随后单独下载，Location 先解析为绝对 URL
+        char target[2048];
+        char* redirected = NULL;
+        if (response_info.location[0] &&
+          resolve_redirect_location(entry->url, response_info.location, target, sizeof(target)) == 0 &&
+          (redirected = strdup(target)) != NULL) {
+          free(entry->url);
+          entry->url = redirected;
+        }
+      }
+      else if (action == STATUS_ACTION_ERROR) {
+        fprintf(stderr, "%s错误: %s 返回状态码 %d%s\n", RED, entry->url, response_info.status_code, RESET);
+        entry->status = -1;
+      }
+      // 5xx 的文件保持未完成，随后单独下载（相当于重试一次）
+    }
+
+    int reusable = pipelining && next_response == group_count && !server_closes &&
+      buffer->parse_position == buffer->data_length;
+    connection_pool_release(connection, reusable);
+  }
+
+  if (!pipelining && next_response < group_count) {
+    printf("%s警告: %s 不能继续流水线，剩余 %d 个文件改为每个文件一个连接下载%s\n",
+      YELLOW, origin->host, group_count - next_response, RESET);
+  }
+
+  free(buffer);
+  free(requests);
+}
+
+int pipeline_download_batch(const char* list_file, const char* download_dir, int depth) {
+  BatchEntry* entries = NULL;
+  int entry_count = 0;
+  if (load_batch_list(list_file, &entries, &entry_count) != 0) {
+    free_batch_list(entries, entry_count);
+    return -1;
+  }
+  if (entry_count == 0) {
+    printf("%s警告: URL 列表 %s 中没有地址%s\n", YELLOW, list_file, RESET);
+    free(entries);
+    return 0;
+  }
+
+  if (download_dir && download_dir[0]) {
+    struct stat dir_stat;
+    if (stat(download_dir, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+      fprintf(stderr, "%s错误: 下载目录不存在: %s%s\n", RED, download_dir, RESET);
+      free_batch_list(entries, entry_count);
+      return -1;
+    }
+  }
+
+  // 按 scheme + host + port 分组，同一主机的文件共用流水线连接
+  char (*origins)[600] = malloc(entry_count * sizeof(*origins));
+  int* group = malloc(entry_count * sizeof(int));
+  if (!origins || !group) {
+    fprintf(stderr, "%s错误: 内存分配失败%s\n", RED, RESET);
+    free(origins);
+    free(group);
+    free_batch_list(entries, entry_count);
+    return -1;
+  }
+  for (int i = 0; i < entry_count; i++) {
+    URLInfo url_info = { 0 };
+    if (parse_url(entries[i].url, &url_info) != 0 ||
+      (url_info.protocol_type != PROTOCOL_HTTP && url_info.protocol_type != PROTOCOL_HTTPS)) {
+      fprintf(stderr, "%s错误: 无法解析URL: %s%s\n", RED, entries[i].url, RESET);
+      entries[i].status = -1;
+      origins[i][0] = '\0';
+      continue;
+    }
+    snprintf(origins[i], sizeof(origins[i]), "%s://%s:%d", url_info.scheme, url_info.host, url_info.port);
+  }
+
+  printf("%s批量下载: %d 个文件，流水线深度 %d%s\n", CYAN, entry_count, depth, RESET);
+  double start_ms = get_monotonic_ms();
+  int connection_count = 0;
+  int fallback_count = 0;
+
+  for (int i = 0; i < entry_count; i++) {
+    if (entries[i].status != 0 || origins[i][0] == '\0') {
+      continue;
+    }
+
+    char key[sizeof(origins[i])];
+    memcpy(key, origins[i], sizeof(key));
+    int group_count = 0;
+    for (int j = i; j < entry_count; j++) {
+      if (origins[j][0] && strcasecmp(origins[j], key) == 0) {
+        group[group_count++] = j;
+        origins[j][0] = '\0';
+      }
+    }
+
+    URLInfo origin = { 0 };
+    parse_url(entries[i].url, &origin);
+    fetch_group(entries, group, group_count, &origin, download_dir, depth, &connection_count);
+
+    // 流水线没有完成的文件每个文件一个连接单独下载
+    for (int k = 0; k < group_count; k++) {
+      BatchEntry* entry = &entries[group[k]];
+      if (entry->status == 0) {
+        fallback_count++;
+        entry->status = download_file_auto(entry->url, entry->output_filename, download_dir, 0, 1) == DOWNLOAD_SUCCESS ? 1 : -1;
+      }
+    }
+  }
+
+  int failed = 0;
+  for (int i = 0; i < entry_count; i++) {
+    if (entries[i].status != 1) {
+      failed++;
+    }
+  }
+  printf("%s批量下载完成: %d 个成功，%d 个失败，用时 %.2f 秒（流水线使用 %d 个连接，%d 个文件单独下载）%s\n",
+    failed ? YELLOW : GREEN, entry_count - failed, failed, (get_monotonic_ms() - start_ms) / 1000.0,
+    connection_count, fallback_count, RESET);
+
+  free(origins);
+  free(group);
+  free_batch_list(entries, entry_count);
+  return failed;
+}
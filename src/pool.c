@@ -0,0 +1,356 @@
+#include "../include/common.h"
+#include "../include/pool.h"
+#include "../include/https.h"
+#include "../include/http.h"
+#include "../include/net.h"
+#include "../include/parser.h"
+
+// 空闲连接链表（进程内共享）
+static PooledConnection* idle_connections = NULL;
+static int idle_count = 0;
+static ConnectionPoolStats pool_stats = { 0 };
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void close_pooled_connection(PooledConnection* connection) {
+  if (!connection) {
+    return;
+  }
+
+#ifdef WITH_OPENSSL
+  if (connection->https_connection) {
+    close_https_connection(connection->https_connection);
+  }
+#endif
+  if (connection->sockfd >= 0) {
+    close(connection->sockfd);
+  }
+  free(connection);
+}
+
+static void close_connection_list(PooledConnection* list) {
+  while (list) {
+    PooledConnection* next = list->next;
+    close_pooled_connection(list);
+    list = next;
+  }
+}
+
+static int pooled_connection_fd(const PooledConnection* connection) {
+  if (connection->https_connection) {
+    return connection->https_connection->sockfd;
+  }
+  return connection->sockfd;
+}
+
+// 检查空闲连接是否仍然可用
+static int is_connection_alive(const PooledConnection* connection) {
+  char probe;
+  ssize_t result = recv(pooled_connection_fd(connection), &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  if (result == 0) {
+    return 0; // 对端已关闭
+  }
+  if (result < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  // 空闲的 HTTP 连接上不应有数据；HTTPS 上可能是会话票据等 TLS 记录
+  return connection->protocol_type == PROTOCOL_HTTPS;
+}
+
+// 从空闲链表中摘下超时的连接（调用者持有锁）
+static PooledConnection* detach_expired_locked(time_t now) {
+  PooledConnection* expired = NULL;
+  PooledConnection** link = &idle_connections;
+
+  while (*link) {
+    PooledConnection* connection = *link;
+    if (now - connection->last_used >= POOL_IDLE_TIMEOUT) {
+      *link = connection->next;
+      connection->next = expired;
+      expired = connection;
+      idle_count--;
+      pool_stats.evictions++;
+      continue;
+    }
+    link = &connection->next;
+  }
+  return expired;
+}
+
+PooledConnection* pooled_connection_create(const URLInfo* url_info, int sockfd, HttpsConnection* https_connection) {
+  PooledConnection* connection = malloc(sizeof(PooledConnection));
+  if (!connection) {
+    fprintf(stderr, "错误: 内存分配失败\n");
+    return NULL;
+  }
+
+  memset(connection, 0, sizeof(PooledConnection));
+  connection->protocol_type = url_info->protocol_type;
+  snprintf(connection->host, sizeof(connection->host), "%s", url_info->host);
+  connection->port = url_info->port;
+  connection->sockfd = https_connection ? -1 : sockfd;
+  connection->https_connection = https_connection;
+
+  socklen_t address_length = sizeof(connection->peer_address);
+  connection->has_peer_address = getpeername(pooled_connection_fd(connection),
+    (struct sockaddr*)&connection->peer_address, &address_length) == 0;
+
+  pthread_mutex_lock(&pool_mutex);
+  pool_stats.misses++;
+  pthread_mutex_unlock(&pool_mutex);
+
+  return connection;
+}
+
+static PooledConnection* open_new_connection(const URLInfo* url_info) {
+  PooledConnection* connection = NULL;
+
+  if (url_info->protocol_type == PROTOCOL_HTTPS) {
+#ifdef WITH_OPENSSL
+    if (init_openssl() != 0) {
+      return NULL;
+    }
+    HttpsConnection* https_connection = create_https_connection(url_info->host, url_info->port);
+    if (!https_connection) {
+      return NULL;
+    }
+    connection = pooled_connection_create(url_info, -1, https_connection);
+    if (!connection) {
+      close_https_connection(https_connection);
+    }
+#else
+    fprintf(stderr, "错误: HTTPS 支持未编译\n");
+#endif
+  }
+  else {
+    int sockfd = connect_to_host(url_info->host, url_info->port);
+    if (sockfd < 0) {
+      return NULL;
+    }
+    connection = pooled_connection_create(url_info, sockfd, NULL);
+    if (!connection) {
+      close(sockfd);
+    }
+  }
+
+  return connection;
+}
+
+PooledConnection* connection_pool_acquire_idle(const URLInfo* url_info) {
+  if (!url_info) {
+    return NULL;
+  }
+
+  PooledConnection* found = NULL;
+  PooledConnection* discarded = NULL;
+
+  pthread_mutex_lock(&pool_mutex);
+
+  discarded = detach_expired_locked(time(NULL));
+
+  PooledConnection** link = &idle_connections;
+  while (*link) {
+    PooledConnection* connection = *link;
+    if (connection->protocol_type != url_info->protocol_type ||
+      connection->port != url_info->port ||
+      strcasecmp(connection->host, url_info->host) != 0) {
+      link = &connection->next;
+      continue;
+    }
+
+    *link = connection->next;
+    idle_count--;
+
+    if (is_connection_alive(connection)) {
+      found = connection;
+      break;
+    }
+
+    // 服务器已关闭的连接直接丢弃
+    connection->next = discarded;
+    discarded = connection;
+    pool_stats.evictions++;
+  }
+
+  if (found) {
+    pool_stats.hits++;
+  }
+
+  pthread_mutex_unlock(&pool_mutex);
+
+  close_connection_list(discarded);
+
+  if (found) {
+    found->next = NULL;
+    found->reused = 1;
+  }
+  return found;
+}
+
+PooledConnection* connection_pool_acquire(const URLInfo* url_info) {
+  if (!url_info) {
+    return NULL;
+  }
+
+  PooledConnection* found = connection_pool_acquire_idle(url_info);
+  if (found) {
+    return found;
+  }
+
+  return open_new_connection(url_info);
+}
+
+void connection_pool_release(PooledConnection* connection, int reusable) {
+  if (!connection) {
+    return;
+  }
+
+  if (!reusable) {
+    close_pooled_connection(connection);
+    return;
+  }
+
+  // 非阻塞模式使用过的连接恢复为阻塞模式后再放回池中
+  set_socket_nonblocking(pooled_connection_fd(connection), 0);
+
+  pthread_mutex_lock(&pool_mutex);
+  if (idle_count >= POOL_MAX_IDLE_CONNECTIONS) {
+    pthread_mutex_unlock(&pool_mutex);
+    close_pooled_connection(connection);
+    return;
+  }
+
+  connection->last_used = time(NULL);
+  connection->next = idle_connections;
+  idle_connections = connection;
+  idle_count++;
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+int pooled_connection_send(PooledConnection* connection, const char* buffer, size_t length) {
+  if (!connection || !buffer) {
+    return -1;
+  }
+
+#ifdef WITH_OPENSSL
+  if (connection->https_connection) {
+    return ssl_send_data(connection->https_connection, buffer, length);
+  }
+#endif
+  return send_full_data(connection->sockfd, buffer, length);
+}
+
+ssize_t pooled_connection_recv(PooledConnection* connection, void* buffer, size_t length) {
+  if (!connection || !buffer) {
+    return -1;
+  }
+
+#ifdef WITH_OPENSSL
+  if (connection->https_connection) {
+    return ssl_recv_data(connection->https_connection, buffer, length);
+  }
+#endif
+  return recv(connection->sockfd, buffer, length, 0);
+}
+
+static int pooled_connection_parse_headers(PooledConnection* connection, HttpResponseInfo* response_info, HttpReadBuffer* remaining_buffer) {
+#ifdef WITH_OPENSSL
+  if (connection->https_connection) {
+    return parse_https_response_headers(connection->https_connection, response_info, remaining_buffer);
+  }
+#endif
+  return parse_http_response_headers(connection->sockfd, response_info, remaining_buffer);
+}
+
+int pooled_connection_request(const URLInfo* url_info, const char* request, size_t request_len,
+  PooledConnection** connection, HttpResponseInfo* response_info, HttpReadBuffer* remaining_buffer) {
+  if (!url_info || !request || !connection || !response_info || !remaining_buffer) {
+    return -1;
+  }
+
+  *connection = NULL;
+
+  while (1) {
+    PooledConnection* current = connection_pool_acquire(url_info);
+    if (!current) {
+      return -1;
+    }
+
+    current->request_count++;
+    if (pooled_connection_send(current, request, request_len) == 0 &&
+      pooled_connection_parse_headers(current, response_info, remaining_buffer) == 0) {
+      *connection = current;
+      return 0;
+    }
+
+    int was_reused = current->reused;
+    connection_pool_release(current, 0);
+    if (!was_reused) {
+      return -1;
+    }
+
+    // 复用的连接已被服务器关闭，换一个连接重发
+    pthread_mutex_lock(&pool_mutex);
+    pool_stats.stale_retries++;
+    pthread_mutex_unlock(&pool_mutex);
+  }
+}
+
+int pooled_connection_drain(PooledConnection* connection, HttpReadBuffer* remaining_buffer, long long length) {
+  if (!connection || length < 0) {
+    return -1;
+  }
+
+  long long remaining = length;
+
+  // 先消耗响应头之后已读入缓冲区的数据
+  if (remaining_buffer && remaining_buffer->parse_position < remaining_buffer->data_length) {
+    long long buffered = remaining_buffer->data_length - remaining_buffer->parse_position;
+    if (buffered > remaining) {
+      return -1; // 多出的数据不属于本响应，连接状态未知
+    }
+    remaining -= buffered;
+    remaining_buffer->parse_position = remaining_buffer->data_length;
+  }
+
+  char buffer[READ_BUFFER_SIZE];
+  while (remaining > 0) {
+    size_t bytes_to_read = remaining < (long long)sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+    ssize_t bytes_received = pooled_connection_recv(connection, buffer, bytes_to_read);
+    if (bytes_received <= 0) {
+      return -1;
+    }
+    remaining -= bytes_received;
+  }
+
+  return 0;
+}
+
+void connection_pool_evict_idle() {
+  pthread_mutex_lock(&pool_mutex);
+  PooledConnection* expired = detach_expired_locked(time(NULL));
+  pthread_mutex_unlock(&pool_mutex);
+
+  close_connection_list(expired);
+}
+
+void connection_pool_get_stats(ConnectionPoolStats* stats) {
+  if (!stats) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool_mutex);
+  *stats = pool_stats;
+  stats->idle_connections = idle_count;
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+void connection_pool_cleanup() {
+  pthread_mutex_lock(&pool_mutex);
+  PooledConnection* list = idle_connections;
+  idle_connections = NULL;
+  idle_count = 0;
+  pthread_mutex_unlock(&pool_mutex);
+
+  close_connection_list(list);
+}
@@ -0,0 +1,385 @@
+#include "../include/common.h"
+#include "../include/ratelimit.h"
+#include "../include/utils.h"
+#include "../include/config.h"
+
+// CLI颜色定义
+static const char* CYAN = "\033[36m";
+static const char* RED = "\033[31m";
+static const char* RESET = "\033[0m";
+
+// 单独限速的主机
+typedef struct {
+  char host[256];             // 主机名
+  RateBucket bucket;          // 该主机的令牌桶
+} HostRateLimit;
+
+static RateBucket global_bucket;
+static HostRateLimit host_limits[RATE_LIMIT_MAX_HOSTS];
+static _Atomic int host_limit_count = 0;
+static pthread_mutex_t host_limit_mutex = PTHREAD_MUTEX_INITIALIZER; // 新增主机时使用，查找不加锁
+static _Atomic long long download_rate = 0;
+
+static char control_path[PATH_MAX];
+static _Atomic long long control_mtime_ns = 0;  // 最近一次读取时控制文件的修改时间
+static _Atomic long long control_checked_ns = 0; // 最近一次检查控制文件的时间
+
+static long long monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+long long ratelimit_parse_rate(const char* text) {
+  if (!text) {
+    return -1;
+  }
+
+  char* end = NULL;
+  double value = strtod(text, &end);
+  if (end == text || value < 0) {
+    return -1;
+  }
+
+  switch (toupper((unsigned char)*end)) {
+  case 'K':
+    value *= 1024;
+    end++;
+    break;
+  case 'M':
+    value *= 1024 * 1024;
+    end++;
+    break;
+  case 'G':
+    value *= 1024.0 * 1024 * 1024;
+    end++;
+    break;
+  default:
+    break;
+  }
+  return *end == '\0' ? (long long)value : -1;
+}
+
+void ratelimit_set_global(long long rate) {
+  atomic_store(&global_bucket.rate, rate);
+}
+
+// 查找主机的令牌桶（不加锁：条目写好后才增加计数，已有条目不会移动）
+static RateBucket* find_host_bucket(const char* host) {
+  int count = atomic_load(&host_limit_count);
+  for (int i = 0; i < count; i++) {
+    if (strcasecmp(host_limits[i].host, host) == 0) {
+      return &host_limits[i].bucket;
+    }
+  }
+  return NULL;
+}
+
+int ratelimit_set_host(const char* host, long long rate) {
+  pthread_mutex_lock(&host_limit_mutex);
+  RateBucket* bucket = find_host_bucket(host);
+  if (!bucket) {
+    int count = atomic_load(&host_limit_count);
+    if (count >= RATE_LIMIT_MAX_HOSTS) {
+      pthread_mutex_unlock(&host_limit_mutex);
+      return -1;
+    }
+    snprintf(host_limits[count].host, sizeof(host_limits[count].host), "%s", host);
+    bucket = &host_limits[count].bucket;
+    atomic_store(&host_limit_count, count + 1);
+  }
+  atomic_store(&bucket->rate, rate);
+  pthread_mutex_unlock(&host_limit_mutex);
+  return 0;
+}
+
+void ratelimit_set_download(long long rate) {
+  atomic_store(&download_rate, rate);
+}
+
+// 读取控制文件，每行一条设置；文件中没有出现的设置保持不变
+static int load_control_file() {
+  FILE* file = fopen(control_path, "r");
+  if (!file) {
+    fprintf(stderr, "%s错误: 无法读取限速控制文件 %s%s\n", RED, control_path, RESET);
+    return -1;
+  }
+
+  int result = 0;
+  int line_number = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char key[16];
+    char first[256];
+    char second[64];
+    int fields = sscanf(line, "%15s %255s %63s", key, first, second);
+    if (fields <= 0) {
+      continue;
+    }
+
+    long long rate = -1;
+    if (strcmp(key, "global") == 0 && fields == 2 && (rate = ratelimit_parse_rate(first)) >= 0) {
+      ratelimit_set_global(rate);
+    }
+    else if (strcmp(key, "download") == 0 && fields == 2 && (rate = ratelimit_parse_rate(first)) >= 0) {
+      ratelimit_set_download(rate);
+    }
+    else if (strcmp(key, "host") == 0 && fields == 3 && (rate = ratelimit_parse_rate(second)) >= 0 &&
+      ratelimit_set_host(first, rate) == 0) {
+      continue;
+    }
+    else {
+      fprintf(stderr, "%s错误: 限速控制文件第 %d 行无效%s\n", RED, line_number, RESET);
+      result = -1;
+    }
+  }
+
+  fclose(file);
+  return result;
+}
+
+int ratelimit_set_control_file(const char* path) {
+  snprintf(control_path, sizeof(control_path), "%s", path);
+
+  struct stat st;
+  if (stat(control_path, &st) == 0) {
+    atomic_store(&control_mtime_ns, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+  }
+  atomic_store(&control_checked_ns, monotonic_ns());
+  return load_control_file();
+}
+
+// 下载过程中检查控制文件是否被修改（同一时刻只有一个线程检查）
+static void poll_control_file() {
+  if (!control_path[0]) {
+    return;
+  }
+
+  long long now = monotonic_ns();
+  long long checked = atomic_load(&control_checked_ns);
+  if (now - checked < RATE_LIMIT_POLL_MS * 1000000LL ||
+    !atomic_compare_exchange_strong(&control_checked_ns, &checked, now)) {
+    return;
+  }
+
+  struct stat st;
+  if (stat(control_path, &st) != 0) {
+    return;
+  }
+  long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  if (mtime == atomic_load(&control_mtime_ns)) {
+    return;
+  }
+  atomic_store(&control_mtime_ns, mtime);
+
+  if (load_control_file() == 0) {
+    long long global = atomic_load(&global_bucket.rate);
+    long long download = atomic_load(&download_rate);
+    char global_text[32];
+    char download_text[32];
+    snprintf(global_text, sizeof(global_text), "%s/s", format_file_size(global));
+    snprintf(download_text, sizeof(download_text), "%s/s", format_file_size(download));
+    printf("\n%s限速已更新: 全局 %s, 每个下载 %s%s\n", CYAN, global > 0 ? global_text : "不限",
+      download > 0 ? download_text : "不限", RESET);
+  }
+}
+
+int ratelimit_enabled() {
+  if (control_path[0] || atomic_load(&global_bucket.rate) > 0 || atomic_load(&download_rate) > 0) {
+    return 1;
+  }
+  int count = atomic_load(&host_limit_count);
+  for (int i = 0; i < count; i++) {
+    if (atomic_load(&host_limits[i].bucket.rate) > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void ratelimit_init(RateLimiter* limiter, const char* host, RateBucket* download) {
+  limiter->host = host ? find_host_bucket(host) : NULL;
+  limiter->download = download;
+}
+
+// 令牌桶容量：RATE_LIMIT_BURST_MS 的数据量
+static long long bucket_burst(long long rate) {
+  long long burst = rate * RATE_LIMIT_BURST_MS / 1000;
+  return burst > RATE_LIMIT_MIN_SLICE ? burst : RATE_LIMIT_MIN_SLICE;
+}
+
+// 按经过的时间补充令牌。只有成功把补充时间向前推进的线程加入令牌，并发的线程不会重复补充
+static void bucket_refill(RateBucket* bucket, long long rate, long long now_ns) {
+  long long last = atomic_load(&bucket->refill_ns);
+  long long elapsed = now_ns - last;
+  if (elapsed <= 0) {
+    return;
+  }
+
+  long long added;
+  long long advanced;
+  if (elapsed >= 1000000000LL) {
+    // 空闲超过1秒（或首次使用）：补满一秒的量，超出容量的部分下面会被截掉
+    added = rate;
+    advanced = now_ns;
+  }
+  else {
+    added = (long long)((double)elapsed * rate / 1e9);
+    if (added <= 0) {
+      return;
+    }
+    advanced = last + (long long)((double)added * 1e9 / rate); // 不足一个字节的时间留给下次补充
+  }
+
+  if (!atomic_compare_exchange_strong(&bucket->refill_ns, &last, advanced)) {
+    return;
+  }
+
+  long long burst = bucket_burst(rate);
+  long long tokens = atomic_fetch_add(&bucket->tokens, added) + added;
+  while (tokens > burst && !atomic_compare_exchange_weak(&bucket->tokens, &tokens, burst)) {
+  }
+}
+
+// 收集限速器生效的令牌桶，返回数量
+static int active_buckets(RateLimiter* limiter, RateBucket* buckets[3], long long rates[3]) {
+  RateBucket* candidates[3] = { &global_bucket, limiter ? limiter->host : NULL, limiter ? limiter->download : NULL };
+
+  // 每个下载的速率可以在下载过程中修改，使用前同步到下载的令牌桶
+  if (limiter && limiter->download) {
+    atomic_store(&limiter->download->rate, atomic_load(&download_rate));
+  }
+
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    long long rate = candidates[i] ? atomic_load(&candidates[i]->rate) : 0;
+    if (rate > 0) {
+      buckets[count] = candidates[i];
+      rates[count] = rate;
+      count++;
+    }
+  }
+  return count;
+}
+
+long long ratelimit_low_speed_limit(RateLimiter* limiter, int connections) {
+  long long limit = get_download_options()->low_speed_limit;
+  if (limit <= 0) {
+    return 0;
+  }
+
+  RateBucket* buckets[3];
+  long long rates[3];
+  int count = active_buckets(limiter, buckets, rates);
+  for (int i = 0; i < count; i++) {
+    long long share = rates[i] / (connections > 1 ? connections : 1) / 2;
+    if (share < limit) {
+      limit = share;
+    }
+  }
+  return limit > 0 ? limit : 1;
+}
+
+// 每次最多取一个时间片的令牌，接收调用不会因为一次取太多而长时间等待
+static size_t slice_grant(const long long* rates, int count, size_t wanted) {
+  size_t granted = wanted;
+  for (int i = 0; i < count; i++) {
+    long long slice = rates[i] * RATE_LIMIT_SLICE_MS / 1000;
+    if (slice < RATE_LIMIT_MIN_SLICE) {
+      slice = RATE_LIMIT_MIN_SLICE;
+    }
+    if ((long long)granted > slice) {
+      granted = (size_t)slice;
+    }
+  }
+  return granted;
+}
+
+size_t ratelimit_acquire(RateLimiter* limiter, size_t wanted) {
+  poll_control_file();
+
+  RateBucket* buckets[3];
+  long long rates[3];
+  int count = active_buckets(limiter, buckets, rates);
+  if (count == 0) {
+    return wanted;
+  }
+  size_t granted = slice_grant(rates, count, wanted);
+
+  // 先预支令牌，令牌不足时等到欠下的令牌补回来
+  long long now = monotonic_ns();
+  long long wait_ns = 0;
+  for (int i = 0; i < count; i++) {
+    bucket_refill(buckets[i], rates[i], now);
+    long long left = atomic_fetch_sub(&buckets[i]->tokens, (long long)granted) - (long long)granted;
+    if (left < 0) {
+      long long wait = (long long)((double)-left * 1e9 / rates[i]);
+      if (wait > wait_ns) {
+        wait_ns = wait;
+      }
+    }
+  }
+
+  if (wait_ns > 0) {
+    struct timespec delay = { wait_ns / 1000000000LL, wait_ns % 1000000000LL };
+    nanosleep(&delay, NULL);
+  }
+  return granted;
+}
+
+size_t ratelimit_try_acquire(RateLimiter* limiter, size_t wanted, int* wait_ms) {
+  poll_control_file();
+  *wait_ms = 0;
+
+  RateBucket* buckets[3];
+  long long rates[3];
+  int count = active_buckets(limiter, buckets, rates);
+  if (count == 0) {
+    return wanted;
+  }
+
+  // 任一令牌桶还欠着令牌时不取，返回补回欠款需要的时间
+  long long now = monotonic_ns();
+  long long wait_ns = 0;
+  for (int i = 0; i < count; i++) {
+    bucket_refill(buckets[i], rates[i], now);
+    long long tokens = atomic_load(&buckets[i]->tokens);
+    if (tokens < 0) {
+      long long wait = (long long)((double)-tokens * 1e9 / rates[i]);
+      if (wait > wait_ns) {
+        wait_ns = wait;
+      }
+    }
+  }
+  if (wait_ns > 0) {
+    *wait_ms = (int)((wait_ns + 999999) / 1000000);
+    return 0;
+  }
+
+  // 和 ratelimit_acquire 一样预支一个时间片，欠下的令牌由下一次调用等待
+  size_t granted = slice_grant(rates, count, wanted);
+  for (int i = 0; i < count; i++) {
+    atomic_fetch_sub(&buckets[i]->tokens, (long long)granted);
+  }
+  return granted;
+}
+
+void ratelimit_refund(RateLimiter* limiter, size_t granted, ssize_t received) {
+  long long unused = (long long)granted - (received > 0 ? received : 0);
+  if (unused <= 0) {
+    return;
+  }
+
+  RateBucket* buckets[3];
+  long long rates[3];
+  int count = active_buckets(limiter, buckets, rates);
+  for (int i = 0; i < count; i++) {
+    atomic_fetch_add(&buckets[i]->tokens, unused);
+  }
+}
@@ -0,0 +1,198 @@
+#include "../include/common.h"
+#include "../include/redirect.h"
+
+#define REDIRECT_CACHE_LINE_SIZE (2 * 2048 + 64) // 一条缓存记录：过期时间 原始URL 目标URL
+
+int resolve_redirect_location(const char* base_url, const char* location, char* output, size_t output_size) {
+  if (!base_url || !location || !location[0]) {
+    return -1;
+  }
+
+  // 绝对 URL：scheme://...
+  const char* p = location;
+  while (isalnum((unsigned char)*p) || *p == '+' || *p == '-' || *p == '.') {
+    p++;
+  }
+  if (p > location && strncmp(p, "://", 3) == 0) {
+    return snprintf(output, output_size, "%s", location) < (int)output_size ? 0 : -1;
+  }
+
+  const char* scheme_end = strstr(base_url, "://");
+  if (!scheme_end) {
+    return -1;
+  }
+  const char* authority = scheme_end + 3;
+  const char* authority_end = authority + strcspn(authority, "/?#");
+  int written;
+
+  if (strncmp(location, "//", 2) == 0) {
+    // 省略协议：沿用原请求的协议
+    written = snprintf(output, output_size, "%.*s:%s", (int)(scheme_end - base_url), base_url, location);
+  }
+  else if (location[0] == '/') {
+    // 绝对路径：沿用原请求的协议和主机
+    written = snprintf(output, output_size, "%.*s%s", (int)(authority_end - base_url), base_url, location);
+  }
+  else {
+    // 相对路径：相对于原请求路径的目录
+    const char* path_end = authority_end + strcspn(authority_end, "?#");
+    const char* directory_end = authority_end;
+    for (const char* c = authority_end; c < path_end; c++) {
+      if (*c == '/') {
+        directory_end = c + 1;
+      }
+    }
+    if (directory_end == authority_end) {
+      written = snprintf(output, output_size, "%.*s/%s", (int)(authority_end - base_url), base_url, location);
+    }
+    else {
+      written = snprintf(output, output_size, "%.*s%s", (int)(directory_end - base_url), base_url, location);
+    }
+  }
+
+  return written > 0 && written < (int)output_size ? 0 : -1;
+}
+
+// 缓存文件路径：$XDG_CACHE_HOME/chttpdownloader/redirects 或 ~/.cache/chttpdownloader/redirects
+static int redirect_cache_path(char* path, size_t path_size, int create_directory) {
+  char directory[PATH_MAX];
+  const char* cache_home = getenv("XDG_CACHE_HOME");
+
+  if (cache_home && cache_home[0]) {
+    if (create_directory) {
+      mkdir(cache_home, 0700);
+    }
+    snprintf(directory, sizeof(directory), "%s/chttpdownloader", cache_home);
+  }
+  else {
+    const char* home = getenv("HOME");
+    if (!home || !home[0]) {
+      return -1;
+    }
+    snprintf(directory, sizeof(directory), "%s/.cache", home);
+    if (create_directory) {
+      mkdir(directory, 0700);
+    }
+    snprintf(directory, sizeof(directory), "%s/.cache/chttpdownloader", home);
+  }
+
+  if (create_directory && mkdir(directory, 0700) != 0 && errno != EEXIST) {
+    return -1;
+  }
+  return snprintf(path, path_size, "%s/redirects", directory) < (int)path_size ? 0 : -1;
+}
+
+// 解析一行缓存记录，格式为 "过期时间 原始URL 目标URL"；成功返回0
+static int parse_cache_line(char* line, long long* expires, char** url, char** target) {
+  char* save = NULL;
+  char* expires_field = strtok_r(line, " \n", &save);
+  *url = strtok_r(NULL, " \n", &save);
+  *target = strtok_r(NULL, " \n", &save);
+  if (!expires_field || !*url || !*target) {
+    return -1;
+  }
+  *expires = atoll(expires_field);
+  return 0;
+}
+
+int redirect_cache_lookup(const char* url, char* target, size_t target_size) {
+  char path[PATH_MAX];
+  if (redirect_cache_path(path, sizeof(path), 0) != 0) {
+    return -1;
+  }
+
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    return -1;
+  }
+
+  int found = -1;
+  long long now = (long long)time(NULL);
+  char line[REDIRECT_CACHE_LINE_SIZE];
+  while (fgets(line, sizeof(line), file)) {
+    long long expires;
+    char* entry_url;
+    char* entry_target;
+    if (parse_cache_line(line, &expires, &entry_url, &entry_target) == 0 &&
+      expires > now && strcmp(entry_url, url) == 0 &&
+      snprintf(target, target_size, "%s", entry_target) < (int)target_size) {
+      found = 0; // 后写入的记录覆盖先写入的
+    }
+  }
+
+  fclose(file);
+  return found;
+}
+
+// 重写缓存文件：丢弃过期条目和 url 的旧条目，可选追加一条新记录，超出容量时丢弃最旧的条目
+static void redirect_cache_rewrite(const char* url, const char* target) {
+  char path[PATH_MAX];
+  if (redirect_cache_path(path, sizeof(path), target != NULL) != 0) {
+    return;
+  }
+
+  char (*lines)[REDIRECT_CACHE_LINE_SIZE] = malloc(sizeof(*lines) * REDIRECT_CACHE_MAX_ENTRIES);
+  if (!lines) {
+    return;
+  }
+
+  // 保留仍然有效的条目（环形保存最新的 REDIRECT_CACHE_MAX_ENTRIES - 1 条）
+  int kept = 0;
+  int capacity = target ? REDIRECT_CACHE_MAX_ENTRIES - 1 : REDIRECT_CACHE_MAX_ENTRIES;
+  long long now = (long long)time(NULL);
+  FILE* input = fopen(path, "r");
+  if (input) {
+    char line[REDIRECT_CACHE_LINE_SIZE];
+    char parsed[REDIRECT_CACHE_LINE_SIZE];
+    while (fgets(line, sizeof(line), input)) {
+      long long expires;
+      char* entry_url;
+      char* entry_target;
+      memcpy(parsed, line, sizeof(parsed));
+      if (parse_cache_line(parsed, &expires, &entry_url, &entry_target) != 0 ||
+        expires <= now || strcmp(entry_url, url) == 0) {
+        continue;
+      }
+      snprintf(lines[kept % capacity], REDIRECT_CACHE_LINE_SIZE, "%lld %s %s\n", expires, entry_url, entry_target);
+      kept++;
+    }
+    fclose(input);
+  }
+
+  // 先写临时文件再重命名，其他进程不会读到写了一半的缓存
+  char temp_path[PATH_MAX + 32];
+  snprintf(temp_path, sizeof(temp_path), "%s.%d", path, (int)getpid());
+  FILE* output = fopen(temp_path, "w");
+  if (!output) {
+    free(lines);
+    return;
+  }
+
+  int count = kept < capacity ? kept : capacity;
+  for (int i = 0; i < count; i++) {
+    fputs(lines[(kept - count + i) % capacity], output);
+  }
+  if (target) {
+    fprintf(output, "%lld %s %s\n", now + REDIRECT_CACHE_TTL, url, target);
+  }
+
+  if (fclose(output) != 0 || rename(temp_path, path) != 0) {
+    unlink(temp_path);
+  }
+  free(lines);
+}
+
+void redirect_cache_store(const char* url, const char* target) {
+  // URL 中不应出现空白，含空白的地址不缓存，避免破坏记录格式
+  if (!url || !target || strpbrk(url, " \t\r\n") || strpbrk(target, " \t\r\n")) {
+    return;
+  }
+  redirect_cache_rewrite(url, target);
+}
+
+void redirect_cache_remove(const char* url) {
+  char target[2048];
+  if (url && redirect_cache_lookup(url, target, sizeof(target)) == 0) {
+    redirect_cache_rewrite(url, NULL);
+  }
+}
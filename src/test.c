@@ -1,6 +1,12 @@
 #include "../include/common.h"
 #include "../include/parser.h"
 #include "../include/download.h"
+#include "../include/multithread.h"
+#include "../include/config.h"
+#include "../include/uring.h"
+#include "../include/utils.h"
+#include <sys/resource.h>
+#include <sys/mman.h>
 
 void url_parse_test() {
   const char* test_urls[] = {
@@ -61,4 +67,165 @@ void download_test() {
     printf("----------------------------下载完成----------------------------\n");
     free(info);
   }
-}
\ No newline at end of file
+}
+
+static double timeval_to_seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// 文件当前留在页缓存中的字节数（mincore 统计映射后驻留内存的页），失败返回-1
+static long long file_cached_bytes(const char* path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return file_stat.st_size == 0 ? 0 : -1;
+  }
+
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t page_count = (file_stat.st_size + page_size - 1) / page_size;
+  void* mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  unsigned char* residency = malloc(page_count);
+  long long cached = -1;
+  if (residency && mincore(mapping, file_stat.st_size, residency) == 0) {
+    cached = 0;
+    for (size_t i = 0; i < page_count; i++) {
+      if (residency[i] & 1) {
+        cached += page_size;
+      }
+    }
+  }
+  free(residency);
+  munmap(mapping, file_stat.st_size);
+  return cached;
+}
+
+// 系统页缓存的总大小（/proc/meminfo 的 Cached），失败返回-1
+static long long system_cached_bytes() {
+  FILE* file = fopen("/proc/meminfo", "r");
+  if (!file) {
+    return -1;
+  }
+  char line[256];
+  long long cached = -1;
+  while (fgets(line, sizeof(line), file)) {
+    long long kilobytes;
+    if (sscanf(line, "Cached: %lld kB", &kilobytes) == 1) {
+      cached = kilobytes * 1024;
+      break;
+    }
+  }
+  fclose(file);
+  return cached;
+}
+
+int download_benchmark(const char* url, int thread_count) {
+  // CLI颜色定义
+  const char* CYAN = "\033[36m";
+  const char* YELLOW = "\033[33m";
+  const char* RESET = "\033[0m";
+  const char* BOLD = "\033[1m";
+
+  // 参与比较的 I/O 后端（writer 为 recv 加写入线程合并写入，stdio 由下载线程直接 fwrite，
+  // direct 为写入线程以 O_DIRECT 写入）
+  struct {
+    const char* name;
+    IoBackend backend;
+    long long write_buffer;
+    int direct_io;
+    int available;
+    int result;
+    double wall_seconds;
+    double user_seconds;
+    double system_seconds;
+    long long file_size;
+    long long file_cached;      // 下载完成后输出文件留在页缓存中的字节数
+    long long cached_growth;    // 下载前后系统页缓存的增长
+  } cases[] = {
+    { .name = "stdio", .backend = IO_BACKEND_STDIO, .available = 1 },
+    { .name = "writer", .backend = IO_BACKEND_STDIO, .write_buffer = WRITE_BUFFER_DEFAULT, .available = 1 },
+    { .name = "direct", .backend = IO_BACKEND_STDIO, .write_buffer = WRITE_BUFFER_DEFAULT, .direct_io = 1, .available = 1 },
+    { .name = "io_uring", .backend = IO_BACKEND_URING, .available = uring_available() },
+    { .name = "splice", .backend = IO_BACKEND_SPLICE, .available = 1 },
+  };
+  const int case_count = sizeof(cases) / sizeof(cases[0]);
+
+  DownloadOptions* options = get_download_options();
+  IoBackend saved_backend = options->io_backend;
+  long long saved_write_buffer = options->write_buffer;
+  int saved_direct_io = options->direct_io;
+  const char* output_filename = "CHttpDownloader_benchmark.bin";
+
+  for (int i = 0; i < case_count; i++) {
+    if (!cases[i].available) {
+      printf("%s跳过 %s: 当前内核不可用%s\n", YELLOW, cases[i].name, RESET);
+      continue;
+    }
+
+    printf("\n%s%s=== 基准测试: %s ===%s\n", BOLD, CYAN, cases[i].name, RESET);
+    options->io_backend = cases[i].backend;
+    options->write_buffer = cases[i].write_buffer;
+    options->direct_io = cases[i].direct_io;
+
+    MultiThreadDownloader* downloader = create_multithread_downloader(url, output_filename, NULL, thread_count);
+    if (!downloader) {
+      cases[i].result = -1;
+      continue;
+    }
+
+    struct rusage usage_before, usage_after;
+    getrusage(RUSAGE_SELF, &usage_before);
+    long long cached_before = system_cached_bytes();
+    double start_ms = get_monotonic_ms();
+
+    cases[i].result = multithread_download(downloader);
+
+    cases[i].wall_seconds = (get_monotonic_ms() - start_ms) / 1000.0;
+    getrusage(RUSAGE_SELF, &usage_after);
+    cases[i].user_seconds = timeval_to_seconds(usage_after.ru_utime) - timeval_to_seconds(usage_before.ru_utime);
+    cases[i].system_seconds = timeval_to_seconds(usage_after.ru_stime) - timeval_to_seconds(usage_before.ru_stime);
+    cases[i].file_size = downloader->file_size;
+    cases[i].file_cached = file_cached_bytes(output_filename);
+    long long cached_after = system_cached_bytes();
+    cases[i].cached_growth = cached_before >= 0 && cached_after >= 0 ? cached_after - cached_before : 0;
+
+    destroy_multithread_downloader(downloader);
+    unlink(output_filename);
+  }
+
+  options->io_backend = saved_backend;
+  options->write_buffer = saved_write_buffer;
+  options->direct_io = saved_direct_io;
+
+  printf("\n%s%s=== 基准测试结果 (%d 线程) ===%s\n", BOLD, CYAN, thread_count, RESET);
+  printf("%-10s %10s %12s %10s %10s %12s %14s %14s\n", "后端", "耗时(s)", "吞吐(MB/s)", "用户CPU(s)", "系统CPU(s)",
+    "CPU(s)/GB", "文件页缓存(MB)", "页缓存增长(MB)");
+  for (int i = 0; i < case_count; i++) {
+    if (!cases[i].available) {
+      printf("%-10s %10s\n", cases[i].name, "不可用");
+      continue;
+    }
+    if (cases[i].result != 0 || cases[i].file_size <= 0) {
+      printf("%-10s %10s\n", cases[i].name, "失败");
+      continue;
+    }
+
+    double megabytes = cases[i].file_size / (1024.0 * 1024.0);
+    double cpu_seconds = cases[i].user_seconds + cases[i].system_seconds;
+    printf("%-10s %10.2f %12.2f %10.2f %10.2f %12.2f %14.2f %14.2f\n", cases[i].name,
+      cases[i].wall_seconds,
+      cases[i].wall_seconds > 0 ? megabytes / cases[i].wall_seconds : 0.0,
+      cases[i].user_seconds, cases[i].system_seconds,
+      cpu_seconds * 1024.0 / megabytes,
+      cases[i].file_cached / (1024.0 * 1024.0), cases[i].cached_growth / (1024.0 * 1024.0));
+  }
+
+  return 0;
+}
@@ -0,0 +1,230 @@
+#include "../include/common.h"
+#include "../include/uring.h"
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t arg_size) {
+  return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned int opcode, const void* arg, unsigned int nr_args) {
+  return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+int uring_available() {
+  static int available = -1;
+
+  if (available < 0) {
+    IoUring ring;
+    available = uring_init(&ring, 2) == 0;
+    if (available) {
+      uring_destroy(&ring);
+    }
+  }
+  return available;
+}
+
+int uring_init(IoUring* ring, unsigned int entries) {
+  if (!ring) {
+    return -EINVAL;
+  }
+
+  memset(ring, 0, sizeof(IoUring));
+  ring->ring_fd = -1;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int ring_fd = sys_io_uring_setup(entries, &params);
+  if (ring_fd < 0) {
+    return -errno;
+  }
+
+  ring->ring_fd = ring_fd;
+  ring->features = params.features;
+  ring->sq_entries = params.sq_entries;
+
+  // 映射提交队列和完成队列（新内核可以共用一个映射）
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  ring->sq_ring_ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring_ptr == MAP_FAILED) {
+    int error = errno;
+    close(ring_fd);
+    ring->ring_fd = -1;
+    return -error;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring_ptr = ring->sq_ring_ptr;
+  }
+  else {
+    ring->cq_ring_ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring_ptr == MAP_FAILED) {
+      int error = errno;
+      munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+      close(ring_fd);
+      ring->ring_fd = -1;
+      return -error;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    int error = errno;
+    if (ring->cq_ring_ptr != ring->sq_ring_ptr) {
+      munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    close(ring_fd);
+    ring->ring_fd = -1;
+    return -error;
+  }
+
+  char* sq_ptr = ring->sq_ring_ptr;
+  ring->sq_head = (unsigned int*)(sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned int*)(sq_ptr + params.sq_off.tail);
+  ring->sq_mask = (unsigned int*)(sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int*)(sq_ptr + params.sq_off.array);
+
+  char* cq_ptr = ring->cq_ring_ptr;
+  ring->cq_head = (unsigned int*)(cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned int*)(cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (unsigned int*)(cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+
+  ring->sqe_head = ring->sqe_tail = *ring->sq_tail;
+  return 0;
+}
+
+void uring_destroy(IoUring* ring) {
+  if (!ring || ring->ring_fd < 0) {
+    return;
+  }
+
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring_ptr != ring->sq_ring_ptr) {
+    munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+  }
+  munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+  close(ring->ring_fd);
+  ring->ring_fd = -1;
+}
+
+int uring_register_buffers(IoUring* ring, const struct iovec* iovecs, unsigned int count) {
+  if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, count) < 0) {
+    return -errno;
+  }
+  return 0;
+}
+
+struct io_uring_sqe* uring_get_sqe(IoUring* ring) {
+  unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sqe_tail - head >= ring->sq_entries) {
+    return NULL; // 提交队列已满
+  }
+
+  struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+// 把本地填写的提交项发布到提交队列，返回发布的数量
+static unsigned int uring_flush_sq(IoUring* ring) {
+  unsigned int tail = *ring->sq_tail;
+  unsigned int to_submit = ring->sqe_tail - ring->sqe_head;
+
+  while (ring->sqe_head != ring->sqe_tail) {
+    ring->sq_array[tail & *ring->sq_mask] = ring->sqe_head & *ring->sq_mask;
+    tail++;
+    ring->sqe_head++;
+  }
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  return to_submit;
+}
+
+int uring_submit_and_wait(IoUring* ring, unsigned int wait_nr, int timeout_ms) {
+  unsigned int to_submit = uring_flush_sq(ring);
+  unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  void* arg = NULL;
+  size_t arg_size = 0;
+
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg getevents_arg;
+  if (wait_nr > 0 && timeout_ms >= 0 && (ring->features & IORING_FEAT_EXT_ARG)) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    memset(&getevents_arg, 0, sizeof(getevents_arg));
+    getevents_arg.ts = (unsigned long long)(uintptr_t)&timeout;
+    flags |= IORING_ENTER_EXT_ARG;
+    arg = &getevents_arg;
+    arg_size = sizeof(getevents_arg);
+  }
+
+  int result;
+  do {
+    result = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags, arg, arg_size);
+  } while (result < 0 && errno == EINTR && to_submit == 0);
+
+  if (result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+int uring_peek_cqe(IoUring* ring, struct io_uring_cqe** cqe) {
+  unsigned int head = *ring->cq_head;
+  unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return 0;
+  }
+
+  *cqe = &ring->cqes[head & *ring->cq_mask];
+  return 1;
+}
+
+void uring_cqe_seen(IoUring* ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_prep_recv(struct io_uring_sqe* sqe, int sockfd, void* buffer, size_t length, int flags) {
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sockfd;
+  sqe->addr = (unsigned long long)(uintptr_t)buffer;
+  sqe->len = (unsigned int)length;
+  sqe->msg_flags = (unsigned int)flags;
+}
+
+void uring_prep_write_fixed(struct io_uring_sqe* sqe, int fd, const void* buffer, size_t length, long long offset, int buffer_index) {
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long long)(uintptr_t)buffer;
+  sqe->len = (unsigned int)length;
+  sqe->off = (unsigned long long)offset;
+  sqe->buf_index = (unsigned short)buffer_index;
+}
+
+void uring_prep_cancel(struct io_uring_sqe* sqe, unsigned long long user_data) {
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+}
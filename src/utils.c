@@ -33,4 +33,28 @@ char* format_time(int seconds) {
   }
 
   return buffer;
-}
\ No newline at end of file
+}
+
+double get_monotonic_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+int retry_backoff_ms(int retry) {
+  if (retry <= 1) {
+    return 0;
+  }
+
+  int delay = RETRY_MAX_DELAY_MS;
+  if (retry - 2 < 16 && (RETRY_BASE_DELAY_MS << (retry - 2)) < RETRY_MAX_DELAY_MS) {
+    delay = RETRY_BASE_DELAY_MS << (retry - 2);
+  }
+
+  // 每个线程独立的随机数种子
+  static _Thread_local unsigned int seed = 0;
+  if (seed == 0) {
+    seed = (unsigned int)get_monotonic_ms() ^ (unsigned int)(size_t)&seed;
+  }
+  return delay / 2 + rand_r(&seed) % (delay / 2 + 1);
+}
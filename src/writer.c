@@ -0,0 +1,374 @@
+#include "../include/common.h"
+#include "../include/writer.h"
+#include "../include/utils.h"
+#include <sys/uio.h>
+
+// 队列中是否有尚未写出的块（调用者持有 mutex 或只做提示性检查）
+static int rings_pending(AsyncWriter* writer) {
+  for (int i = 0; i < writer->ring_count; i++) {
+    WriteRing* ring = &writer->rings[i];
+    if (atomic_load(&ring->tail) != atomic_load(&ring->head)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 把缓冲块放回空闲链表，唤醒等待空闲块的网络线程（调用者持有 mutex）
+static void release_block_locked(AsyncWriter* writer, char* data) {
+  writer->free_blocks[writer->free_count++] = data;
+  if (writer->waiters > 0) {
+    pthread_cond_broadcast(&writer->space_cond);
+  }
+}
+
+// 偏移和长度都按扇区对齐的块才能以直接 I/O 写入（缓冲块本身按页对齐分配）
+static int direct_io_aligned(const WriteBlock* block) {
+  return block->offset % DIRECT_IO_ALIGN == 0 && block->length % DIRECT_IO_ALIGN == 0;
+}
+
+// 文件系统在写入时才拒绝直接 I/O：关闭 O_DIRECT 文件，之后全部经页缓存写入
+static void disable_direct_io(AsyncWriter* writer, int error) {
+  fprintf(stderr, "警告: 直接 I/O 写入失败 (%s)，改用页缓存写入\n", strerror(error));
+  close(writer->direct_fd);
+  writer->direct_fd = -1;
+}
+
+// 从队列尾部取出同一文件上连续的若干块，合并为一次 pwritev 写出
+// 使用直接 I/O 时段首不对齐的块单独经页缓存写出，段尾不对齐的块留到下一批
+// @return 写出的块数，队列为空返回0
+static int write_ring_batch(AsyncWriter* writer, WriteRing* ring) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail == head) {
+    return 0;
+  }
+
+  struct iovec iov[WRITER_MAX_IOV];
+  WriteBlock* first = &ring->blocks[tail % WRITER_RING_SLOTS];
+  int direct = writer->direct_fd >= 0 && direct_io_aligned(first);
+  int count = 0;
+  size_t total = 0;
+  while (tail + count != head && count < WRITER_MAX_IOV) {
+    WriteBlock* block = &ring->blocks[(tail + count) % WRITER_RING_SLOTS];
+    if (count > 0 && (block->fd != first->fd || block->offset != first->offset + (long long)total ||
+      (writer->direct_fd >= 0 && !(direct && direct_io_aligned(block))))) {
+      break;
+    }
+    iov[count].iov_base = block->data;
+    iov[count].iov_len = block->length;
+    total += block->length;
+    count++;
+  }
+
+  // 之前的块已经写入失败时丢弃后续数据，生产者排空队列时会得到错误
+  int error = atomic_load(&ring->error);
+  double start_ms = get_monotonic_ms();
+  struct iovec* vec = iov;
+  int vec_count = count;
+  size_t done = 0;
+  size_t direct_done = 0;
+  while (!error && done < total) {
+    ssize_t written = pwritev(direct ? writer->direct_fd : first->fd, vec, vec_count, first->offset + (off_t)done);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (direct && errno == EINVAL) {
+        disable_direct_io(writer, errno);
+        direct = 0;
+        continue;
+      }
+      error = errno;
+      break;
+    }
+    if (written == 0) {
+      error = EIO;
+      break;
+    }
+    done += written;
+    if (direct) {
+      direct_done += written;
+    }
+
+    // 部分写入：跳过已写完的块，调整当前块的起始位置
+    while (vec_count > 0 && (size_t)written >= vec->iov_len) {
+      written -= vec->iov_len;
+      vec++;
+      vec_count--;
+    }
+    if (vec_count > 0) {
+      vec->iov_base = (char*)vec->iov_base + written;
+      vec->iov_len -= written;
+    }
+  }
+  double end_ms = get_monotonic_ms();
+  if (error) {
+    int expected = 0;
+    atomic_compare_exchange_strong(&ring->error, &expected, error);
+  }
+
+  pthread_mutex_lock(&writer->mutex);
+  double write_ms = end_ms - start_ms;
+  writer->stats.written_bytes += done;
+  writer->stats.direct_bytes += direct_done;
+  writer->stats.write_calls++;
+  writer->stats.blocks += count;
+  writer->stats.write_ms += write_ms;
+  if (write_ms > writer->stats.max_write_ms) {
+    writer->stats.max_write_ms = write_ms;
+  }
+  for (int i = 0; i < count; i++) {
+    WriteBlock* block = &ring->blocks[(tail + i) % WRITER_RING_SLOTS];
+    writer->stats.queue_wait_ms += end_ms - block->commit_ms;
+    if (!error && block->written) {
+      atomic_store(block->written, block->written_value);
+    }
+    release_block_locked(writer, block->data);
+    block->data = NULL;
+  }
+  atomic_fetch_sub(&writer->queued_bytes, (long long)total);
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+  pthread_mutex_unlock(&writer->mutex);
+
+  return count;
+}
+
+// 写入线程：轮流处理各连接的队列，所有队列为空时等待新数据
+static void* writer_thread(void* arg) {
+  AsyncWriter* writer = (AsyncWriter*)arg;
+  int next_ring = 0;
+
+  while (1) {
+    int written = 0;
+    for (int i = 0; i < writer->ring_count; i++) {
+      WriteRing* ring = &writer->rings[(next_ring + i) % writer->ring_count];
+      if (write_ring_batch(writer, ring) > 0) {
+        written = 1;
+      }
+    }
+    next_ring = (next_ring + 1) % writer->ring_count;
+    if (written) {
+      continue;
+    }
+
+    // 先声明空闲再检查队列：生产者放入数据后看到 idle 才会唤醒，二者至少有一方看到对方
+    pthread_mutex_lock(&writer->mutex);
+    atomic_store(&writer->idle, 1);
+    while (!rings_pending(writer) && !writer->stopping) {
+      pthread_cond_wait(&writer->work_cond, &writer->mutex);
+    }
+    atomic_store(&writer->idle, 0);
+    int stop = writer->stopping && !rings_pending(writer);
+    pthread_mutex_unlock(&writer->mutex);
+    if (stop) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+AsyncWriter* async_writer_create(int ring_count, long long budget) {
+  if (ring_count <= 0) {
+    return NULL;
+  }
+
+  AsyncWriter* writer = calloc(1, sizeof(AsyncWriter));
+  if (!writer) {
+    return NULL;
+  }
+
+  long long max_blocks = budget / WRITER_BLOCK_SIZE;
+  writer->max_blocks = max_blocks < 2 ? 2 : (max_blocks > INT_MAX / 2 ? INT_MAX / 2 : (int)max_blocks);
+  writer->rings = calloc(ring_count, sizeof(WriteRing));
+  writer->free_blocks = malloc(sizeof(char*) * writer->max_blocks);
+  if (!writer->rings || !writer->free_blocks) {
+    free(writer->rings);
+    free(writer->free_blocks);
+    free(writer);
+    return NULL;
+  }
+  writer->ring_count = ring_count;
+  writer->direct_fd = -1;
+  writer->stats.budget_bytes = (long long)writer->max_blocks * WRITER_BLOCK_SIZE;
+  for (int i = 0; i < ring_count; i++) {
+    writer->rings[i].writer = writer;
+  }
+
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->work_cond, NULL);
+  pthread_cond_init(&writer->space_cond, NULL);
+
+  if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->work_cond);
+    pthread_cond_destroy(&writer->space_cond);
+    free(writer->rings);
+    free(writer->free_blocks);
+    free(writer);
+    return NULL;
+  }
+
+  return writer;
+}
+
+void async_writer_destroy(AsyncWriter* writer, WriterStats* stats) {
+  if (!writer) {
+    return;
+  }
+
+  pthread_mutex_lock(&writer->mutex);
+  writer->stopping = 1;
+  pthread_cond_signal(&writer->work_cond);
+  pthread_mutex_unlock(&writer->mutex);
+  pthread_join(writer->thread, NULL);
+
+  if (stats) {
+    async_writer_get_stats(writer, stats);
+  }
+
+  // 不对齐的段首段尾经页缓存写入，写回后从页缓存中丢弃
+  if (writer->direct_fd >= 0) {
+    posix_fadvise(writer->direct_fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(writer->direct_fd);
+  }
+
+  for (int i = 0; i < writer->ring_count; i++) {
+    free(writer->rings[i].reserved);
+  }
+  for (int i = 0; i < writer->free_count; i++) {
+    free(writer->free_blocks[i]);
+  }
+  pthread_mutex_destroy(&writer->mutex);
+  pthread_cond_destroy(&writer->work_cond);
+  pthread_cond_destroy(&writer->space_cond);
+  free(writer->rings);
+  free(writer->free_blocks);
+  free(writer);
+}
+
+int async_writer_enable_direct_io(AsyncWriter* writer, const char* path) {
+  int fd = open(path, O_WRONLY | O_DIRECT | O_CLOEXEC);
+  if (fd < 0) {
+    // tmpfs 等文件系统不支持 O_DIRECT，打开时返回 EINVAL
+    fprintf(stderr, "警告: 无法以直接 I/O 打开 %s (%s)，使用页缓存写入\n", path, strerror(errno));
+    return -1;
+  }
+  writer->direct_fd = fd;
+  return 0;
+}
+
+WriteRing* async_writer_ring(AsyncWriter* writer, int index) {
+  return &writer->rings[index];
+}
+
+void async_writer_get_stats(AsyncWriter* writer, WriterStats* stats) {
+  pthread_mutex_lock(&writer->mutex);
+  *stats = writer->stats;
+  pthread_mutex_unlock(&writer->mutex);
+  stats->queued_bytes = atomic_load(&writer->queued_bytes);
+  stats->peak_queued_bytes = atomic_load(&writer->peak_queued_bytes);
+}
+
+char* write_ring_reserve(WriteRing* ring, size_t* capacity) {
+  *capacity = WRITER_BLOCK_SIZE;
+  if (ring->reserved) {
+    return ring->reserved;
+  }
+
+  AsyncWriter* writer = ring->writer;
+  pthread_mutex_lock(&writer->mutex);
+
+  // 本连接的队列已满，或所有缓冲块都在排队：磁盘跟不上网络，等待写入线程腾出空间
+  double wait_start_ms = 0;
+  while (atomic_load(&ring->head) - atomic_load(&ring->tail) >= WRITER_RING_SLOTS ||
+    (writer->free_count == 0 && writer->allocated_blocks >= writer->max_blocks)) {
+    if (wait_start_ms == 0) {
+      wait_start_ms = get_monotonic_ms();
+      writer->stats.backpressure_waits++;
+    }
+    writer->waiters++;
+    pthread_cond_wait(&writer->space_cond, &writer->mutex);
+    writer->waiters--;
+  }
+  if (wait_start_ms > 0) {
+    writer->stats.backpressure_ms += get_monotonic_ms() - wait_start_ms;
+  }
+
+  char* data = NULL;
+  if (writer->free_count > 0) {
+    data = writer->free_blocks[--writer->free_count];
+  }
+  else if (posix_memalign((void**)&data, DIRECT_IO_ALIGN, WRITER_BLOCK_SIZE) == 0) {
+    // 按页对齐分配，直接 I/O 可以直接使用缓冲块
+    writer->allocated_blocks++;
+  }
+  else {
+    data = NULL;
+  }
+  pthread_mutex_unlock(&writer->mutex);
+
+  ring->reserved = data;
+  return data;
+}
+
+void write_ring_commit(WriteRing* ring, int fd, long long offset, size_t length,
+  _Atomic long long* written, long long written_value) {
+  AsyncWriter* writer = ring->writer;
+  char* data = ring->reserved;
+  if (!data) {
+    return;
+  }
+  ring->reserved = NULL;
+
+  if (length == 0) {
+    pthread_mutex_lock(&writer->mutex);
+    release_block_locked(writer, data);
+    pthread_mutex_unlock(&writer->mutex);
+    return;
+  }
+
+  // 只有本线程推进 head，写入线程读取 head 之前看到的块内容是完整的
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  WriteBlock* block = &ring->blocks[head % WRITER_RING_SLOTS];
+  block->data = data;
+  block->length = length;
+  block->offset = offset;
+  block->fd = fd;
+  block->commit_ms = get_monotonic_ms();
+  block->written = written;
+  block->written_value = written_value;
+
+  long long queued = atomic_fetch_add(&writer->queued_bytes, (long long)length) + (long long)length;
+  long long peak = atomic_load(&writer->peak_queued_bytes);
+  while (queued > peak && !atomic_compare_exchange_weak(&writer->peak_queued_bytes, &peak, queued)) {
+  }
+
+  atomic_store(&ring->head, head + 1);
+  if (atomic_load(&writer->idle)) {
+    pthread_mutex_lock(&writer->mutex);
+    pthread_cond_signal(&writer->work_cond);
+    pthread_mutex_unlock(&writer->mutex);
+  }
+}
+
+int write_ring_drain(WriteRing* ring) {
+  AsyncWriter* writer = ring->writer;
+  write_ring_commit(ring, -1, 0, 0, NULL, 0); // 归还尚未放入队列的缓冲块
+
+  pthread_mutex_lock(&writer->mutex);
+  while (atomic_load(&ring->tail) != atomic_load(&ring->head)) {
+    writer->waiters++;
+    pthread_cond_wait(&writer->space_cond, &writer->mutex);
+    writer->waiters--;
+  }
+  pthread_mutex_unlock(&writer->mutex);
+
+  int error = atomic_exchange(&ring->error, 0);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,796 @@
+// 最小的 HTTP/2 测试服务器，用于在本机离线测试 --http2
+// 客户端通过 ALPN 选择 h2 时使用 HTTP/2，否则按 HTTP/1.1 处理（下载器初始化时的探测走 HTTP/1.1）；
+// TLS 证书在启动时自签名生成，从目录中提供文件，支持单个 Range，
+// 按客户端的流窗口和连接窗口发送 DATA 帧，多个流轮流发送
+//
+// 用法: h2_test_server [-p 端口] [-d 目录] [-c 并发流上限] [--no-h2] [--cert 证书 --key 私钥]
+// 示例: h2_test_server -p 8443 -d /tmp/www && CHttpDownloader -d https://127.0.0.1:8443/file.bin -m 8 --http2
+
+#include "../include/common.h"
+#include "../include/hpack.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <poll.h>
+
+#define SERVER_MAX_STREAMS 512          // 每个连接同时处理的流数上限
+#define SERVER_FRAME_SIZE 16384         // 发送 DATA 帧的最大长度
+#define SERVER_READ_BUFFER (4 * (SERVER_FRAME_SIZE + 9))
+#define SERVER_HEADER_BLOCK (64 * 1024)
+#define SERVER_DEFAULT_WINDOW 65535
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+typedef struct {
+  unsigned int id;                    // 流 ID，0表示空闲
+  int fd;                             // 响应的文件
+  long long offset;                   // 下一个要发送的文件偏移
+  long long remaining;                // 剩余要发送的字节数
+  long long window;                   // 流的发送窗口
+} ServerStream;
+
+typedef struct {
+  SSL* ssl;
+  int sockfd;
+  const char* root;
+  unsigned int max_streams;
+  ServerStream streams[SERVER_MAX_STREAMS];
+  long long connection_window;        // 连接的发送窗口
+  long long initial_window;           // 客户端 SETTINGS_INITIAL_WINDOW_SIZE
+  HpackTable decoder;
+  unsigned char header_block[SERVER_HEADER_BLOCK];
+  size_t header_block_length;
+  unsigned int header_stream;
+  unsigned char buffer[SERVER_READ_BUFFER];
+  size_t buffer_length;
+  int preface_received;
+  int next_round_robin;
+} ServerConnection;
+
+typedef struct {
+  char method[16];
+  char path[2048];
+  char range[128];
+} RequestHeaders;
+
+typedef struct {
+  int status;
+  int fd;                             // 有响应体时为打开的文件，否则为-1
+  long long start;
+  long long length;
+  char content_range[96];
+} Response;
+
+static int send_all(ServerConnection* connection, const void* data, size_t length) {
+  const unsigned char* position = data;
+  while (length > 0) {
+    int written = SSL_write(connection->ssl, position, (int)length);
+    if (written <= 0) {
+      return -1;
+    }
+    position += written;
+    length -= written;
+  }
+  return 0;
+}
+
+static void frame_header(unsigned char* header, size_t length, int type, int flags, unsigned int stream_id) {
+  header[0] = (length >> 16) & 0xff;
+  header[1] = (length >> 8) & 0xff;
+  header[2] = length & 0xff;
+  header[3] = type;
+  header[4] = flags;
+  header[5] = (stream_id >> 24) & 0x7f;
+  header[6] = (stream_id >> 16) & 0xff;
+  header[7] = (stream_id >> 8) & 0xff;
+  header[8] = stream_id & 0xff;
+}
+
+static int send_frame(ServerConnection* connection, int type, int flags, unsigned int stream_id, const void* payload, size_t length) {
+  unsigned char frame[9 + SERVER_FRAME_SIZE];
+  if (length > SERVER_FRAME_SIZE) {
+    return -1;
+  }
+  frame_header(frame, length, type, flags, stream_id);
+  if (length > 0) {
+    memcpy(frame + 9, payload, length);
+  }
+  return send_all(connection, frame, 9 + length);
+}
+
+static int send_rst_stream(ServerConnection* connection, unsigned int stream_id, unsigned int error_code) {
+  unsigned char payload[4] = { error_code >> 24, error_code >> 16, error_code >> 8, error_code };
+  return send_frame(connection, 0x3, 0, stream_id, payload, sizeof(payload));
+}
+
+static unsigned int read_uint32(const unsigned char* data) {
+  return ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16) | ((unsigned int)data[2] << 8) | data[3];
+}
+
+static ServerStream* find_stream(ServerConnection* connection, unsigned int stream_id) {
+  for (int i = 0; i < SERVER_MAX_STREAMS; i++) {
+    if (connection->streams[i].id == stream_id && stream_id != 0) {
+      return &connection->streams[i];
+    }
+  }
+  return NULL;
+}
+
+static void close_stream(ServerStream* stream) {
+  if (stream->fd >= 0) {
+    close(stream->fd);
+  }
+  memset(stream, 0, sizeof(ServerStream));
+  stream->fd = -1;
+}
+
+static void on_request_header(void* context, const char* name, size_t name_length, const char* value, size_t value_length) {
+  RequestHeaders* request = context;
+  char* target = NULL;
+  size_t target_size = 0;
+
+  if (name_length == 7 && memcmp(name, ":method", 7) == 0) {
+    target = request->method;
+    target_size = sizeof(request->method);
+  }
+  else if (name_length == 5 && memcmp(name, ":path", 5) == 0) {
+    target = request->path;
+    target_size = sizeof(request->path);
+  }
+  else if (name_length == 5 && memcmp(name, "range", 5) == 0) {
+    target = request->range;
+    target_size = sizeof(request->range);
+  }
+  if (target) {
+    snprintf(target, target_size, "%.*s", (int)value_length, value);
+  }
+}
+
+// 编码并发送响应头
+static int send_response_headers(ServerConnection* connection, unsigned int stream_id, int status,
+  long long content_length, const char* content_range, int end_stream) {
+  unsigned char block[1024];
+  char status_text[8];
+  char length_text[32];
+  size_t length = 0;
+  int written;
+
+  snprintf(status_text, sizeof(status_text), "%d", status);
+  snprintf(length_text, sizeof(length_text), "%lld", content_length);
+  const char* headers[][2] = {
+    { ":status", status_text },
+    { "content-length", length_text },
+    { "accept-ranges", "bytes" },
+    { "content-type", "application/octet-stream" },
+    { "content-range", content_range },
+  };
+
+  for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+    if (!headers[i][1] || !headers[i][1][0]) {
+      continue;
+    }
+    written = hpack_encode_header(block + length, sizeof(block) - length, headers[i][0], headers[i][1]);
+    if (written < 0) {
+      return -1;
+    }
+    length += written;
+  }
+  return send_frame(connection, 0x1, 0x4 | (end_stream ? 0x1 : 0), stream_id, block, length);
+}
+
+// 解析 "bytes=a-b"、"bytes=a-" 或 "bytes=-n"，成功返回0
+static int parse_range(const char* range, long long size, long long* start, long long* end) {
+  long long first = -1;
+  long long last = -1;
+  if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',')) {
+    return -1;
+  }
+  const char* spec = range + 6;
+  if (*spec == '-') {
+    long long suffix = atoll(spec + 1);
+    if (suffix <= 0) {
+      return -1;
+    }
+    first = suffix > size ? 0 : size - suffix;
+    last = size - 1;
+  }
+  else {
+    char* dash = NULL;
+    first = strtoll(spec, &dash, 10);
+    if (!dash || *dash != '-') {
+      return -1;
+    }
+    last = dash[1] ? atoll(dash + 1) : size - 1;
+  }
+  if (first < 0 || first >= size || last < first) {
+    return -1;
+  }
+  *start = first;
+  *end = last < size ? last : size - 1;
+  return 0;
+}
+
+// 根据请求找到文件和范围，HTTP/1.1 和 HTTP/2 共用
+static void resolve_request(const char* root, RequestHeaders* request, Response* response) {
+  memset(response, 0, sizeof(Response));
+  response->fd = -1;
+
+  char* query = strchr(request->path, '?');
+  if (query) {
+    *query = '\0';
+  }
+  char file_path[PATH_MAX];
+  snprintf(file_path, sizeof(file_path), "%s%s", root, request->path);
+
+  struct stat st;
+  int fd = -1;
+  if ((strcmp(request->method, "GET") != 0 && strcmp(request->method, "HEAD") != 0) ||
+    request->path[0] != '/' || strstr(request->path, "..") ||
+    (fd = open(file_path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    response->status = 404;
+    return;
+  }
+
+  long long start = 0;
+  long long end = st.st_size - 1;
+  response->status = 200;
+  if (request->range[0]) {
+    if (parse_range(request->range, st.st_size, &start, &end) != 0) {
+      close(fd);
+      response->status = 416;
+      snprintf(response->content_range, sizeof(response->content_range), "bytes */%lld", (long long)st.st_size);
+      return;
+    }
+    response->status = 206;
+    snprintf(response->content_range, sizeof(response->content_range), "bytes %lld-%lld/%lld",
+      start, end, (long long)st.st_size);
+  }
+
+  response->start = start;
+  response->length = end - start + 1;
+  if (strcmp(request->method, "GET") == 0 && response->length > 0) {
+    response->fd = fd;
+  }
+  else {
+    close(fd);
+  }
+}
+
+static int handle_request(ServerConnection* connection, unsigned int stream_id) {
+  RequestHeaders request = { 0 };
+  if (hpack_decode_block(&connection->decoder, connection->header_block, connection->header_block_length,
+    on_request_header, &request) != 0) {
+    return -1;
+  }
+
+  int open_streams = 0;
+  ServerStream* slot = NULL;
+  for (int i = 0; i < SERVER_MAX_STREAMS; i++) {
+    if (connection->streams[i].id != 0) {
+      open_streams++;
+    }
+    else if (!slot) {
+      slot = &connection->streams[i];
+    }
+  }
+  if (!slot || open_streams >= (int)connection->max_streams) {
+    return send_rst_stream(connection, stream_id, 0x7); // REFUSED_STREAM
+  }
+
+  Response response;
+  resolve_request(connection->root, &request, &response);
+  fprintf(stderr, "h2 流 %u: %s %s (%s) -> %d, %lld 字节\n", stream_id, request.method, request.path,
+    request.range[0] ? request.range : "完整文件", response.status, response.length);
+  if (send_response_headers(connection, stream_id, response.status, response.length,
+    response.content_range, response.fd < 0) != 0) {
+    if (response.fd >= 0) {
+      close(response.fd);
+    }
+    return -1;
+  }
+  if (response.fd < 0) {
+    return 0;
+  }
+
+  slot->id = stream_id;
+  slot->fd = response.fd;
+  slot->offset = response.start;
+  slot->remaining = response.length;
+  slot->window = connection->initial_window;
+  return 0;
+}
+
+static int on_settings(ServerConnection* connection, int flags, const unsigned char* payload, size_t length) {
+  if (flags & 0x1) {
+    return 0;
+  }
+  if (length % 6 != 0) {
+    return -1;
+  }
+  for (size_t i = 0; i < length; i += 6) {
+    int identifier = (payload[i] << 8) | payload[i + 1];
+    long long value = read_uint32(payload + i + 2);
+    if (identifier == 0x4) {
+      // 初始窗口变化同样作用于已打开的流
+      long long delta = value - connection->initial_window;
+      connection->initial_window = value;
+      for (int j = 0; j < SERVER_MAX_STREAMS; j++) {
+        if (connection->streams[j].id != 0) {
+          connection->streams[j].window += delta;
+        }
+      }
+    }
+  }
+  return send_frame(connection, 0x4, 0x1, 0, NULL, 0);
+}
+
+// 处理一个帧，返回0继续，1表示客户端结束连接，-1表示协议错误
+static int handle_frame(ServerConnection* connection, int type, int flags, unsigned int stream_id,
+  const unsigned char* payload, size_t length) {
+  if (connection->header_stream != 0 && type != 0x9) {
+    return -1;
+  }
+
+  switch (type) {
+  case 0x1: // HEADERS
+  case 0x9: // CONTINUATION
+    if (type == 0x1) {
+      size_t padding = 0;
+      if (flags & 0x8) {
+        if (length < 1) {
+          return -1;
+        }
+        padding = payload[0];
+        payload++;
+        length--;
+      }
+      if (flags & 0x20) {
+        if (length < 5) {
+          return -1;
+        }
+        payload += 5;
+        length -= 5;
+      }
+      if (padding > length) {
+        return -1;
+      }
+      length -= padding;
+      connection->header_block_length = 0;
+      connection->header_stream = stream_id;
+    }
+    else if (stream_id != connection->header_stream) {
+      return -1;
+    }
+    if (length > sizeof(connection->header_block) - connection->header_block_length) {
+      return -1;
+    }
+    memcpy(connection->header_block + connection->header_block_length, payload, length);
+    connection->header_block_length += length;
+    if (flags & 0x4) {
+      connection->header_stream = 0;
+      return handle_request(connection, stream_id);
+    }
+    return 0;
+  case 0x3: // RST_STREAM
+  {
+    ServerStream* stream = find_stream(connection, stream_id);
+    if (stream) {
+      close_stream(stream);
+    }
+    return 0;
+  }
+  case 0x4: // SETTINGS
+    return on_settings(connection, flags, payload, length);
+  case 0x6: // PING
+    return (flags & 0x1) || length != 8 ? 0 : send_frame(connection, 0x6, 0x1, 0, payload, length);
+  case 0x7: // GOAWAY
+    return 1;
+  case 0x8: // WINDOW_UPDATE
+  {
+    if (length != 4) {
+      return -1;
+    }
+    long long increment = read_uint32(payload) & 0x7fffffff;
+    if (stream_id == 0) {
+      connection->connection_window += increment;
+    }
+    else {
+      ServerStream* stream = find_stream(connection, stream_id);
+      if (stream) {
+        stream->window += increment;
+      }
+    }
+    return 0;
+  }
+  default:
+    return 0; // DATA（GET 请求没有请求体）、PRIORITY 等忽略
+  }
+}
+
+// 处理缓冲区中的完整帧
+static int process_input(ServerConnection* connection) {
+  size_t position = 0;
+
+  if (!connection->preface_received) {
+    if (connection->buffer_length < sizeof(PREFACE) - 1) {
+      return 0;
+    }
+    if (memcmp(connection->buffer, PREFACE, sizeof(PREFACE) - 1) != 0) {
+      return -1;
+    }
+    connection->preface_received = 1;
+    position = sizeof(PREFACE) - 1;
+  }
+
+  int result = 0;
+  while (connection->buffer_length - position >= 9) {
+    const unsigned char* header = connection->buffer + position;
+    size_t length = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+    if (length > SERVER_FRAME_SIZE) {
+      return -1;
+    }
+    if (connection->buffer_length - position < 9 + length) {
+      break;
+    }
+    result = handle_frame(connection, header[3], header[4], read_uint32(header + 5) & 0x7fffffff, header + 9, length);
+    position += 9 + length;
+    if (result != 0) {
+      break;
+    }
+  }
+
+  memmove(connection->buffer, connection->buffer + position, connection->buffer_length - position);
+  connection->buffer_length -= position;
+  return result;
+}
+
+// 各个有窗口的流轮流发送一个 DATA 帧，返回发送的帧数，出错返回-1
+static int send_round(ServerConnection* connection) {
+  unsigned char frame[9 + SERVER_FRAME_SIZE];
+  int sent = 0;
+
+  for (int n = 0; n < SERVER_MAX_STREAMS && connection->connection_window > 0; n++) {
+    ServerStream* stream = &connection->streams[(connection->next_round_robin + n) % SERVER_MAX_STREAMS];
+    if (stream->id == 0 || stream->window <= 0) {
+      continue;
+    }
+
+    long long chunk = SERVER_FRAME_SIZE;
+    if (chunk > stream->remaining) {
+      chunk = stream->remaining;
+    }
+    if (chunk > stream->window) {
+      chunk = stream->window;
+    }
+    if (chunk > connection->connection_window) {
+      chunk = connection->connection_window;
+    }
+
+    ssize_t bytes_read = pread(stream->fd, frame + 9, chunk, stream->offset);
+    if (bytes_read <= 0) {
+      send_rst_stream(connection, stream->id, 0x2); // INTERNAL_ERROR
+      close_stream(stream);
+      continue;
+    }
+
+    int end_stream = bytes_read == stream->remaining;
+    frame_header(frame, bytes_read, 0x0, end_stream ? 0x1 : 0, stream->id);
+    if (send_all(connection, frame, 9 + bytes_read) != 0) {
+      return -1;
+    }
+    stream->offset += bytes_read;
+    stream->remaining -= bytes_read;
+    stream->window -= bytes_read;
+    connection->connection_window -= bytes_read;
+    sent++;
+    if (end_stream) {
+      close_stream(stream);
+    }
+  }
+
+  connection->next_round_robin = (connection->next_round_robin + 1) % SERVER_MAX_STREAMS;
+  return sent;
+}
+
+static int has_sendable_data(const ServerConnection* connection) {
+  if (connection->connection_window <= 0) {
+    return 0;
+  }
+  for (int i = 0; i < SERVER_MAX_STREAMS; i++) {
+    if (connection->streams[i].id != 0 && connection->streams[i].window > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 客户端没有选择 h2 时按 HTTP/1.1 处理（支持 keep-alive，不支持请求体）
+static void serve_http1(SSL* ssl, const char* root) {
+  char buffer[8192];
+  size_t length = 0;
+
+  while (1) {
+    char* header_end;
+    while (!(header_end = memmem(buffer, length, "\r\n\r\n", 4))) {
+      if (length == sizeof(buffer) - 1) {
+        return;
+      }
+      int bytes_read = SSL_read(ssl, buffer + length, sizeof(buffer) - 1 - length);
+      if (bytes_read <= 0) {
+        return;
+      }
+      length += bytes_read;
+    }
+    *header_end = '\0';
+    size_t consumed = header_end + 4 - buffer;
+
+    RequestHeaders request = { 0 };
+    if (sscanf(buffer, "%15s %2047s", request.method, request.path) != 2) {
+      return;
+    }
+    const char* range = strcasestr(buffer, "\r\nRange:");
+    if (range) {
+      range += 8;
+      range += strspn(range, " \t");
+      snprintf(request.range, sizeof(request.range), "%.*s", (int)strcspn(range, "\r\n"), range);
+    }
+    int keep_alive = !strcasestr(buffer, "\r\nConnection: close");
+
+    Response response;
+    resolve_request(root, &request, &response);
+    fprintf(stderr, "HTTP/1.1: %s %s (%s) -> %d\n", request.method, request.path,
+      request.range[0] ? request.range : "完整文件", response.status);
+
+    char header[512];
+    int header_length = snprintf(header, sizeof(header),
+      "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\n"
+      "Content-Type: application/octet-stream\r\n%s%s%s%s\r\n",
+      response.status, response.status == 200 ? "OK" : response.status == 206 ? "Partial Content" :
+      response.status == 416 ? "Range Not Satisfiable" : "Not Found",
+      response.length, response.content_range[0] ? "Content-Range: " : "", response.content_range,
+      response.content_range[0] ? "\r\n" : "", keep_alive ? "" : "Connection: close\r\n");
+    if (SSL_write(ssl, header, header_length) != header_length) {
+      keep_alive = 0;
+    }
+
+    long long offset = response.start;
+    long long remaining = response.fd >= 0 ? response.length : 0;
+    while (keep_alive && remaining > 0) {
+      char chunk[SERVER_FRAME_SIZE];
+      ssize_t bytes_read = pread(response.fd, chunk, remaining < (long long)sizeof(chunk) ? remaining : (long long)sizeof(chunk), offset);
+      if (bytes_read <= 0 || SSL_write(ssl, chunk, (int)bytes_read) != bytes_read) {
+        keep_alive = 0;
+        break;
+      }
+      offset += bytes_read;
+      remaining -= bytes_read;
+    }
+    if (response.fd >= 0) {
+      close(response.fd);
+    }
+    if (!keep_alive) {
+      return;
+    }
+
+    memmove(buffer, buffer + consumed, length - consumed);
+    length -= consumed;
+  }
+}
+
+static void serve_connection(SSL_CTX* ctx, int sockfd, const char* root, unsigned int max_streams) {
+  ServerConnection* connection = calloc(1, sizeof(ServerConnection));
+  if (!connection) {
+    return;
+  }
+  connection->sockfd = sockfd;
+  connection->root = root;
+  connection->max_streams = max_streams;
+  connection->connection_window = SERVER_DEFAULT_WINDOW;
+  connection->initial_window = SERVER_DEFAULT_WINDOW;
+  for (int i = 0; i < SERVER_MAX_STREAMS; i++) {
+    connection->streams[i].fd = -1;
+  }
+  hpack_table_init(&connection->decoder);
+
+  connection->ssl = SSL_new(ctx);
+  SSL_set_fd(connection->ssl, sockfd);
+  if (SSL_accept(connection->ssl) != 1) {
+    ERR_print_errors_fp(stderr);
+    goto done;
+  }
+
+  const unsigned char* alpn = NULL;
+  unsigned int alpn_length = 0;
+  SSL_get0_alpn_selected(connection->ssl, &alpn, &alpn_length);
+  if (alpn_length != 2 || memcmp(alpn, "h2", 2) != 0) {
+    serve_http1(connection->ssl, root);
+    goto done;
+  }
+
+  // 服务器前言：SETTINGS（并发流上限）
+  unsigned char settings[6] = { 0, 0x3, max_streams >> 24, max_streams >> 16, max_streams >> 8, max_streams };
+  if (send_frame(connection, 0x4, 0, 0, settings, sizeof(settings)) != 0) {
+    goto done;
+  }
+
+  while (1) {
+    // 有可发送的数据时只读取已到达的数据，否则阻塞等待客户端的帧
+    int sendable = has_sendable_data(connection);
+    struct pollfd poll_fd = { .fd = sockfd, .events = POLLIN };
+    if (SSL_pending(connection->ssl) > 0 || poll(&poll_fd, 1, sendable ? 0 : -1) > 0) {
+      int bytes_read = SSL_read(connection->ssl, connection->buffer + connection->buffer_length,
+        sizeof(connection->buffer) - connection->buffer_length);
+      if (bytes_read <= 0) {
+        break;
+      }
+      connection->buffer_length += bytes_read;
+
+      int result = process_input(connection);
+      if (result < 0) {
+        unsigned char goaway[8] = { 0, 0, 0, 0, 0, 0, 0, 0x1 };
+        send_frame(connection, 0x7, 0, 0, goaway, sizeof(goaway));
+        break;
+      }
+      if (result > 0) {
+        break;
+      }
+    }
+
+    if (sendable && send_round(connection) < 0) {
+      break;
+    }
+  }
+
+done:
+  for (int i = 0; i < SERVER_MAX_STREAMS; i++) {
+    if (connection->streams[i].id != 0) {
+      close_stream(&connection->streams[i]);
+    }
+  }
+  hpack_table_free(&connection->decoder);
+  SSL_shutdown(connection->ssl);
+  SSL_free(connection->ssl);
+  free(connection);
+}
+
+static int select_alpn(SSL* ssl, const unsigned char** out, unsigned char* out_length,
+  const unsigned char* in, unsigned int in_length, void* arg) {
+  (void)ssl;
+  if (*(int*)arg) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  for (unsigned int i = 0; i < in_length; i += in[i] + 1) {
+    if (in[i] == 2 && i + 2 < in_length && memcmp(in + i + 1, "h2", 2) == 0) {
+      *out = in + i + 1;
+      *out_length = 2;
+      return SSL_TLSEXT_ERR_OK;
+    }
+  }
+  return SSL_TLSEXT_ERR_NOACK;
+}
+
+// 生成一次性的自签名证书（P-256）
+static int use_generated_certificate(SSL_CTX* ctx) {
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* certificate = X509_new();
+  if (!key || !certificate) {
+    EVP_PKEY_free(key);
+    X509_free(certificate);
+    return -1;
+  }
+
+  ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+  X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+  X509_gmtime_adj(X509_getm_notAfter(certificate), 365L * 24 * 3600);
+  X509_set_pubkey(certificate, key);
+  X509_NAME* name = X509_get_subject_name(certificate);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(certificate, name);
+
+  int result = X509_sign(certificate, key, EVP_sha256()) > 0 &&
+    SSL_CTX_use_certificate(ctx, certificate) == 1 && SSL_CTX_use_PrivateKey(ctx, key) == 1 ? 0 : -1;
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  int port = 8443;
+  const char* root = ".";
+  unsigned int max_streams = 100;
+  const char* certificate_file = NULL;
+  const char* key_file = NULL;
+  int no_h2 = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      root = argv[++i];
+    }
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      max_streams = (unsigned int)atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-h2") == 0) {
+      no_h2 = 1; // 只用 HTTP/1.1，用于测试客户端的回退
+    }
+    else if (strcmp(argv[i], "--cert") == 0 && i + 1 < argc) {
+      certificate_file = argv[++i];
+    }
+    else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+      key_file = argv[++i];
+    }
+    else {
+      fprintf(stderr, "用法: %s [-p 端口] [-d 目录] [-c 并发流上限] [--no-h2] [--cert 证书 --key 私钥]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (max_streams == 0 || max_streams > SERVER_MAX_STREAMS) {
+    fprintf(stderr, "错误: 并发流上限必须在 1 到 %d 之间\n", SERVER_MAX_STREAMS);
+    return 1;
+  }
+
+  SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    ERR_print_errors_fp(stderr);
+    return 1;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_alpn_select_cb(ctx, select_alpn, &no_h2);
+  int certificate_result = certificate_file && key_file ?
+    (SSL_CTX_use_certificate_chain_file(ctx, certificate_file) == 1 &&
+      SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) == 1 ? 0 : -1) :
+    use_generated_certificate(ctx);
+  if (certificate_result != 0) {
+    fprintf(stderr, "错误: 无法加载证书\n");
+    ERR_print_errors_fp(stderr);
+    return 1;
+  }
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in address = { 0 };
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0) {
+    fprintf(stderr, "错误: 无法监听端口 %d: %s\n", port, strerror(errno));
+    return 1;
+  }
+
+  // 每个连接一个子进程，退出的子进程由内核回收
+  signal(SIGCHLD, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "HTTP/2 测试服务器: https://127.0.0.1:%d/ -> %s（%s，并发流上限 %u）\n", port, root,
+    no_h2 ? "只用 HTTP/1.1" : "h2 和 HTTP/1.1", max_streams);
+
+  while (1) {
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "错误: accept 失败: %s\n", strerror(errno));
+      break;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listen_fd);
+      serve_connection(ctx, client_fd, root, max_streams);
+      close(client_fd);
+      _exit(0);
+    }
+    close(client_fd);
+  }
+
+  close(listen_fd);
+  SSL_CTX_free(ctx);
+  return 0;
+}